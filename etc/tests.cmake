@@ -1,5 +1,7 @@
 enable_testing ()
 
 add_test(NAME t_websocket_loop         COMMAND websocket-loop)
+add_test(NAME t_eventloop_poll         COMMAND eventloop-benchmark poll)
+add_test(NAME t_eventloop_epoll        COMMAND eventloop-benchmark epoll)
 
 add_custom_target(check COMMAND ${CMAKE_CTEST_COMMAND} --output-on-failure --timeout 10 -R '^t_')
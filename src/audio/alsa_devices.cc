@@ -12,6 +12,7 @@
 
 #include "alsa_devices.hh"
 #include "exception.hh"
+#include "mix_kernels.hh"
 
 using namespace std;
 using namespace std::chrono;
@@ -116,10 +117,12 @@ pair<string, string> ALSADevices::find_device( const vector<string_view> descrip
   throw runtime_error( "Audio device not found" );
 }
 
-AudioPair::AudioPair( const string_view interface_name )
+AudioPair::AudioPair( const string_view interface_name, const AudioInterface::Configuration& config )
   : headphone_( interface_name, "Headphone", SND_PCM_STREAM_PLAYBACK )
   , microphone_( interface_name, "Microphone", SND_PCM_STREAM_CAPTURE )
-{}
+{
+  set_config( config );
+}
 
 void AudioPair::set_config( const AudioInterface::Configuration& config )
 {
@@ -133,6 +136,7 @@ AudioInterface::AudioInterface( const string_view interface_name,
                                 const snd_pcm_stream_t stream )
   : interface_name_( interface_name )
   , annotation_( annotation )
+  , stream_( stream )
   , pcm_( nullptr )
 {
   const string diagnostic = "snd_pcm_open(" + name() + ")";
@@ -179,7 +183,7 @@ void AudioInterface::initialize()
     alsa_check_easy( snd_pcm_hw_params_set_rate_resample( pcm_, params.get(), false ) );
     alsa_check_easy( snd_pcm_hw_params_set_access( pcm_, params.get(), SND_PCM_ACCESS_MMAP_INTERLEAVED ) );
     alsa_check_easy( snd_pcm_hw_params_set_format( pcm_, params.get(), SND_PCM_FORMAT_S32_LE ) );
-    alsa_check_easy( snd_pcm_hw_params_set_channels( pcm_, params.get(), 2 ) );
+    alsa_check_easy( snd_pcm_hw_params_set_channels( pcm_, params.get(), channels() ) );
     alsa_check_easy( snd_pcm_hw_params_set_rate( pcm_, params.get(), config_.sample_rate, 0 ) );
     alsa_check_easy( snd_pcm_hw_params_set_period_size( pcm_, params.get(), config_.period_size, 0 ) );
     alsa_check_easy( snd_pcm_hw_params_set_buffer_size( pcm_, params.get(), config_.buffer_size ) );
@@ -314,7 +318,7 @@ bool AudioPair::mic_has_samples()
   return microphone_.avail();
 }
 
-void AudioPair::loopback( ChannelPair& capture_output, const ChannelPair& playback_input )
+void AudioPair::loopback( ChannelSet& capture_output, const ChannelPair& playback_input )
 {
   statistics_.total_wakeups++;
   fd_.register_read();
@@ -334,6 +338,8 @@ void AudioPair::loopback( ChannelPair& capture_output, const ChannelPair& playba
     return;
   }
 
+  statistics_.service_latency.log( uint64_t( microphone_.avail() ) * 1'000'000'000 / config_.sample_rate );
+
   if ( headphone_.delay() > config_.start_threshold and headphone_.state() == SND_PCM_STATE_PREPARED ) {
     headphone_.start();
   }
@@ -353,27 +359,99 @@ void AudioPair::loopback( ChannelPair& capture_output, const ChannelPair& playba
   microphone_.copy_all_available_samples_to( headphone_, capture_output, playback_input, statistics_.sample_stats );
 }
 
-inline float sample_to_float( const int32_t sample )
+void AudioInterface::loopback( const span_view<int32_t> captured,
+                               span<int32_t> playback,
+                               const size_t cursor,
+                               ChannelSet& capture_output,
+                               const ChannelPair& playback_input,
+                               const Configuration& config,
+                               AudioStatistics::SampleStats& stats )
 {
-  if ( sample & 0xff ) {
-    throw runtime_error( "invalid sample: " + to_string( sample ) );
+  constexpr size_t BLOCK_SIZE = 256;
+  constexpr size_t MAX_CHANNELS = ChannelSet::MAX_CHANNELS;
+  array<array<float, BLOCK_SIZE>, MAX_CHANNELS> in_buf, out_buf;
+  array<float*, MAX_CHANNELS> in;
+
+  const size_t in_channels = config.capture_channels, out_channels = config.playback_channels;
+  if ( in_channels < 1 or in_channels > MAX_CHANNELS or out_channels < 2 or out_channels > MAX_CHANNELS ) {
+    throw runtime_error( "unsupported channel count" );
   }
-  constexpr float maxval = uint64_t( 1 ) << 31;
-  const float ret = sample / maxval;
-  if ( ret > 1.0 or ret < -1.0 ) {
-    throw runtime_error( "invalid sample: " + to_string( sample ) );
-  }
-  return ret;
-}
 
-inline int32_t float_to_sample( const float sample_f )
-{
-  constexpr float maxval = uint64_t( 1 ) << 31;
-  return lrint( clamp( sample_f, -1.0f, 1.0f ) * maxval );
+  const size_t captured_channels = min( in_channels, capture_output.num_channels() );
+  const size_t num_frames = min( captured.size() / in_channels, playback.size() / out_channels );
+
+  for ( size_t done = 0; done < num_frames; done += BLOCK_SIZE ) {
+    const size_t count = min( BLOCK_SIZE, num_frames - done );
+    const auto captured_block = captured.substr( in_channels * done, in_channels * count );
+    auto playback_block = playback.substr( out_channels * done, out_channels * count );
+
+    /* capture into output buffer (directly, unless part of the block falls outside its window) */
+    const auto extent = capture_output.clip( cursor + done, count );
+    const bool direct = extent.length == count;
+    for ( size_t c = 0; c < in_channels; c++ ) {
+      in[c] = ( direct and c < captured_channels )
+                ? capture_output.channel( c ).region( cursor + done, count ).mutable_data()
+                : in_buf[c].data();
+    }
+
+    bool valid = true;
+    if ( in_channels == 2 ) {
+      valid = s32_to_float( captured_block, { in[0], count }, { in[1], count } );
+    } else {
+      for ( size_t c = 0; c < in_channels; c++ ) {
+        valid &= s32_to_float_strided( captured_block, in_channels, c, { in[c], count } );
+      }
+    }
+    if ( not valid ) {
+      throw runtime_error( "invalid sample (low bits set)" );
+    }
+
+    if ( not direct ) {
+      for ( size_t c = 0; c < captured_channels; c++ ) {
+        capture_output.channel( c )
+          .region( extent.begin, extent.length )
+          .copy( { in[c] + extent.offset, extent.length } );
+      }
+    }
+
+    /* track statistics (of the first two channels) */
+    const span_view<float> ch1 { in[0], count }, ch2 { in[in_channels > 1], count };
+    stats.samples_counted += count;
+    stats.ssa_ch1 += sum_of_squares( ch1 );
+    stats.ssa_ch2 += sum_of_squares( ch2 );
+    stats.max_ch1_amplitude = max( stats.max_ch1_amplitude, peak_amplitude( ch1 ) );
+    stats.max_ch2_amplitude = max( stats.max_ch2_amplitude, peak_amplitude( ch2 ) );
+
+    /* play from input buffer (on the first two channels) + captured samples */
+    auto out = [&]( const size_t o ) { return span<float> { out_buf[o].data(), count }; };
+    playback_input.safe_read( cursor + done, out( 0 ), out( 1 ) );
+    for ( size_t o = 2; o < out_channels; o++ ) {
+      fill( out( o ).begin(), out( o ).end(), 0 );
+    }
+
+    for ( size_t c = 0; c < in_channels; c++ ) {
+      const auto& gain = config.loopback_gain[c];
+      for ( size_t o = 0; o < out_channels; o += 2 ) {
+        /* (with an odd number of outputs, the last pair's second half lands in an unused buffer) */
+        const float next_gain = o + 1 < out_channels ? gain[o + 1] : 0;
+        if ( gain[o] != 0 or next_gain != 0 ) {
+          mix_accumulate( { in[c], count }, gain[o], next_gain, out( o ), out( o + 1 ) );
+        }
+      }
+    }
+
+    if ( out_channels == 2 ) {
+      float_to_s32( out( 0 ), out( 1 ), playback_block );
+    } else {
+      for ( size_t o = 0; o < out_channels; o++ ) {
+        float_to_s32_strided( out( o ), out_channels, o, playback_block );
+      }
+    }
+  }
 }
 
 void AudioInterface::copy_all_available_samples_to( AudioInterface& other,
-                                                    ChannelPair& capture_output,
+                                                    ChannelSet& capture_output,
                                                     const ChannelPair& playback_input,
                                                     AudioStatistics::SampleStats& stats )
 {
@@ -385,33 +463,14 @@ void AudioInterface::copy_all_available_samples_to( AudioInterface& other,
 
     const unsigned int num_frames = write_buf.frame_count();
 
-    for ( unsigned int i = 0; i < num_frames; i++ ) {
-      const float ch1_sample = sample_to_float( read_buf.sample( false, i ) );
-      const float ch2_sample = sample_to_float( read_buf.sample( true, i ) );
-
-      /* capture into output buffer */
-      capture_output.safe_set( cursor_, { ch1_sample, ch2_sample } );
-
-      /* track statistics */
-      stats.samples_counted++;
-      stats.ssa_ch1 += stats.max_ch1_amplitude * stats.max_ch1_amplitude;
-      stats.ssa_ch2 += stats.max_ch2_amplitude * stats.max_ch2_amplitude;
-      stats.max_ch1_amplitude = max( stats.max_ch1_amplitude, abs( ch1_sample ) );
-      stats.max_ch2_amplitude = max( stats.max_ch2_amplitude, abs( ch2_sample ) );
-
-      /* play from input buffer + captured sample */
-      const auto playback_sample = playback_input.safe_get( cursor_ );
-
-      write_buf.sample( false, i )
-        = float_to_sample( ch1_sample * config_.ch1_loopback_gain[0] + ch2_sample * config_.ch2_loopback_gain[0]
-                           + playback_sample.first );
-
-      write_buf.sample( true, i )
-        = float_to_sample( ch1_sample * config_.ch1_loopback_gain[1] + ch2_sample * config_.ch2_loopback_gain[1]
-                           + playback_sample.second );
-
-      cursor_++;
-    }
+    loopback( read_buf.interleaved().substr( 0, channels() * num_frames ),
+              write_buf.interleaved(),
+              cursor_,
+              capture_output,
+              playback_input,
+              config_,
+              stats );
+    cursor_ += num_frames;
 
     unsigned int amount_to_write = num_frames;
 
@@ -435,10 +494,10 @@ void AudioInterface::link_with( AudioInterface& other )
 AudioInterface::Buffer::Buffer( AudioInterface& interface, const unsigned int frames_requested )
   : pcm_( interface.pcm_ )
   , areas_( nullptr )
+  , channels_( interface.channels() )
   , frame_count_( 0 )
   , offset_( 0 )
 {
-  /* XXX channel count must be 2 */
   snd_pcm_uframes_t frames_returned = frames_requested;
   alsa_check_easy( snd_pcm_mmap_begin( pcm_, &areas_, &offset_, &frames_returned ) );
 
@@ -449,12 +508,15 @@ AudioInterface::Buffer::Buffer( AudioInterface& interface, const unsigned int fr
 
   frame_count_ = frames_returned;
 
-  if ( areas_[0].addr != areas_[1].addr ) {
-    throw runtime_error( "non-interleaved areas returned" );
-  }
+  for ( unsigned int channel = 0; channel < channels_; channel++ ) {
+    const auto& area = areas_[channel];
+    if ( area.addr != areas_[0].addr ) {
+      throw runtime_error( "non-interleaved areas returned" );
+    }
 
-  if ( areas_[0].first != 0 or areas_[1].first != 32 or areas_[0].step != 64 or areas_[1].step != 64 ) {
-    throw runtime_error( "unexpected format or stride returned" );
+    if ( area.first != 32 * channel or area.step != 32 * channels_ ) {
+      throw runtime_error( "unexpected format or stride returned" );
+    }
   }
 }
 
@@ -9,6 +9,7 @@
 
 #include "audio_buffer.hh"
 #include "file_descriptor.hh"
+#include "timer.hh"
 
 class ALSADevices
 {
@@ -44,6 +45,9 @@ struct AudioStatistics
   unsigned int min_headphone_delay { std::numeric_limits<unsigned int>::max() };
   unsigned int max_combined_samples;
 
+  /* how long the oldest captured sample had been waiting when the device was serviced */
+  Timer::Histogram service_latency;
+
   struct SampleStats
   {
     unsigned int samples_counted;
@@ -56,6 +60,7 @@ struct AudioStatistics
 class AudioInterface
 {
   std::string interface_name_, annotation_;
+  snd_pcm_stream_t stream_;
   snd_pcm_t* pcm_;
 
   void check_state( const snd_pcm_state_t expected_state );
@@ -68,6 +73,7 @@ class AudioInterface
   {
     snd_pcm_t* pcm_;
     const snd_pcm_channel_area_t* areas_;
+    unsigned int channels_;
     unsigned int frame_count_;
     snd_pcm_uframes_t offset_;
 
@@ -77,11 +83,14 @@ class AudioInterface
     void commit() { commit( frame_count_ ); }
     ~Buffer();
 
-    int32_t& sample( const bool right_channel, const unsigned int sample_num )
+    int32_t& sample( const unsigned int channel, const unsigned int sample_num )
     {
-      return *( static_cast<int32_t*>( areas_[0].addr ) + right_channel + 2 * ( offset_ + sample_num ) );
+      return *( static_cast<int32_t*>( areas_[0].addr ) + channel + channels_ * ( offset_ + sample_num ) );
     }
 
+    /* all the frames, interleaved */
+    span<int32_t> interleaved() { return { &sample( 0, 0 ), channels_ * frame_count_ }; }
+
     /* can't copy or assign */
     Buffer( const Buffer& other ) = delete;
     Buffer& operator=( const Buffer& other ) = delete;
@@ -100,8 +109,23 @@ public:
     unsigned int start_threshold { 24 };
     unsigned int skip_threshold { 64 };
 
-    std::array<float, 2> ch1_loopback_gain { 2.0, 2.0 };
-    std::array<float, 2> ch2_loopback_gain { 2.0, 2.0 };
+    /* interleaved channels in each direction (the first two headphone channels also carry the playback) */
+    unsigned int capture_channels { 2 };
+    unsigned int playback_channels { 2 };
+
+    /* loopback_gain[i][o]: how much of captured channel i to play on headphone channel o */
+    using GainMatrix = std::array<std::array<float, ChannelSet::MAX_CHANNELS>, ChannelSet::MAX_CHANNELS>;
+    GainMatrix loopback_gain { stereo_loopback( 2.0 ) };
+
+    /* every captured channel, at `gain`, on both of the first two headphone channels */
+    static GainMatrix stereo_loopback( const float gain )
+    {
+      GainMatrix ret {};
+      for ( auto& row : ret ) {
+        row[0] = row[1] = gain;
+      }
+      return ret;
+    }
   };
 
 private:
@@ -120,10 +144,20 @@ public:
   bool update();
 
   void copy_all_available_samples_to( AudioInterface& other,
-                                      ChannelPair& capture_output,
+                                      ChannelSet& capture_output,
                                       const ChannelPair& playback_input,
                                       AudioStatistics::SampleStats& stats );
 
+  /* The loopback kernel: capture interleaved frames (starting at `cursor`) into `capture_output`, and play them,
+     mixed into `playback_input`, into the interleaved `playback`. */
+  static void loopback( const span_view<int32_t> captured,
+                        span<int32_t> playback,
+                        const size_t cursor,
+                        ChannelSet& capture_output,
+                        const ChannelPair& playback_input,
+                        const Configuration& config,
+                        AudioStatistics::SampleStats& stats );
+
   const Configuration& config() const { return config_; }
   void set_config( const Configuration& other ) { config_ = other; }
 
@@ -131,6 +165,11 @@ public:
   unsigned int avail() const { return avail_; }
   unsigned int delay() const { return delay_; }
 
+  unsigned int channels() const
+  {
+    return stream_ == SND_PCM_STREAM_CAPTURE ? config_.capture_channels : config_.playback_channels;
+  }
+
   std::string name() const;
   PCMFD fd();
 
@@ -145,36 +184,31 @@ public:
   AudioInterface& operator=( const AudioInterface& other ) = delete;
 };
 
-class AudioPair
+/* What AudioDeviceTask needs from a sound card (or something standing in for one) */
+class AudioDevice
 {
-  AudioInterface headphone_, microphone_;
+protected:
   AudioInterface::Configuration config_ {};
-  PCMFD fd_ { microphone_.fd() };
-
   AudioStatistics statistics_ {};
 
 public:
-  AudioPair( const std::string_view interface_name );
-
-  const AudioInterface::Configuration& config() const { return config_; }
-  void set_config( const AudioInterface::Configuration& config );
+  virtual ~AudioDevice() = default;
 
-  void initialize()
-  {
-    microphone_.initialize();
-    headphone_.initialize();
-  }
+  virtual void initialize() = 0;
+  virtual void start() = 0;
+  virtual void recover() = 0;
 
-  PCMFD& fd() { return fd_; }
+  /* capture what's available into `capture_output`, and play the same span of `playback_input` (plus loopback) */
+  virtual void loopback( ChannelSet& capture_output, const ChannelPair& playback_input ) = 0;
+  virtual bool mic_has_samples() = 0;
 
-  void start() { microphone_.start(); }
-  void recover();
-  void loopback( ChannelPair& capture_output, const ChannelPair& playback_input );
+  /* readable when the device needs servicing */
+  virtual FileDescriptor& fd() = 0;
 
-  bool mic_has_samples();
-  unsigned int mic_avail() { return microphone_.avail(); }
+  virtual size_t cursor() const = 0;
 
-  size_t cursor() const { return microphone_.cursor(); }
+  const AudioInterface::Configuration& config() const { return config_; }
+  virtual void set_config( const AudioInterface::Configuration& config ) { config_ = config; }
 
   const AudioStatistics& statistics() const { return statistics_; }
   void reset_statistics()
@@ -188,6 +222,35 @@ public:
   }
 };
 
+class AudioPair : public AudioDevice
+{
+  AudioInterface headphone_, microphone_;
+  PCMFD fd_ { microphone_.fd() };
+
+public:
+  /* the configuration (e.g. channel counts) takes effect at initialize() */
+  AudioPair( const std::string_view interface_name, const AudioInterface::Configuration& config = {} );
+
+  void set_config( const AudioInterface::Configuration& config ) override;
+
+  void initialize() override
+  {
+    microphone_.initialize();
+    headphone_.initialize();
+  }
+
+  PCMFD& fd() override { return fd_; }
+
+  void start() override { microphone_.start(); }
+  void recover() override;
+  void loopback( ChannelSet& capture_output, const ChannelPair& playback_input ) override;
+
+  bool mic_has_samples() override;
+  unsigned int mic_avail() { return microphone_.avail(); }
+
+  size_t cursor() const override { return microphone_.cursor(); }
+};
+
 inline float float_to_dbfs( const float sample_f )
 {
   if ( sample_f <= 0.00001 ) {
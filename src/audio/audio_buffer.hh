@@ -1,5 +1,7 @@
 #pragma once
 
+#include <vector>
+
 #include "typed_ring_buffer.hh"
 
 using AudioChannel = SafeEndlessBuffer<float>;
@@ -29,15 +31,79 @@ public:
     ch2_.pop_before( index );
   }
 
+  /* both channels of [index, index + count) */
+  template<class Span>
+  struct Region
+  {
+    Span ch1, ch2;
+  };
+
+  Region<span<float>> region( const size_t index, const size_t count )
+  {
+    return { ch1_.region( index, count ), ch2_.region( index, count ) };
+  }
+
+  Region<span_view<float>> region( const size_t index, const size_t count ) const
+  {
+    return { ch1_.region( index, count ), ch2_.region( index, count ) };
+  }
+
+  /* the part of [index, index + count) inside the window (the channels share one), `offset` samples in */
+  template<class Span>
+  struct Clipped
+  {
+    size_t offset;
+    Span ch1, ch2;
+
+    size_t size() const { return ch1.size(); }
+  };
+
+  Clipped<span<float>> clipped_region( const size_t index, const size_t count )
+  {
+    const auto extent = ch1_.clip( index, count );
+    return { extent.offset,
+             ch1_.region( extent.begin, extent.length ),
+             ch2_.region( extent.begin, extent.length ) };
+  }
+
+  Clipped<span_view<float>> clipped_region( const size_t index, const size_t count ) const
+  {
+    const auto extent = ch1_.clip( index, count );
+    return { extent.offset,
+             ch1_.region( extent.begin, extent.length ),
+             ch2_.region( extent.begin, extent.length ) };
+  }
+
   std::pair<float, float> safe_get( const size_t index ) const
   {
-    return { ch1_.safe_get( index ), ch2_.safe_get( index ) };
+    if ( not ch1_.contains( index ) ) {
+      return {};
+    }
+
+    return { ch1_[index], ch2_[index] };
   }
 
   void safe_set( const size_t index, const std::pair<float, float> val )
   {
-    ch1_.safe_set( index, val.first );
-    ch2_.safe_set( index, val.second );
+    if ( not ch1_.contains( index ) ) {
+      return;
+    }
+
+    ch1_[index] = val.first;
+    ch2_[index] = val.second;
+  }
+
+  void safe_write( const size_t index, const span_view<float> ch1, const span_view<float> ch2 )
+  {
+    auto target = clipped_region( index, ch1.size() );
+    target.ch1.copy( ch1.substr( target.offset, target.size() ) );
+    target.ch2.copy( ch2.substr( target.offset, target.size() ) );
+  }
+
+  void safe_read( const size_t index, span<float> ch1, span<float> ch2 ) const
+  {
+    ch1_.safe_read( index, ch1 );
+    ch2_.safe_read( index, ch2 );
   }
 
   AudioChannel& ch1() { return ch1_; }
@@ -46,3 +112,51 @@ public:
   const AudioChannel& ch1() const { return ch1_; }
   const AudioChannel& ch2() const { return ch2_; }
 };
+
+/* any number of channels sharing one window, e.g. everything a multi-input interface captures */
+class ChannelSet
+{
+  std::vector<AudioChannel> channels_ {};
+
+public:
+  static constexpr size_t MAX_CHANNELS = 8;
+
+  ChannelSet( const size_t num_channels, const size_t capacity )
+  {
+    if ( num_channels < 1 or num_channels > MAX_CHANNELS ) {
+      throw std::runtime_error( "ChannelSet: unsupported channel count " + std::to_string( num_channels ) );
+    }
+
+    channels_.reserve( num_channels );
+    for ( size_t i = 0; i < num_channels; i++ ) {
+      channels_.emplace_back( capacity );
+    }
+  }
+
+  size_t num_channels() const { return channels_.size(); }
+
+  size_t range_begin() const { return channels_.front().range_begin(); }
+  size_t range_end() const { return channels_.front().range_end(); }
+
+  void pop_before( const size_t index )
+  {
+    for ( auto& channel : channels_ ) {
+      channel.pop_before( index );
+    }
+  }
+
+  /* [index, index + count) clipped to the (shared) window */
+  AudioChannel::Extent clip( const size_t index, const size_t count ) const
+  {
+    return channels_.front().clip( index, count );
+  }
+
+  AudioChannel& channel( const size_t i ) { return channels_.at( i ); }
+  const AudioChannel& channel( const size_t i ) const { return channels_.at( i ); }
+
+  AudioChannel& ch1() { return channel( 0 ); }
+  AudioChannel& ch2() { return channel( num_channels() > 1 ); }
+
+  const AudioChannel& ch1() const { return channel( 0 ); }
+  const AudioChannel& ch2() const { return channel( num_channels() > 1 ); }
+};
@@ -1,104 +1,204 @@
 #include "audio_task.hh"
+#include "timer.hh"
 #include "timestamp.hh"
 
 using namespace std;
 using namespace chrono;
 
-AudioDeviceTask::AudioDeviceTask( const string_view interface_name, EventLoop& loop )
-  : device_( interface_name )
+AudioDeviceTask::AudioDeviceTask( unique_ptr<AudioDevice> device,
+                                  EventLoop& loop,
+                                  const bool own_thread,
+                                  const optional<unsigned int> cpu,
+                                  const Wakeup wakeup )
+  : device_( move( device ) )
+  , capture_( device_->config().capture_channels, 65536 )
+  , thread_( own_thread ? make_unique<AudioDeviceThread>( *device_ ) : nullptr )
+  , thread_cpu_( cpu )
 {
-  device_.initialize();
+  device_->initialize();
 
-  install_rules( loop );
+  install_rules( loop, wakeup );
 }
 
-void AudioDeviceTask::install_rules( EventLoop& loop )
+AudioDeviceTask::AudioDeviceTask( const string_view interface_name,
+                                  EventLoop& loop,
+                                  const bool own_thread,
+                                  const optional<unsigned int> cpu,
+                                  const Wakeup wakeup )
+  : AudioDeviceTask( make_unique<AudioPair>( interface_name ), loop, own_thread, cpu, wakeup )
+{}
+
+void AudioDeviceTask::install_rules( EventLoop& loop, const Wakeup wakeup )
 {
-  loop.add_rule(
-    "audio loopback [fast path]", [&] { service_device(); }, [&] { return device_.mic_has_samples(); } );
+  if ( thread_ ) {
+    loop.add_rule( "audio handoff", thread_->capture_ready(), Direction::In, [&] {
+      thread_->receive_capture( capture_ );
+    } );
+    return;
+  }
+
+  if ( wakeup == Wakeup::Predict ) {
+    predictor_.emplace( device_->config().sample_rate, device_->config().avail_minimum );
+    loop.add_timed_rule(
+      "audio loopback [predicted]", [&] { service_device(); }, [&] { return predictor_->next_wakeup(); } );
+  } else {
+    loop.add_rule(
+      "audio loopback [fast path]", [&] { service_device(); }, [&] { return device_->mic_has_samples(); } );
+  }
 
   loop.add_rule(
     "audio loopback [slow path]",
-    device_.fd(),
+    device_->fd(),
     Direction::In,
     [&] { service_device(); },
     [] { return true; },
     [] {},
     [&] {
-      device_.recover();
+      device_->recover();
+      if ( predictor_ ) {
+        predictor_->reset( Timer::timestamp_ns() );
+      }
       return true;
     } );
 }
 
+void AudioDeviceTask::start()
+{
+  if ( thread_ ) {
+    thread_->start( thread_cpu_ );
+  } else {
+    device_->start();
+    if ( predictor_ ) {
+      predictor_->reset( Timer::timestamp_ns() );
+    }
+  }
+}
+
 void AudioDeviceTask::service_device()
 {
-  device_.loopback( capture_, playback_ );
-  playback_.pop_before( device_.cursor() );
+  const size_t cursor_before = device_->cursor();
+  const unsigned int recoveries_before = device_->statistics().recoveries;
+
+  device_->loopback( capture_, playback_ );
+  playback_.pop_before( device_->cursor() );
+
+  if ( predictor_ ) {
+    if ( device_->statistics().recoveries != recoveries_before ) {
+      predictor_->reset( Timer::timestamp_ns() );
+    } else {
+      predictor_->serviced( device_->cursor(), device_->cursor() == cursor_before, Timer::timestamp_ns() );
+    }
+  }
+}
+
+void AudioDeviceTask::commit_playback( const size_t sample )
+{
+  if ( thread_ ) {
+    thread_->send_playback( playback_, sample );
+    playback_.pop_before( thread_->playback_sent() );
+  }
 }
 
 void AudioDeviceTask::summary( ostream& out ) const
 {
-  if ( device_.statistics().sample_stats.samples_counted ) {
+  using Status = AudioDeviceThread::Status;
+  const Status status = thread_ ? thread_->status() : Status { device_->statistics(), device_->config(), cursor() };
+  const AudioStatistics& stats = status.statistics;
+
+  if ( stats.sample_stats.samples_counted ) {
     out << "Audio info: dB = [ " << setw( 3 ) << setprecision( 1 ) << fixed
-        << float_to_dbfs(
-             sqrt( device_.statistics().sample_stats.ssa_ch1 / device_.statistics().sample_stats.samples_counted ) )
-        << "/" << setw( 3 ) << setprecision( 1 ) << fixed
-        << float_to_dbfs( device_.statistics().sample_stats.max_ch1_amplitude ) << ", ";
+        << float_to_dbfs( sqrt( stats.sample_stats.ssa_ch1 / stats.sample_stats.samples_counted ) ) << "/"
+        << setw( 3 ) << setprecision( 1 ) << fixed << float_to_dbfs( stats.sample_stats.max_ch1_amplitude ) << ", ";
 
     out << setw( 3 ) << setprecision( 1 ) << fixed
-        << float_to_dbfs(
-             sqrt( device_.statistics().sample_stats.ssa_ch2 / device_.statistics().sample_stats.samples_counted ) )
-        << "/" << setw( 3 ) << setprecision( 1 ) << fixed
-        << float_to_dbfs( device_.statistics().sample_stats.max_ch2_amplitude ) << " ]";
+        << float_to_dbfs( sqrt( stats.sample_stats.ssa_ch2 / stats.sample_stats.samples_counted ) ) << "/"
+        << setw( 3 ) << setprecision( 1 ) << fixed << float_to_dbfs( stats.sample_stats.max_ch2_amplitude ) << " ]";
   }
 
   out << " cursor=";
-  pp_samples( out, device_.cursor() );
-  if ( device_.cursor() - capture_.range_begin() > 120 ) {
+  pp_samples( out, status.cursor );
+  if ( thread_ and status.cursor > cursor() ) {
+    out << " handoff=";
+    pp_samples( out, status.cursor - cursor() );
+  }
+  if ( cursor() - capture_.range_begin() > 120 ) {
     out << " capture=";
-    pp_samples( out, device_.cursor() - capture_.range_begin() );
+    pp_samples( out, cursor() - capture_.range_begin() );
   }
-  if ( device_.cursor() != playback_.range_begin() ) {
+  if ( cursor() > playback_.range_begin() ) {
     out << " playback=";
-    pp_samples( out, device_.cursor() - playback_.range_begin() );
+    pp_samples( out, cursor() - playback_.range_begin() );
   }
 
-  if ( device_.statistics().recoveries ) {
-    out << " recoveries=" << device_.statistics().recoveries;
+  if ( stats.recoveries ) {
+    out << " recoveries=" << stats.recoveries;
   }
 
-  if ( device_.statistics().last_recovery
-       and ( device_.cursor() - device_.statistics().last_recovery < 48000 * 60 ) ) {
+  if ( stats.last_recovery and ( status.cursor - stats.last_recovery < 48000 * 60 ) ) {
     out << " last recovery=";
-    pp_samples( out, device_.cursor() - device_.statistics().last_recovery );
-    out << " skipped=" << device_.statistics().sample_stats.samples_skipped;
+    pp_samples( out, status.cursor - stats.last_recovery );
+    out << " skipped=" << stats.sample_stats.samples_skipped;
   }
 
-  if ( device_.statistics().max_microphone_avail > 32 ) {
-    out << " mic<=" << device_.statistics().max_microphone_avail << "!";
+  if ( stats.max_microphone_avail > 32 ) {
+    out << " mic<=" << stats.max_microphone_avail << "!";
+  }
+  if ( stats.min_headphone_delay <= 6 ) {
+    out << " phone>=" << stats.min_headphone_delay << "!";
+  }
+  if ( stats.max_combined_samples > 64 ) {
+    out << " combined<=" << stats.max_combined_samples << "!";
   }
-  if ( device_.statistics().min_headphone_delay <= 6 ) {
-    out << " phone>=" << device_.statistics().min_headphone_delay << "!";
+  if ( stats.empty_wakeups ) {
+    out << " empty=" << stats.empty_wakeups << "/" << stats.total_wakeups << "!";
   }
-  if ( device_.statistics().max_combined_samples > 64 ) {
-    out << " combined<=" << device_.statistics().max_combined_samples << "!";
+  if ( predictor_ ) {
+    out << " predicted rate=" << setprecision( 1 ) << fixed << predictor_->measured_rate()
+        << " margin=" << setprecision( 0 ) << predictor_->margin_ns() / 1000 << "us";
+  }
+  if ( stats.service_latency.count() ) {
+    const auto& latency = stats.service_latency;
+    out << " latency p50<" << latency.quantile_ns( 0.5 ) / 1000 << "us p99<" << latency.quantile_ns( 0.99 ) / 1000
+        << "us max=" << latency.max_ns / 1000 << "us";
+  }
+  const auto& gain = status.config.loopback_gain;
+  out << " loopback gains=" << gain[0][0] << ":" << gain[0][1] << ":" << gain[1][0] << ":" << gain[1][1];
+  if ( status.config.capture_channels != 2 or status.config.playback_channels != 2 ) {
+    out << " channels=" << status.config.capture_channels << "/" << status.config.playback_channels;
+  }
+}
+
+void AudioDeviceTask::reset_summary()
+{
+  if ( thread_ ) {
+    thread_->reset_statistics();
+  } else {
+    device_->reset_statistics();
   }
-  if ( device_.statistics().empty_wakeups ) {
-    out << " empty=" << device_.statistics().empty_wakeups << "/" << device_.statistics().total_wakeups << "!";
+}
+
+AudioInterface::Configuration AudioDeviceTask::config() const
+{
+  return thread_ ? thread_->status().config : device_->config();
+}
+
+void AudioDeviceTask::set_config( const AudioInterface::Configuration& config )
+{
+  if ( thread_ ) {
+    thread_->set_config( config );
+  } else {
+    device_->set_config( config );
   }
-  out << " loopback gains=" << device_.config().ch1_loopback_gain[0] << ":" << device_.config().ch1_loopback_gain[1]
-      << ":" << device_.config().ch2_loopback_gain[0] << ":" << device_.config().ch2_loopback_gain[1];
 }
 
 void AudioDeviceTask::set_loopback_gain( const float gain )
 {
-  auto config = device_.config();
-  config.ch1_loopback_gain = { gain, gain };
-  config.ch2_loopback_gain = { gain, gain };
-  device_.set_config( config );
+  auto new_config = config();
+  new_config.loopback_gain = AudioInterface::Configuration::stereo_loopback( gain );
+  set_config( new_config );
 }
 
 float AudioDeviceTask::loopback_gain() const
 {
-  return device_.config().ch1_loopback_gain.at( 0 );
+  return config().loopback_gain.at( 0 ).at( 0 );
 }
@@ -1,34 +1,79 @@
 #pragma once
 
 #include <chrono>
+#include <memory>
+#include <optional>
 #include <ostream>
 #include <string>
 
 #include "alsa_devices.hh"
+#include "audio_thread.hh"
 #include "eventloop.hh"
 #include "summarize.hh"
+#include "wakeup_predictor.hh"
 
 class AudioDeviceTask : public Summarizable
 {
-  AudioPair device_;
-  ChannelPair capture_ { 65536 }, playback_ { 65536 };
+public:
+  /* how the EventLoop finds out the device needs servicing (unless it has its own thread): by asking it on every
+     iteration, or by sleeping until it's predicted to have frames ready (either way, its fd is the backstop) */
+  enum class Wakeup : uint8_t
+  {
+    Poll,
+    Predict
+  };
+
+private:
+  std::unique_ptr<AudioDevice> device_;
+  ChannelSet capture_;
+  ChannelPair playback_ { 65536 };
+
+  /* if present, the device runs on its own real-time thread, and capture_ and playback_ are this side of it */
+  std::unique_ptr<AudioDeviceThread> thread_ {};
+  std::optional<unsigned int> thread_cpu_ {};
+
+  std::optional<WakeupPredictor> predictor_ {};
+
   void service_device();
-  void install_rules( EventLoop& loop );
+  void install_rules( EventLoop& loop, const Wakeup wakeup );
+
+  AudioInterface::Configuration config() const;
+  void set_config( const AudioInterface::Configuration& config );
 
 public:
-  AudioDeviceTask( const std::string_view interface_name, EventLoop& loop );
+  /* with `own_thread`, the device runs on a dedicated SCHED_FIFO thread (optionally pinned to one CPU) */
+  AudioDeviceTask( std::unique_ptr<AudioDevice> device,
+                   EventLoop& loop,
+                   const bool own_thread = false,
+                   const std::optional<unsigned int> cpu = {},
+                   const Wakeup wakeup = Wakeup::Poll );
+
+  /* an ALSA device */
+  AudioDeviceTask( const std::string_view interface_name,
+                   EventLoop& loop,
+                   const bool own_thread = false,
+                   const std::optional<unsigned int> cpu = {},
+                   const Wakeup wakeup = Wakeup::Poll );
+
+  void start();
+
   void summary( std::ostream& out ) const override;
-  void reset_summary() override { device_.reset_statistics(); }
+  void reset_summary() override;
 
-  AudioPair& device() { return device_; }
-  ChannelPair& capture() { return capture_; }
+  /* only while the device is serviced by the EventLoop */
+  AudioDevice& device() { return *device_; }
+  const AudioDevice& device() const { return *device_; }
+
+  ChannelSet& capture() { return capture_; }
   ChannelPair& playback() { return playback_; }
 
-  const AudioPair& device() const { return device_; }
-  const ChannelPair& capture() const { return capture_; }
+  const ChannelSet& capture() const { return capture_; }
   const ChannelPair& playback() const { return playback_; }
 
-  size_t cursor() const { return device().cursor(); }
+  size_t cursor() const { return thread_ ? thread_->cursor() : device().cursor(); }
+
+  /* playback() before `sample` won't change any more */
+  void commit_playback( const size_t sample );
 
   void set_loopback_gain( const float gain );
   float loopback_gain() const;
@@ -0,0 +1,245 @@
+#include <array>
+#include <iostream>
+#include <utility>
+
+#include <poll.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "audio_thread.hh"
+#include "exception.hh"
+
+using namespace std;
+
+/* [pos, pos + out.size()) of a ChannelPair, interleaved (zero outside its window) */
+template<class Sample>
+static void interleave( const ChannelPair& in, const size_t pos, span<Sample> out )
+{
+  const auto source = in.clipped_region( pos, out.size() );
+  for ( size_t i = 0; i < out.size(); i++ ) {
+    if ( i >= source.offset and i < source.offset + source.size() ) {
+      out[i] = { source.ch1[i - source.offset], source.ch2[i - source.offset] };
+    } else {
+      out[i] = {};
+    }
+  }
+}
+
+/* and back (skipping whatever falls outside the window) */
+template<class Sample>
+static void deinterleave( const span_view<Sample> in, ChannelPair& out, const size_t pos )
+{
+  auto target = out.clipped_region( pos, in.size() );
+  for ( size_t i = 0; i < target.size(); i++ ) {
+    target.ch1[i] = in[target.offset + i][0];
+    target.ch2[i] = in[target.offset + i][1];
+  }
+}
+
+/* the same for all the channels of a ChannelSet */
+template<class Frame>
+static void interleave( const ChannelSet& in, const size_t pos, span<Frame> out )
+{
+  fill( out.begin(), out.end(), Frame {} );
+  const auto extent = in.clip( pos, out.size() );
+  for ( size_t c = 0; c < in.num_channels(); c++ ) {
+    const auto source = in.channel( c ).region( extent.begin, extent.length );
+    for ( size_t i = 0; i < source.size(); i++ ) {
+      out[extent.offset + i][c] = source[i];
+    }
+  }
+}
+
+template<class Frame>
+static void deinterleave( const span_view<Frame> in, ChannelSet& out, const size_t pos )
+{
+  const auto extent = out.clip( pos, in.size() );
+  for ( size_t c = 0; c < out.num_channels(); c++ ) {
+    auto target = out.channel( c ).region( extent.begin, extent.length );
+    for ( size_t i = 0; i < target.size(); i++ ) {
+      target[i] = in[extent.offset + i][c];
+    }
+  }
+}
+
+AudioDeviceThread::AudioDeviceThread( AudioDevice& device )
+  : device_( device )
+  , capture_( device_.config().capture_channels, 65536 )
+{
+  status_ = { device_.statistics(), device_.config(), device_.cursor() };
+  capture_sent_ = capture_received_ = device_.cursor();
+}
+
+void AudioDeviceThread::start( const optional<unsigned int> cpu )
+{
+  /* don't page-fault on the device thread */
+  try {
+    CheckSystemCall( "mlockall", mlockall( MCL_CURRENT | MCL_FUTURE ) );
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+  }
+
+  device_.start();
+  thread_ = thread( [this, cpu] { run( cpu ); } );
+}
+
+AudioDeviceThread::~AudioDeviceThread()
+{
+  shutting_down_ = true;
+  try {
+    shutdown_.signal();
+  } catch ( const exception& e ) {
+    cerr << "Exception in destructor: " << e.what() << endl;
+  }
+
+  if ( thread_.joinable() ) {
+    thread_.join();
+  }
+}
+
+void AudioDeviceThread::run( const optional<unsigned int> cpu )
+{
+  /* real-time priority */
+  try {
+    if ( cpu.has_value() ) {
+      cpu_set_t cpus;
+      CPU_ZERO( &cpus );
+      CPU_SET( cpu.value(), &cpus );
+      CheckSystemCall( "sched_setaffinity", sched_setaffinity( 0, sizeof( cpus ), &cpus ) );
+    }
+
+    sched_param param {};
+    param.sched_priority = CheckSystemCall( "sched_get_priority_max", sched_get_priority_max( SCHED_FIFO ) );
+    CheckSystemCall( "sched_setscheduler", sched_setscheduler( 0, SCHED_FIFO | SCHED_RESET_ON_FORK, &param ) );
+  } catch ( const exception& e ) {
+    cerr << "audio thread: " << e.what() << "\n";
+  }
+
+  try {
+    array<pollfd, 2> fds { { { device_.fd().fd_num(), POLLIN, 0 }, { shutdown_.fd_num(), POLLIN, 0 } } };
+
+    while ( not shutting_down_ ) {
+      /* same as the EventLoop's fast path: don't sleep if there are already samples */
+      if ( not device_.mic_has_samples() ) {
+        if ( poll( fds.data(), fds.size(), -1 ) < 0 ) {
+          if ( errno == EINTR ) {
+            continue;
+          }
+          throw unix_error( "poll" );
+        }
+
+        if ( fds[1].revents ) {
+          break;
+        }
+
+        if ( fds[0].revents & ( POLLERR | POLLHUP ) ) {
+          device_.recover();
+          continue;
+        }
+      }
+
+      service();
+    }
+  } catch ( ... ) {
+    {
+      lock_guard<mutex> lock { mutex_ };
+      error_ = current_exception();
+    }
+    capture_ready_.signal();
+  }
+}
+
+void AudioDeviceThread::service()
+{
+  /* playback from the owner, at the samples it was meant for */
+  const span_view<StereoSample> incoming = playback_ring_.readable_region();
+  deinterleave( incoming, playback_, playback_received_ );
+  playback_ring_.pop( incoming.size() );
+  playback_received_ += incoming.size();
+
+  device_.loopback( capture_, playback_ );
+  playback_.pop_before( device_.cursor() );
+
+  /* capture to the owner (whatever doesn't fit in the ring waits in capture_) */
+  span<CaptureFrame> outgoing = capture_ring_.writable_region();
+  outgoing = outgoing.substr( 0, min( device_.cursor() - capture_sent_, outgoing.size() ) );
+  interleave( as_const( capture_ ), capture_sent_, outgoing );
+  capture_ring_.push( outgoing.size() );
+  capture_sent_ += outgoing.size();
+  capture_.pop_before( capture_sent_ );
+
+  if ( outgoing.size() ) {
+    capture_ready_.signal();
+  }
+
+  publish();
+}
+
+void AudioDeviceThread::publish()
+{
+  unique_lock<mutex> lock { mutex_, try_to_lock };
+  if ( not lock.owns_lock() ) {
+    return;
+  }
+
+  if ( new_config_.has_value() ) {
+    device_.set_config( new_config_.value() );
+    new_config_.reset();
+  }
+
+  if ( reset_requested_ ) {
+    device_.reset_statistics();
+    reset_requested_ = false;
+  }
+
+  status_ = { device_.statistics(), device_.config(), device_.cursor() };
+}
+
+void AudioDeviceThread::receive_capture( ChannelSet& capture )
+{
+  capture_ready_.acknowledge();
+
+  {
+    lock_guard<mutex> lock { mutex_ };
+    if ( error_ ) {
+      rethrow_exception( error_ );
+    }
+  }
+
+  const span_view<CaptureFrame> incoming = capture_ring_.readable_region();
+  deinterleave( incoming, capture, capture_received_ );
+  capture_ring_.pop( incoming.size() );
+  capture_received_ += incoming.size();
+}
+
+void AudioDeviceThread::send_playback( const ChannelPair& playback, const size_t until )
+{
+  if ( until <= playback_sent_ ) {
+    return;
+  }
+
+  span<StereoSample> outgoing = playback_ring_.writable_region();
+  outgoing = outgoing.substr( 0, min( until - playback_sent_, outgoing.size() ) );
+  interleave( playback, playback_sent_, outgoing );
+  playback_ring_.push( outgoing.size() );
+  playback_sent_ += outgoing.size();
+}
+
+AudioDeviceThread::Status AudioDeviceThread::status() const
+{
+  lock_guard<mutex> lock { mutex_ };
+  return status_;
+}
+
+void AudioDeviceThread::set_config( const AudioInterface::Configuration& config )
+{
+  lock_guard<mutex> lock { mutex_ };
+  new_config_ = config;
+  status_.config = config;
+}
+
+void AudioDeviceThread::reset_statistics()
+{
+  lock_guard<mutex> lock { mutex_ };
+  reset_requested_ = true;
+}
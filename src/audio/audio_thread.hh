@@ -0,0 +1,85 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+#include "alsa_devices.hh"
+#include "eventfd.hh"
+#include "spsc_ring_buffer.hh"
+
+/* Services an AudioDevice on its own SCHED_FIFO thread, so nothing else the program does can delay the loopback.
+   Audio crosses between that thread and the one that owns this object through lock-free rings: capture in
+   order from the device's cursor, and playback in order from sample 0 (the owner says how far its playback is
+   final). Playback that arrives after its sample has been played is dropped. */
+class AudioDeviceThread
+{
+public:
+  struct Status
+  {
+    AudioStatistics statistics;
+    AudioInterface::Configuration config;
+    size_t cursor;
+  };
+
+private:
+  using StereoSample = std::array<float, 2>;
+  using CaptureFrame = std::array<float, ChannelSet::MAX_CHANNELS>;
+
+  AudioDevice& device_;
+
+  /* the device thread's side */
+  ChannelSet capture_;
+  ChannelPair playback_ { 65536 };
+  size_t capture_sent_ {}, playback_received_ {};
+
+  SPSCRingBuffer<CaptureFrame> capture_ring_ { 8192 };
+  SPSCRingBuffer<StereoSample> playback_ring_ { 8192 };
+  EventFD capture_ready_ {}, shutdown_ {};
+
+  /* the owner's side */
+  size_t capture_received_ {}, playback_sent_ {};
+
+  /* published by the device thread whenever it can take the lock without waiting */
+  mutable std::mutex mutex_ {};
+  Status status_ {};
+  std::optional<AudioInterface::Configuration> new_config_ {};
+  bool reset_requested_ {};
+  std::exception_ptr error_ {};
+
+  std::atomic<bool> shutting_down_ {};
+  std::thread thread_ {};
+
+  void run( const std::optional<unsigned int> cpu );
+  void service();
+  void publish();
+
+public:
+  explicit AudioDeviceThread( AudioDevice& device );
+  ~AudioDeviceThread();
+
+  /* start the device and the thread (optionally pinned to one CPU) */
+  void start( const std::optional<unsigned int> cpu );
+
+  /* readable when there is new capture (or the device thread failed) */
+  EventFD& capture_ready() { return capture_ready_; }
+
+  /* append new capture to `capture` (rethrowing anything the device thread threw) */
+  void receive_capture( ChannelSet& capture );
+
+  /* hand over the playback before `until` */
+  void send_playback( const ChannelPair& playback, const size_t until );
+
+  size_t cursor() const { return capture_received_; }
+  size_t playback_sent() const { return playback_sent_; }
+
+  Status status() const;
+  void set_config( const AudioInterface::Configuration& config );
+  void reset_statistics();
+
+  AudioDeviceThread( const AudioDeviceThread& other ) = delete;
+  AudioDeviceThread& operator=( const AudioDeviceThread& other ) = delete;
+};
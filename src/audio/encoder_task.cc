@@ -1,5 +1,8 @@
 #include "encoder_task.hh"
 
+#include <algorithm>
+#include <cmath>
+
 using namespace std;
 
 template class EncoderTask<AudioDeviceTask>;
@@ -13,13 +16,41 @@ EncoderTask<AudioSource>::EncoderTask( const int bit_rate1,
   : OpusEncoderProcess( bit_rate1, bit_rate2, sample_rate )
   , source_( source )
 {
+  install_rules( loop );
+}
+
+template<class AudioSource>
+EncoderTask<AudioSource>::EncoderTask( const Multistream& multistream,
+                                       const int sample_rate,
+                                       const shared_ptr<AudioSource> source,
+                                       EventLoop& loop )
+  : OpusEncoderProcess( multistream, sample_rate )
+  , source_( source )
+{
+  install_rules( loop );
+}
+
+template<class AudioSource>
+void EncoderTask<AudioSource>::install_rules( EventLoop& loop )
+{
+  if ( multistream_.has_value() ) {
+    loop.add_rule(
+      "encode [multistream]",
+      [&] {
+        multistream_->encode_one_frame( source_->capture() );
+        pop_from_source();
+      },
+      [&] { return multistream_->can_encode_frame( source_->cursor() ); } );
+    return;
+  }
+
   loop.add_rule(
     "encode [ch1]",
     [&] {
-      enc1_.encode_one_frame( source_->capture().ch1() );
+      enc1_->encode_one_frame( source_->capture().ch1() );
       pop_from_source();
     },
-    [&] { return enc1_.can_encode_frame( source_->cursor() ); } );
+    [&] { return enc1_->can_encode_frame( source_->cursor() ); } );
 
   loop.add_rule(
     "encode [ch2]",
@@ -41,7 +72,11 @@ void EncoderTask<AudioSource>::pop_from_source()
 
 bool OpusEncoderProcess::has_frame() const
 {
-  if ( not enc1_.output().has_value() ) {
+  if ( multistream_.has_value() ) {
+    return multistream_->output().has_value();
+  }
+
+  if ( not enc1_->output().has_value() ) {
     return false;
   }
 
@@ -57,76 +92,154 @@ void OpusEncoderProcess::pop_frame()
   if ( not has_frame() ) {
     throw std::runtime_error( "pop_frame() but not has_frame()" );
   }
-  enc1_.output().reset();
-  if ( enc2_.has_value() ) {
-    enc2_->output().reset();
+  if ( multistream_.has_value() ) {
+    multistream_->output().reset();
+  } else {
+    enc1_->output().reset();
+    if ( enc2_.has_value() ) {
+      enc2_->output().reset();
+    }
   }
   num_popped_++;
 }
 
 OpusEncoderProcess::OpusEncoderProcess( const int bit_rate1, const int bit_rate2, const int sample_rate )
-  : enc1_( bit_rate1, sample_rate, 1 )
+  : enc1_( make_optional<TrackedEncoder>( bit_rate1, sample_rate, 1 ) )
   , enc2_( make_optional<TrackedEncoder>( bit_rate2, sample_rate, 1 ) )
 {}
 
 OpusEncoderProcess::OpusEncoderProcess( const int bit_rate1, const int sample_rate )
-  : enc1_( bit_rate1, sample_rate, 2 )
+  : enc1_( make_optional<TrackedEncoder>( bit_rate1, sample_rate, 2 ) )
   , enc2_()
 {}
 
-OpusEncoderProcess::TrackedEncoder::TrackedEncoder( const int bit_rate,
-                                                    const int sample_rate,
-                                                    const int channel_count )
+OpusEncoderProcess::OpusEncoderProcess( const Multistream& multistream, const int sample_rate )
+  : enc1_()
+  , enc2_()
+  , multistream_(
+      make_optional<TrackedMultistreamEncoder>( multistream.bit_rate, sample_rate, multistream.channels ) )
+{}
+
+template<class Encoder, class Frame>
+OpusEncoderProcess::Tracked<Encoder, Frame>::Tracked( const int bit_rate,
+                                                      const int sample_rate,
+                                                      const int channel_count )
   : channel_count_( channel_count )
   , enc_( bit_rate, sample_rate, channel_count_, OPUS_APPLICATION_RESTRICTED_LOWDELAY )
 {}
 
-void OpusEncoderProcess::TrackedEncoder::reset( const int bit_rate, const int sample_rate )
+template<class Encoder, class Frame>
+void OpusEncoderProcess::Tracked<Encoder, Frame>::reset( const int bit_rate, const int sample_rate )
 {
   enc_ = { bit_rate, sample_rate, channel_count_, OPUS_APPLICATION_RESTRICTED_LOWDELAY };
+  enc_.set_expected_loss( expected_loss_percent_ );
 }
 
-size_t OpusEncoderProcess::min_encode_cursor() const
+template<class Encoder, class Frame>
+void OpusEncoderProcess::Tracked<Encoder, Frame>::set_expected_loss( const int percent )
+{
+  if ( percent != expected_loss_percent_ ) {
+    enc_.set_expected_loss( percent );
+    expected_loss_percent_ = percent;
+  }
+}
+
+void OpusEncoderProcess::set_expected_loss( const float loss_fraction )
 {
+  const int percent = clamp( int( lrint( 100 * loss_fraction ) ), 0, 100 );
+  if ( multistream_.has_value() ) {
+    multistream_->set_expected_loss( percent );
+    return;
+  }
+
+  enc1_->set_expected_loss( percent );
   if ( enc2_.has_value() ) {
-    return min( enc1_.cursor(), enc2_->cursor() );
+    enc2_->set_expected_loss( percent );
+  }
+}
+
+size_t OpusEncoderProcess::min_encode_cursor() const
+{
+  if ( multistream_.has_value() ) {
+    return multistream_->cursor();
+  } else if ( enc2_.has_value() ) {
+    return min( enc1_->cursor(), enc2_->cursor() );
   } else {
-    return enc1_.cursor();
+    return enc1_->cursor();
   }
 }
 
-bool OpusEncoderProcess::TrackedEncoder::can_encode_frame( const size_t source_cursor ) const
+template<class Encoder, class Frame>
+bool OpusEncoderProcess::Tracked<Encoder, Frame>::can_encode_frame( const size_t source_cursor ) const
 {
   return ( source_cursor >= cursor() + opus_frame::NUM_SAMPLES ) and ( not output_.has_value() );
 }
 
-void OpusEncoderProcess::TrackedEncoder::encode_one_frame( const AudioChannel& channel )
+template<class Encoder, class Frame>
+void OpusEncoderProcess::Tracked<Encoder, Frame>::start_frame()
 {
   if ( output_.has_value() ) {
     throw runtime_error( "internal error: encode_one_frame called but output already has value" );
   }
 
   output_.emplace();
+}
+
+template<class Encoder, class Frame>
+void OpusEncoderProcess::Tracked<Encoder, Frame>::encode_one_frame( const AudioChannel& channel )
+{
+  start_frame();
   enc_.encode( channel.region( cursor(), opus_frame::NUM_SAMPLES ), output_.value() );
   num_pushed_++;
 }
 
-void OpusEncoderProcess::TrackedEncoder::encode_one_frame( const AudioChannel& ch1, const AudioChannel& ch2 )
+template<class Encoder, class Frame>
+void OpusEncoderProcess::Tracked<Encoder, Frame>::encode_one_frame( const ChannelPair& input )
 {
-  if ( output_.has_value() ) {
-    throw runtime_error( "internal error: encode_one_frame called but output already has value" );
+  start_frame();
+  const auto frame = input.region( cursor(), opus_frame::NUM_SAMPLES );
+  enc_.encode_stereo( frame.ch1, frame.ch2, output_.value() );
+  num_pushed_++;
+}
+
+template<class Encoder, class Frame>
+void OpusEncoderProcess::Tracked<Encoder, Frame>::encode_one_frame( const ChannelSet& input )
+{
+  if ( input.num_channels() != size_t( channel_count_ ) ) {
+    throw runtime_error( "multistream encoder: expected " + to_string( channel_count_ ) + " channels, got "
+                         + to_string( input.num_channels() ) );
   }
 
-  output_.emplace();
-  enc_.encode_stereo( ch1.region( cursor(), opus_frame::NUM_SAMPLES ),
-                      ch2.region( cursor(), opus_frame::NUM_SAMPLES ),
-                      output_.value() );
+  start_frame();
+
+  constexpr size_t NUM_SAMPLES = Frame::NUM_SAMPLES;
+  array<float, opus_multistream_frame::MAX_CHANNELS * NUM_SAMPLES> interleaved;
+  for ( int c = 0; c < channel_count_; c++ ) {
+    const auto samples = input.channel( c ).region( cursor(), NUM_SAMPLES );
+    for ( size_t i = 0; i < NUM_SAMPLES; i++ ) {
+      interleaved[channel_count_ * i + c] = samples[i];
+    }
+  }
+
+  enc_.encode( { interleaved.data(), channel_count_ * NUM_SAMPLES }, output_.value() );
+  num_pushed_++;
+}
+
+template<class Encoder, class Frame>
+void OpusEncoderProcess::Tracked<Encoder, Frame>::encode_silent_frame()
+{
+  start_frame();
   num_pushed_++;
 }
 
 void OpusEncoderProcess::reset( const int bit_rate1, const int sample_rate )
 {
-  enc1_.reset( bit_rate1, sample_rate );
+  if ( multistream_.has_value() ) {
+    multistream_->reset( bit_rate1, sample_rate );
+    return;
+  }
+
+  enc1_->reset( bit_rate1, sample_rate );
   if ( enc2_.has_value() ) {
     throw runtime_error( "stereo reset called on independent-channel OpusEncoderProcess" );
   }
@@ -134,17 +247,46 @@ void OpusEncoderProcess::reset( const int bit_rate1, const int sample_rate )
 
 void OpusEncoderProcess::reset( const int bit_rate1, const int bit_rate2, const int sample_rate )
 {
-  enc1_.reset( bit_rate1, sample_rate );
+  enc1_.value().reset( bit_rate1, sample_rate );
   enc2_.value().reset( bit_rate2, sample_rate );
 }
 
-void OpusEncoderProcess::encode_one_frame( const AudioChannel& ch1, const AudioChannel& ch2 )
+void OpusEncoderProcess::encode_one_frame( const ChannelPair& input )
 {
+  if ( multistream_.has_value() ) {
+    throw runtime_error( "multistream OpusEncoderProcess needs a ChannelSet" );
+  }
+
   if ( enc2_.has_value() ) {
-    enc1_.encode_one_frame( ch1 );
-    enc2_->encode_one_frame( ch2 );
+    enc1_->encode_one_frame( input.ch1() );
+    enc2_->encode_one_frame( input.ch2() );
   } else {
-    enc1_.encode_one_frame( ch1, ch2 );
+    enc1_->encode_one_frame( input );
+  }
+}
+
+void OpusEncoderProcess::encode_one_frame( const ChannelSet& input )
+{
+  if ( multistream_.has_value() ) {
+    multistream_->encode_one_frame( input );
+  } else if ( enc2_.has_value() ) {
+    enc1_->encode_one_frame( input.ch1() );
+    enc2_->encode_one_frame( input.ch2() );
+  } else {
+    throw runtime_error( "stereo OpusEncoderProcess needs a ChannelPair" );
+  }
+}
+
+void OpusEncoderProcess::encode_silent_frame()
+{
+  if ( multistream_.has_value() ) {
+    multistream_->encode_silent_frame();
+    return;
+  }
+
+  enc1_->encode_silent_frame();
+  if ( enc2_.has_value() ) {
+    enc2_->encode_silent_frame();
   }
 }
 
@@ -152,8 +294,13 @@ AudioFrame OpusEncoderProcess::front( const uint32_t frame_index ) const
 {
   AudioFrame ret;
   ret.frame_index = frame_index;
+  if ( multistream_.has_value() ) {
+    ret.set_multistream( multistream_->channel_count(), multistream_->output().value() );
+    return ret;
+  }
+
   ret.separate_channels = enc2_.has_value();
-  ret.frame1 = enc1_.output().value();
+  ret.frame1 = enc1_->output().value();
   if ( enc2_.has_value() ) {
     ret.frame2 = enc2_.value().output().value();
   }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "audio_buffer.hh"
 #include "audio_task.hh"
 #include "eventloop.hh"
 #include "formats.hh"
@@ -8,36 +9,60 @@
 
 class OpusEncoderProcess
 {
-  class TrackedEncoder
+  /* an encoder and how far it has got (Encoder is OpusEncoder or OpusMSEncoder, with matching Frame) */
+  template<class Encoder, class Frame>
+  class Tracked
   {
     int channel_count_;
-    OpusEncoder enc_;
-    std::optional<opus_frame> output_ {};
+    Encoder enc_;
+    std::optional<Frame> output_ {};
     size_t num_pushed_ {};
 
+    int expected_loss_percent_ {};
+
+    void start_frame();
+
   public:
-    TrackedEncoder( const int bit_rate, const int sample_rate, const int channel_count );
+    Tracked( const int bit_rate, const int sample_rate, const int channel_count );
 
     bool can_encode_frame( const size_t source_cursor ) const;
     void encode_one_frame( const AudioChannel& channel );
-    void encode_one_frame( const AudioChannel& ch1, const AudioChannel& ch2 );
+    void encode_one_frame( const ChannelPair& input );
+    void encode_one_frame( const ChannelSet& input );
+    void encode_silent_frame();
     size_t cursor() const { return num_pushed_ * opus_frame::NUM_SAMPLES; }
 
-    std::optional<opus_frame>& output() { return output_; }
-    const std::optional<opus_frame>& output() const { return output_; }
+    std::optional<Frame>& output() { return output_; }
+    const std::optional<Frame>& output() const { return output_; }
+
+    int channel_count() const { return channel_count_; }
 
     void reset( const int bit_rate, const int sample_rate );
+
+    void set_expected_loss( const int percent );
   };
 
+  using TrackedEncoder = Tracked<OpusEncoder, opus_frame>;
+  using TrackedMultistreamEncoder = Tracked<OpusMSEncoder, opus_multistream_frame>;
+
   size_t num_popped_ {};
 
 protected:
-  TrackedEncoder enc1_;
-  std::optional<TrackedEncoder> enc2_;
+  /* either one stereo encoder (enc1_), two mono encoders (enc1_ and enc2_), or one multistream encoder */
+  std::optional<TrackedEncoder> enc1_, enc2_;
+  std::optional<TrackedMultistreamEncoder> multistream_ {};
 
 public:
+  /* all of an interface's channels (up to opus_multistream_frame::MAX_CHANNELS) in one packet per frame */
+  struct Multistream
+  {
+    int bit_rate; /* for all the channels together */
+    unsigned int channels;
+  };
+
   OpusEncoderProcess( const int bit_rate, const int sample_rate );
   OpusEncoderProcess( const int bit_rate1, const int bit_rate2, const int sample_rate );
+  OpusEncoderProcess( const Multistream& multistream, const int sample_rate );
 
   bool has_frame() const;
   void pop_frame();
@@ -50,7 +75,15 @@ public:
 
   AudioFrame front( const uint32_t frame_index ) const;
 
-  void encode_one_frame( const AudioChannel& ch1, const AudioChannel& ch2 );
+  void encode_one_frame( const ChannelPair& input );
+  void encode_one_frame( const ChannelSet& input );
+
+  /* an empty frame in place of a silent one, without running the encoder (decoders play it as silence) */
+  void encode_silent_frame();
+
+  /* the loss rate the receiver is seeing (0 to 1): as it rises, CELT codes band energies with less prediction from
+     earlier frames */
+  void set_expected_loss( const float loss_fraction );
 };
 
 template<class AudioSource>
@@ -59,6 +92,7 @@ class EncoderTask : public OpusEncoderProcess
   std::shared_ptr<AudioSource> source_;
 
   void pop_from_source();
+  void install_rules( EventLoop& loop );
 
 public:
   EncoderTask( const int bit_rate1,
@@ -66,6 +100,11 @@ public:
                const int sample_rate,
                const std::shared_ptr<AudioSource> source,
                EventLoop& loop );
+
+  EncoderTask( const Multistream& multistream,
+               const int sample_rate,
+               const std::shared_ptr<AudioSource> source,
+               EventLoop& loop );
 };
 
 using ClientEncoderTask = EncoderTask<AudioDeviceTask>;
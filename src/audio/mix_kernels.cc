@@ -0,0 +1,375 @@
+#include "mix_kernels.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+#define MIX_KERNELS_X86
+#define AVX2_KERNEL __attribute__( ( target( "avx2,fma" ) ) )
+#endif
+
+using namespace std;
+
+struct MixKernelTable
+{
+  const char* name;
+  void ( *mix_accumulate )( const float*, float, float, float*, float*, size_t );
+  float ( *sum_of_squares )( const float*, size_t );
+  float ( *peak_amplitude )( const float*, size_t );
+  bool ( *s32_to_float )( const int32_t*, float*, float*, size_t );
+  void ( *float_to_s32 )( const float*, const float*, int32_t*, size_t );
+};
+
+static constexpr float S32_SCALE = uint64_t( 1 ) << 31;
+static constexpr float S32_MAX_FLOAT = 2147483520.0f / S32_SCALE; /* largest float that still fits in an int32 */
+
+static void mix_accumulate_scalar( const float* source,
+                                   const float gain1,
+                                   const float gain2,
+                                   float* target1,
+                                   float* target2,
+                                   const size_t count )
+{
+  for ( size_t i = 0; i < count; i++ ) {
+    target1[i] += gain1 * source[i];
+    target2[i] += gain2 * source[i];
+  }
+}
+
+static float sum_of_squares_scalar( const float* samples, const size_t count )
+{
+  float ret = 0;
+  for ( size_t i = 0; i < count; i++ ) {
+    ret += samples[i] * samples[i];
+  }
+  return ret;
+}
+
+static float peak_amplitude_scalar( const float* samples, const size_t count )
+{
+  float ret = 0;
+  for ( size_t i = 0; i < count; i++ ) {
+    ret = max( ret, abs( samples[i] ) );
+  }
+  return ret;
+}
+
+static bool s32_to_float_scalar( const int32_t* interleaved, float* ch1, float* ch2, const size_t count )
+{
+  int32_t low_bits = 0;
+  for ( size_t i = 0; i < count; i++ ) {
+    low_bits |= interleaved[2 * i] | interleaved[2 * i + 1];
+    ch1[i] = interleaved[2 * i] / S32_SCALE;
+    ch2[i] = interleaved[2 * i + 1] / S32_SCALE;
+  }
+  return not( low_bits & 0xff );
+}
+
+static void float_to_s32_scalar( const float* ch1, const float* ch2, int32_t* interleaved, const size_t count )
+{
+  for ( size_t i = 0; i < count; i++ ) {
+    interleaved[2 * i] = lrint( clamp( ch1[i], -1.0f, S32_MAX_FLOAT ) * S32_SCALE );
+    interleaved[2 * i + 1] = lrint( clamp( ch2[i], -1.0f, S32_MAX_FLOAT ) * S32_SCALE );
+  }
+}
+
+#ifdef MIX_KERNELS_X86
+
+static void mix_accumulate_sse( const float* source,
+                                const float gain1,
+                                const float gain2,
+                                float* target1,
+                                float* target2,
+                                const size_t count )
+{
+  const __m128 g1 = _mm_set1_ps( gain1 );
+  const __m128 g2 = _mm_set1_ps( gain2 );
+
+  size_t i = 0;
+  for ( ; i + 4 <= count; i += 4 ) {
+    const __m128 x = _mm_loadu_ps( source + i );
+    _mm_storeu_ps( target1 + i, _mm_add_ps( _mm_loadu_ps( target1 + i ), _mm_mul_ps( g1, x ) ) );
+    _mm_storeu_ps( target2 + i, _mm_add_ps( _mm_loadu_ps( target2 + i ), _mm_mul_ps( g2, x ) ) );
+  }
+
+  mix_accumulate_scalar( source + i, gain1, gain2, target1 + i, target2 + i, count - i );
+}
+
+static float sum_of_squares_sse( const float* samples, const size_t count )
+{
+  __m128 acc = _mm_setzero_ps();
+
+  size_t i = 0;
+  for ( ; i + 4 <= count; i += 4 ) {
+    const __m128 x = _mm_loadu_ps( samples + i );
+    acc = _mm_add_ps( acc, _mm_mul_ps( x, x ) );
+  }
+
+  alignas( 16 ) float lanes[4];
+  _mm_store_ps( lanes, acc );
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_of_squares_scalar( samples + i, count - i );
+}
+
+static float peak_amplitude_sse( const float* samples, const size_t count )
+{
+  const __m128 abs_mask = _mm_castsi128_ps( _mm_set1_epi32( 0x7fffffff ) );
+  __m128 peak = _mm_setzero_ps();
+
+  size_t i = 0;
+  for ( ; i + 4 <= count; i += 4 ) {
+    peak = _mm_max_ps( peak, _mm_and_ps( abs_mask, _mm_loadu_ps( samples + i ) ) );
+  }
+
+  alignas( 16 ) float lanes[4];
+  _mm_store_ps( lanes, peak );
+  return max( { lanes[0], lanes[1], lanes[2], lanes[3], peak_amplitude_scalar( samples + i, count - i ) } );
+}
+
+static bool s32_to_float_sse( const int32_t* interleaved, float* ch1, float* ch2, const size_t count )
+{
+  const __m128 scale = _mm_set1_ps( 1 / S32_SCALE );
+  __m128i low_bits = _mm_setzero_si128();
+
+  size_t i = 0;
+  for ( ; i + 4 <= count; i += 4 ) {
+    const __m128i a = _mm_loadu_si128( reinterpret_cast<const __m128i*>( interleaved + 2 * i ) );
+    const __m128i b = _mm_loadu_si128( reinterpret_cast<const __m128i*>( interleaved + 2 * i + 4 ) );
+    low_bits = _mm_or_si128( low_bits, _mm_or_si128( a, b ) );
+
+    const __m128 fa = _mm_mul_ps( _mm_cvtepi32_ps( a ), scale ); /* L0 R0 L1 R1 */
+    const __m128 fb = _mm_mul_ps( _mm_cvtepi32_ps( b ), scale ); /* L2 R2 L3 R3 */
+    _mm_storeu_ps( ch1 + i, _mm_shuffle_ps( fa, fb, _MM_SHUFFLE( 2, 0, 2, 0 ) ) );
+    _mm_storeu_ps( ch2 + i, _mm_shuffle_ps( fa, fb, _MM_SHUFFLE( 3, 1, 3, 1 ) ) );
+  }
+
+  const bool tail_ok = s32_to_float_scalar( interleaved + 2 * i, ch1 + i, ch2 + i, count - i );
+  return tail_ok and _mm_movemask_epi8( _mm_cmpeq_epi32( _mm_and_si128( low_bits, _mm_set1_epi32( 0xff ) ),
+                                                        _mm_setzero_si128() ) )
+                       == 0xffff;
+}
+
+static void float_to_s32_sse( const float* ch1, const float* ch2, int32_t* interleaved, const size_t count )
+{
+  const __m128 lower = _mm_set1_ps( -1.0f );
+  const __m128 upper = _mm_set1_ps( S32_MAX_FLOAT );
+  const __m128 scale = _mm_set1_ps( S32_SCALE );
+
+  size_t i = 0;
+  for ( ; i + 4 <= count; i += 4 ) {
+    const __m128 l = _mm_min_ps( _mm_max_ps( _mm_loadu_ps( ch1 + i ), lower ), upper );
+    const __m128 r = _mm_min_ps( _mm_max_ps( _mm_loadu_ps( ch2 + i ), lower ), upper );
+    const __m128i li = _mm_cvtps_epi32( _mm_mul_ps( l, scale ) );
+    const __m128i ri = _mm_cvtps_epi32( _mm_mul_ps( r, scale ) );
+    _mm_storeu_si128( reinterpret_cast<__m128i*>( interleaved + 2 * i ), _mm_unpacklo_epi32( li, ri ) );
+    _mm_storeu_si128( reinterpret_cast<__m128i*>( interleaved + 2 * i + 4 ), _mm_unpackhi_epi32( li, ri ) );
+  }
+
+  float_to_s32_scalar( ch1 + i, ch2 + i, interleaved + 2 * i, count - i );
+}
+
+AVX2_KERNEL static void mix_accumulate_avx2( const float* source,
+                                             const float gain1,
+                                             const float gain2,
+                                             float* target1,
+                                             float* target2,
+                                             const size_t count )
+{
+  const __m256 g1 = _mm256_set1_ps( gain1 );
+  const __m256 g2 = _mm256_set1_ps( gain2 );
+
+  size_t i = 0;
+  for ( ; i + 8 <= count; i += 8 ) {
+    const __m256 x = _mm256_loadu_ps( source + i );
+    _mm256_storeu_ps( target1 + i, _mm256_fmadd_ps( g1, x, _mm256_loadu_ps( target1 + i ) ) );
+    _mm256_storeu_ps( target2 + i, _mm256_fmadd_ps( g2, x, _mm256_loadu_ps( target2 + i ) ) );
+  }
+
+  mix_accumulate_scalar( source + i, gain1, gain2, target1 + i, target2 + i, count - i );
+}
+
+AVX2_KERNEL static float sum_of_squares_avx2( const float* samples, const size_t count )
+{
+  __m256 acc = _mm256_setzero_ps();
+
+  size_t i = 0;
+  for ( ; i + 8 <= count; i += 8 ) {
+    const __m256 x = _mm256_loadu_ps( samples + i );
+    acc = _mm256_fmadd_ps( x, x, acc );
+  }
+
+  const __m128 half = _mm_add_ps( _mm256_castps256_ps128( acc ), _mm256_extractf128_ps( acc, 1 ) );
+  alignas( 16 ) float lanes[4];
+  _mm_store_ps( lanes, half );
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_of_squares_scalar( samples + i, count - i );
+}
+
+AVX2_KERNEL static float peak_amplitude_avx2( const float* samples, const size_t count )
+{
+  const __m256 abs_mask = _mm256_castsi256_ps( _mm256_set1_epi32( 0x7fffffff ) );
+  __m256 peak = _mm256_setzero_ps();
+
+  size_t i = 0;
+  for ( ; i + 8 <= count; i += 8 ) {
+    peak = _mm256_max_ps( peak, _mm256_and_ps( abs_mask, _mm256_loadu_ps( samples + i ) ) );
+  }
+
+  const __m128 half = _mm_max_ps( _mm256_castps256_ps128( peak ), _mm256_extractf128_ps( peak, 1 ) );
+  alignas( 16 ) float lanes[4];
+  _mm_store_ps( lanes, half );
+  return max( { lanes[0], lanes[1], lanes[2], lanes[3], peak_amplitude_scalar( samples + i, count - i ) } );
+}
+
+AVX2_KERNEL static bool s32_to_float_avx2( const int32_t* interleaved, float* ch1, float* ch2, const size_t count )
+{
+  const __m256 scale = _mm256_set1_ps( 1 / S32_SCALE );
+  __m256i low_bits = _mm256_setzero_si256();
+
+  size_t i = 0;
+  for ( ; i + 8 <= count; i += 8 ) {
+    const __m256i a = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( interleaved + 2 * i ) );
+    const __m256i b = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( interleaved + 2 * i + 8 ) );
+    low_bits = _mm256_or_si256( low_bits, _mm256_or_si256( a, b ) );
+
+    const __m256 fa = _mm256_mul_ps( _mm256_cvtepi32_ps( a ), scale ); /* L0 R0 L1 R1 | L2 R2 L3 R3 */
+    const __m256 fb = _mm256_mul_ps( _mm256_cvtepi32_ps( b ), scale ); /* L4 R4 L5 R5 | L6 R6 L7 R7 */
+
+    /* L0 L1 L4 L5 | L2 L3 L6 L7, then put the 64-bit pairs back in order */
+    const __m256 l = _mm256_shuffle_ps( fa, fb, _MM_SHUFFLE( 2, 0, 2, 0 ) );
+    const __m256 r = _mm256_shuffle_ps( fa, fb, _MM_SHUFFLE( 3, 1, 3, 1 ) );
+    const __m256d l_ordered = _mm256_permute4x64_pd( _mm256_castps_pd( l ), _MM_SHUFFLE( 3, 1, 2, 0 ) );
+    const __m256d r_ordered = _mm256_permute4x64_pd( _mm256_castps_pd( r ), _MM_SHUFFLE( 3, 1, 2, 0 ) );
+    _mm256_storeu_ps( ch1 + i, _mm256_castpd_ps( l_ordered ) );
+    _mm256_storeu_ps( ch2 + i, _mm256_castpd_ps( r_ordered ) );
+  }
+
+  const bool tail_ok = s32_to_float_scalar( interleaved + 2 * i, ch1 + i, ch2 + i, count - i );
+  return tail_ok and _mm256_testz_si256( low_bits, _mm256_set1_epi32( 0xff ) );
+}
+
+AVX2_KERNEL static void float_to_s32_avx2( const float* ch1,
+                                           const float* ch2,
+                                           int32_t* interleaved,
+                                           const size_t count )
+{
+  const __m256 lower = _mm256_set1_ps( -1.0f );
+  const __m256 upper = _mm256_set1_ps( S32_MAX_FLOAT );
+  const __m256 scale = _mm256_set1_ps( S32_SCALE );
+
+  size_t i = 0;
+  for ( ; i + 8 <= count; i += 8 ) {
+    const __m256 l = _mm256_min_ps( _mm256_max_ps( _mm256_loadu_ps( ch1 + i ), lower ), upper );
+    const __m256 r = _mm256_min_ps( _mm256_max_ps( _mm256_loadu_ps( ch2 + i ), lower ), upper );
+    const __m256i li = _mm256_cvtps_epi32( _mm256_mul_ps( l, scale ) );
+    const __m256i ri = _mm256_cvtps_epi32( _mm256_mul_ps( r, scale ) );
+
+    /* L0 R0 L1 R1 | L4 R4 L5 R5 and L2 R2 L3 R3 | L6 R6 L7 R7 */
+    const __m256i lo = _mm256_unpacklo_epi32( li, ri );
+    const __m256i hi = _mm256_unpackhi_epi32( li, ri );
+    _mm256_storeu_si256( reinterpret_cast<__m256i*>( interleaved + 2 * i ),
+                         _mm256_permute2x128_si256( lo, hi, 0x20 ) );
+    _mm256_storeu_si256( reinterpret_cast<__m256i*>( interleaved + 2 * i + 8 ),
+                         _mm256_permute2x128_si256( lo, hi, 0x31 ) );
+  }
+
+  float_to_s32_scalar( ch1 + i, ch2 + i, interleaved + 2 * i, count - i );
+}
+
+#endif
+
+static const MixKernelTable& kernels()
+{
+  static const MixKernelTable chosen = [] {
+#ifdef MIX_KERNELS_X86
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports( "avx2" ) and __builtin_cpu_supports( "fma" ) ) {
+      return MixKernelTable { "avx2",
+                              mix_accumulate_avx2,
+                              sum_of_squares_avx2,
+                              peak_amplitude_avx2,
+                              s32_to_float_avx2,
+                              float_to_s32_avx2 };
+    }
+    if ( __builtin_cpu_supports( "sse2" ) ) {
+      return MixKernelTable { "sse",
+                              mix_accumulate_sse,
+                              sum_of_squares_sse,
+                              peak_amplitude_sse,
+                              s32_to_float_sse,
+                              float_to_s32_sse };
+    }
+#endif
+    return MixKernelTable { "scalar",
+                            mix_accumulate_scalar,
+                            sum_of_squares_scalar,
+                            peak_amplitude_scalar,
+                            s32_to_float_scalar,
+                            float_to_s32_scalar };
+  }();
+
+  return chosen;
+}
+
+void mix_accumulate( const span_view<float> source,
+                     const float gain1,
+                     const float gain2,
+                     span<float> target1,
+                     span<float> target2 )
+{
+  const size_t count = min( source.size(), min( target1.size(), target2.size() ) );
+  kernels().mix_accumulate( source.data(), gain1, gain2, target1.mutable_data(), target2.mutable_data(), count );
+}
+
+float sum_of_squares( const span_view<float> samples )
+{
+  return kernels().sum_of_squares( samples.data(), samples.size() );
+}
+
+float peak_amplitude( const span_view<float> samples )
+{
+  return kernels().peak_amplitude( samples.data(), samples.size() );
+}
+
+bool s32_to_float( const span_view<int32_t> interleaved, span<float> ch1, span<float> ch2 )
+{
+  const size_t count = min( interleaved.size() / 2, min( ch1.size(), ch2.size() ) );
+  return kernels().s32_to_float( interleaved.data(), ch1.mutable_data(), ch2.mutable_data(), count );
+}
+
+void float_to_s32( const span_view<float> ch1, const span_view<float> ch2, span<int32_t> interleaved )
+{
+  const size_t count = min( interleaved.size() / 2, min( ch1.size(), ch2.size() ) );
+  kernels().float_to_s32( ch1.data(), ch2.data(), interleaved.mutable_data(), count );
+}
+
+bool s32_to_float_strided( const span_view<int32_t> interleaved,
+                           const size_t stride,
+                           const size_t channel,
+                           span<float> samples )
+{
+  const size_t count = min( interleaved.size() / stride, samples.size() );
+  int32_t low_bits = 0;
+  for ( size_t i = 0; i < count; i++ ) {
+    const int32_t sample = interleaved[stride * i + channel];
+    low_bits |= sample;
+    samples[i] = sample / S32_SCALE;
+  }
+  return not( low_bits & 0xff );
+}
+
+void float_to_s32_strided( const span_view<float> samples,
+                           const size_t stride,
+                           const size_t channel,
+                           span<int32_t> interleaved )
+{
+  const size_t count = min( interleaved.size() / stride, samples.size() );
+  for ( size_t i = 0; i < count; i++ ) {
+    interleaved[stride * i + channel] = lrint( clamp( samples[i], -1.0f, S32_MAX_FLOAT ) * S32_SCALE );
+  }
+}
+
+const char* mix_kernels_name()
+{
+  return kernels().name;
+}
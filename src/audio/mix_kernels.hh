@@ -0,0 +1,41 @@
+#pragma once
+
+#include "spans.hh"
+
+/* Block kernels for mixing, metering and sample conversion. The implementation (AVX2, SSE or plain C++)
+   is picked once, at startup, according to what the CPU supports. Each kernel works on
+   the length of the shortest span it is given. */
+
+/* target1 += gain1 * source, target2 += gain2 * source */
+void mix_accumulate( const span_view<float> source,
+                     const float gain1,
+                     const float gain2,
+                     span<float> target1,
+                     span<float> target2 );
+
+/* sum of samples^2 */
+float sum_of_squares( const span_view<float> samples );
+
+/* max |sample| */
+float peak_amplitude( const span_view<float> samples );
+
+/* Interleaved stereo S32 (the top 24 bits significant) to planar float in [-1, 1). Returns false if any sample
+   has its low 8 bits set. */
+bool s32_to_float( const span_view<int32_t> interleaved, span<float> ch1, span<float> ch2 );
+
+/* planar float to interleaved stereo S32, clamped to [-1, 1] and rounded to nearest */
+void float_to_s32( const span_view<float> ch1, const span_view<float> ch2, span<int32_t> interleaved );
+
+/* The same for one channel of an interface with any number of channels (`stride` of them, interleaved). These
+   don't vary with the CPU; the stereo kernels above are the fast path. */
+bool s32_to_float_strided( const span_view<int32_t> interleaved,
+                           const size_t stride,
+                           const size_t channel,
+                           span<float> samples );
+void float_to_s32_strided( const span_view<float> samples,
+                           const size_t stride,
+                           const size_t channel,
+                           span<int32_t> interleaved );
+
+/* name of the implementation in use ("avx2", "sse" or "scalar") */
+const char* mix_kernels_name();
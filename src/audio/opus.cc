@@ -1,3 +1,4 @@
+#include <cstring>
 #include <iostream>
 #include <opus/opus.h>
 
@@ -53,6 +54,11 @@ OpusEncoder::OpusEncoder( const int bit_rate, const int sample_rate, const int c
   */
 }
 
+void OpusEncoder::set_expected_loss( const int percent )
+{
+  opus_check( opus_encoder_ctl( encoder_.get(), OPUS_SET_PACKET_LOSS_PERC( percent ) ) );
+}
+
 void OpusEncoder::encode( const span_view<float> samples, opus_frame& encoded_output )
 {
   if ( channels_ != 1 ) {
@@ -200,3 +206,120 @@ void OpusDecoder::decode_missing_stereo( span<float> ch1, span<float> ch2 )
     tie( ch1[i], ch2[i] ) = interleave_buffer[i];
   }
 }
+
+void OpusDecoder::copy_state_from( const OpusDecoder& other )
+{
+  if ( channels_ != other.channels_ ) {
+    throw runtime_error( "can't copy state between decoders with different numbers of channels" );
+  }
+
+  memcpy( static_cast<void*>( decoder_.get() ),
+          static_cast<const void*>( other.decoder_.get() ),
+          opus_check( opus_decoder_get_size( channels_ ) ) );
+}
+
+/* one stream per channel, channel i in stream i */
+static array<unsigned char, opus_multistream_frame::MAX_CHANNELS> identity_mapping( const int channels )
+{
+  if ( channels < 1 or channels > int( opus_multistream_frame::MAX_CHANNELS ) ) {
+    throw runtime_error( "unsupported multistream channel count: " + to_string( channels ) );
+  }
+
+  array<unsigned char, opus_multistream_frame::MAX_CHANNELS> mapping {};
+  for ( int i = 0; i < channels; i++ ) {
+    mapping[i] = i;
+  }
+  return mapping;
+}
+
+void OpusMSEncoder::encoder_deleter::operator()( OpusMSEncoder* x ) const
+{
+  opus_multistream_encoder_destroy( x );
+}
+
+OpusMSEncoder::OpusMSEncoder( const int bit_rate, const int sample_rate, const int channels, const int application )
+  : channels_( channels )
+{
+  int out;
+
+  /* create encoder */
+  const auto mapping = identity_mapping( channels );
+  encoder_.reset( notnull(
+    "opus_multistream_encoder_create",
+    opus_multistream_encoder_create( sample_rate, channels, channels, 0, mapping.data(), application, &out ) ) );
+  opus_check( out );
+
+  /* set bit rate (for all the streams together) */
+  opus_check( opus_multistream_encoder_ctl( encoder_.get(), OPUS_SET_BITRATE( bit_rate ) ) );
+
+  /* check sample rate */
+  opus_check( opus_multistream_encoder_ctl( encoder_.get(), OPUS_GET_SAMPLE_RATE( &out ) ) );
+  if ( out != sample_rate ) {
+    throw runtime_error( "sample rate mismatch" );
+  }
+}
+
+void OpusMSEncoder::set_expected_loss( const int percent )
+{
+  opus_check( opus_multistream_encoder_ctl( encoder_.get(), OPUS_SET_PACKET_LOSS_PERC( percent ) ) );
+}
+
+void OpusMSEncoder::encode( const span_view<float> interleaved, opus_multistream_frame& encoded_output )
+{
+  if ( interleaved.size() != channels_ * opus_multistream_frame::NUM_SAMPLES ) {
+    throw runtime_error( "OpusMSEncoder::encode: wrong number of samples" );
+  }
+
+  encoded_output.resize( opus_check( opus_multistream_encode_float( encoder_.get(),
+                                                                    interleaved.data(),
+                                                                    opus_multistream_frame::NUM_SAMPLES,
+                                                                    encoded_output.mutable_unsigned_data_ptr(),
+                                                                    encoded_output.capacity() ) ) );
+}
+
+void OpusMSDecoder::decoder_deleter::operator()( OpusMSDecoder* x ) const
+{
+  opus_multistream_decoder_destroy( x );
+}
+
+OpusMSDecoder::OpusMSDecoder( const int sample_rate, const int channels )
+  : decoder_()
+  , channels_( channels )
+{
+  int out;
+  const auto mapping = identity_mapping( channels );
+  decoder_.reset(
+    notnull( "opus_multistream_decoder_create",
+             opus_multistream_decoder_create( sample_rate, channels, channels, 0, mapping.data(), &out ) ) );
+  opus_check( out );
+}
+
+void OpusMSDecoder::decode( const opus_multistream_frame* encoded_input, span<float> interleaved )
+{
+  if ( interleaved.size() != channels_ * opus_multistream_frame::NUM_SAMPLES ) {
+    throw runtime_error( "OpusMSDecoder::decode: wrong number of samples" );
+  }
+
+  const size_t samples_written
+    = opus_check( opus_multistream_decode_float( decoder_.get(),
+                                                 encoded_input ? encoded_input->unsigned_data_ptr() : nullptr,
+                                                 encoded_input ? encoded_input->length() : 0,
+                                                 interleaved.mutable_data(),
+                                                 opus_multistream_frame::NUM_SAMPLES,
+                                                 0 ) );
+
+  if ( samples_written != opus_multistream_frame::NUM_SAMPLES ) {
+    throw runtime_error( "invalid count from opus_multistream_decode_float: " + to_string( samples_written ) );
+  }
+}
+
+void OpusMSDecoder::copy_state_from( const OpusMSDecoder& other )
+{
+  if ( channels_ != other.channels_ ) {
+    throw runtime_error( "can't copy state between decoders with different numbers of channels" );
+  }
+
+  memcpy( static_cast<void*>( decoder_.get() ),
+          static_cast<const void*>( other.decoder_.get() ),
+          opus_check( opus_multistream_decoder_get_size( channels_, 0 ) ) );
+}
@@ -2,6 +2,7 @@
 
 #include <memory>
 #include <opus/opus.h>
+#include <opus/opus_multistream.h>
 
 #include "stackbuffer.hh"
 
@@ -19,6 +20,16 @@ public:
   static constexpr unsigned int NUM_SAMPLES = 480; /* 10 ms at 48 kHz */
 };
 
+/* Several channels in one packet, as long as two opus_frames (which is how it travels in an AudioFrame): 2x60 =
+   120 bytes per 2.5 ms, or 384 kbps in all. With 8 channels that leaves each stream 15 bytes (48 kbps), less the
+   length prefix of every stream but the last. */
+class opus_multistream_frame : public StackBuffer<0, uint8_t, 120>
+{
+public:
+  static constexpr unsigned int NUM_SAMPLES = opus_frame::NUM_SAMPLES;
+  static constexpr unsigned int MAX_CHANNELS = 8;
+};
+
 class OpusEncoder
 {
   struct encoder_deleter
@@ -33,6 +44,8 @@ public:
   OpusEncoder( const int bit_rate, const int sample_rate, const int channels, const int application );
   void encode( const span_view<float> samples, opus_frame& encoded_output );
 
+  void set_expected_loss( const int percent );
+
   template<class OpusFrameType>
   void encode_stereo( const span_view<float> ch1, const span_view<float> ch2, OpusFrameType& encoded_output );
 };
@@ -53,4 +66,50 @@ public:
   void decode_stereo( const opus_frame& encoded_input, span<float> ch1, span<float> ch2 );
   void decode_missing( span<float> samples );
   void decode_missing_stereo( span<float> ch1, span<float> ch2 );
+
+  /* make this decoder continue from where `other` is (the decoder state is one flat allocation) */
+  void copy_state_from( const OpusDecoder& other );
+};
+
+/* each channel its own (uncoupled) stream, so independent sources stay independent */
+class OpusMSEncoder
+{
+  struct encoder_deleter
+  {
+    void operator()( OpusMSEncoder* x ) const;
+  };
+
+  std::unique_ptr<OpusMSEncoder, encoder_deleter> encoder_ {};
+  uint8_t channels_;
+
+public:
+  OpusMSEncoder( const int bit_rate, const int sample_rate, const int channels, const int application );
+
+  /* `interleaved` holds NUM_SAMPLES frames of all the channels */
+  void encode( const span_view<float> interleaved, opus_multistream_frame& encoded_output );
+
+  void set_expected_loss( const int percent );
+
+  uint8_t channels() const { return channels_; }
+};
+
+class OpusMSDecoder
+{
+  struct decoder_deleter
+  {
+    void operator()( OpusMSDecoder* x ) const;
+  };
+
+  std::unique_ptr<OpusMSDecoder, decoder_deleter> decoder_;
+  uint8_t channels_;
+
+public:
+  OpusMSDecoder( const int sample_rate, const int channels );
+
+  /* into NUM_SAMPLES interleaved frames; without input, conceal a lost packet */
+  void decode( const opus_multistream_frame* encoded_input, span<float> interleaved );
+
+  void copy_state_from( const OpusMSDecoder& other );
+
+  uint8_t channels() const { return channels_; }
 };
@@ -0,0 +1,214 @@
+#include <cmath>
+
+#include "mix_kernels.hh"
+#include "timer.hh"
+#include "virtual_device.hh"
+
+using namespace std;
+
+static constexpr size_t MAX_BLOCK = 1024;
+
+VirtualAudioPair::VirtualAudioPair( const Options& options )
+  : options_( options )
+{
+  if ( options_.period_size < 1 ) {
+    throw runtime_error( "virtual audio period must be at least one frame" );
+  }
+
+  config_.period_size = options_.period_size;
+  config_.buffer_size = max( config_.buffer_size, 4 * options_.period_size );
+  config_.capture_channels = options_.capture_channels;
+  config_.playback_channels = options_.playback_channels;
+
+  ch1_.resize( MAX_BLOCK );
+  ch2_.resize( MAX_BLOCK );
+  captured_.resize( config_.capture_channels * MAX_BLOCK );
+  played_.resize( config_.playback_channels * MAX_BLOCK );
+
+  if ( options_.source == Options::Source::WavFile ) {
+    source_file_.emplace( options_.source_path );
+    if ( source_file_->error() ) {
+      throw runtime_error( options_.source_path + ": " + source_file_->strError() );
+    }
+    if ( source_file_->channels() < 1 or source_file_->channels() > 2 ) {
+      throw runtime_error( options_.source_path + ": only mono and stereo files are supported" );
+    }
+    if ( source_file_->samplerate() != int( config_.sample_rate ) ) {
+      throw runtime_error( options_.source_path + ": sample rate must be " + to_string( config_.sample_rate ) );
+    }
+    if ( source_file_->frames() < 1 ) {
+      throw runtime_error( options_.source_path + ": file has no audio" );
+    }
+  }
+
+  if ( not options_.sink_path.empty() ) {
+    sink_file_.emplace( options_.sink_path,
+                        SFM_WRITE,
+                        SF_FORMAT_WAV | SF_FORMAT_FLOAT,
+                        config_.playback_channels,
+                        config_.sample_rate );
+    if ( sink_file_->error() ) {
+      throw runtime_error( options_.sink_path + ": " + sink_file_->strError() );
+    }
+    sink_buffer_.resize( played_.size() );
+  }
+}
+
+uint64_t VirtualAudioPair::nominal_time( const size_t sample ) const
+{
+  return clock_origin_ns_ + ( sample - clock_origin_sample_ ) * 1'000'000'000 / config_.sample_rate;
+}
+
+void VirtualAudioPair::schedule_next_delivery()
+{
+  next_delivery_ns_ = nominal_time( delivered_ + config_.period_size );
+  if ( options_.jitter_ns ) {
+    next_delivery_ns_ += uniform_int_distribution<uint64_t> { 0, options_.jitter_ns }( rng_ );
+  }
+}
+
+void VirtualAudioPair::restart_clock()
+{
+  clock_origin_ns_ = Timer::timestamp_ns();
+  clock_origin_sample_ = delivered_ = cursor_;
+  schedule_next_delivery();
+  timer_.set_deadline( next_delivery_ns_ );
+}
+
+void VirtualAudioPair::start()
+{
+  started_ = true;
+  restart_clock();
+}
+
+void VirtualAudioPair::recover()
+{
+  statistics_.recoveries++;
+  statistics_.last_recovery = cursor();
+
+  /* like a sound card after an overrun, start again from the next sample, losing what was in the buffer */
+  restart_clock();
+}
+
+bool VirtualAudioPair::mic_has_samples()
+{
+  return started_ and Timer::timestamp_ns() >= next_delivery_ns_;
+}
+
+void VirtualAudioPair::loopback( ChannelSet& capture_output, const ChannelPair& playback_input )
+{
+  statistics_.total_wakeups++;
+  timer_.acknowledge();
+
+  const uint64_t now = Timer::timestamp_ns();
+  if ( not started_ or now < next_delivery_ns_ ) {
+    statistics_.empty_wakeups++;
+    return;
+  }
+
+  /* every period whose delivery time has passed */
+  statistics_.service_latency.log( now - next_delivery_ns_ );
+  while ( now >= next_delivery_ns_ ) {
+    delivered_ += config_.period_size;
+    schedule_next_delivery();
+  }
+  timer_.set_deadline( next_delivery_ns_ );
+
+  const size_t avail = delivered_ - cursor_;
+  statistics_.max_microphone_avail = max( statistics_.max_microphone_avail, (unsigned int)avail );
+
+  if ( avail > config_.buffer_size ) {
+    recover();
+    return;
+  }
+
+  for ( size_t done = 0; done < avail; ) {
+    const size_t count = min( MAX_BLOCK, avail - done );
+    span<float> ch1 { ch1_.data(), count }, ch2 { ch2_.data(), count };
+    span<int32_t> captured { captured_.data(), config_.capture_channels * count };
+    span<int32_t> played { played_.data(), config_.playback_channels * count };
+
+    /* every channel hears the source (alternating between its channels); the ALSA path expects 24-bit samples in
+       the top of each int32 */
+    generate( cursor_, ch1, ch2 );
+    for ( size_t c = 0; c < config_.capture_channels; c++ ) {
+      float_to_s32_strided( c % 2 ? ch2 : ch1, config_.capture_channels, c, captured );
+    }
+    for ( auto& sample : captured ) {
+      sample &= ~0xff;
+    }
+
+    AudioInterface::loopback(
+      captured, played, cursor_, capture_output, playback_input, config_, statistics_.sample_stats );
+    write_to_sink( played );
+
+    cursor_ += count;
+    done += count;
+  }
+}
+
+void VirtualAudioPair::generate( const size_t first_sample, span<float> ch1, span<float> ch2 )
+{
+  switch ( options_.source ) {
+    case Options::Source::Silence:
+      fill( ch1.begin(), ch1.end(), 0 );
+      break;
+
+    case Options::Source::Tone:
+      for ( size_t i = 0; i < ch1.size(); i++ ) {
+        const double t = double( first_sample + i ) / config_.sample_rate;
+        ch1[i] = options_.amplitude * sin( 2 * M_PI * options_.frequency * t );
+      }
+      break;
+
+    case Options::Source::Clicks:
+      for ( size_t i = 0; i < ch1.size(); i++ ) {
+        const bool click = ( first_sample + i ) % config_.sample_rate < config_.sample_rate / 1000;
+        ch1[i] = click ? options_.amplitude : 0;
+      }
+      break;
+
+    case Options::Source::WavFile: {
+      const size_t channels = source_file_->channels();
+      array<float, 2 * MAX_BLOCK> interleaved {};
+      bool rewound = false;
+      for ( size_t done = 0; done < ch1.size(); ) {
+        const sf_count_t got = source_file_->readf( interleaved.data(), ch1.size() - done );
+        if ( got <= 0 ) {
+          if ( rewound ) {
+            throw runtime_error( options_.source_path + ": no audio after rewinding" );
+          }
+          source_file_->seek( 0, SEEK_SET );
+          rewound = true;
+          continue;
+        }
+        rewound = false;
+        for ( sf_count_t i = 0; i < got; i++ ) {
+          ch1[done + i] = interleaved[channels * i];
+          ch2[done + i] = interleaved[channels * i + channels - 1];
+        }
+        done += got;
+      }
+      return;
+    }
+  }
+
+  ch2.copy( ch1 );
+}
+
+void VirtualAudioPair::write_to_sink( const span_view<int32_t> played )
+{
+  if ( not sink_file_.has_value() ) {
+    return;
+  }
+
+  constexpr float maxval = uint64_t( 1 ) << 31;
+  for ( size_t i = 0; i < played.size(); i++ ) {
+    sink_buffer_[i] = played[i] / maxval;
+  }
+
+  const sf_count_t frames = played.size() / config_.playback_channels;
+  if ( sink_file_->writef( sink_buffer_.data(), frames ) != frames ) {
+    throw runtime_error( options_.sink_path + ": short write" );
+  }
+}
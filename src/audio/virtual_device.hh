@@ -0,0 +1,79 @@
+#pragma once
+
+#include <optional>
+#include <random>
+#include <sndfile.hh>
+#include <string>
+#include <vector>
+
+#include "alsa_devices.hh"
+#include "timerfd.hh"
+
+/* A stand-in for an AudioPair without a sound card. A timerfd plays the part of the sample clock, delivering a
+   period of capture at a time (each up to `jitter_ns` late); the microphone hears a synthetic source, and what
+   would have gone to the headphones goes to a WAV file or nowhere. Falling more than a buffer behind counts as
+   an overrun, and the device recovers the way a real one would. */
+class VirtualAudioPair : public AudioDevice
+{
+public:
+  struct Options
+  {
+    enum class Source : uint8_t
+    {
+      Silence,
+      Tone,
+      Clicks, /* a 1 ms click at the start of every second, to measure end-to-end latency */
+      WavFile /* looped; mono files play on both channels */
+    } source { Source::Tone };
+
+    float frequency { 440 };
+    float amplitude { 0.1 };
+    std::string source_path {};
+
+    std::string sink_path {}; /* if set, the headphone output is written here */
+
+    unsigned int capture_channels { 2 }, playback_channels { 2 };
+
+    unsigned int period_size { 12 };
+    uint64_t jitter_ns {};
+  };
+
+private:
+  Options options_;
+  TimerFD timer_ {};
+
+  std::optional<SndfileHandle> source_file_ {}, sink_file_ {};
+  std::default_random_engine rng_ { std::random_device {}() };
+
+  /* the sample clock: sample `clock_origin_sample_` was captured at `clock_origin_ns_` */
+  uint64_t clock_origin_ns_ {};
+  size_t clock_origin_sample_ {};
+  bool started_ {};
+
+  size_t delivered_ {}; /* frames the "hardware" has captured */
+  uint64_t next_delivery_ns_ {};
+  size_t cursor_ {};
+
+  std::vector<float> ch1_ {}, ch2_ {}, sink_buffer_ {};
+  std::vector<int32_t> captured_ {}, played_ {};
+
+  uint64_t nominal_time( const size_t sample ) const;
+  void schedule_next_delivery();
+  void restart_clock();
+
+  void generate( const size_t first_sample, span<float> ch1, span<float> ch2 );
+  void write_to_sink( const span_view<int32_t> played );
+
+public:
+  explicit VirtualAudioPair( const Options& options );
+
+  void initialize() override {}
+  void start() override;
+  void recover() override;
+
+  void loopback( ChannelSet& capture_output, const ChannelPair& playback_input ) override;
+  bool mic_has_samples() override;
+
+  FileDescriptor& fd() override { return timer_; }
+  size_t cursor() const override { return cursor_; }
+};
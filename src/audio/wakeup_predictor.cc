@@ -0,0 +1,53 @@
+#include <algorithm>
+
+#include "wakeup_predictor.hh"
+
+using namespace std;
+
+static constexpr uint64_t RATE_WINDOW = 100'000'000; /* ns */
+static constexpr double RATE_ALPHA = 0.1;
+static constexpr double MAX_DRIFT = 0.01;
+static constexpr unsigned int MAX_MARGIN = 4; /* in units of avail_minimum */
+
+WakeupPredictor::WakeupPredictor( const unsigned int sample_rate, const unsigned int avail_minimum )
+  : nominal_ns_per_sample_( 1e9 / sample_rate )
+  , ns_per_sample_( nominal_ns_per_sample_ )
+  , avail_minimum_( max( 1U, avail_minimum ) )
+{}
+
+void WakeupPredictor::reset( const uint64_t now )
+{
+  started_ = false;
+  margin_ns_ = 0;
+  next_wakeup_ = now + avail_minimum_ * ns_per_sample_;
+}
+
+void WakeupPredictor::serviced( const size_t cursor, const bool empty, const uint64_t now )
+{
+  if ( empty ) {
+    /* too early (perhaps the device delivers in bigger chunks): try again a little later, and be later next time */
+    const double chunk = avail_minimum_ * ns_per_sample_;
+    margin_ns_ = min( margin_ns_ + chunk / 2, MAX_MARGIN * chunk );
+    next_wakeup_ = now + max( ns_per_sample_, avail_minimum_ * ns_per_sample_ / 4 );
+    return;
+  }
+
+  /* measure the device's actual sample rate (within reason) over windows of about 100 ms */
+  if ( not started_ ) {
+    started_ = true;
+    window_cursor_ = cursor;
+    window_start_ = now;
+  } else if ( now - window_start_ >= RATE_WINDOW and cursor > window_cursor_ ) {
+    const double measured = double( now - window_start_ ) / ( cursor - window_cursor_ );
+    ns_per_sample_ = ( 1 - RATE_ALPHA ) * ns_per_sample_ + RATE_ALPHA * measured;
+    ns_per_sample_ = clamp( ns_per_sample_,
+                            nominal_ns_per_sample_ * ( 1 - MAX_DRIFT ),
+                            nominal_ns_per_sample_ * ( 1 + MAX_DRIFT ) );
+    window_cursor_ = cursor;
+    window_start_ = now;
+  }
+
+  /* everything before the cursor has been captured, so the next `avail_minimum` frames are still to come */
+  margin_ns_ -= margin_ns_ / 64;
+  next_wakeup_ = now + avail_minimum_ * ns_per_sample_ + margin_ns_;
+}
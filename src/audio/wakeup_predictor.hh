@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+/* Predicts when a capture device will next have `avail_minimum` frames ready, from the rate at which it has
+   actually been delivering them, so it can be serviced from a timer instead of being polled. */
+class WakeupPredictor
+{
+  double nominal_ns_per_sample_, ns_per_sample_;
+  unsigned int avail_minimum_;
+
+  /* for measuring the rate: where the cursor was at the start of the current window */
+  size_t window_cursor_ {};
+  uint64_t window_start_ {};
+  bool started_ {};
+
+  /* how much later than the estimated rate the frames have been turning up */
+  double margin_ns_ {};
+
+  uint64_t next_wakeup_ { std::numeric_limits<uint64_t>::max() };
+
+public:
+  WakeupPredictor( const unsigned int sample_rate, const unsigned int avail_minimum );
+
+  /* the device was just serviced, and had captured everything before `cursor` */
+  void serviced( const size_t cursor, const bool empty, const uint64_t now );
+
+  /* forget the phase (e.g. after the device was restarted) */
+  void reset( const uint64_t now );
+
+  uint64_t next_wakeup() const { return next_wakeup_; }
+  double measured_rate() const { return 1e9 / ns_per_sample_; }
+  double margin_ns() const { return margin_ns_; }
+};
@@ -225,3 +225,81 @@ struct atomic_scene_update : public control_message<7>
     p.object( insertions );
   }
 };
+
+/* an empty bus_name takes the channel off its bus */
+struct set_bus : public control_message<8>
+{
+  NetString board_name {}, channel_name {}, bus_name {};
+
+  uint32_t serialized_length() const
+  {
+    return board_name.serialized_length() + channel_name.serialized_length() + bus_name.serialized_length();
+  }
+  void serialize( Serializer& s ) const
+  {
+    s.object( board_name );
+    s.object( channel_name );
+    s.object( bus_name );
+  }
+  void parse( Parser& p )
+  {
+    p.object( board_name );
+    p.object( channel_name );
+    p.object( bus_name );
+  }
+};
+
+struct set_bus_gain : public control_message<9>
+{
+  NetString board_name {}, bus_name {};
+  float gain1 {}, gain2 {};
+
+  uint32_t serialized_length() const
+  {
+    return board_name.serialized_length() + bus_name.serialized_length() + sizeof( gain1 ) + sizeof( gain2 );
+  }
+  void serialize( Serializer& s ) const
+  {
+    s.object( board_name );
+    s.object( bus_name );
+    s.floating( gain1 );
+    s.floating( gain2 );
+  }
+  void parse( Parser& p )
+  {
+    p.object( board_name );
+    p.object( bus_name );
+    p.floating( gain1 );
+    p.floating( gain2 );
+  }
+};
+
+/* one listener's own gain for a bus on their board; with follow_board set, they hear the board's bus gain again */
+struct set_client_bus_gain : public control_message<10>
+{
+  NetString client_name {}, bus_name {};
+  uint8_t follow_board {};
+  float gain1 {}, gain2 {};
+
+  uint32_t serialized_length() const
+  {
+    return client_name.serialized_length() + bus_name.serialized_length() + sizeof( follow_board )
+           + sizeof( gain1 ) + sizeof( gain2 );
+  }
+  void serialize( Serializer& s ) const
+  {
+    s.object( client_name );
+    s.object( bus_name );
+    s.integer( follow_board );
+    s.floating( gain1 );
+    s.floating( gain2 );
+  }
+  void parse( Parser& p )
+  {
+    p.object( client_name );
+    p.object( bus_name );
+    p.integer( follow_board );
+    p.floating( gain1 );
+    p.floating( gain2 );
+  }
+};
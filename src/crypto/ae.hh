@@ -172,6 +172,32 @@ extern "C"
    *
    * ----------------------------------------------------------------------- */
 
+  typedef struct
+  {
+    ae_ctx* ctx;
+    const void* nonce;
+    const void* in; /* plaintext, or ciphertext with its tag bundled */
+    int in_len;
+    const void* ad;
+    int ad_len;
+    void* out; /* receives the ciphertext and tag, or the plaintext */
+    int result;
+  } ae_msg;
+
+  void ae_encrypt_batch( ae_msg* msgs, int n );
+  void ae_decrypt_batch( ae_msg* msgs, int n );
+  /* --------------------------------------------------------------------------
+   *
+   * Encrypt or decrypt several whole messages, interleaving their AES rounds.
+   *
+   * Each message is processed as by ae_encrypt() or ae_decrypt() with a NULL
+   * tag and final = AE_FINALIZE, and its result is what that call would have
+   * returned. The messages may be under different contexts, or the same one
+   * more than once, but their buffers must not overlap (except in==out). A
+   * ciphertext shorter than a tag is AE_INVALID.
+   *
+   * ----------------------------------------------------------------------- */
+
 #ifdef __cplusplus
 } /* closing brace for extern "C" */
 #endif
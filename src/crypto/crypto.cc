@@ -5,6 +5,7 @@
 #include <cstring>
 #include <iostream>
 #include <limits>
+#include <optional>
 #include <unistd.h>
 
 using namespace std;
@@ -81,7 +82,25 @@ CryptoSession::CryptoSession( CryptoSession&& other )
 void CryptoSession::encrypt( const string_view associated_data, const Plaintext& plaintext, Ciphertext& ciphertext )
 {
   plaintext.validate();
+  encrypt( associated_data, plaintext.data_ptr(), plaintext.length(), ciphertext );
+}
 
+void CryptoSession::encrypt_in_place( const string_view associated_data,
+                                      const uint16_t plaintext_length,
+                                      Ciphertext& ciphertext )
+{
+  if ( plaintext_length > Plaintext::capacity() ) {
+    throw runtime_error( "plaintext too long to encrypt" );
+  }
+
+  /* OCB allows the plaintext and ciphertext to be the same */
+  encrypt( associated_data, ciphertext.data_ptr(), plaintext_length, ciphertext );
+}
+
+Nonce CryptoSession::start_message( const string_view associated_data,
+                                   const uint16_t plaintext_length,
+                                   Ciphertext& ciphertext )
+{
   if ( randomize_nonce_ ) {
     set_random_nonce();
   } else {
@@ -90,7 +109,7 @@ void CryptoSession::encrypt( const string_view associated_data, const Plaintext&
 
   Nonce nonce { nonce_val_ };
 
-  const int ciphertext_len = plaintext.length() + TAG_LEN;
+  const int ciphertext_len = plaintext_length + TAG_LEN;
 
   ciphertext.resize( ciphertext_len + Nonce::SERIALIZED_LEN + associated_data.size() );
 
@@ -99,11 +118,35 @@ void CryptoSession::encrypt( const string_view associated_data, const Plaintext&
           associated_data.data(),
           associated_data.size() );
 
-  if ( ciphertext_len
+  return nonce;
+}
+
+void CryptoSession::count_blocks( const uint16_t plaintext_length )
+{
+  /* track use of key per RFC 7253 */
+  blocks_encrypted_ += plaintext_length >> 4;
+  if ( plaintext_length & 0xF ) {
+    /* partial block */
+    blocks_encrypted_++;
+  }
+
+  if ( blocks_encrypted_ >> 47 ) {
+    throw runtime_error( "encrypted 2^47 blocks" );
+  }
+}
+
+void CryptoSession::encrypt( const string_view associated_data,
+                             const char* plaintext,
+                             const uint16_t plaintext_length,
+                             Ciphertext& ciphertext )
+{
+  const Nonce nonce = start_message( associated_data, plaintext_length, ciphertext );
+
+  if ( plaintext_length + TAG_LEN
        != ae_encrypt( encrypt_context_.get(),        /* ctx */
                       nonce.data().data(),           /* nonce */
-                      plaintext.data_ptr(),          /* pt */
-                      plaintext.length(),            /* pt_len */
+                      plaintext,                     /* pt */
+                      plaintext_length,              /* pt_len */
                       associated_data.data(),        /* ad */
                       associated_data.size(),        /* ad_len */
                       ciphertext.mutable_data_ptr(), /* ct */
@@ -112,15 +155,67 @@ void CryptoSession::encrypt( const string_view associated_data, const Plaintext&
     throw runtime_error( "ae_encrypt() returned error" );
   }
 
-  /* track use of key per RFC 7253 */
-  blocks_encrypted_ += plaintext.length() >> 4;
-  if ( plaintext.length() & 0xF ) {
-    /* partial block */
-    blocks_encrypted_++;
+  count_blocks( plaintext_length );
+}
+
+void CryptoSession::encrypt_batch( const span_view<EncryptRequest> requests )
+{
+  for ( size_t first = 0; first < requests.size(); first += BATCH_SIZE ) {
+    const size_t count = min( BATCH_SIZE, requests.size() - first );
+    array<optional<Nonce>, BATCH_SIZE> nonces;
+    array<ae_msg, BATCH_SIZE> messages;
+
+    for ( size_t i = 0; i < count; i++ ) {
+      const EncryptRequest& request = requests[first + i];
+      if ( request.plaintext_length > Plaintext::capacity() ) {
+        throw runtime_error( "plaintext too long to encrypt" );
+      }
+
+      nonces[i].emplace(
+        request.session->start_message( request.associated_data, request.plaintext_length, *request.ciphertext ) );
+      messages[i] = { request.session->encrypt_context_.get(),
+                      nonces[i]->data().data(),
+                      request.ciphertext->data_ptr(), /* encrypted in place */
+                      request.plaintext_length,
+                      request.associated_data.data(),
+                      int( request.associated_data.size() ),
+                      request.ciphertext->mutable_data_ptr(),
+                      0 };
+    }
+
+    ae_encrypt_batch( messages.data(), count );
+
+    for ( size_t i = 0; i < count; i++ ) {
+      const EncryptRequest& request = requests[first + i];
+      if ( messages[i].result != request.plaintext_length + TAG_LEN ) {
+        throw runtime_error( "ae_encrypt_batch() returned error" );
+      }
+      request.session->count_blocks( request.plaintext_length );
+    }
   }
+}
 
-  if ( blocks_encrypted_ >> 47 ) {
-    throw runtime_error( "encrypted 2^47 blocks" );
+/* length of the ciphertext and tag, or -1 if there isn't room for them with the nonce and associated data */
+static int body_length( const Ciphertext& ciphertext, const string_view associated_data )
+{
+  ciphertext.validate();
+
+  if ( ciphertext.length() < CryptoSession::TAG_LEN + Nonce::SERIALIZED_LEN + associated_data.size() ) {
+    return -1;
+  }
+
+  return ciphertext.length() - Nonce::SERIALIZED_LEN - associated_data.size();
+}
+
+static void check_associated_data( const Ciphertext& ciphertext,
+                                   const int body_len,
+                                   const string_view expected_associated_data )
+{
+  const string_view actual_associated_data { static_cast<string_view>( ciphertext )
+                                               .substr( body_len + Nonce::SERIALIZED_LEN,
+                                                        expected_associated_data.size() ) };
+  if ( actual_associated_data != expected_associated_data ) {
+    throw runtime_error( "associated data mismatch" );
   }
 }
 
@@ -128,14 +223,11 @@ bool CryptoSession::decrypt( const Ciphertext& ciphertext,
                              const string_view expected_associated_data,
                              Plaintext& plaintext ) const
 {
-  ciphertext.validate();
-
-  if ( ciphertext.length() < TAG_LEN + Nonce::SERIALIZED_LEN + expected_associated_data.size() ) {
+  const int body_len = body_length( ciphertext, expected_associated_data );
+  if ( body_len < 0 ) {
     return false;
   }
 
-  const int body_len = ciphertext.length() - Nonce::SERIALIZED_LEN - expected_associated_data.size();
-
   const int pt_len = body_len - TAG_LEN;
   plaintext.resize( pt_len );
 
@@ -154,12 +246,57 @@ bool CryptoSession::decrypt( const Ciphertext& ciphertext,
     return false;
   }
 
-  const string_view actual_associated_data { static_cast<string_view>( ciphertext )
-                                               .substr( body_len + Nonce::SERIALIZED_LEN,
-                                                        expected_associated_data.size() ) };
-  if ( actual_associated_data != expected_associated_data ) {
-    throw runtime_error( "associated data mismatch" );
-  }
+  check_associated_data( ciphertext, body_len, expected_associated_data );
 
   return true;
 }
+
+void CryptoSession::decrypt_batch( span<DecryptRequest> requests )
+{
+  for ( size_t first = 0; first < requests.size(); first += BATCH_SIZE ) {
+    const size_t count = min( BATCH_SIZE, requests.size() - first );
+    array<optional<Nonce>, BATCH_SIZE> nonces;
+    array<ae_msg, BATCH_SIZE> messages;
+    array<int, BATCH_SIZE> body_lengths;
+    size_t num_messages = 0;
+
+    for ( size_t i = 0; i < count; i++ ) {
+      DecryptRequest& request = requests[first + i];
+      request.success = false;
+
+      const int body_len = body_length( *request.ciphertext, request.expected_associated_data );
+      body_lengths[i] = body_len;
+      if ( body_len < 0 ) {
+        continue;
+      }
+
+      request.plaintext->resize( body_len - TAG_LEN );
+      optional<Nonce>& nonce = nonces[num_messages];
+      nonce.emplace( static_cast<string_view>( *request.ciphertext ).substr( body_len, Nonce::SERIALIZED_LEN ) );
+      messages[num_messages++] = { request.session->decrypt_context_.get(),
+                                   nonce->data().data(),
+                                   request.ciphertext->data_ptr(),
+                                   body_len,
+                                   request.expected_associated_data.data(),
+                                   int( request.expected_associated_data.size() ),
+                                   request.plaintext->mutable_data_ptr(),
+                                   0 };
+    }
+
+    ae_decrypt_batch( messages.data(), num_messages );
+
+    for ( size_t i = 0, j = 0; i < count; i++ ) {
+      if ( body_lengths[i] < 0 ) {
+        continue;
+      }
+
+      DecryptRequest& request = requests[first + i];
+      if ( messages[j++].result != body_lengths[i] - TAG_LEN ) {
+        continue;
+      }
+
+      check_associated_data( *request.ciphertext, body_lengths[i], request.expected_associated_data );
+      request.success = true;
+    }
+  }
+}
@@ -37,6 +37,17 @@ class CryptoSession
 
   void set_random_nonce();
 
+  /* take the next nonce, and write it and the associated data where they go after the ciphertext and tag */
+  Nonce start_message( const std::string_view associated_data,
+                       const uint16_t plaintext_length,
+                       Ciphertext& ciphertext );
+  void count_blocks( const uint16_t plaintext_length );
+
+  void encrypt( const std::string_view associated_data,
+                const char* plaintext,
+                const uint16_t plaintext_length,
+                Ciphertext& ciphertext );
+
   struct ae_deleter
   {
     void operator()( ae_ctx* x ) const noexcept;
@@ -51,10 +62,41 @@ public:
 
   void encrypt( const std::string_view associated_data, const Plaintext& plaintext, Ciphertext& ciphertext );
 
+  /* encrypt the plaintext already written at the start of the ciphertext */
+  void encrypt_in_place( const std::string_view associated_data,
+                         const uint16_t plaintext_length,
+                         Ciphertext& ciphertext );
+
   bool decrypt( const Ciphertext& ciphertext,
                 const std::string_view expected_associated_data,
                 Plaintext& plaintext ) const;
 
+  /* messages whose AES rounds are interleaved at once (enough to keep the AES unit busy) */
+  static constexpr size_t BATCH_SIZE = 8;
+
+  struct EncryptRequest
+  {
+    CryptoSession* session {};
+    std::string_view associated_data {};
+    uint16_t plaintext_length {}; /* already written at the start of the ciphertext */
+    Ciphertext* ciphertext {};
+  };
+
+  /* encrypt_in_place() each message, under any mix of sessions, BATCH_SIZE at a time */
+  static void encrypt_batch( const span_view<EncryptRequest> requests );
+
+  struct DecryptRequest
+  {
+    const CryptoSession* session {};
+    const Ciphertext* ciphertext {};
+    std::string_view expected_associated_data {};
+    Plaintext* plaintext {};
+    bool success {};
+  };
+
+  /* decrypt() each message (setting its success), BATCH_SIZE at a time */
+  static void decrypt_batch( span<DecryptRequest> requests );
+
   CryptoSession( const CryptoSession& other ) = delete;
   CryptoSession& operator=( const CryptoSession& other ) = delete;
 
@@ -1394,6 +1394,401 @@ int ae_decrypt( ae_ctx* ctx,
   return ct_len;
 }
 
+/* ----------------------------------------------------------------------- */
+/* Batches of messages                                                     */
+/* ----------------------------------------------------------------------- */
+
+/* A short message leaves the AES unit mostly idle: its nonce, associated
+/  data, final partial block and tag are each a short chain of dependent
+/  rounds. These gather the blocks of several messages (under any mix of
+/  keys) and run the rounds of all of them together. Each message is
+/  processed as by a single call with a bundled tag and AE_FINALIZE; the
+/  contexts' incremental state is left alone.                              */
+
+static void encrypt_one( ae_msg* m )
+{
+  m->result = ae_encrypt( m->ctx, m->nonce, m->in, m->in_len, m->ad, m->ad_len, m->out, NULL, AE_FINALIZE );
+}
+
+static void decrypt_one( ae_msg* m )
+{
+  if ( m->in_len < OCB_TAG_LEN )
+    m->result = AE_INVALID;
+  else
+    m->result = ae_decrypt( m->ctx, m->nonce, m->in, m->in_len, m->ad, m->ad_len, m->out, NULL, AE_FINALIZE );
+}
+
+#if USE_AES_NI && ( OCB_TAG_LEN == 16 )
+
+#define BATCH_MSGS 8   /* Most messages whose blocks are gathered at once  */
+#define BATCH_BLKS 256 /* Most blocks gathered at once                     */
+
+/* As AES_ecb_encrypt_blks(), but with a key for each block; eight blocks
+/  at a time, so that their rounds stay in registers                       */
+static void AES_ecb_encrypt_blks_keys( block* blks, const AES_KEY* const* keys, unsigned nblks )
+{
+  unsigned i, j, k, m, rnds = ROUNDS( keys[0] );
+  for ( k = 0; k < nblks; k += m ) {
+    block b[8];
+    const __m128i* sched[8];
+    m = nblks - k < 8 ? nblks - k : 8;
+    for ( i = 0; i < 8; ++i ) { /* Spare lanes repeat the first block */
+      sched[i] = keys[k + ( i < m ? i : 0 )]->rd_key;
+      b[i] = _mm_xor_si128( blks[k + ( i < m ? i : 0 )], sched[i][0] );
+    }
+    for ( j = 1; j < rnds; ++j ) {
+      b[0] = _mm_aesenc_si128( b[0], sched[0][j] );
+      b[1] = _mm_aesenc_si128( b[1], sched[1][j] );
+      b[2] = _mm_aesenc_si128( b[2], sched[2][j] );
+      b[3] = _mm_aesenc_si128( b[3], sched[3][j] );
+      b[4] = _mm_aesenc_si128( b[4], sched[4][j] );
+      b[5] = _mm_aesenc_si128( b[5], sched[5][j] );
+      b[6] = _mm_aesenc_si128( b[6], sched[6][j] );
+      b[7] = _mm_aesenc_si128( b[7], sched[7][j] );
+    }
+    b[0] = _mm_aesenclast_si128( b[0], sched[0][j] );
+    b[1] = _mm_aesenclast_si128( b[1], sched[1][j] );
+    b[2] = _mm_aesenclast_si128( b[2], sched[2][j] );
+    b[3] = _mm_aesenclast_si128( b[3], sched[3][j] );
+    b[4] = _mm_aesenclast_si128( b[4], sched[4][j] );
+    b[5] = _mm_aesenclast_si128( b[5], sched[5][j] );
+    b[6] = _mm_aesenclast_si128( b[6], sched[6][j] );
+    b[7] = _mm_aesenclast_si128( b[7], sched[7][j] );
+    for ( i = 0; i < m; ++i )
+      blks[k + i] = b[i];
+  }
+}
+
+static void AES_ecb_decrypt_blks_keys( block* blks, const AES_KEY* const* keys, unsigned nblks )
+{
+  unsigned i, j, k, m, rnds = ROUNDS( keys[0] );
+  for ( k = 0; k < nblks; k += m ) {
+    block b[8];
+    const __m128i* sched[8];
+    m = nblks - k < 8 ? nblks - k : 8;
+    for ( i = 0; i < 8; ++i ) { /* Spare lanes repeat the first block */
+      sched[i] = keys[k + ( i < m ? i : 0 )]->rd_key;
+      b[i] = _mm_xor_si128( blks[k + ( i < m ? i : 0 )], sched[i][0] );
+    }
+    for ( j = 1; j < rnds; ++j ) {
+      b[0] = _mm_aesdec_si128( b[0], sched[0][j] );
+      b[1] = _mm_aesdec_si128( b[1], sched[1][j] );
+      b[2] = _mm_aesdec_si128( b[2], sched[2][j] );
+      b[3] = _mm_aesdec_si128( b[3], sched[3][j] );
+      b[4] = _mm_aesdec_si128( b[4], sched[4][j] );
+      b[5] = _mm_aesdec_si128( b[5], sched[5][j] );
+      b[6] = _mm_aesdec_si128( b[6], sched[6][j] );
+      b[7] = _mm_aesdec_si128( b[7], sched[7][j] );
+    }
+    b[0] = _mm_aesdeclast_si128( b[0], sched[0][j] );
+    b[1] = _mm_aesdeclast_si128( b[1], sched[1][j] );
+    b[2] = _mm_aesdeclast_si128( b[2], sched[2][j] );
+    b[3] = _mm_aesdeclast_si128( b[3], sched[3][j] );
+    b[4] = _mm_aesdeclast_si128( b[4], sched[4][j] );
+    b[5] = _mm_aesdeclast_si128( b[5], sched[5][j] );
+    b[6] = _mm_aesdeclast_si128( b[6], sched[6][j] );
+    b[7] = _mm_aesdeclast_si128( b[7], sched[7][j] );
+    for ( i = 0; i < m; ++i )
+      blks[k + i] = b[i];
+  }
+}
+
+/* As gen_offset_from_nonce() (on a little-endian machine, as AES-NI
+/  implies), with the cache misses encrypted together                      */
+static void gen_offsets_from_nonces( ae_msg* msgs, unsigned n, block* offsets )
+{
+  union
+  {
+    uint32_t u32[4];
+    uint8_t u8[16];
+    block bl;
+  } tmp;
+  block tops[BATCH_MSGS], ktops[BATCH_MSGS];
+  const AES_KEY* keys[BATCH_MSGS] = {};
+  unsigned idx[BATCH_MSGS], missed[BATCH_MSGS];
+  unsigned i, nmissed = 0;
+
+  for ( i = 0; i < n; i++ ) {
+    tmp.u32[0] = 0x01000000 + ( ( OCB_TAG_LEN * 8 % 128 ) << 1 );
+    memcpy( tmp.u8 + 4, msgs[i].nonce, 12 ); /* Nonces need not be aligned */
+    idx[i] = (unsigned)( tmp.u8[15] & 0x3f );
+    tmp.u8[15] = tmp.u8[15] & 0xc0;
+    if ( unequal_blocks( tmp.bl, msgs[i].ctx->cached_Top ) ) {
+      tops[nmissed] = ktops[nmissed] = tmp.bl;
+      keys[nmissed] = &msgs[i].ctx->encrypt_key;
+      missed[nmissed++] = i;
+    } else {
+      offsets[i] = gen_offset( msgs[i].ctx->KtopStr, idx[i] );
+    }
+  }
+
+  if ( nmissed )
+    AES_ecb_encrypt_blks_keys( ktops, keys, nmissed );
+
+  /* One context may appear more than once, so use each Ktop as it is cached */
+  for ( i = 0; i < nmissed; i++ ) {
+    ae_ctx* ctx = msgs[missed[i]].ctx;
+    ctx->cached_Top = tops[i];
+    memcpy( ctx->KtopStr, &ktops[i], 16 );
+    ctx->KtopStr[0] = bswap64( ctx->KtopStr[0] ); /* Make Register Correct */
+    ctx->KtopStr[1] = bswap64( ctx->KtopStr[1] );
+    ctx->KtopStr[2] = ctx->KtopStr[0] ^ ( ctx->KtopStr[0] << 8 ) ^ ( ctx->KtopStr[1] >> 56 );
+    offsets[missed[i]] = gen_offset( ctx->KtopStr, idx[missed[i]] );
+  }
+}
+
+/* Blocks that a message of text_len bytes (not counting any tag) and
+/  ad_len bytes of associated data puts through AES                        */
+static unsigned batch_blocks( int text_len, int ad_len )
+{
+  return ( text_len + 15 ) / 16 + ( ad_len + 15 ) / 16 + 1;
+}
+
+/* Queue the associated data's blocks, at ta[k] onwards, returning the new k */
+static unsigned gather_ad( ae_ctx* ctx, const void* ad, int ad_len, block* ta, const AES_KEY** keys, unsigned k )
+{
+  union
+  {
+    uint32_t u32[4];
+    uint8_t u8[16];
+    block bl;
+  } tmp;
+  const block* adp = (block*)ad;
+  block ad_offset = zero_block();
+  unsigned j, full = (unsigned)ad_len / 16, remaining = (unsigned)ad_len % 16;
+
+  for ( j = 1; j <= full; j++ ) {
+    ad_offset = xor_block( ad_offset, getL( ctx, ntz( j ) ) );
+    ta[k] = xor_block( ad_offset, adp[j - 1] );
+    keys[k++] = &ctx->encrypt_key;
+  }
+  if ( remaining ) {
+    ad_offset = xor_block( ad_offset, ctx->Lstar );
+    tmp.bl = zero_block();
+    memcpy( tmp.u8, adp + full, remaining );
+    tmp.u8[remaining] = (unsigned char)0x80u;
+    ta[k] = xor_block( ad_offset, tmp.bl );
+    keys[k++] = &ctx->encrypt_key;
+  }
+  return k;
+}
+
+static block sum_ad( int ad_len, const block* ta, unsigned* k )
+{
+  block ad_checksum = zero_block();
+  unsigned j, nblks = ( (unsigned)ad_len + 15 ) / 16;
+  for ( j = 0; j < nblks; j++ )
+    ad_checksum = xor_block( ad_checksum, ta[( *k )++] );
+  return ad_checksum;
+}
+
+static void encrypt_group( ae_msg* msgs, unsigned n )
+{
+  union
+  {
+    uint32_t u32[4];
+    uint8_t u8[16];
+    block bl;
+  } tmp;
+  block ta[BATCH_BLKS], oa[BATCH_BLKS], offsets[BATCH_MSGS];
+  const AES_KEY* keys[BATCH_BLKS] = {};
+  unsigned i, j, k = 0;
+
+  gen_offsets_from_nonces( msgs, n, offsets );
+
+  /* Each message's whole blocks, then its partial block (its padded
+  /  plaintext kept in oa[] for after), associated data and tag            */
+  for ( i = 0; i < n; i++ ) {
+    ae_ctx* ctx = msgs[i].ctx;
+    const block* ptp = (block*)msgs[i].in;
+    unsigned full = (unsigned)msgs[i].in_len / 16, remaining = (unsigned)msgs[i].in_len % 16;
+    block offset = offsets[i], checksum = zero_block();
+
+    for ( j = 1; j <= full; j++ ) {
+      offset = xor_block( offset, getL( ctx, ntz( j ) ) );
+      oa[k] = offset;
+      ta[k] = xor_block( offset, ptp[j - 1] );
+      checksum = xor_block( checksum, ptp[j - 1] );
+      keys[k++] = &ctx->encrypt_key;
+    }
+    if ( remaining ) {
+      tmp.bl = zero_block();
+      memcpy( tmp.u8, ptp + full, remaining );
+      tmp.u8[remaining] = (unsigned char)0x80u;
+      checksum = xor_block( checksum, tmp.bl );
+      oa[k] = tmp.bl;
+      ta[k] = offset = xor_block( offset, ctx->Lstar );
+      keys[k++] = &ctx->encrypt_key;
+    }
+    k = gather_ad( ctx, msgs[i].ad, msgs[i].ad_len, ta, keys, k );
+    ta[k] = xor_block( xor_block( offset, ctx->Ldollar ), checksum );
+    keys[k++] = &ctx->encrypt_key;
+  }
+
+  AES_ecb_encrypt_blks_keys( ta, keys, k );
+
+  k = 0;
+  for ( i = 0; i < n; i++ ) {
+    block* ctp = (block*)msgs[i].out;
+    unsigned full = (unsigned)msgs[i].in_len / 16, remaining = (unsigned)msgs[i].in_len % 16;
+    block ad_checksum;
+
+    for ( j = 0; j < full; j++, k++ )
+      ctp[j] = xor_block( ta[k], oa[k] );
+    if ( remaining ) {
+      tmp.bl = xor_block( ta[k], oa[k] );
+      memcpy( ctp + full, tmp.u8, remaining );
+      k++;
+    }
+    ad_checksum = sum_ad( msgs[i].ad_len, ta, &k );
+    tmp.bl = xor_block( ta[k++], ad_checksum ); /* Tag */
+    memcpy( (char*)msgs[i].out + msgs[i].in_len, tmp.u8, OCB_TAG_LEN );
+    msgs[i].result = msgs[i].in_len + OCB_TAG_LEN;
+  }
+}
+
+static void decrypt_group( ae_msg* msgs, unsigned n )
+{
+  union
+  {
+    uint32_t u32[4];
+    uint8_t u8[16];
+    block bl;
+  } tmp;
+  block da[BATCH_BLKS], oa[BATCH_BLKS], ea[BATCH_BLKS];
+  block offsets[BATCH_MSGS], ad_checksums[BATCH_MSGS], tags[BATCH_MSGS];
+  const AES_KEY *dkeys[BATCH_BLKS] = {}, *ekeys[BATCH_BLKS] = {}, *tkeys[BATCH_MSGS] = {};
+  unsigned i, j, d = 0, e = 0;
+
+  gen_offsets_from_nonces( msgs, n, offsets );
+
+  /* Whole blocks go through the decryption key; the partial block's pad
+  /  and the associated data through the encryption key                   */
+  for ( i = 0; i < n; i++ ) {
+    ae_ctx* ctx = msgs[i].ctx;
+    const block* ctp = (block*)msgs[i].in;
+    unsigned ct_len = (unsigned)( msgs[i].in_len - OCB_TAG_LEN );
+    unsigned full = ct_len / 16;
+
+    for ( j = 1; j <= full; j++ ) {
+      offsets[i] = xor_block( offsets[i], getL( ctx, ntz( j ) ) );
+      oa[d] = offsets[i];
+      da[d] = xor_block( offsets[i], ctp[j - 1] );
+      dkeys[d++] = &ctx->decrypt_key;
+    }
+    if ( ct_len % 16 ) {
+      ea[e] = offsets[i] = xor_block( offsets[i], ctx->Lstar );
+      ekeys[e++] = &ctx->encrypt_key;
+    }
+    e = gather_ad( ctx, msgs[i].ad, msgs[i].ad_len, ea, ekeys, e );
+  }
+
+  if ( d )
+    AES_ecb_decrypt_blks_keys( da, dkeys, d );
+  if ( e )
+    AES_ecb_encrypt_blks_keys( ea, ekeys, e );
+
+  /* Write out the plaintext, whose checksum goes into the tag */
+  d = e = 0;
+  for ( i = 0; i < n; i++ ) {
+    ae_ctx* ctx = msgs[i].ctx;
+    const block* ctp = (block*)msgs[i].in;
+    block* ptp = (block*)msgs[i].out;
+    unsigned ct_len = (unsigned)( msgs[i].in_len - OCB_TAG_LEN );
+    unsigned full = ct_len / 16, remaining = ct_len % 16;
+    block checksum = zero_block();
+
+    for ( j = 0; j < full; j++, d++ ) {
+      ptp[j] = xor_block( da[d], oa[d] );
+      checksum = xor_block( checksum, ptp[j] );
+    }
+    if ( remaining ) {
+      tmp.bl = ea[e];
+      memcpy( tmp.u8, ctp + full, remaining );
+      tmp.bl = xor_block( tmp.bl, ea[e++] );
+      tmp.u8[remaining] = (unsigned char)0x80u;
+      memcpy( ptp + full, tmp.u8, remaining );
+      checksum = xor_block( checksum, tmp.bl );
+    }
+    ad_checksums[i] = sum_ad( msgs[i].ad_len, ea, &e );
+    tags[i] = xor_block( xor_block( offsets[i], ctx->Ldollar ), checksum );
+    tkeys[i] = &ctx->encrypt_key;
+  }
+
+  AES_ecb_encrypt_blks_keys( tags, tkeys, n );
+
+  for ( i = 0; i < n; i++ ) {
+    int ct_len = msgs[i].in_len - OCB_TAG_LEN;
+    memcpy( tmp.u8, (const char*)msgs[i].in + ct_len, OCB_TAG_LEN );
+    if ( unequal_blocks( xor_block( tags[i], ad_checksums[i] ), tmp.bl ) )
+      msgs[i].result = AE_INVALID;
+    else
+      msgs[i].result = ct_len;
+  }
+}
+
+/* Split the messages into groups that fit, sending any too long for a
+/  group (or too short to decrypt) to single_fn                            */
+static void run_in_groups( ae_msg* msgs,
+                           int n,
+                           int tag_len,
+                           void ( *group_fn )( ae_msg*, unsigned ),
+                           void ( *single_fn )( ae_msg* ) )
+{
+  int i, first = 0;
+  unsigned blks = 0, b;
+
+  for ( i = 0; i < n; i++ ) {
+    b = ( msgs[i].in_len < tag_len || msgs[i].ad_len < 0 )
+          ? BATCH_BLKS + 1
+          : batch_blocks( msgs[i].in_len - tag_len, msgs[i].ad_len );
+    if ( b > BATCH_BLKS ) {
+      if ( first < i )
+        group_fn( msgs + first, (unsigned)( i - first ) );
+      single_fn( msgs + i );
+      first = i + 1;
+      blks = 0;
+      continue;
+    }
+    if ( i - first == BATCH_MSGS || blks + b > BATCH_BLKS ) {
+      group_fn( msgs + first, (unsigned)( i - first ) );
+      first = i;
+      blks = 0;
+    }
+    blks += b;
+  }
+  if ( first < n )
+    group_fn( msgs + first, (unsigned)( n - first ) );
+}
+
+void ae_encrypt_batch( ae_msg* msgs, int n )
+{
+  run_in_groups( msgs, n, 0, encrypt_group, encrypt_one );
+}
+
+void ae_decrypt_batch( ae_msg* msgs, int n )
+{
+  run_in_groups( msgs, n, OCB_TAG_LEN, decrypt_group, decrypt_one );
+}
+
+#else
+
+void ae_encrypt_batch( ae_msg* msgs, int n )
+{
+  int i;
+  for ( i = 0; i < n; i++ )
+    encrypt_one( msgs + i );
+}
+
+void ae_decrypt_batch( ae_msg* msgs, int n )
+{
+  int i;
+  for ( i = 0; i < n; i++ )
+    decrypt_one( msgs + i );
+}
+
+#endif
+
 /* ----------------------------------------------------------------------- */
 /* Simple test program                                                     */
 /* ----------------------------------------------------------------------- */
@@ -0,0 +1,3 @@
+#define NDBUS
+#define VIRTUAL_AUDIO
+#include "stagecast-client.cc"
@@ -17,12 +17,66 @@
 #include "audio_device_claim.hh"
 #endif /* NDBUS */
 
+#ifdef VIRTUAL_AUDIO
+#include "virtual_device.hh"
+#endif /* VIRTUAL_AUDIO */
+
 using namespace std;
 
+#ifdef VIRTUAL_AUDIO
+/* STAGECAST_VIRTUAL_SOURCE = silence | tone[:Hz] | clicks | wav:path, STAGECAST_VIRTUAL_SINK = wav:path,
+   STAGECAST_VIRTUAL_PERIOD = frames per wakeup, STAGECAST_VIRTUAL_JITTER_US = maximum lateness of a wakeup */
+static unique_ptr<AudioDevice> make_virtual_device( const AudioInterface::Configuration& audio_config )
+{
+  VirtualAudioPair::Options options;
+  options.capture_channels = audio_config.capture_channels;
+  options.playback_channels = audio_config.playback_channels;
+
+  const char* source_env = getenv( "STAGECAST_VIRTUAL_SOURCE" );
+  const string source = source_env ? source_env : "tone";
+  if ( source == "silence" ) {
+    options.source = VirtualAudioPair::Options::Source::Silence;
+  } else if ( source == "clicks" ) {
+    options.source = VirtualAudioPair::Options::Source::Clicks;
+  } else if ( source.substr( 0, 4 ) == "tone" ) {
+    options.source = VirtualAudioPair::Options::Source::Tone;
+    if ( source.size() > 5 and source.at( 4 ) == ':' ) {
+      options.frequency = stof( source.substr( 5 ) );
+    }
+  } else if ( source.substr( 0, 4 ) == "wav:" ) {
+    options.source = VirtualAudioPair::Options::Source::WavFile;
+    options.source_path = source.substr( 4 );
+  } else {
+    throw runtime_error( "unknown STAGECAST_VIRTUAL_SOURCE: " + source );
+  }
+
+  const char* sink_env = getenv( "STAGECAST_VIRTUAL_SINK" );
+  const string sink = sink_env ? sink_env : "";
+  if ( sink.substr( 0, 4 ) == "wav:" ) {
+    options.sink_path = sink.substr( 4 );
+  } else if ( not sink.empty() ) {
+    throw runtime_error( "unknown STAGECAST_VIRTUAL_SINK: " + sink );
+  }
+
+  if ( const char* period = getenv( "STAGECAST_VIRTUAL_PERIOD" ) ) {
+    options.period_size = stoul( period );
+  }
+
+  if ( const char* jitter = getenv( "STAGECAST_VIRTUAL_JITTER_US" ) ) {
+    options.jitter_ns = stoull( jitter ) * 1000;
+  }
+
+  cerr << "Using a virtual audio device (source " << source << ", period " << options.period_size << ").\n";
+
+  return make_unique<VirtualAudioPair>( options );
+}
+#endif /* VIRTUAL_AUDIO */
+
 void program_body( const string& host, const string& service, const string& key_filename )
 {
   ios::sync_with_stdio( false );
 
+#ifndef VIRTUAL_AUDIO
   /* real-time priority */
   try {
     sched_param param;
@@ -31,6 +85,7 @@ void program_body( const string& host, const string& service, const string& key_
   } catch ( const exception& e ) {
     cerr << e.what() << "\n";
   }
+#endif /* VIRTUAL_AUDIO */
 
   /* read key */
   ReadOnlyFile keyfile { key_filename };
@@ -41,23 +96,62 @@ void program_body( const string& host, const string& service, const string& key_
 
   auto loop = make_shared<EventLoop>();
 
+#ifndef VIRTUAL_AUDIO
   /* Audio task gets first priority in EventLoop */
   const auto [name, interface_name] = ALSADevices::find_device( { "Scarlett", "UAC-2, USB Audio" } );
 
 #ifndef NDBUS
   const auto device_claim = AudioDeviceClaim::try_claim( name );
 #endif /* NDBUS */
+#endif /* VIRTUAL_AUDIO */
+
+  /* optionally, the audio device gets its own real-time thread (STAGECAST_AUDIO_THREAD=cpu pins it) */
+  const char* audio_thread = getenv( "STAGECAST_AUDIO_THREAD" );
+  optional<unsigned int> audio_cpu;
+  if ( audio_thread and *audio_thread ) {
+    audio_cpu = stoul( audio_thread );
+  }
 
-  auto uac2 = make_shared<AudioDeviceTask>( interface_name, *loop );
+  /* STAGECAST_CHANNELS=in[:out] for a multi-input interface (with more than two inputs, all are sent together) */
+  AudioInterface::Configuration audio_config;
+  if ( const char* channels = getenv( "STAGECAST_CHANNELS" ) ) {
+    const string_view spec { channels };
+    audio_config.capture_channels = stoul( string( spec.substr( 0, spec.find( ':' ) ) ) );
+    if ( spec.find( ':' ) != string_view::npos ) {
+      audio_config.playback_channels = stoul( string( spec.substr( spec.find( ':' ) + 1 ) ) );
+    }
+  }
+
+  /* STAGECAST_AUDIO_PREDICT: service the device from a timer set for when it should have frames, not by polling */
+  const auto wakeup
+    = getenv( "STAGECAST_AUDIO_PREDICT" ) ? AudioDeviceTask::Wakeup::Predict : AudioDeviceTask::Wakeup::Poll;
+
+#ifdef VIRTUAL_AUDIO
+  auto uac2 = make_shared<AudioDeviceTask>(
+    make_virtual_device( audio_config ), *loop, audio_thread != nullptr, audio_cpu, wakeup );
+#else
+  auto uac2 = make_shared<AudioDeviceTask>(
+    make_unique<AudioPair>( interface_name, audio_config ), *loop, audio_thread != nullptr, audio_cpu, wakeup );
+#endif /* VIRTUAL_AUDIO */
 
   const bool send_second_channel = getenv( "STAGECAST_2CH" );
 
   /* Opus encoder task registers itself in EventLoop */
-  auto encoder = make_shared<ClientEncoderTask>( 96000, ( send_second_channel ? 96000 : 600 ), 48000, uac2, *loop );
+  const unsigned int capture_channels = audio_config.capture_channels;
+  auto encoder
+    = capture_channels > 2
+        ? make_shared<ClientEncoderTask>(
+          OpusEncoderProcess::Multistream { int( min( 48000 * capture_channels, 384000U ) ), capture_channels },
+          48000,
+          uac2,
+          *loop )
+        : make_shared<ClientEncoderTask>( 96000, ( send_second_channel ? 96000 : 600 ), 48000, uac2, *loop );
 
   /* Network client registers itself in EventLoop */
   const Address stagecast_server { host, service };
-  auto network_client = make_shared<NetworkClient>( stagecast_server, key, encoder, uac2, *loop );
+  /* STAGECAST_FORWARD: the server forwards each performer's audio (still encoded), and it is mixed here */
+  auto network_client
+    = make_shared<NetworkClient>( stagecast_server, key, encoder, uac2, *loop, getenv( "STAGECAST_FORWARD" ) );
 
   /* Controller registers itself in EventLoop */
   ClientController controller { network_client, uac2, *loop };
@@ -71,9 +165,14 @@ void program_body( const string& host, const string& service, const string& key_
   const uint64_t update_interval = 50'000'000;
   uint64_t next_update = Timer::timestamp_ns() + update_interval;
   NetString update_str;
-  loop->add_rule(
+  loop->add_timed_rule(
     "stats update",
     [&] {
+      next_update = Timer::timestamp_ns() + update_interval;
+      if ( not network_client->has_cursor() ) {
+        return;
+      }
+
       client_report report;
       report.resets = network_client->cursor().stats().resets;
       report.target_lag
@@ -91,12 +190,11 @@ void program_body( const string& host, const string& service, const string& key_
       update_str.resize( s.bytes_written() );
 
       network_client->queue_update( update_str );
-      next_update = Timer::timestamp_ns() + update_interval;
     },
-    [&] { return network_client->has_session() and ( Timer::timestamp_ns() > next_update ); } );
+    [&] { return next_update; } );
 
   /* Start audio device and event loop */
-  uac2->device().start();
+  uac2->start();
   while ( loop->wait_next_event( -1 ) != EventLoop::Result::Exit ) {
   }
 }
@@ -9,20 +9,55 @@
 #include "controller.hh"
 #include "encoder_task.hh"
 #include "eventloop.hh"
+#include "forwarding_server.hh"
 #include "multiserver.hh"
 #include "stats_printer.hh"
 
 using namespace std;
 using namespace std::chrono;
 
+/* each client's audio goes to the others still encoded, and they mix it themselves */
+static void forwarding_body( const vector<string>& keyfiles )
+{
+  auto loop = make_shared<EventLoop>();
+
+  /* Network server registers itself in EventLoop */
+  auto server = make_shared<NetworkForwardingServer>( *loop );
+
+  for ( const auto& filename : keyfiles ) {
+    ReadOnlyFile file { filename };
+    Parser p { file };
+    LongLivedKey key { p };
+    server->add_key( key );
+  }
+
+  /* Print out statistics to terminal */
+  StatsPrinterTask stats_printer { loop };
+  stats_printer.add( server );
+
+  while ( loop->wait_next_event( -1 ) != EventLoop::Result::Exit ) {
+  }
+}
+
 void program_body( const vector<string>& keyfiles )
 {
   ios::sync_with_stdio( false );
 
+  /* STAGECAST_FORWARD: relay audio between clients (for clients run with STAGECAST_FORWARD too), don't mix it */
+  if ( getenv( "STAGECAST_FORWARD" ) ) {
+    forwarding_body( keyfiles );
+    return;
+  }
+
   auto loop = make_shared<EventLoop>();
 
+  /* Threads for per-client decoding and encoding (default: one per core) */
+  const char* workers_env = getenv( "STAGECAST_WORKERS" );
+  const size_t num_workers = workers_env ? stoul( workers_env ) : max( 1U, thread::hardware_concurrency() );
+  cerr << "Using " << num_workers << " worker thread" << ( num_workers == 1 ? "" : "s" ) << ".\n";
+
   /* Network server registeres itself in EventLoop */
-  auto server = make_shared<NetworkMultiServer>( keyfiles.size(), *loop );
+  auto server = make_shared<NetworkMultiServer>( keyfiles.size(), *loop, num_workers );
 
   for ( const auto& filename : keyfiles ) {
     ReadOnlyFile file { filename };
@@ -55,10 +90,8 @@ void program_body( const vector<string>& keyfiles )
   uint64_t next_json_update = Timer::timestamp_ns() + json_update_interval;
   Json::Value root;
   ostringstream json_str;
-  loop->add_rule(
+  loop->add_timed_rule(
     "JSON update",
-    json_updates,
-    Direction::Out,
     [&] {
       root.clear();
       json_str.str( "" );
@@ -68,10 +101,10 @@ void program_body( const vector<string>& keyfiles )
       json_updates.sendto_ignore_errors( json_update_address, json_str.str() );
       next_json_update = Timer::timestamp_ns() + json_update_interval;
     },
-    [&] { return Timer::timestamp_ns() > next_json_update; } );
+    [&] { return next_json_update; } );
 
   /* Start audio device and event loop */
-  while ( loop->wait_next_event( 0 ) != EventLoop::Result::Exit ) {
+  while ( loop->wait_next_event( -1 ) != EventLoop::Result::Exit ) {
   }
 }
 
@@ -45,10 +45,8 @@ void program_body( const vector<string>& keyfiles )
   uint64_t next_json_update = Timer::timestamp_ns() + json_update_interval;
   Json::Value root;
   ostringstream json_str;
-  loop->add_rule(
+  loop->add_timed_rule(
     "JSON update",
-    json_updates,
-    Direction::Out,
     [&] {
       root.clear();
       json_str.str( "" );
@@ -58,10 +56,10 @@ void program_body( const vector<string>& keyfiles )
       json_updates.sendto_ignore_errors( json_update_address, json_str.str() );
       next_json_update = Timer::timestamp_ns() + json_update_interval;
     },
-    [&] { return Timer::timestamp_ns() > next_json_update; } );
+    [&] { return next_json_update; } );
 
   /* Start audio device and event loop */
-  while ( loop->wait_next_event( 1 ) != EventLoop::Result::Exit ) {
+  while ( loop->wait_next_event( -1 ) != EventLoop::Result::Exit ) {
   }
 }
 
@@ -288,8 +288,8 @@ void program_body( const string origin, const string cert_filename, const string
   };
   auto clients = make_shared<ClientList>();
 
-  /* set up event loop */
-  auto loop = make_shared<EventLoop>();
+  /* set up event loop (epoll: one listener per connection, many connections) */
+  auto loop = make_shared<EventLoop>( EventLoop::Backend::Epoll );
   EventCategories categories { *loop };
 
   auto cull_needed = make_shared<bool>( false );
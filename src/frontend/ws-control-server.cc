@@ -120,6 +120,47 @@ private:
         send_control( instruction );
       } catch ( const exception& e ) {
       }
+    } else if ( fields_[0] == "bus" ) {
+      set_bus instruction;
+      instruction.board_name = fields_[1];
+      instruction.channel_name = fields_[2];
+      instruction.bus_name = fields_[3];
+      send_control( instruction );
+    } else if ( fields_[0] == "busgain" ) {
+      const string_view board_name = fields_[1];
+      const string_view bus_name = fields_[2];
+      const string_view db_gain = fields_[3];
+
+      try {
+        const float absolute_gain = dbfs_to_float( stof( string( db_gain ) ) );
+        set_bus_gain instruction;
+        instruction.board_name = board_name;
+        instruction.bus_name = bus_name;
+        instruction.gain1 = absolute_gain;
+        instruction.gain2 = absolute_gain;
+        send_control( instruction );
+      } catch ( const exception& e ) {
+      }
+    } else if ( fields_[0] == "clientbusgain" ) {
+      /* an empty gain puts the listener back on the board's bus gain */
+      const string_view client_name = fields_[1];
+      const string_view bus_name = fields_[2];
+      const string_view db_gain = fields_[3];
+
+      try {
+        set_client_bus_gain instruction;
+        instruction.client_name = client_name;
+        instruction.bus_name = bus_name;
+        if ( db_gain.empty() ) {
+          instruction.follow_board = true;
+        } else {
+          const float absolute_gain = dbfs_to_float( stof( string( db_gain ) ) );
+          instruction.gain1 = absolute_gain;
+          instruction.gain2 = absolute_gain;
+        }
+        send_control( instruction );
+      } catch ( const exception& e ) {
+      }
     }
   }
 
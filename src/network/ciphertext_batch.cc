@@ -0,0 +1,42 @@
+#include "ciphertext_batch.hh"
+
+using namespace std;
+
+size_t CiphertextBatch::receive()
+{
+  array<string_span, capacity> buffers;
+  for ( size_t i = 0; i < capacity; i++ ) {
+    buffers[i] = ciphertexts_[i].mutable_buffer();
+  }
+
+  array<size_t, capacity> lengths;
+  size_ = socket_.recv_batch(
+    { addresses_.data(), capacity }, { buffers.data(), capacity }, { lengths.data(), capacity } );
+
+  for ( size_t i = 0; i < size_; i++ ) {
+    ciphertexts_[i].resize( lengths[i] );
+  }
+
+  return size_;
+}
+
+Ciphertext& CiphertextBatch::add( const Address& destination )
+{
+  if ( size_ == capacity ) {
+    send();
+  }
+
+  addresses_[size_] = destination;
+  return ciphertexts_[size_++];
+}
+
+void CiphertextBatch::send()
+{
+  array<string_view, capacity> payloads;
+  for ( size_t i = 0; i < size_; i++ ) {
+    payloads[i] = ciphertexts_[i];
+  }
+
+  socket_.sendto_batch( { addresses_.data(), size_ }, { payloads.data(), size_ } );
+  size_ = 0;
+}
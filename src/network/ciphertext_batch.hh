@@ -0,0 +1,42 @@
+#pragma once
+
+#include <array>
+
+#include "address.hh"
+#include "crypto.hh"
+#include "socket.hh"
+
+/* Ciphertexts to or from a UDPSocket, moved in batches of up to UDPSocket::max_batch per system call */
+class CiphertextBatch
+{
+public:
+  static constexpr size_t capacity = UDPSocket::max_batch;
+
+private:
+  UDPSocket& socket_;
+
+  std::array<Address, capacity> addresses_ {};
+  std::array<Ciphertext, capacity> ciphertexts_ {};
+  size_t size_ {};
+
+public:
+  CiphertextBatch( UDPSocket& socket )
+    : socket_( socket )
+  {}
+
+  /* replace the contents with the datagrams waiting on the socket (as many as fit); returns how many */
+  size_t receive();
+
+  /* add an outbound datagram (sending the batch first if it is full) and return it to be filled in */
+  Ciphertext& add( const Address& destination );
+
+  /* send every outbound datagram and empty the batch */
+  void send();
+
+  size_t size() const { return size_; }
+  const Address& address( const size_t i ) const { return addresses_.at( i ); }
+  const Ciphertext& ciphertext( const size_t i ) const { return ciphertexts_.at( i ); }
+
+  CiphertextBatch( const CiphertextBatch& other ) = delete;
+  CiphertextBatch& operator=( const CiphertextBatch& other ) = delete;
+};
@@ -6,21 +6,21 @@
 
 using namespace std;
 
-template<class FrameType, class SourceType>
-NetworkConnection<FrameType, SourceType>::NetworkConnection( const char node_id,
-                                                             const char peer_id,
-                                                             CryptoSession&& crypto,
-                                                             const Address& destination )
+template<class FrameType, class SourceType, class InboundFrameType>
+NetworkConnection<FrameType, SourceType, InboundFrameType>::NetworkConnection( const char node_id,
+                                                                               const char peer_id,
+                                                                               CryptoSession&& crypto,
+                                                                               const Address& destination )
   : NetworkConnection( node_id, peer_id, move( crypto ) )
 {
   auto_home_ = false;
   destination_.emplace( destination );
 }
 
-template<class FrameType, class SourceType>
-NetworkConnection<FrameType, SourceType>::NetworkConnection( const char node_id,
-                                                             const char peer_id,
-                                                             CryptoSession&& crypto )
+template<class FrameType, class SourceType, class InboundFrameType>
+NetworkConnection<FrameType, SourceType, InboundFrameType>::NetworkConnection( const char node_id,
+                                                                               const char peer_id,
+                                                                               CryptoSession&& crypto )
   : node_id_( node_id )
   , peer_id_( peer_id )
   , crypto_( move( crypto ) )
@@ -28,39 +28,64 @@ NetworkConnection<FrameType, SourceType>::NetworkConnection( const char node_id,
   , destination_()
 {}
 
-template<class FrameType, class SourceType>
-void NetworkConnection<FrameType, SourceType>::send_packet( UDPSocket& socket )
+template<class FrameType, class SourceType, class InboundFrameType>
+CryptoSession::EncryptRequest NetworkConnection<FrameType, SourceType, InboundFrameType>::serialize_packet(
+  Ciphertext& ciphertext )
 {
-  if ( not has_destination() ) {
-    throw runtime_error( "no destination" );
-  }
-
-  /* make packet to send */
-  Packet<FrameType> pack {};
+  /* make packet to send (referring to the frames where the sender keeps them) */
+  PacketRef<FrameType> pack {};
+  pack.format = outbound_format_;
   sender_.set_sender_section( pack.sender_section );
   receiver_.set_receiver_section( pack.receiver_section );
 
   /* do we have room for an unreliable update? */
   if ( pending_outbound_unreliable_data_.has_value() and ( pack.serialized_length() < 1200 ) ) {
-    pack.unreliable_data_ = pending_outbound_unreliable_data_.value();
-    pending_outbound_unreliable_data_.reset();
+    pack.unreliable_data = pending_outbound_unreliable_data_.value();
   }
 
-  /* serialize */
-  Plaintext plaintext;
-  Serializer s { plaintext.mutable_buffer() };
+  /* serialize straight into the datagram, to be encrypted there */
+  Serializer s { ciphertext.mutable_buffer().substr( 0, Plaintext::capacity() ) };
   pack.serialize( s );
-  plaintext.resize( s.bytes_written() );
 
-  /* encrypt */
-  Ciphertext ciphertext;
-  crypto_.encrypt( { &node_id_, 1 }, plaintext, ciphertext );
+  if ( not pack.unreliable_data.empty() ) {
+    pending_outbound_unreliable_data_.reset();
+  }
+
+  return { &crypto_, { &node_id_, 1 }, uint16_t( s.bytes_written() ), &ciphertext };
+}
+
+template<class FrameType, class SourceType, class InboundFrameType>
+void NetworkConnection<FrameType, SourceType, InboundFrameType>::make_packet( Ciphertext& ciphertext )
+{
+  const CryptoSession::EncryptRequest packet = serialize_packet( ciphertext );
+  crypto_.encrypt_in_place( packet.associated_data, packet.plaintext_length, ciphertext );
+}
+
+template<class FrameType, class SourceType, class InboundFrameType>
+void NetworkConnection<FrameType, SourceType, InboundFrameType>::send_packet( UDPSocket& socket )
+{
+  if ( not has_destination() ) {
+    throw runtime_error( "no destination" );
+  }
 
+  Ciphertext ciphertext;
+  make_packet( ciphertext );
   socket.sendto( destination_.value(), ciphertext );
 }
 
-template<class FrameType, class SourceType>
-bool NetworkConnection<FrameType, SourceType>::receive_packet( const Ciphertext& ciphertext, const Address& source )
+template<class FrameType, class SourceType, class InboundFrameType>
+void NetworkConnection<FrameType, SourceType, InboundFrameType>::send_packet( CiphertextBatch& batch )
+{
+  if ( not has_destination() ) {
+    throw runtime_error( "no destination" );
+  }
+
+  make_packet( batch.add( destination_.value() ) );
+}
+
+template<class FrameType, class SourceType, class InboundFrameType>
+bool NetworkConnection<FrameType, SourceType, InboundFrameType>::receive_packet( const Ciphertext& ciphertext,
+                                                                                 const Address& source )
 {
   if ( not receive_packet( ciphertext ) ) {
     return false;
@@ -80,8 +105,8 @@ bool NetworkConnection<FrameType, SourceType>::receive_packet( const Ciphertext&
   return true;
 }
 
-template<class FrameType, class SourceType>
-bool NetworkConnection<FrameType, SourceType>::receive_packet( const Ciphertext& ciphertext )
+template<class FrameType, class SourceType, class InboundFrameType>
+bool NetworkConnection<FrameType, SourceType, InboundFrameType>::receive_packet( const Ciphertext& ciphertext )
 {
   /* decrypt */
   Plaintext plaintext;
@@ -90,32 +115,38 @@ bool NetworkConnection<FrameType, SourceType>::receive_packet( const Ciphertext&
     return false;
   }
 
-  /* parse */
+  /* parse, taking new frames straight from the plaintext into the receiver */
   Parser parser { plaintext };
-  const Packet<FrameType> packet { parser };
+  PacketParser<InboundFrameType> packet { parser };
+  if ( not parser.error() and packet.sequence_number() == uint32_t( -1 ) ) { /* ignore packet, only for priming */
+    return true;
+  }
+
+  auto frames = receiver_.parse_sender_section( packet );
+  PacketReceiverSection receiver_section;
+  packet.parse_receiver_section( receiver_section );
+  const string_view unreliable_data = packet.parse_unreliable_data();
+
   if ( parser.error() ) {
+    receiver_.forget( frames );
     stats_.invalid++;
     parser.clear_error();
     return false;
   }
 
-  if ( packet.sender_section.sequence_number == uint32_t( -1 ) ) { /* ignore packet, only used for priming */
-    return true;
-  }
-
-  /* act on packet contents */
-  sender_.receive_receiver_section( packet.receiver_section );
-  receiver_.receive_sender_section( packet.sender_section );
+  /* act on the packet */
+  receiver_.receive_sender_section( packet.sequence_number(), frames );
+  sender_.receive_receiver_section( receiver_section );
 
-  if ( packet.unreliable_data_.length() > 0 ) {
-    inbound_unreliable_data_.emplace( packet.unreliable_data_ );
+  if ( not unreliable_data.empty() ) {
+    inbound_unreliable_data_.emplace( unreliable_data );
   }
 
   return true;
 }
 
-template<class FrameType, class SourceType>
-void NetworkConnection<FrameType, SourceType>::summary( ostream& out ) const
+template<class FrameType, class SourceType, class InboundFrameType>
+void NetworkConnection<FrameType, SourceType, InboundFrameType>::summary( ostream& out ) const
 {
   if ( stats_.decryption_failures ) {
     out << "decryption_failures=" << stats_.decryption_failures << " ";
@@ -125,8 +156,14 @@ void NetworkConnection<FrameType, SourceType>::summary( ostream& out ) const
     out << "invalid=" << stats_.invalid << " ";
   }
 
+  if ( outbound_format_ == WireFormat::Compact ) {
+    out << "compact ";
+  }
+
   sender_.summary( out );
   receiver_.summary( out );
 }
 
 template class NetworkConnection<AudioFrame, OpusEncoderProcess>;
+template class NetworkConnection<AudioFrame, OpusEncoderProcess, ForwardedAudioFrame>;
+template class NetworkConnection<ForwardedAudioFrame, ForwardingQueue, AudioFrame>;
@@ -5,19 +5,22 @@
 #include <ostream>
 
 #include "address.hh"
+#include "ciphertext_batch.hh"
 #include "crypto.hh"
+#include "forwarding_queue.hh"
 #include "receiver.hh"
 #include "sender.hh"
 #include "socket.hh"
 #include "summarize.hh"
 
-template<class FrameType, class SourceType>
+/* sends FrameTypes (from a SourceType), and receives InboundFrameTypes (the same, except through a relay) */
+template<class FrameType, class SourceType, class InboundFrameType = FrameType>
 class NetworkConnection : public Summarizable
 {
   char node_id_, peer_id_;
 
   NetworkSender<FrameType> sender_ {};
-  NetworkReceiver<FrameType> receiver_ {};
+  NetworkReceiver<InboundFrameType> receiver_ {};
 
   CryptoSession crypto_;
 
@@ -25,6 +28,8 @@ class NetworkConnection : public Summarizable
   std::optional<Address> destination_;
   std::optional<uint32_t> last_biggest_seqno_received_ {};
 
+  WireFormat outbound_format_ { WireFormat::Original };
+
   struct Statistics
   {
     unsigned int decryption_failures {}, invalid {};
@@ -41,28 +46,49 @@ public:
   const Address& destination() const { return destination_.value(); }
 
   void push_frame( SourceType& source ) { sender_.push_frame( source ); }
+
+  /* any other source of ready-made frames (e.g. those an encoder group shares among its listeners) */
+  template<class OtherSourceType>
+  void push_frame( OtherSourceType& source )
+  {
+    sender_.push_frame( source );
+  }
+
+  void push_frames( SourceType& source ) { sender_.push_frames( source ); }
   void summary( std::ostream& out ) const override;
 
+  void make_packet( Ciphertext& ciphertext );
+  /* make_packet() up to the encryption, which is left to the caller (e.g. to batch with other connections') */
+  CryptoSession::EncryptRequest serialize_packet( Ciphertext& ciphertext );
   void send_packet( UDPSocket& socket );
+  void send_packet( CiphertextBatch& batch );
   bool receive_packet( const Ciphertext& ciphertext, const Address& source );
   bool receive_packet( const Ciphertext& ciphertext );
 
   uint32_t next_frame_needed() const { return receiver_.next_frame_needed(); }
   uint32_t unreceived_beyond_this_frame_index() const { return receiver_.unreceived_beyond_this_frame_index(); }
-  const PartialFrameStore<FrameType>& frames() const { return receiver_.frames(); }
+  const PartialFrameStore<InboundFrameType>& frames() const { return receiver_.frames(); }
   void pop_frames( const size_t num ) { receiver_.pop_frames( num ); }
 
   uint8_t node_id() const { return node_id_; }
   uint8_t peer_id() const { return peer_id_; }
 
   const typename NetworkSender<FrameType>::Statistics& sender_stats() const { return sender_.stats(); }
-  const typename NetworkReceiver<FrameType>::Statistics& receiver_stats() const { return receiver_.stats(); }
+  const typename NetworkReceiver<InboundFrameType>::Statistics& receiver_stats() const { return receiver_.stats(); }
 
   bool has_inbound_unreliable_data() const { return inbound_unreliable_data_.has_value(); }
   const NetString& inbound_unreliable_data() const { return inbound_unreliable_data_.value(); }
   void pop_inbound_unreliable_data() { inbound_unreliable_data_.reset(); }
 
   void set_outbound_unreliable_data( const NetString& str ) { pending_outbound_unreliable_data_.emplace( str ); }
+
+  /* as agreed at key exchange (inbound packets may be in either format) */
+  void set_wire_format( const WireFormat format ) { outbound_format_ = format; }
+  WireFormat wire_format() const { return outbound_format_; }
 };
 
 using AudioNetworkConnection = NetworkConnection<AudioFrame, OpusEncoderProcess>;
+
+/* a client's connection to a forwarding server, and the server's end of it */
+using ForwardedAudioNetworkConnection = NetworkConnection<AudioFrame, OpusEncoderProcess, ForwardedAudioFrame>;
+using ForwardingNetworkConnection = NetworkConnection<ForwardedAudioFrame, ForwardingQueue, AudioFrame>;
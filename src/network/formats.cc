@@ -6,18 +6,23 @@ using namespace std;
 
 uint8_t AudioFrame::serialized_length() const
 {
-  return sizeof( frame_index ) + frame1.serialized_length()
-         + ( separate_channels ? frame2.serialized_length() : 0 );
+  return sizeof( frame_index ) + ( multistream() ? sizeof( multistream_channels ) : 0 ) + frame1.serialized_length()
+         + ( separate_channels or multistream() ? frame2.serialized_length() : 0 );
 }
 
 void AudioFrame::serialize( Serializer& s ) const
 {
-  const uint32_t first_word = ( separate_channels << 31 ) | ( frame_index & 0x7FFF'FFFF );
+  const bool two_frames = separate_channels or multistream();
+  const uint32_t first_word = ( two_frames << 31 ) | ( multistream() << 30 ) | ( frame_index & 0x3FFF'FFFF );
 
   s.integer( first_word );
+  if ( multistream() ) {
+    s.integer( multistream_channels );
+  }
+
   s.object( frame1 );
 
-  if ( separate_channels ) {
+  if ( two_frames ) {
     s.object( frame2 );
   }
 }
@@ -26,16 +31,176 @@ void AudioFrame::parse( Parser& p )
 {
   uint32_t first_word {};
   p.integer( first_word );
-  frame_index = first_word & 0x7FFF'FFFF;
-  separate_channels = first_word & 0x8000'0000;
+  frame_index = first_word & 0x3FFF'FFFF;
+  const bool two_frames = first_word & 0x8000'0000;
+  const bool is_multistream = first_word & 0x4000'0000;
+
+  multistream_channels = 0;
+  if ( is_multistream ) {
+    p.integer( multistream_channels );
+    if ( multistream_channels == 0 or multistream_channels > opus_multistream_frame::MAX_CHANNELS ) {
+      p.set_error();
+      return;
+    }
+  }
+  separate_channels = two_frames and not is_multistream;
 
   p.object( frame1 );
 
-  if ( separate_channels ) {
+  if ( two_frames ) {
     p.object( frame2 );
   }
 }
 
+void AudioFrame::set_multistream( const uint8_t channels, const opus_multistream_frame& packet )
+{
+  separate_channels = false;
+  multistream_channels = channels;
+
+  const size_t first_half = min( size_t( packet.length() ), size_t( opus_frame::capacity() ) );
+  frame1.resize( first_half );
+  memcpy( frame1.mutable_data_ptr(), packet.data_ptr(), first_half );
+  frame2.resize( packet.length() - first_half );
+  memcpy( frame2.mutable_data_ptr(), packet.data_ptr() + first_half, packet.length() - first_half );
+}
+
+void AudioFrame::get_multistream( opus_multistream_frame& packet ) const
+{
+  packet.resize( frame1.length() + frame2.length() );
+  memcpy( packet.mutable_data_ptr(), frame1.data_ptr(), frame1.length() );
+  memcpy( packet.mutable_data_ptr() + frame1.length(), frame2.data_ptr(), frame2.length() );
+}
+
+/* In the Compact encoding, a frame index is a varint: the zigzag-coded difference from the frame before it in the
+   packet (usually 1, or a small step back to a retransmission), or for the first frame, from the packet's sequence
+   number (which starts from 0 with the frame index, and mostly keeps pace). With nothing to refer to, it is the
+   index itself. */
+static uint32_t index_code( const uint32_t frame_index, const optional<uint32_t> previous_index )
+{
+  if ( not previous_index.has_value() ) {
+    return frame_index;
+  }
+
+  const int32_t delta = frame_index - previous_index.value();
+  return ( uint32_t( delta ) << 1 ) ^ uint32_t( delta >> 31 );
+}
+
+static uint32_t index_from_code( const uint32_t code, const optional<uint32_t> previous_index )
+{
+  if ( not previous_index.has_value() ) {
+    return code;
+  }
+
+  return previous_index.value() + ( ( code >> 1 ) ^ -( code & 1 ) );
+}
+
+/* Compact AudioFrame: one byte with the two-frames and multistream flags and frame1's length, the index, the
+   channel count (if multistream), frame1's data, and frame2 (if any) as in the Original encoding. */
+static_assert( opus_frame::capacity() < 64 );
+
+uint32_t AudioFrame::compact_length( const optional<uint32_t> previous_index ) const
+{
+  return 1 + Serializer::varint_length( index_code( frame_index, previous_index ) )
+         + ( multistream() ? sizeof( multistream_channels ) : 0 ) + frame1.length()
+         + ( separate_channels or multistream() ? frame2.serialized_length() : 0 );
+}
+
+void AudioFrame::serialize_compact( Serializer& s, const optional<uint32_t> previous_index ) const
+{
+  const bool two_frames = separate_channels or multistream();
+  s.integer( uint8_t( ( two_frames << 7 ) | ( multistream() << 6 ) | frame1.length() ) );
+  s.varint( index_code( frame_index, previous_index ) );
+
+  if ( multistream() ) {
+    s.integer( multistream_channels );
+  }
+
+  s.string( frame1.as_string_view() );
+
+  if ( two_frames ) {
+    s.object( frame2 );
+  }
+}
+
+void AudioFrame::parse_compact( Parser& p, const optional<uint32_t> previous_index )
+{
+  uint8_t first_byte {};
+  p.integer( first_byte );
+  const bool two_frames = first_byte & 0x80;
+  const bool is_multistream = first_byte & 0x40;
+
+  uint32_t code {};
+  p.varint( code );
+  frame_index = index_from_code( code, previous_index );
+
+  multistream_channels = 0;
+  if ( is_multistream ) {
+    p.integer( multistream_channels );
+    if ( multistream_channels == 0 or multistream_channels > opus_multistream_frame::MAX_CHANNELS ) {
+      p.set_error();
+      return;
+    }
+  }
+  separate_channels = two_frames and not is_multistream;
+
+  const uint8_t frame1_length = first_byte & 0x3f;
+  if ( frame1_length > opus_frame::capacity() ) {
+    p.set_error();
+    return;
+  }
+  frame1.resize( frame1_length );
+  p.string( frame1.mutable_buffer().substr( 0, frame1_length ) );
+
+  if ( two_frames ) {
+    p.object( frame2 );
+  } else {
+    frame2.resize( 0 );
+  }
+}
+
+uint8_t ForwardedAudioFrame::serialized_length() const
+{
+  return sizeof( frame_index ) + sizeof( source ) + frame.serialized_length();
+}
+
+void ForwardedAudioFrame::serialize( Serializer& s ) const
+{
+  s.integer( frame_index );
+  s.integer( source );
+  s.object( frame );
+}
+
+void ForwardedAudioFrame::parse( Parser& p )
+{
+  p.integer( frame_index );
+  p.integer( source );
+  p.object( frame );
+}
+
+/* Compact ForwardedAudioFrame: the downlink's index, the source, and the performer's frame (whose index, in the
+   performer's own numbering, stands alone) */
+uint32_t ForwardedAudioFrame::compact_length( const optional<uint32_t> previous_index ) const
+{
+  return Serializer::varint_length( index_code( frame_index, previous_index ) ) + sizeof( source )
+         + frame.compact_length( {} );
+}
+
+void ForwardedAudioFrame::serialize_compact( Serializer& s, const optional<uint32_t> previous_index ) const
+{
+  s.varint( index_code( frame_index, previous_index ) );
+  s.integer( source );
+  frame.serialize_compact( s, {} );
+}
+
+void ForwardedAudioFrame::parse_compact( Parser& p, const optional<uint32_t> previous_index )
+{
+  uint32_t code {};
+  p.varint( code );
+  frame_index = index_from_code( code, previous_index );
+  p.integer( source );
+  frame.parse_compact( p, {} );
+}
+
 uint16_t VideoChunk::serialized_length() const
 {
   return sizeof( frame_index ) + sizeof( nal_index ) + data.serialized_length();
@@ -62,63 +227,457 @@ void VideoChunk::parse( Parser& p )
   p.object( data );
 }
 
+/* Compact VideoChunk: the index code shifted left one, with end_of_nal in the low bit, then the NAL index */
+uint32_t VideoChunk::compact_length( const optional<uint32_t> previous_index ) const
+{
+  return Serializer::varint_length( uint64_t( index_code( frame_index, previous_index ) ) << 1 )
+         + Serializer::varint_length( nal_index ) + data.serialized_length();
+}
+
+void VideoChunk::serialize_compact( Serializer& s, const optional<uint32_t> previous_index ) const
+{
+  s.varint( ( uint64_t( index_code( frame_index, previous_index ) ) << 1 ) | end_of_nal );
+  s.varint( nal_index );
+  s.object( data );
+}
+
+void VideoChunk::parse_compact( Parser& p, const optional<uint32_t> previous_index )
+{
+  uint64_t first_word {};
+  p.varint( first_word );
+  frame_index = index_from_code( first_word >> 1, previous_index );
+  end_of_nal = first_word & 1;
+
+  p.varint( nal_index );
+
+  p.object( data );
+}
+
+static uint8_t significant_bytes( uint32_t val )
+{
+  uint8_t ret = 0;
+  while ( val ) {
+    val >>= 8;
+    ret++;
+  }
+  return ret;
+}
+
+optional<uint32_t> PacketReceiverSection::restore( const uint32_t value, const uint32_t sender_count ) const
+{
+  if ( not low_bits_only ) {
+    if ( value > sender_count ) {
+      return {};
+    }
+    return value;
+  }
+
+  const uint16_t behind = uint16_t( sender_count ) - uint16_t( value );
+  if ( behind > sender_count ) {
+    return {};
+  }
+  return sender_count - behind;
+}
+
+PacketReceiverSection::PacketList PacketReceiverSection::packets_received() const
+{
+  PacketList ret;
+  if ( packets_received_end == 0 ) {
+    return ret;
+  }
+
+  const uint32_t newest = packets_received_end - 1;
+  ret.push_back( newest );
+  for ( uint32_t bit = 0; bit < 32 and bit < newest and ret.length < ret.capacity; bit++ ) {
+    if ( not( packets_missing & ( uint32_t( 1 ) << bit ) ) ) {
+      ret.push_back( newest - 1 - bit );
+    }
+  }
+
+  return ret;
+}
+
+uint32_t PacketReceiverSection::serialized_length() const
+{
+  return sizeof( next_frame_needed ) + packets_received().serialized_length();
+}
+
+void PacketReceiverSection::serialize( Serializer& s ) const
+{
+  s.integer( next_frame_needed );
+  s.object( packets_received() );
+}
+
+void PacketReceiverSection::parse( Parser& p )
+{
+  p.integer( next_frame_needed );
+  PacketList packets;
+  p.object( packets );
+
+  low_bits_only = false;
+  frame_runs.length = 0;
+  packets_received_end = 0;
+  for ( const uint32_t sequence_number : packets ) {
+    if ( sequence_number == uint32_t( -1 ) ) { /* the priming packet, never acknowledged */
+      p.set_error();
+      return;
+    }
+    packets_received_end = max( packets_received_end, sequence_number + 1 );
+  }
+
+  packets_missing = ~uint32_t( 0 );
+  for ( const uint32_t sequence_number : packets ) {
+    const uint32_t behind = packets_received_end - 1 - sequence_number;
+    if ( behind >= 1 and behind <= 32 ) {
+      packets_missing &= ~( uint32_t( 1 ) << ( behind - 1 ) );
+    }
+  }
+}
+
+uint32_t PacketReceiverSection::compact_length() const
+{
+  uint32_t ret = sizeof( uint16_t ) + sizeof( uint16_t ) + sizeof( uint8_t ) + significant_bytes( packets_missing );
+  for ( const auto& run : frame_runs ) {
+    ret += Serializer::varint_length( run.gap.value ) + Serializer::varint_length( run.length.value );
+  }
+  return ret;
+}
+
+void PacketReceiverSection::serialize_compact( Serializer& s ) const
+{
+  const uint8_t missing_bytes = significant_bytes( packets_missing );
+  s.integer( uint8_t( ( frame_runs.length << 3 ) | missing_bytes ) );
+  s.integer( uint16_t( next_frame_needed ) );
+  s.integer( uint16_t( packets_received_end ) );
+
+  for ( uint8_t i = 0; i < missing_bytes; i++ ) {
+    s.integer( uint8_t( packets_missing >> ( 8 * i ) ) );
+  }
+
+  for ( const auto& run : frame_runs ) {
+    s.varint( run.gap.value );
+    s.varint( run.length.value );
+  }
+}
+
+void PacketReceiverSection::parse_compact( Parser& p )
+{
+  uint8_t counts {};
+  p.integer( counts );
+  frame_runs.length = counts >> 3;
+  const uint8_t missing_bytes = counts & 0x07;
+  if ( frame_runs.length > frame_runs.capacity or missing_bytes > sizeof( packets_missing ) ) {
+    p.set_error();
+    return;
+  }
+
+  uint16_t wire_value {};
+  p.integer( wire_value );
+  next_frame_needed = wire_value;
+  p.integer( wire_value );
+  packets_received_end = wire_value;
+  low_bits_only = true;
+
+  packets_missing = 0;
+  for ( uint8_t i = 0; i < missing_bytes; i++ ) {
+    uint8_t byte {};
+    p.integer( byte );
+    packets_missing |= uint32_t( byte ) << ( 8 * i );
+  }
+
+  for ( uint8_t i = 0; i < frame_runs.length; i++ ) {
+    p.varint( frame_runs.elements[i].gap.value );
+    p.varint( frame_runs.elements[i].length.value );
+  }
+}
+
+/* A packet is written from a Packet or a PacketRef, whose frames are held by value or by pointer */
 template<class FrameType>
-uint32_t Packet<FrameType>::serialized_length() const
+static const FrameType& deref( const FrameType& frame )
 {
-  return sizeof( sender_section.sequence_number ) + sender_section.frames.serialized_length()
-         + sizeof( receiver_section.next_frame_needed ) + receiver_section.packets_received.serialized_length()
-         + unreliable_data_.serialized_length();
+  return frame;
 }
 
 template<class FrameType>
-void Packet<FrameType>::serialize( Serializer& s ) const
+static const FrameType& deref( const FrameType* frame )
+{
+  return *frame;
+}
+
+template<class FrameType, class SenderSection>
+static uint32_t packet_length( const WireFormat format,
+                               const SenderSection& sender_section,
+                               const PacketReceiverSection& receiver_section,
+                               const string_view unreliable_data )
 {
-  s.integer( sender_section.sequence_number );
-  s.object( sender_section.frames );
+  uint32_t ret = sizeof( uint8_t ) + unreliable_data.size();
 
-  s.integer( receiver_section.next_frame_needed );
-  s.object( receiver_section.packets_received );
+  if ( format == WireFormat::Compact ) {
+    ret += sizeof( Packet<FrameType>::compact_marker );
+    ret += Serializer::varint_length( sender_section.sequence_number );
+    uint32_t previous_index = sender_section.sequence_number;
+    for ( const auto& frame : sender_section.frames ) {
+      ret += deref( frame ).compact_length( previous_index );
+      previous_index = deref( frame ).frame_index;
+    }
 
-  s.object( unreliable_data_ );
+    return ret + receiver_section.compact_length();
+  }
+
+  ret += sizeof( sender_section.sequence_number ) + sizeof( sender_section.frames.length );
+  for ( const auto& frame : sender_section.frames ) {
+    ret += deref( frame ).serialized_length();
+  }
+
+  return ret + receiver_section.serialized_length();
+}
+
+template<class FrameType, class SenderSection>
+static void serialize_packet( Serializer& s,
+                              const WireFormat format,
+                              const SenderSection& sender_section,
+                              const PacketReceiverSection& receiver_section,
+                              const string_view unreliable_data )
+{
+  if ( format == WireFormat::Compact ) {
+    s.integer( uint8_t( Packet<FrameType>::compact_marker | sender_section.frames.length ) );
+    s.varint( sender_section.sequence_number );
+    uint32_t previous_index = sender_section.sequence_number;
+    for ( const auto& frame : sender_section.frames ) {
+      deref( frame ).serialize_compact( s, previous_index );
+      previous_index = deref( frame ).frame_index;
+    }
+
+    receiver_section.serialize_compact( s );
+  } else {
+    s.integer( sender_section.sequence_number );
+    s.integer( sender_section.frames.length );
+    for ( const auto& frame : sender_section.frames ) {
+      s.object( deref( frame ) );
+    }
+
+    s.object( receiver_section );
+  }
+
+  /* as a NetString */
+  if ( unreliable_data.size() > NetString::capacity() ) {
+    throw runtime_error( "unreliable data too long" );
+  }
+  s.integer( uint8_t( unreliable_data.size() ) );
+  if ( not unreliable_data.empty() ) {
+    s.string( unreliable_data );
+  }
+}
+
+template<class FrameType>
+uint32_t Packet<FrameType>::serialized_length() const
+{
+  return packet_length<FrameType>( format, sender_section, receiver_section, unreliable_data_ );
+}
+
+template<class FrameType>
+void Packet<FrameType>::serialize( Serializer& s ) const
+{
+  serialize_packet<FrameType>( s, format, sender_section, receiver_section, unreliable_data_ );
 }
 
 template<class FrameType>
 void Packet<FrameType>::parse( Parser& p )
 {
-  p.integer( sender_section.sequence_number );
-  p.object( sender_section.frames );
+  PacketParser<FrameType> packet { p };
+  format = packet.format();
+  sender_section.sequence_number = packet.sequence_number();
+
+  auto& frames = sender_section.frames;
+  frames.length = 0;
+  while ( packet.has_frame() ) {
+    packet.parse_frame( frames.elements[frames.length++] );
+  }
 
-  p.integer( receiver_section.next_frame_needed );
-  p.object( receiver_section.packets_received );
+  packet.parse_receiver_section( receiver_section );
+  unreliable_data_ = NetString { packet.parse_unreliable_data() };
+}
+
+template<class FrameType>
+uint32_t PacketRef<FrameType>::serialized_length() const
+{
+  return packet_length<FrameType>( format, sender_section, receiver_section, unreliable_data );
+}
 
-  p.object( unreliable_data_ );
+template<class FrameType>
+void PacketRef<FrameType>::serialize( Serializer& s ) const
+{
+  serialize_packet<FrameType>( s, format, sender_section, receiver_section, unreliable_data );
 }
 
 template<class FrameType>
-typename Packet<FrameType>::Record Packet<FrameType>::SenderSection::to_record() const
+typename Packet<FrameType>::Record PacketRef<FrameType>::SenderSection::to_record() const
 {
-  Record ret;
+  typename Packet<FrameType>::Record ret;
 
   ret.sequence_number = sequence_number;
   ret.frames.length = frames.length;
   for ( uint8_t i = 0; i < frames.length; i++ ) {
-    ret.frames.elements[i].value = frames.elements[i].frame_index;
+    ret.frames.elements[i].value = frames.elements[i]->frame_index;
   }
 
   return ret;
 }
 
+/* where each kind of frame keeps its index (the parse functions read it the same way) */
+template<class FrameType>
+static uint32_t parse_frame_index( Parser& p, const WireFormat format, const uint32_t previous_index );
+
+template<>
+uint32_t parse_frame_index<AudioFrame>( Parser& p, const WireFormat format, const uint32_t previous_index )
+{
+  if ( format == WireFormat::Compact ) {
+    uint8_t first_byte {};
+    p.integer( first_byte );
+    uint32_t code {};
+    p.varint( code );
+    return index_from_code( code, previous_index );
+  }
+
+  uint32_t first_word {};
+  p.integer( first_word );
+  return first_word & 0x3FFF'FFFF;
+}
+
+template<>
+uint32_t parse_frame_index<ForwardedAudioFrame>( Parser& p, const WireFormat format, const uint32_t previous_index )
+{
+  uint32_t ret {};
+  if ( format == WireFormat::Compact ) {
+    p.varint( ret );
+    return index_from_code( ret, previous_index );
+  }
+
+  p.integer( ret );
+  return ret;
+}
+
+template<>
+uint32_t parse_frame_index<VideoChunk>( Parser& p, const WireFormat format, const uint32_t previous_index )
+{
+  if ( format == WireFormat::Compact ) {
+    uint64_t first_word {};
+    p.varint( first_word );
+    return index_from_code( first_word >> 1, previous_index );
+  }
+
+  uint32_t first_word {};
+  p.integer( first_word );
+  return first_word & 0x7FFF'FFFF;
+}
+
+template<class FrameType>
+PacketParser<FrameType>::PacketParser( Parser& p )
+  : p_( p )
+{
+  if ( not p.input().empty() and ( uint8_t( p.input().front() ) & 0xF0 ) == Packet<FrameType>::compact_marker ) {
+    format_ = WireFormat::Compact;
+    uint8_t first_byte {};
+    p.integer( first_byte );
+    frames_left_ = first_byte & 0x0F;
+    p.varint( sequence_number_ );
+  } else {
+    p.integer( sequence_number_ );
+    p.integer( frames_left_ );
+  }
+
+  if ( frames_left_ > FrameType::frames_per_packet ) {
+    p.set_error();
+  }
+
+  previous_index_ = sequence_number_;
+}
+
+template<class FrameType>
+uint32_t PacketParser<FrameType>::next_frame_index() const
+{
+  Parser peek { p_.input() };
+  const uint32_t ret = parse_frame_index<FrameType>( peek, format_, previous_index_ );
+  peek.clear_error(); /* if the frame is malformed, parse_frame will say so */
+  return ret;
+}
+
+template<class FrameType>
+void PacketParser<FrameType>::parse_frame( FrameType& frame )
+{
+  if ( format_ == WireFormat::Compact ) {
+    frame.parse_compact( p_, previous_index_ );
+  } else {
+    p_.object( frame );
+  }
+
+  previous_index_ = frame.frame_index;
+  frames_left_--;
+}
+
+template<class FrameType>
+void PacketParser<FrameType>::skip_frame()
+{
+  FrameType frame;
+  parse_frame( frame );
+}
+
+template<class FrameType>
+void PacketParser<FrameType>::parse_receiver_section( PacketReceiverSection& receiver_section )
+{
+  if ( frames_left_ > 0 and not p_.error() ) {
+    throw runtime_error( "PacketParser: frames left unread" );
+  }
+
+  if ( format_ == WireFormat::Compact ) {
+    if ( not p_.error() ) {
+      receiver_section.parse_compact( p_ );
+    }
+  } else {
+    p_.object( receiver_section );
+  }
+}
+
+template<class FrameType>
+string_view PacketParser<FrameType>::parse_unreliable_data()
+{
+  uint8_t length {};
+  p_.integer( length );
+  return p_.view( length );
+}
+
 template struct Packet<AudioFrame>;
+template struct Packet<ForwardedAudioFrame>;
 template struct Packet<VideoChunk>;
+template struct PacketRef<AudioFrame>;
+template struct PacketRef<ForwardedAudioFrame>;
+template struct PacketRef<VideoChunk>;
+template class PacketParser<AudioFrame>;
+template class PacketParser<ForwardedAudioFrame>;
+template class PacketParser<VideoChunk>;
 
 void KeyMessage::serialize( Serializer& s ) const
 {
   s.object( id );
   s.object( key_pair );
+  if ( wire_format.has_value() ) {
+    s.integer( uint8_t( wire_format.value() ) );
+  }
 }
 
 void KeyMessage::parse( Parser& p )
 {
   p.object( id );
   p.object( key_pair );
+
+  wire_format.reset();
+  if ( not p.error() and not p.input().empty() ) {
+    uint8_t format {};
+    p.integer( format );
+    if ( format < uint8_t( WireFormat::Original ) or format > uint8_t( WireFormat::Compact ) ) {
+      p.set_error(); /* a format we don't know: better no session than packets we'd misread */
+      return;
+    }
+    wire_format = WireFormat( format );
+  }
 }
@@ -8,24 +8,68 @@
 #include "opus.hh"
 #include "parser.hh"
 
+/* Packets travel in one of two encodings. Every peer parses both (a Compact packet says so in its first byte), but
+   sends Compact packets only if the other side said at key exchange that it can parse them. */
+enum class WireFormat : uint8_t
+{
+  Original = 1, /* what every peer has always spoken, acknowledging with a list of packets received */
+  Compact = 2,  /* varints, frame indices as deltas within the packet, flags packed with lengths, and acks as
+                   frame runs and a packet bitmap */
+};
+
 struct AudioFrame
 {
-  uint32_t frame_index {}; // units of opus_frame::NUM_SAMPLES, about two months at 2^31 * 120 / 48 kHz
+  uint32_t frame_index {}; // units of opus_frame::NUM_SAMPLES, about a month at 2^30 * 120 / 48 kHz
   bool separate_channels {};
 
+  /* if nonzero, frame1 and frame2 are the two halves of an opus_multistream_frame with this many channels */
+  uint8_t multistream_channels {};
+
   opus_frame frame1 {}, frame2 {};
 
   size_t sample_index() const { return frame_index * opus_frame::NUM_SAMPLES; }
 
+  bool multistream() const { return multistream_channels; }
+
+  /* no Opus data at all: the sender skipped a silent block */
+  bool silent() const { return frame1.length() == 0 and frame2.length() == 0; }
+
+  void set_multistream( const uint8_t channels, const opus_multistream_frame& packet );
+  void get_multistream( opus_multistream_frame& packet ) const;
+
   uint8_t serialized_length() const;
   void serialize( Serializer& s ) const;
   void parse( Parser& p );
 
+  /* the Compact encoding, given the index of the frame before it in the packet (if any) */
+  uint32_t compact_length( const std::optional<uint32_t> previous_index ) const;
+  void serialize_compact( Serializer& s, const std::optional<uint32_t> previous_index ) const;
+  void parse_compact( Parser& p, const std::optional<uint32_t> previous_index );
+
   static constexpr uint8_t frames_per_packet = 8;
 };
 
 static_assert( sizeof( AudioFrame ) == 128 );
 
+/* A performer's AudioFrame on its way from a forwarding server to another client. The downlink numbers these
+   frames itself (frame_index); the performer's own numbering is still in `frame`. */
+struct ForwardedAudioFrame
+{
+  uint32_t frame_index {};
+  uint8_t source {}; /* performer's node id */
+  AudioFrame frame {};
+
+  uint8_t serialized_length() const;
+  void serialize( Serializer& s ) const;
+  void parse( Parser& p );
+
+  uint32_t compact_length( const std::optional<uint32_t> previous_index ) const;
+  void serialize_compact( Serializer& s, const std::optional<uint32_t> previous_index ) const;
+  void parse_compact( Parser& p, const std::optional<uint32_t> previous_index );
+
+  static constexpr uint8_t frames_per_packet = AudioFrame::frames_per_packet;
+};
+
 struct VideoChunk
 {
   uint32_t frame_index {}; /* index of this chunk (not video frame) */
@@ -40,6 +84,10 @@ struct VideoChunk
   void serialize( Serializer& s ) const;
   void parse( Parser& p );
 
+  uint32_t compact_length( const std::optional<uint32_t> previous_index ) const;
+  void serialize_compact( Serializer& s, const std::optional<uint32_t> previous_index ) const;
+  void parse_compact( Parser& p, const std::optional<uint32_t> previous_index );
+
   static constexpr uint8_t frames_per_packet = 2;
 };
 
@@ -134,6 +182,48 @@ public:
   }
 };
 
+/* what a receiver acknowledges doesn't depend on the kind of frame, which can differ in the two directions */
+struct PacketReceiverSection
+{
+  /* every frame before this one has arrived */
+  uint32_t next_frame_needed {};
+
+  /* the frames held beyond next_frame_needed, as runs: each begins `gap` frames after the end of the one before
+     (the first, after next_frame_needed) */
+  struct FrameRun
+  {
+    NetInteger<uint16_t> gap {}, length {};
+  };
+
+  NetArray<FrameRun, 16> frame_runs {};
+
+  /* Every packet received is before packets_received_end (0 if none has been). Of the 32 packets before the
+     newest, those whose bit is set in packets_missing (bit i: packet packets_received_end - 2 - i) have not been
+     received. */
+  uint32_t packets_received_end {};
+  uint32_t packets_missing {};
+
+  /* The Compact encoding sends next_frame_needed and packets_received_end as their low 16 bits. Neither is past
+     the sender's own count (of frames or packets), which it uses to restore the rest. */
+  bool low_bits_only {};
+  std::optional<uint32_t> restore( const uint32_t value, const uint32_t sender_count ) const;
+
+  /* Original: next_frame_needed, then a list of (at most 32) packets received: the newest, then those of the 32
+     before it that aren't missing. Parsed, it has no frame runs, and a packet it doesn't list counts as missing. */
+  using PacketList = NetArray<NetInteger<uint32_t>, 32>;
+  PacketList packets_received() const;
+
+  uint32_t serialized_length() const;
+  void serialize( Serializer& s ) const;
+  void parse( Parser& p );
+
+  /* Compact: one byte with the number of runs and of packets_missing bytes, the two counters, packets_missing
+     (without its high zero bytes), and the runs as varints */
+  uint32_t compact_length() const;
+  void serialize_compact( Serializer& s ) const;
+  void parse_compact( Parser& p );
+};
+
 template<class FrameType>
 struct Packet
 {
@@ -147,18 +237,21 @@ struct Packet
   {
     uint32_t sequence_number {};
     NetArray<FrameType, FrameType::frames_per_packet> frames {};
-
-    Record to_record() const;
   } sender_section {};
 
-  struct ReceiverSection
-  {
-    uint32_t next_frame_needed {};
-    NetArray<NetInteger<uint32_t>, 32> packets_received {};
-  } receiver_section {};
+  using ReceiverSection = PacketReceiverSection;
+  ReceiverSection receiver_section {};
 
   NetString unreliable_data_ {};
 
+  /* how the packet was (or will be) encoded */
+  WireFormat format { WireFormat::Original };
+
+  /* A Compact packet begins with this, plus its number of frames. An Original packet begins with the high byte of
+     its sequence number, which won't reach 0xC0 for months (the priming packet, numbered 0xFFFFFFFF, aside). */
+  static constexpr uint8_t compact_marker = 0xC0;
+  static_assert( FrameType::frames_per_packet < 16 );
+
   uint32_t serialized_length() const;
   void serialize( Serializer& s ) const;
   void parse( Parser& p );
@@ -167,6 +260,56 @@ struct Packet
   Packet( Parser& p ) { parse( p ); }
 };
 
+/* An outbound Packet that refers to its frames (where the NetworkSender keeps them) and its unreliable data instead
+   of holding copies. It serializes exactly as the Packet would, and must be serialized before they change. */
+template<class FrameType>
+struct PacketRef
+{
+  struct SenderSection
+  {
+    uint32_t sequence_number {};
+    NetArray<const FrameType*, FrameType::frames_per_packet> frames {};
+
+    typename Packet<FrameType>::Record to_record() const;
+  } sender_section {};
+
+  PacketReceiverSection receiver_section {};
+  std::string_view unreliable_data {};
+  WireFormat format { WireFormat::Original };
+
+  uint32_t serialized_length() const;
+  void serialize( Serializer& s ) const;
+};
+
+/* Reads a Packet (in either WireFormat) without copying it out of the datagram. The caller learns each frame's
+   index and then parses the frame straight to where it will be kept (or skips it); after the frames come the
+   receiver section and a view of the unreliable data. */
+template<class FrameType>
+class PacketParser
+{
+  Parser& p_;
+  WireFormat format_ { WireFormat::Original };
+  uint32_t sequence_number_ {};
+  uint8_t frames_left_ {};
+  uint32_t previous_index_ {}; /* for the Compact encoding's deltas */
+
+public:
+  /* reads up to the first frame */
+  explicit PacketParser( Parser& p );
+
+  bool error() const { return p_.error(); }
+  WireFormat format() const { return format_; }
+  uint32_t sequence_number() const { return sequence_number_; }
+
+  bool has_frame() const { return frames_left_ > 0 and not p_.error(); }
+  uint32_t next_frame_index() const;
+  void parse_frame( FrameType& frame );
+  void skip_frame();
+
+  void parse_receiver_section( PacketReceiverSection& receiver_section );
+  std::string_view parse_unreliable_data();
+};
+
 struct KeyMessage
 {
   static constexpr char keyreq_id = uint8_t( 254 );
@@ -175,7 +318,14 @@ struct KeyMessage
   NetInteger<uint8_t> id {};
   KeyPair key_pair {};
 
-  constexpr uint32_t serialized_length() const { return id.serialized_length() + key_pair.serialized_length(); }
+  /* The client's key request is empty, or one byte: the newest WireFormat it parses. If it sent that byte, the
+     reply ends with the WireFormat the server parses (and will send). */
+  std::optional<WireFormat> wire_format {};
+
+  uint32_t serialized_length() const
+  {
+    return id.serialized_length() + key_pair.serialized_length() + ( wire_format.has_value() ? 1 : 0 );
+  }
   void serialize( Serializer& s ) const;
   void parse( Parser& p );
 };
@@ -0,0 +1,23 @@
+#include "forwarding_queue.hh"
+
+using namespace std;
+
+void ForwardingQueue::push( const uint8_t source, const AudioFrame& frame )
+{
+  if ( end_ >= frames_.range_end() ) {
+    /* the client hasn't been sent anything for a while; the oldest frames are the least useful */
+    frames_.pop( 1 );
+    dropped_++;
+  }
+
+  auto& dest = frames_.at( end_++ );
+  dest.source = source;
+  dest.frame = frame;
+}
+
+ForwardedAudioFrame ForwardingQueue::front( const uint32_t frame_index ) const
+{
+  ForwardedAudioFrame ret = frames_.at( frames_.range_begin() );
+  ret.frame_index = frame_index;
+  return ret;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "formats.hh"
+#include "typed_ring_buffer.hh"
+
+/* Performers' frames waiting to go out to one client of a forwarding server, in the order they reached the
+   server. This is the frame source for that client's NetworkSender, as an OpusEncoderProcess is for a client. */
+class ForwardingQueue
+{
+  EndlessBuffer<ForwardedAudioFrame> frames_ { 512 };
+  size_t end_ {};
+
+  unsigned int dropped_ {};
+
+public:
+  void push( const uint8_t source, const AudioFrame& frame );
+
+  size_t size() const { return end_ - frames_.range_begin(); }
+  unsigned int dropped() const { return dropped_; }
+
+  /* for NetworkSender */
+  bool has_frame() const { return size() > 0; }
+  ForwardedAudioFrame front( const uint32_t frame_index ) const;
+  void pop_frame() { frames_.pop( 1 ); }
+};
@@ -3,49 +3,158 @@
 
 using namespace std;
 
+template<class FrameType>
+optional<FrameType>* NetworkReceiver<FrameType>::slot_for( const uint32_t frame_index )
+{
+  unreceived_beyond_this_frame_index_ = max( unreceived_beyond_this_frame_index_, frame_index + 1 );
+
+  if ( frame_index < next_frame_needed_ ) {
+    stats_.already_acked++;
+    return nullptr;
+  }
+
+  if ( frame_index >= frames_.range_end() ) {
+    discard_frames( frame_index - frames_.range_end() + 1 );
+  }
+
+  auto& dest = frames_.at( frame_index );
+  if ( dest.has_value() ) {
+    stats_.redundant++;
+    return nullptr;
+  }
+
+  return &dest;
+}
+
 template<class FrameType>
 void NetworkReceiver<FrameType>::receive_sender_section(
   const typename Packet<FrameType>::SenderSection& sender_section )
 {
-  if ( not biggest_seqno_received_.has_value() ) {
-    biggest_seqno_received_ = sender_section.sequence_number;
-  } else {
-    biggest_seqno_received_ = max( biggest_seqno_received_.value(), sender_section.sequence_number );
-  }
+  note_packet_received( sender_section.sequence_number );
 
   const uint64_t now = Timer::timestamp_ns();
 
   for ( const auto& frame : sender_section.frames ) {
-    unreceived_beyond_this_frame_index_ = max( unreceived_beyond_this_frame_index_, frame.frame_index + 1 );
+    const auto dest = slot_for( frame.frame_index );
+    if ( dest ) {
+      *dest = frame;
+      add_to_runs_held( frame.frame_index );
+      stats_.last_new_frame_received = now;
+    }
+  }
 
-    if ( frame.frame_index < next_frame_needed_ ) {
-      stats_.already_acked++;
-      continue;
+  advance_next_frame_needed();
+}
+
+template<class FrameType>
+typename NetworkReceiver<FrameType>::ParsedFrames NetworkReceiver<FrameType>::parse_sender_section(
+  PacketParser<FrameType>& packet )
+{
+  using Kind = typename ParsedFrames::Kind;
+  ParsedFrames ret;
+
+  for ( ; packet.has_frame(); ret.count++ ) {
+    const uint32_t frame_index = ret.indices[ret.count] = packet.next_frame_index();
+    if ( frame_index >= frames_.range_end() ) { /* the window only moves once the packet is known to be good */
+      packet.parse_frame( ret.aside[ret.count].emplace() );
+      ret.kinds[ret.count] = Kind::Aside;
+    } else if ( frame_index >= next_frame_needed_ and not frames_.at( frame_index ).has_value() ) {
+      packet.parse_frame( frames_.at( frame_index ).emplace() );
+      ret.kinds[ret.count] = Kind::Stored;
+    } else {
+      packet.skip_frame();
+      ret.kinds[ret.count] = Kind::Skipped;
     }
+  }
+
+  return ret;
+}
 
-    if ( frame.frame_index >= frames_.range_end() ) {
-      discard_frames( frame.frame_index - frames_.range_end() + 1 );
+template<class FrameType>
+void NetworkReceiver<FrameType>::forget( const ParsedFrames& frames )
+{
+  for ( uint8_t i = 0; i < frames.count; i++ ) {
+    if ( frames.kinds[i] == ParsedFrames::Kind::Stored ) {
+      frames_.at( frames.indices[i] ).reset();
     }
+  }
+}
 
-    auto& dest = frames_.at( frame.frame_index );
-    if ( dest.has_value() ) {
-      stats_.redundant++;
-      continue;
+template<class FrameType>
+void NetworkReceiver<FrameType>::receive_sender_section( const uint32_t sequence_number, ParsedFrames& frames )
+{
+  note_packet_received( sequence_number );
+
+  const uint64_t now = Timer::timestamp_ns();
+
+  for ( uint8_t i = 0; i < frames.count; i++ ) {
+    const uint32_t frame_index = frames.indices[i];
+    if ( frames.kinds[i] == ParsedFrames::Kind::Stored ) {
+      unreceived_beyond_this_frame_index_ = max( unreceived_beyond_this_frame_index_, frame_index + 1 );
+    } else {
+      /* counts a skipped frame as already acknowledged or held, or makes room for one set aside */
+      const auto dest = slot_for( frame_index );
+      if ( not dest or frames.kinds[i] == ParsedFrames::Kind::Skipped ) {
+        continue;
+      }
+      *dest = move( frames.aside[i] );
     }
 
-    dest = frame;
+    add_to_runs_held( frame_index );
     stats_.last_new_frame_received = now;
   }
 
   advance_next_frame_needed();
+}
+
+template<class FrameType>
+void NetworkReceiver<FrameType>::note_packet_received( const uint32_t sequence_number )
+{
+  if ( not biggest_seqno_received_.has_value() ) {
+    /* everything sent before it is missing */
+    biggest_seqno_received_ = sequence_number;
+    packets_missing_ = sequence_number >= 32 ? ~uint32_t( 0 ) : ( uint32_t( 1 ) << sequence_number ) - 1;
+    return;
+  }
 
-  if ( sender_section.frames.length ) {
-    if ( recent_packets_.num_stored() >= recent_packets_.capacity() ) {
-      recent_packets_.pop( 1 );
+  const uint32_t biggest = biggest_seqno_received_.value();
+
+  if ( sequence_number > biggest ) {
+    /* the old biggest moves to bit distance - 1, and the packets between the two are missing */
+    const uint32_t distance = sequence_number - biggest;
+    packets_missing_ = distance >= 32 ? 0 : packets_missing_ << distance;
+    packets_missing_ |= distance > 32 ? ~uint32_t( 0 ) : ( uint32_t( 1 ) << ( distance - 1 ) ) - 1;
+    biggest_seqno_received_ = sequence_number;
+  } else if ( sequence_number < biggest and biggest - sequence_number <= 32 ) {
+    packets_missing_ &= ~( uint32_t( 1 ) << ( biggest - sequence_number - 1 ) );
+  }
+}
+
+template<class FrameType>
+void NetworkReceiver<FrameType>::add_to_runs_held( const uint32_t frame_index )
+{
+  /* the first run that ends at or after the frame, which isn't in it (usually none, or the last run) */
+  auto it = runs_held_.end();
+  if ( not runs_held_.empty() and runs_held_.back().end >= frame_index ) {
+    if ( runs_held_.back().begin <= frame_index ) {
+      it = prev( runs_held_.end() );
+    } else {
+      it = lower_bound( runs_held_.begin(), runs_held_.end(), frame_index, []( const FrameRun& run, uint32_t f ) {
+        return run.end < f;
+      } );
     }
+  }
 
-    recent_packets_.writable_region().at( 0 ) = sender_section.to_record();
-    recent_packets_.push( 1 );
+  if ( it != runs_held_.end() and it->end == frame_index ) {
+    it->end++;
+    if ( next( it ) != runs_held_.end() and next( it )->begin == it->end ) {
+      it->end = next( it )->end;
+      runs_held_.erase( next( it ) );
+    }
+  } else if ( it != runs_held_.end() and it->begin == frame_index + 1 ) {
+    it->begin--;
+  } else {
+    runs_held_.insert( it, { frame_index, frame_index + 1 } );
   }
 }
 
@@ -54,15 +163,23 @@ void NetworkReceiver<FrameType>::discard_frames( const unsigned int num )
 {
   frames_.pop( num );
   stats_.dropped += num;
-  next_frame_needed_ = frames_.range_begin();
+  next_frame_needed_ = max( next_frame_needed_, uint32_t( frames_.range_begin() ) );
   advance_next_frame_needed();
 }
 
 template<class FrameType>
 void NetworkReceiver<FrameType>::advance_next_frame_needed()
 {
-  while ( next_frame_needed_ < frames_.range_end() and frames_.at( next_frame_needed_ ).has_value() ) {
-    next_frame_needed_++;
+  /* forget runs that are now behind next_frame_needed_ (or were discarded) */
+  auto first_kept = runs_held_.begin();
+  while ( first_kept != runs_held_.end() and first_kept->end <= next_frame_needed_ ) {
+    first_kept++;
+  }
+  runs_held_.erase( runs_held_.begin(), first_kept );
+
+  if ( not runs_held_.empty() and runs_held_.front().begin <= next_frame_needed_ ) {
+    next_frame_needed_ = runs_held_.front().end;
+    runs_held_.erase( runs_held_.begin() );
   }
 }
 
@@ -72,34 +189,19 @@ void NetworkReceiver<FrameType>::set_receiver_section(
 {
   receiver_section.next_frame_needed = next_frame_needed_;
 
-  if ( biggest_seqno_received_.has_value() ) {
-    receiver_section.packets_received.push_back( biggest_seqno_received_.value() );
-  }
-
-  const span_view<typename Packet<FrameType>::Record> recent = recent_packets_.readable_region();
-  for ( auto it = recent.end() - 1; it >= recent.begin(); --it ) {
-    const auto& p = *it;
-    if ( p.sequence_number == biggest_seqno_received_ ) {
-      continue;
+  uint32_t previous_end = next_frame_needed_;
+  for ( const auto& run : runs_held_ ) {
+    if ( receiver_section.frame_runs.length >= receiver_section.frame_runs.capacity ) {
+      break;
     }
 
-    // does the packet acknowledge a frame that isn't otherwise acknowledged?
-    bool sack_the_packet = false;
-    for ( const auto frame_index : p.frames ) {
-      if ( frame_index == next_frame_needed_ ) {
-        throw runtime_error( "BUG: packet received but frame still needed???" );
-      }
-      if ( frame_index > next_frame_needed_ ) {
-        sack_the_packet = true;
-        break;
-      }
-    }
-    if ( sack_the_packet ) {
-      receiver_section.packets_received.push_back( p.sequence_number );
-      if ( receiver_section.packets_received.length >= receiver_section.packets_received.capacity ) {
-        break;
-      }
-    }
+    receiver_section.frame_runs.push_back( { run.begin - previous_end, run.end - run.begin } );
+    previous_end = run.end;
+  }
+
+  if ( biggest_seqno_received_.has_value() ) {
+    receiver_section.packets_received_end = biggest_seqno_received_.value() + 1;
+    receiver_section.packets_missing = packets_missing_;
   }
 }
 
@@ -125,16 +227,8 @@ void NetworkReceiver<FrameType>::summary( ostream& out ) const
 
   const uint32_t contiguous_count = next_frame_needed_ - frames_.range_begin();
   uint32_t other_count = 0;
-  optional<uint32_t> first_other_held;
-  for ( uint32_t i = next_frame_needed_;
-        i < min( uint32_t( frames_.range_end() ), unreceived_beyond_this_frame_index_ );
-        i++ ) {
-    if ( frames_[i].has_value() ) {
-      other_count++;
-      if ( not first_other_held.has_value() ) {
-        first_other_held = i;
-      }
-    }
+  for ( const auto& run : runs_held_ ) {
+    other_count += run.end - run.begin;
   }
 
   if ( stats_.popped ) {
@@ -147,9 +241,9 @@ void NetworkReceiver<FrameType>::summary( ostream& out ) const
     out << " next_frame_needed=" << next_frame_needed_;
   }
 
-  if ( first_other_held.has_value() ) {
-    out << " + " << other_count << " other (" << first_other_held.value() << " - "
-        << unreceived_beyond_this_frame_index_ - 1 << ")";
+  if ( not runs_held_.empty() ) {
+    out << " + " << other_count << " other in " << runs_held_.size() << " runs (" << runs_held_.front().begin
+        << " - " << unreceived_beyond_this_frame_index_ - 1 << ")";
   }
 
   out << "\n";
@@ -168,3 +262,4 @@ void NetworkReceiver<FrameType>::pop_frames( const size_t num )
 }
 
 template class NetworkReceiver<AudioFrame>;
+template class NetworkReceiver<ForwardedAudioFrame>;
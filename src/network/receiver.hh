@@ -5,6 +5,10 @@
 #include "socket.hh"
 #include "typed_ring_buffer.hh"
 
+#include <array>
+#include <optional>
+#include <vector>
+
 template<class FrameType>
 class PartialFrameStore : public EndlessBuffer<std::optional<FrameType>>
 {
@@ -29,9 +33,20 @@ class NetworkReceiver
   uint32_t next_frame_needed_ {};
   uint32_t unreceived_beyond_this_frame_index_ {};
 
+  /* the frames held beyond next_frame_needed_, as sorted, disjoint runs */
+  struct FrameRun
+  {
+    uint32_t begin, end;
+  };
+  std::vector<FrameRun> runs_held_ {};
+  void add_to_runs_held( const uint32_t frame_index );
+
   std::optional<uint32_t> biggest_seqno_received_ {};
+  uint32_t packets_missing_ {}; /* as in PacketReceiverSection, before biggest_seqno_received_ */
+  void note_packet_received( const uint32_t sequence_number );
 
-  TypedRingBuffer<typename Packet<FrameType>::Record> recent_packets_ { 512 };
+  /* where a new frame goes, or nullptr if it's already acknowledged or held */
+  std::optional<FrameType>* slot_for( const uint32_t frame_index );
 
   void discard_frames( const unsigned int num );
   void advance_next_frame_needed();
@@ -48,6 +63,29 @@ private:
 
 public:
   void receive_sender_section( const typename Packet<FrameType>::SenderSection& sender_section );
+
+  /* A packet's frames, each new one parsed straight from the datagram into the store (or aside, if it's beyond the
+     window), but not yet acted on: a packet counts only once all of it has parsed. */
+  struct ParsedFrames
+  {
+    enum class Kind : uint8_t
+    {
+      Skipped,
+      Stored,
+      Aside
+    };
+
+    uint8_t count {};
+    std::array<uint32_t, FrameType::frames_per_packet> indices {};
+    std::array<Kind, FrameType::frames_per_packet> kinds {};
+    std::array<std::optional<FrameType>, FrameType::frames_per_packet> aside {};
+  };
+
+  ParsedFrames parse_sender_section( PacketParser<FrameType>& packet );
+
+  /* then, if the rest of the packet parsed, record it and keep its new frames; or else forget them */
+  void receive_sender_section( const uint32_t sequence_number, ParsedFrames& frames );
+  void forget( const ParsedFrames& frames );
   void set_receiver_section( typename Packet<FrameType>::ReceiverSection& receiver_section );
 
   void summary( std::ostream& out ) const;
@@ -44,33 +44,11 @@ void NetworkSender<FrameType>::summary( ostream& out ) const
     out << " greatest_sack=" << greatest_sack_.value();
   }
 
-  optional<uint32_t> first_outstanding;
-
-  unsigned int num_outstanding = 0, num_in_flight = 0;
-  /*
-  const span_view<FrameStatus> statuses
-    = frame_status_.region( frame_status_.range_begin(), next_frame_index_ - frame_status_.range_begin() );
-  */
-  for ( uint32_t i = frame_status_.range_begin(); i < next_frame_index_; i++ ) {
-    const auto& status = frame_status_[i];
-    if ( not status.outstanding ) {
-      continue;
-    }
-
-    num_outstanding++;
+  out << " frames in-flight/outstanding=" << num_in_flight_ << "/" << num_outstanding_;
 
-    if ( status.in_flight ) {
-      num_in_flight++;
-    }
-
-    if ( not first_outstanding.has_value() ) {
-      first_outstanding = i;
-    }
-  }
-  out << " frames in-flight/outstanding=" << num_in_flight << "/" << num_outstanding;
-
-  if ( first_outstanding.has_value() ) {
-    out << " out=" << first_outstanding.value() << " - " << next_frame_index_;
+  if ( num_outstanding_ ) {
+    out << " out=" << outstanding_.find_first( frames_.range_begin(), next_frame_index_ ).value() << " - "
+        << next_frame_index_;
   }
 
   out << " packets_in_flight range = [" << packets_in_flight_.range_begin() << " - " << next_sequence_number_
@@ -80,12 +58,47 @@ void NetworkSender<FrameType>::summary( ostream& out ) const
 }
 
 template<class FrameType>
-void NetworkSender<FrameType>::set_sender_section( typename Packet<FrameType>::SenderSection& p )
+void NetworkSender<FrameType>::mark_needs_send( const uint32_t frame_index )
+{
+  needs_send_.set( frame_index );
+  needs_send_from_ = min( needs_send_from_, frame_index );
+}
+
+template<class FrameType>
+void NetworkSender<FrameType>::send_frame( typename PacketRef<FrameType>::SenderSection& p,
+                                           const uint32_t frame_index )
 {
-  if ( frames_.range_begin() != frame_status_.range_begin() ) {
-    throw runtime_error( "NetworkSender internal error" );
+  p.frames.push_back( &frames_.at( frame_index ) );
+  needs_send_.reset( frame_index );
+  num_in_flight_++;
+}
+
+template<class FrameType>
+void NetworkSender<FrameType>::mark_delivered( const uint64_t begin, const uint64_t end )
+{
+  if ( begin >= end ) {
+    return;
   }
 
+  const unsigned int delivered_outstanding = outstanding_.count( begin, end );
+  const unsigned int delivered_needing_send = needs_send_.count( begin, end );
+
+  num_outstanding_ -= delivered_outstanding;
+  num_in_flight_ -= delivered_outstanding - delivered_needing_send;
+  outstanding_.reset( begin, end );
+  needs_send_.reset( begin, end );
+}
+
+template<class FrameType>
+void NetworkSender<FrameType>::pop_frames( const size_t num )
+{
+  mark_delivered( frames_.range_begin(), frames_.range_begin() + num );
+  frames_.pop( num );
+}
+
+template<class FrameType>
+void NetworkSender<FrameType>::set_sender_section( typename PacketRef<FrameType>::SenderSection& p )
+{
   p.sequence_number = next_sequence_number_++;
 
   /* send some frames! */
@@ -93,31 +106,24 @@ void NetworkSender<FrameType>::set_sender_section( typename Packet<FrameType>::S
     stats_.empty_packets++;
   } else {
     /* always send the most recent frame if it needs it */
-    const auto& most_recent_frame = frames_.at( next_frame_index_ - 1 );
-    auto& most_recent_status = frame_status_.at( next_frame_index_ - 1 );
-    if ( most_recent_status.needs_send() ) {
-      p.frames.push_back( most_recent_frame );
-      most_recent_status.in_flight = true;
+    if ( needs_send_.test( next_frame_index_ - 1 ) ) {
+      send_frame( p, next_frame_index_ - 1 );
       need_immediate_send_ = false;
     }
 
-    /* now, attempt to fill up the other slots for frames in the packet */
-    span<FrameStatus> statuses
-      = frame_status_.region( frame_status_.range_begin(), next_frame_index_ - frame_status_.range_begin() );
-    const span_view<FrameType> frames
-      = frames_.region( frame_status_.range_begin(), next_frame_index_ - frame_status_.range_begin() );
-    for ( uint32_t i = 0; i < statuses.size(); i++ ) {
-      auto& status = statuses[i];
-
-      if ( status.needs_send() ) {
-        p.frames.push_back( frames[i] );
-        status.in_flight = true;
-
-        if ( p.frames.length >= p.frames.capacity ) {
-          break;
-        }
+    /* now, attempt to fill up the other slots for frames in the packet, oldest first */
+    uint32_t search_from = max( needs_send_from_, uint32_t( frames_.range_begin() ) );
+    while ( p.frames.length < p.frames.capacity ) {
+      const auto next = needs_send_.find_first( search_from, next_frame_index_ );
+      if ( not next.has_value() ) {
+        search_from = next_frame_index_;
+        break;
       }
+
+      send_frame( p, next.value() );
+      search_from = next.value() + 1;
     }
+    needs_send_from_ = search_from;
   }
 
   /* make room to store the packet in flight */
@@ -149,12 +155,17 @@ void NetworkSender<FrameType>::assume_departed( const PacketSentRecord& pack, co
     return;
   }
 
+  if ( is_loss ) {
+    ewma_update( stats_.smoothed_loss, 1.0f, stats_.LOSS_ALPHA );
+  }
+
   bool frame_departed = false;
   for ( const uint32_t frame_to_mark : pack.record.frames ) {
     // frame might have been dropped or delivered already
-    if ( frame_to_mark >= frame_status_.range_begin() and frame_to_mark < frame_status_.range_end()
-         and frame_status_[frame_to_mark].outstanding and frame_status_[frame_to_mark].in_flight ) {
-      frame_status_[frame_to_mark].in_flight = false;
+    if ( frame_to_mark >= frames_.range_begin() and frame_to_mark < frames_.range_end()
+         and outstanding_.test( frame_to_mark ) and not needs_send_.test( frame_to_mark ) ) {
+      mark_needs_send( frame_to_mark );
+      num_in_flight_--;
       frame_departed = true;
     }
   }
@@ -169,91 +180,113 @@ void NetworkSender<FrameType>::assume_departed( const PacketSentRecord& pack, co
 }
 
 template<class FrameType>
-void NetworkSender<FrameType>::receive_receiver_section(
-  const typename Packet<FrameType>::ReceiverSection& receiver_section )
+void NetworkSender<FrameType>::receive_packet_ack( PacketSentRecord& pack, const uint64_t now )
 {
-  if ( frames_.range_begin() != frame_status_.range_begin() ) {
-    throw runtime_error( "NetworkSender internal error" );
-  }
-
-  if ( receiver_section.next_frame_needed >= frames_.range_end() ) {
-    stats_.bad_acks++;
+  if ( pack.acked ) {
     return;
   }
 
-  if ( receiver_section.next_frame_needed > frames_.range_begin() ) {
-    const size_t num_to_pop = receiver_section.next_frame_needed - frames_.range_begin();
-    frames_.pop( num_to_pop );
-    frame_status_.pop( num_to_pop );
+  if ( pack.assumed_lost ) {
+    stats_.packet_loss_false_positives++;
   }
 
-  optional<uint32_t> greatest_new_sack;
+  pack.acked = true;
+  ewma_update( stats_.smoothed_loss, 0.0f, stats_.LOSS_ALPHA );
 
-  const uint64_t now = Timer::timestamp_ns();
+  const int64_t time_diff = now - pack.sent_timestamp;
+  if ( time_diff <= 0 ) {
+    stats_.invalid_timestamp++;
+  } else {
+    ewma_update( stats_.smoothed_rtt, float( time_diff ), stats_.SRTT_ALPHA );
+  }
 
-  /* For each selectively ACKed packet, mark its Frames as no longer outstanding */
-  for ( const uint32_t sack : receiver_section.packets_received ) {
-    if ( sack >= packets_in_flight_.range_end() ) {
-      stats_.bad_acks++;
-      return;
+  /* mark its frames as no longer outstanding */
+  for ( const uint32_t frame_index : pack.record.frames ) {
+    if ( frame_index >= frames_.range_end() ) {
+      throw runtime_error( "NetworkSender internal error: frame >= frames_.range_end()" );
     }
 
-    if ( greatest_new_sack.has_value() ) {
-      greatest_new_sack = max( greatest_new_sack.value(), sack );
-    } else {
-      greatest_new_sack = sack;
+    if ( frame_index >= frames_.range_begin() ) {
+      mark_delivered( frame_index, frame_index + 1 );
     }
+  }
+}
 
-    if ( sack >= packets_in_flight_.range_begin() ) {
-      auto& pack = packets_in_flight_.at( sack );
-      if ( sack != pack.record.sequence_number ) {
-        throw runtime_error( "NetworkSender internal error: sack " + to_string( sack ) + " != pack.seqno "
-                             + to_string( pack.record.sequence_number ) );
-      }
+template<class FrameType>
+void NetworkSender<FrameType>::receive_receiver_section(
+  const typename Packet<FrameType>::ReceiverSection& receiver_section )
+{
+  const auto next_frame_needed = receiver_section.restore( receiver_section.next_frame_needed, next_frame_index_ );
+  const auto packets_received_end
+    = receiver_section.restore( receiver_section.packets_received_end, next_sequence_number_ );
+  if ( not next_frame_needed.has_value() or not packets_received_end.has_value() ) {
+    stats_.bad_acks++;
+    return;
+  }
 
-      if ( pack.acked ) {
-        continue;
-      }
+  if ( next_frame_needed.value() >= frames_.range_end() ) {
+    stats_.bad_acks++;
+    return;
+  }
 
-      if ( pack.assumed_lost ) {
-        stats_.packet_loss_false_positives++;
-      }
+  /* the frame runs the receiver holds can't reach past what was sent */
+  uint32_t runs_end = next_frame_needed.value();
+  for ( const auto& run : receiver_section.frame_runs ) {
+    runs_end += run.gap + run.length;
+  }
+  if ( runs_end > next_frame_index_ ) {
+    stats_.bad_acks++;
+    return;
+  }
 
-      pack.acked = true;
+  if ( next_frame_needed.value() > frames_.range_begin() ) {
+    pop_frames( next_frame_needed.value() - frames_.range_begin() );
+  }
 
-      const int64_t time_diff = now - pack.sent_timestamp;
-      if ( time_diff <= 0 ) {
-        stats_.invalid_timestamp++;
-      } else {
-        ewma_update( stats_.smoothed_rtt, float( time_diff ), stats_.SRTT_ALPHA );
-      }
+  /* mark the frames the receiver holds beyond next_frame_needed as no longer outstanding */
+  uint32_t run_begin = next_frame_needed.value();
+  for ( const auto& run : receiver_section.frame_runs ) {
+    run_begin += run.gap;
+    mark_delivered( max( run_begin, uint32_t( frames_.range_begin() ) ), run_begin + run.length );
+    run_begin += run.length;
+  }
 
-      for ( const uint32_t frame_index : pack.record.frames ) {
-        if ( frame_index >= frame_status_.range_end() ) {
-          throw runtime_error( "NetworkSender internal error: frame >= frame_status_.range_end()" );
-        }
+  if ( packets_received_end.value() == 0 ) {
+    return;
+  }
 
-        if ( frame_index >= frame_status_.range_begin() ) {
-          frame_status_.at( frame_index ) = { false, false };
-        }
+  const uint32_t greatest_new_sack = packets_received_end.value() - 1;
+  if ( greatest_new_sack >= packets_in_flight_.range_end() ) {
+    stats_.bad_acks++;
+    return;
+  }
+
+  const uint64_t now = Timer::timestamp_ns();
+
+  /* the newest packet received, and those of the 32 before it not marked missing */
+  const uint32_t window_begin = max( uint32_t( packets_in_flight_.range_begin() ),
+                                     greatest_new_sack > 32 ? greatest_new_sack - 32 : 0 );
+  if ( greatest_new_sack >= window_begin ) {
+    span<PacketSentRecord> window
+      = packets_in_flight_.region( window_begin, greatest_new_sack - window_begin + 1 );
+    for ( uint32_t sack = window_begin; sack <= greatest_new_sack; sack++ ) {
+      const uint32_t bit = greatest_new_sack - sack - 1; /* wraps around for the newest, which has no bit */
+      if ( sack == greatest_new_sack or not( receiver_section.packets_missing & ( uint32_t( 1 ) << bit ) ) ) {
+        receive_packet_ack( window[sack - window_begin], now );
       }
     }
   }
 
   /* For each packet sent "significantly" before the most recent acked packet, assume lost if not delivered */
-  if ( not greatest_new_sack.has_value() ) {
-    return;
-  }
-
-  if ( greatest_sack_.has_value() and greatest_new_sack.value() <= greatest_sack_.value() ) {
+  if ( greatest_sack_.has_value() and greatest_new_sack <= greatest_sack_.value() ) {
     return;
   }
 
   const uint32_t start_of_range_to_assume_departed = departure_adjudicated_until_seqno();
 
   uint32_t end_of_range_to_assume_departed;
-  if ( greatest_new_sack.value() > reorder_window ) {
-    end_of_range_to_assume_departed = greatest_new_sack.value() - reorder_window;
+  if ( greatest_new_sack > reorder_window ) {
+    end_of_range_to_assume_departed = greatest_new_sack - reorder_window;
   } else {
     end_of_range_to_assume_departed = packets_in_flight_.range_begin();
   }
@@ -284,3 +317,4 @@ uint32_t NetworkSender<FrameType>::departure_adjudicated_until_seqno() const
 }
 
 template class NetworkSender<AudioFrame>;
+template class NetworkSender<ForwardedAudioFrame>;
@@ -4,23 +4,29 @@
 
 #include "encoder_task.hh"
 #include "formats.hh"
+#include "ring_bitmap.hh"
 #include "typed_ring_buffer.hh"
 
 template<class FrameType>
 class NetworkSender
 {
-  struct FrameStatus
-  {
-    bool outstanding : 1;
-    bool in_flight : 1;
-
-    bool needs_send() const { return outstanding and not in_flight; }
-  };
+  static constexpr size_t frame_capacity = 8192; // 20.48 seconds
 
-  EndlessBuffer<FrameType> frames_ { 8192 }; // 20.48 seconds
-  EndlessBuffer<FrameStatus> frame_status_ { 8192 };
+  EndlessBuffer<FrameType> frames_ { frame_capacity };
   uint32_t next_frame_index_ {};
 
+  /* A frame is outstanding until it is acknowledged, and needs sending when it is outstanding but not in flight.
+     Packet assembly finds the frames to send with find-first-set, starting no earlier than needs_send_from_
+     (nothing before it needs sending), and the counts are kept as the bits change. */
+  RingBitmap<frame_capacity> outstanding_ {}, needs_send_ {};
+  uint32_t needs_send_from_ {};
+  unsigned int num_outstanding_ {}, num_in_flight_ {};
+
+  void send_frame( typename PacketRef<FrameType>::SenderSection& p, const uint32_t frame_index );
+  void mark_needs_send( const uint32_t frame_index );
+  void mark_delivered( const uint64_t begin, const uint64_t end );
+  void pop_frames( const size_t num );
+
   constexpr static uint8_t reorder_window = 2; /* 2 packets, about 5 ms */
   std::optional<uint32_t> greatest_sack_ {};
   uint32_t departure_adjudicated_until_seqno() const;
@@ -39,17 +45,20 @@ class NetworkSender
   bool need_immediate_send_ {};
 
   void assume_departed( const PacketSentRecord& pack, const bool is_loss );
+  void receive_packet_ack( PacketSentRecord& pack, const uint64_t now );
 
 public:
   struct Statistics
   {
     static constexpr float SRTT_ALPHA = 1 / 100.0;
+    static constexpr float LOSS_ALPHA = 1 / 100.0;
 
     unsigned int frames_dropped {}, empty_packets {}, bad_acks {}, packet_transmissions {},
       packet_losses_detected {}, packet_loss_false_positives {}, frames_departed_by_expiration {},
       invalid_timestamp {};
 
     float smoothed_rtt {};
+    float smoothed_loss {}; /* fraction of packets lost, averaged over about the last 100 */
 
     unsigned int packet_losses() const { return packet_losses_detected - packet_loss_false_positives; }
 
@@ -59,39 +68,52 @@ public:
 private:
   Statistics stats_ {};
 
-public:
   template<class SourceType>
-  void push_frame( SourceType& encoder )
+  void push_one_frame( SourceType& encoder )
   {
-    if ( frames_.range_begin() != frame_status_.range_begin() ) {
-      throw std::runtime_error( "NetworkSender internal error" );
-    }
-
     if ( next_frame_index_ < frames_.range_begin() ) {
       throw std::runtime_error( "NetworkSender internal error: next_frame_index_ < frames_.range_begin()" );
     }
 
-    if ( need_immediate_send_ ) {
-      throw std::runtime_error( "packet pushed but not sent" );
-    }
-
     if ( next_frame_index_ >= frames_.range_end() ) {
       const size_t frames_to_drop = next_frame_index_ - frames_.range_end() + 1;
-      frames_.pop( frames_to_drop );
-      frame_status_.pop( frames_to_drop );
+      pop_frames( frames_to_drop );
       stats_.frames_dropped += frames_to_drop;
     }
 
     frames_.at( next_frame_index_ ) = encoder.front( next_frame_index_ );
-    frame_status_.at( next_frame_index_ ) = { true, false };
+    outstanding_.set( next_frame_index_ );
+    num_outstanding_++;
+    mark_needs_send( next_frame_index_ );
     next_frame_index_++;
 
+    encoder.pop_frame();
+  }
+
+public:
+  template<class SourceType>
+  void push_frame( SourceType& encoder )
+  {
+    if ( need_immediate_send_ ) {
+      throw std::runtime_error( "packet pushed but not sent" );
+    }
+
+    push_one_frame( encoder );
     need_immediate_send_ = true;
+  }
 
-    encoder.pop_frame();
+  /* every frame the source has (a relay can have several for one packet, and packs them as room allows) */
+  template<class SourceType>
+  void push_frames( SourceType& source )
+  {
+    while ( source.has_frame() ) {
+      push_one_frame( source );
+    }
+    need_immediate_send_ = false;
   }
 
-  void set_sender_section( typename Packet<FrameType>::SenderSection& p );
+  /* the frames are left in place, so the packet must be serialized before the sender is used again */
+  void set_sender_section( typename PacketRef<FrameType>::SenderSection& p );
   void receive_receiver_section( const typename Packet<FrameType>::ReceiverSection& receiver_section );
 
   void summary( std::ostream& out ) const;
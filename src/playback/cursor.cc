@@ -1,6 +1,7 @@
 #include "cursor.hh"
 #include "ewma.hh"
 
+#include <algorithm>
 #include <iostream>
 
 using namespace std;
@@ -21,6 +22,13 @@ void Cursor::hit()
   ewma_update( stats_.quality, 1.0, ALPHA );
 }
 
+void Cursor::set_adaptive_target_lag( const float quality )
+{
+  lag_estimator_.emplace( quality );
+  min_lag_ratio_ = float( min_lag_samples_ ) / target_lag_samples_;
+  max_lag_ratio_ = float( max_lag_samples_ ) / target_lag_samples_;
+}
+
 void Cursor::setup( const size_t global_sample_index, const size_t frontier_sample_index )
 {
   /* initialize cursor if necessary */
@@ -37,6 +45,43 @@ void Cursor::sample( const PartialFrameStore<AudioFrame>& frames,
                      OpusDecoderProcess& decoder,
                      RubberBand::RubberBandStretcher& stretcher,
                      AudioSlice& output )
+{
+  sample(
+    frames,
+    frontier_sample_index,
+    [&]( const uint64_t frame_index, span<float> ch1_out, span<float> ch2_out ) {
+      if ( frames.has_value( frame_index ) ) {
+        decoder.decode( frames.at( frame_index ).value(), ch1_out, ch2_out );
+      } else {
+        decoder.decode_missing( ch1_out, ch2_out );
+      }
+    },
+    stretcher,
+    output );
+}
+
+void Cursor::sample( const PartialFrameStore<AudioFrame>& frames,
+                     const size_t frontier_sample_index,
+                     const PCMFrameCache& cache,
+                     CachedFrameDecoder& decoder,
+                     RubberBand::RubberBandStretcher& stretcher,
+                     AudioSlice& output )
+{
+  sample(
+    frames,
+    frontier_sample_index,
+    [&]( const uint64_t frame_index, span<float> ch1_out, span<float> ch2_out ) {
+      decoder.decode( cache, frames, frame_index, ch1_out, ch2_out );
+    },
+    stretcher,
+    output );
+}
+
+void Cursor::sample( const PartialFrameStore<AudioFrame>& frames,
+                     const size_t frontier_sample_index,
+                     const DecodeT& decode,
+                     RubberBand::RubberBandStretcher& stretcher,
+                     AudioSlice& output )
 {
   bool fade_in_ {};
 
@@ -62,6 +107,14 @@ void Cursor::sample( const PartialFrameStore<AudioFrame>& frames,
     }
     stats_.resets++;
     fade_in_ = true;
+
+    if ( lag_estimator_.has_value() ) {
+      lag_estimator_->played( frame_cursor_.value(), false, num_samples_output_.value() );
+    }
+  }
+
+  if ( lag_estimator_.has_value() ) {
+    lag_estimator_->observe( frames, frontier_sample_index, num_samples_output_.value() );
   }
 
   /* sample statistics */
@@ -106,22 +159,23 @@ void Cursor::sample( const PartialFrameStore<AudioFrame>& frames,
   span<float> ch1_decoded { ch1_scratch.data(), opus_frame::NUM_SAMPLES };
   span<float> ch2_decoded { ch2_scratch.data(), opus_frame::NUM_SAMPLES };
 
-  /* Do we have an Opus frame ready to decode? */
-  if ( not frames.has_value( frame_cursor ) ) {
-    /* no, so leave it as silence */
-    miss();
-    decoder.decode_missing( ch1_decoded, ch2_decoded );
-  } else {
-    /* decode a frame! */
+  /* Do we have an Opus frame ready to decode? (If not, the decoder conceals the loss.) */
+  if ( frames.has_value( frame_cursor ) ) {
     hit();
+  } else {
+    miss();
+  }
+  decode( frame_cursor, ch1_decoded, ch2_decoded );
+
+  if ( lag_estimator_.has_value() ) {
+    lag_estimator_->played( frame_cursor, frames.has_value( frame_cursor ), num_samples_output_.value() );
 
-    if ( frames.at( frame_cursor ).value().separate_channels ) {
-      decoder.decode( frames.at( frame_cursor ).value().frame1,
-                      frames.at( frame_cursor ).value().frame2,
-                      ch1_decoded,
-                      ch2_decoded );
-    } else {
-      decoder.decode_stereo( frames.at( frame_cursor ).value().frame1, ch1_decoded, ch2_decoded );
+    const auto new_target = lag_estimator_->decide( target_lag_samples_, rate_ == Rate::Steady );
+    if ( new_target.has_value() ) {
+      target_lag_samples_ = new_target.value();
+      min_lag_samples_ = min_lag_ratio_ * target_lag_samples_;
+      max_lag_samples_ = max_lag_ratio_ * target_lag_samples_;
+      stats_.target_changes++;
     }
   }
 
@@ -133,23 +187,62 @@ void Cursor::sample( const PartialFrameStore<AudioFrame>& frames,
     stats_.fades_in++;
   }
 
-  /* time-stretch */
-  array<float*, 2> decoded_audio_for_stretcher = { ch1_scratch.data(), ch2_scratch.data() };
-  stretcher.process( decoded_audio_for_stretcher.data(), opus_frame::NUM_SAMPLES, false );
+  /* keep the decoded audio for the bypass delay line and for priming the stretcher */
+  history_.ch1().region( num_samples_input_, opus_frame::NUM_SAMPLES ).copy( ch1_decoded );
+  history_.ch2().region( num_samples_input_, opus_frame::NUM_SAMPLES ).copy( ch2_decoded );
+  num_samples_input_ += opus_frame::NUM_SAMPLES;
+  history_.pop_before( num_samples_input_ - HISTORY_SAMPLES );
 
-  const int samples_available = stretcher.available();
-  if ( samples_available < 0 ) {
-    throw runtime_error( "stretcher.available() < 0" );
+  if ( not bypass_delay_.has_value() ) {
+    bypass_delay_ = stretcher.getLatency();
+    if ( bypass_delay_.value() + PRIME_SAMPLES + 2 * opus_frame::NUM_SAMPLES > HISTORY_SAMPLES ) {
+      throw runtime_error( "stretcher latency exceeds Cursor history" );
+    }
   }
-  const size_t samples_out = samples_available;
 
-  if ( samples_out > output.ch1.size() ) {
-    throw runtime_error( "stretcher output exceeds available output size" );
-  }
+  /* this frame, delayed as the stretcher would delay it */
+  const uint64_t bypass_begin = num_samples_input_ - opus_frame::NUM_SAMPLES - bypass_delay_.value();
+  const span_view<float> ch1_bypass = history_.ch1().region( bypass_begin, opus_frame::NUM_SAMPLES );
+  const span_view<float> ch2_bypass = history_.ch2().region( bypass_begin, opus_frame::NUM_SAMPLES );
+
+  size_t samples_out;
+  const bool want_stretching = rate_ != Rate::Steady;
+  if ( not stretching_ and not want_stretching ) {
+    /* steady: skip the stretcher */
+    copy( ch1_bypass.begin(), ch1_bypass.end(), output.ch1.begin() );
+    copy( ch2_bypass.begin(), ch2_bypass.end(), output.ch2.begin() );
+    samples_out = opus_frame::NUM_SAMPLES;
+    stats_.frames_bypassed++;
+  } else {
+    if ( not stretching_ ) {
+      start_stretching( stretcher );
+    }
 
-  array<float*, 2> stretched_audio_from_stretcher = { output.ch1.data(), output.ch2.data() };
-  if ( samples_out != stretcher.retrieve( stretched_audio_from_stretcher.data(), samples_out ) ) {
-    throw runtime_error( "unexpected output from stretcher.retrieve()" );
+    /* time-stretch */
+    array<float*, 2> decoded_audio_for_stretcher = { ch1_scratch.data(), ch2_scratch.data() };
+    stretcher.process( decoded_audio_for_stretcher.data(), opus_frame::NUM_SAMPLES, false );
+    samples_out = retrieve_from_stretcher( stretcher, output );
+    stats_.frames_stretched++;
+
+    /* crossfade across the switch in either direction */
+    if ( not stretching_ ) {
+      for ( size_t i = 0; i < min( samples_out, size_t( opus_frame::NUM_SAMPLES ) ); i++ ) {
+        const float weight = float( i ) / float( opus_frame::NUM_SAMPLES );
+        output.ch1[i] = ( 1 - weight ) * ch1_bypass[i] + weight * output.ch1[i];
+        output.ch2[i] = ( 1 - weight ) * ch2_bypass[i] + weight * output.ch2[i];
+      }
+      stretching_ = true;
+    } else if ( not want_stretching ) {
+      for ( size_t i = 0; i < opus_frame::NUM_SAMPLES; i++ ) {
+        const float weight = float( i ) / float( opus_frame::NUM_SAMPLES );
+        const float ch1_stretched = i < samples_out ? output.ch1[i] : ch1_bypass[i];
+        const float ch2_stretched = i < samples_out ? output.ch2[i] : ch2_bypass[i];
+        output.ch1[i] = ( 1 - weight ) * ch1_stretched + weight * ch1_bypass[i];
+        output.ch2[i] = ( 1 - weight ) * ch2_stretched + weight * ch2_bypass[i];
+      }
+      samples_out = opus_frame::NUM_SAMPLES;
+      stretching_ = false;
+    }
   }
 
   output.sample_index = num_samples_output_.value();
@@ -160,10 +253,69 @@ void Cursor::sample( const PartialFrameStore<AudioFrame>& frames,
   ++frame_cursor_.value();
 }
 
+void Cursor::start_stretching( RubberBand::RubberBandStretcher& stretcher )
+{
+  const double time_ratio = stretcher.getTimeRatio();
+  stretcher.reset();
+  stretcher.setTimeRatio( 1.0 );
+
+  /* Replay audio that already went out through the bypass, so the stretcher's window is full. Its output
+     lines up with the bypass once the replayed part is thrown away. */
+  const uint64_t prime_end = num_samples_input_ - opus_frame::NUM_SAMPLES;
+  const size_t prime_length = bypass_delay_.value() + PRIME_SAMPLES;
+  stretcher_output_to_discard_ = prime_length;
+
+  AudioSlice discarded;
+  for ( uint64_t i = prime_end - prime_length; i < prime_end; i += opus_frame::NUM_SAMPLES ) {
+    const size_t length = min( uint64_t( opus_frame::NUM_SAMPLES ), prime_end - i );
+    array<const float*, 2> replay = { history_.ch1().region( i, length ).data(),
+                                      history_.ch2().region( i, length ).data() };
+    stretcher.process( replay.data(), length, false );
+    retrieve_from_stretcher( stretcher, discarded );
+  }
+
+  stretcher.setTimeRatio( time_ratio );
+}
+
+size_t Cursor::retrieve_from_stretcher( RubberBand::RubberBandStretcher& stretcher, AudioSlice& output )
+{
+  array<float*, 2> stretched_audio_from_stretcher = { output.ch1.data(), output.ch2.data() };
+
+  while ( true ) {
+    const int samples_available = stretcher.available();
+    if ( samples_available < 0 ) {
+      throw runtime_error( "stretcher.available() < 0" );
+    }
+    const size_t samples_out = samples_available;
+
+    if ( stretcher_output_to_discard_ == 0 ) {
+      if ( samples_out > output.ch1.size() ) {
+        throw runtime_error( "stretcher output exceeds available output size" );
+      }
+
+      if ( samples_out != stretcher.retrieve( stretched_audio_from_stretcher.data(), samples_out ) ) {
+        throw runtime_error( "unexpected output from stretcher.retrieve()" );
+      }
+
+      return samples_out;
+    }
+
+    const size_t samples_to_discard = min( { samples_out, output.ch1.size(), stretcher_output_to_discard_ } );
+    if ( samples_to_discard == 0 ) {
+      return 0;
+    }
+
+    if ( samples_to_discard != stretcher.retrieve( stretched_audio_from_stretcher.data(), samples_to_discard ) ) {
+      throw runtime_error( "unexpected output from stretcher.retrieve()" );
+    }
+    stretcher_output_to_discard_ -= samples_to_discard;
+  }
+}
+
 void Cursor::summary( ostream& out ) const
 {
   out << "Cursor: ";
-  out << " target lag=" << target_lag_samples_;
+  out << " target lag=" << target_lag_samples_ << ( adaptive() ? " (adaptive)" : "" );
   out << " actual lag=" << stats_.mean_margin_to_frontier;
   out << " quality=" << fixed << setprecision( 5 ) << stats_.quality;
   out << " time ratio=" << fixed << setprecision( 5 ) << stats_.mean_time_ratio;
@@ -172,6 +324,7 @@ void Cursor::summary( ostream& out ) const
   out << " rate=" << int( rate_ );
   out << " resets=" << stats_.resets;
   out << " fades=" << stats_.fades_in;
+  out << " stretched=" << stats_.frames_stretched << "/" << stats_.frames_stretched + stats_.frames_bypassed;
   out << "\n";
 }
 
@@ -185,6 +338,10 @@ void Cursor::json_summary( Json::Value& root ) const
   root["resets"] = stats_.resets;
   root["compressions"] = stats_.compress_starts;
   root["expansions"] = stats_.expand_starts;
+  root["adaptive"] = adaptive();
+  if ( lag_estimator_.has_value() ) {
+    lag_estimator_->json_summary( root );
+  }
 }
 
 void Cursor::default_json_summary( Json::Value& root )
@@ -197,6 +354,7 @@ void Cursor::default_json_summary( Json::Value& root )
   root["resets"] = 0;
   root["compressions"] = 0;
   root["expansions"] = 0;
+  root["adaptive"] = false;
 }
 
 size_t Cursor::ok_to_pop( const PartialFrameStore<AudioFrame>& frames ) const
@@ -1,9 +1,13 @@
 #pragma once
 
+#include "audio_buffer.hh"
 #include "connection.hh"
 #include "decoder_process.hh"
+#include "lag_estimator.hh"
 #include "opus.hh"
+#include "pcm_frame_cache.hh"
 
+#include <functional>
 #include <json/json.h>
 #include <rubberband/RubberBandStretcher.h>
 
@@ -28,11 +32,27 @@ class Cursor
     unsigned int compress_starts, compress_stops;
     unsigned int expand_starts, expand_stops;
     unsigned int fades_in;
+    unsigned int frames_bypassed, frames_stretched;
+    unsigned int target_changes;
   } stats_ {};
 
   std::optional<size_t> num_samples_output_ {};
   std::optional<uint64_t> frame_cursor_ {};
 
+  /* if present, the target lag follows the observed arrival times (and the min/max lags keep their ratio to it) */
+  std::optional<LagEstimator> lag_estimator_ {};
+  float min_lag_ratio_ {}, max_lag_ratio_ {};
+
+  /* While steady, decoded audio bypasses the stretcher through a delay line as long as the stretcher's latency,
+     so the output lines up the same way in both modes. */
+  static constexpr size_t HISTORY_SAMPLES = 4096;
+  static constexpr size_t PRIME_SAMPLES = 4 * opus_frame::NUM_SAMPLES; /* replayed beyond the latency */
+  ChannelPair history_ { 2 * HISTORY_SAMPLES }; /* decoded audio, indexed by num_samples_input_ */
+  uint64_t num_samples_input_ { HISTORY_SAMPLES };
+  std::optional<size_t> bypass_delay_ {};
+  bool stretching_ {};
+  size_t stretcher_output_to_discard_ {}; /* output from priming the stretcher with audio already played */
+
   uint64_t cursor_location() const { return frame_cursor_.value() * opus_frame::NUM_SAMPLES; }
   uint64_t greatest_read_location() const { return cursor_location() + opus_frame::NUM_SAMPLES - 1; }
 
@@ -55,14 +75,36 @@ public:
     span_view<float> ch2_span() const { return { ch2.data(), length }; }
   };
 
+private:
+  using DecodeT = std::function<void( const uint64_t frame_index, span<float> ch1_out, span<float> ch2_out )>;
+
+  void sample( const PartialFrameStore<AudioFrame>& frames,
+               const size_t frontier_sample_index,
+               const DecodeT& decode,
+               RubberBand::RubberBandStretcher& stretcher,
+               AudioSlice& output );
+
+  void start_stretching( RubberBand::RubberBandStretcher& stretcher );
+  size_t retrieve_from_stretcher( RubberBand::RubberBandStretcher& stretcher, AudioSlice& output );
+
+public:
   void sample( const PartialFrameStore<AudioFrame>& frames,
                const size_t frontier_sample_index,
                OpusDecoderProcess& decoder,
                RubberBand::RubberBandStretcher& stretcher,
                AudioSlice& output );
 
+  /* same, but playing PCM decoded once for all the Cursors on a connection */
+  void sample( const PartialFrameStore<AudioFrame>& frames,
+               const size_t frontier_sample_index,
+               const PCMFrameCache& cache,
+               CachedFrameDecoder& decoder,
+               RubberBand::RubberBandStretcher& stretcher,
+               AudioSlice& output );
+
   void setup( const size_t global_sample_index, const size_t frontier_sample_index );
   bool initialized() const { return frame_cursor_.has_value(); }
+  bool stretching() const { return stretching_; }
   void summary( std::ostream& out ) const;
 
   size_t ok_to_pop( const PartialFrameStore<AudioFrame>& frames ) const;
@@ -74,8 +116,13 @@ public:
     target_lag_samples_ = target_samples;
     min_lag_samples_ = min_samples;
     max_lag_samples_ = max_samples;
+    lag_estimator_.reset();
   }
 
+  /* pick the smallest target lag at which this fraction of frames arrive in time */
+  void set_adaptive_target_lag( const float quality );
+  bool adaptive() const { return lag_estimator_.has_value(); }
+
   size_t num_samples_output() const { return num_samples_output_.value(); }
 
   void json_summary( Json::Value& root ) const;
@@ -1,4 +1,5 @@
 #include "decoder_process.hh"
+#include "mix_kernels.hh"
 #include "spans.hh"
 
 using namespace std;
@@ -27,10 +28,95 @@ void OpusDecoderProcess::decode_stereo( const opus_frame& frame, span<float> ch1
 
 void OpusDecoderProcess::decode_missing( span<float> ch1_out, span<float> ch2_out )
 {
-  if ( dec2_.has_value() ) {
+  if ( last_was_silent_ ) {
+    fill( ch1_out.begin(), ch1_out.end(), 0 );
+    fill( ch2_out.begin(), ch2_out.end(), 0 );
+  } else if ( last_was_multistream_ ) {
+    decode_multistream( nullptr, ch1_out, ch2_out );
+  } else if ( dec2_.has_value() ) {
     dec1_.decode_missing( ch1_out );
     dec2_->decode_missing( ch2_out );
   } else {
     dec1_.decode_missing_stereo( ch1_out, ch2_out );
   }
 }
+
+void OpusDecoderProcess::decode( const AudioFrame& frame, span<float> ch1_out, span<float> ch2_out )
+{
+  last_was_silent_ = frame.silent();
+  if ( last_was_silent_ ) {
+    fill( ch1_out.begin(), ch1_out.end(), 0 );
+    fill( ch2_out.begin(), ch2_out.end(), 0 );
+    return;
+  }
+
+  if ( frame.multistream() ) {
+    decode_multistream( &frame, ch1_out, ch2_out );
+    return;
+  }
+  last_was_multistream_ = false;
+
+  if ( frame.separate_channels ) {
+    decode( frame.frame1, frame.frame2, ch1_out, ch2_out );
+  } else {
+    decode_stereo( frame.frame1, ch1_out, ch2_out );
+  }
+}
+
+void OpusDecoderProcess::copy_state_from( const OpusDecoderProcess& other )
+{
+  if ( dec2_.has_value() != other.dec2_.has_value() ) {
+    throw runtime_error( "OpusDecoderProcess::copy_state_from: mismatched channel layouts" );
+  }
+
+  dec1_.copy_state_from( other.dec1_ );
+  if ( dec2_.has_value() ) {
+    dec2_->copy_state_from( other.dec2_.value() );
+  }
+
+  if ( other.multistream_.has_value() ) {
+    if ( not multistream_.has_value() or multistream_->channels() != other.multistream_->channels() ) {
+      multistream_.emplace( 48000, other.multistream_->channels() );
+    }
+    multistream_->copy_state_from( other.multistream_.value() );
+  } else {
+    multistream_.reset();
+  }
+  last_was_multistream_ = other.last_was_multistream_;
+  last_was_silent_ = other.last_was_silent_;
+}
+
+void OpusDecoderProcess::decode_multistream( const AudioFrame* frame, span<float> ch1_out, span<float> ch2_out )
+{
+  constexpr size_t NUM_SAMPLES = opus_multistream_frame::NUM_SAMPLES;
+
+  if ( frame and ( not multistream_.has_value() or multistream_->channels() != frame->multistream_channels ) ) {
+    multistream_.emplace( 48000, frame->multistream_channels );
+  }
+  last_was_multistream_ = true;
+
+  const size_t channels = multistream_.value().channels();
+  array<float, opus_multistream_frame::MAX_CHANNELS * NUM_SAMPLES> interleaved;
+  array<float, NUM_SAMPLES> channel;
+
+  if ( frame ) {
+    opus_multistream_frame packet;
+    frame->get_multistream( packet );
+    multistream_->decode( &packet, { interleaved.data(), channels * NUM_SAMPLES } );
+  } else {
+    multistream_->decode( nullptr, { interleaved.data(), channels * NUM_SAMPLES } );
+  }
+
+  /* downmix: the channels pair up left and right, and an unpaired last channel goes to both sides */
+  fill( ch1_out.begin(), ch1_out.end(), 0 );
+  fill( ch2_out.begin(), ch2_out.end(), 0 );
+  for ( size_t c = 0; c < channels; c++ ) {
+    for ( size_t i = 0; i < NUM_SAMPLES; i++ ) {
+      channel[i] = interleaved[channels * i + c];
+    }
+
+    const bool unpaired = ( c + 1 == channels ) and ( c % 2 == 0 );
+    const float left = unpaired or c % 2 == 0, right = unpaired or c % 2 == 1;
+    mix_accumulate( { channel.data(), NUM_SAMPLES }, left, right, ch1_out, ch2_out );
+  }
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "formats.hh"
 #include "opus.hh"
 #include "spans.hh"
 
@@ -10,6 +11,13 @@ class OpusDecoderProcess
   OpusDecoder dec1_;
   std::optional<OpusDecoder> dec2_;
 
+  /* for multistream frames (made to match the first one), downmixed to stereo */
+  std::optional<OpusMSDecoder> multistream_ {};
+  bool last_was_multistream_ {}; /* so concealment continues with the same decoder */
+  bool last_was_silent_ {};      /* and a missing frame after silent ones is silent too */
+
+  void decode_multistream( const AudioFrame* frame, span<float> ch1_out, span<float> ch2_out );
+
 public:
   OpusDecoderProcess( const bool independent_channels );
 
@@ -18,4 +26,9 @@ public:
   void decode_stereo( const opus_frame& frame, span<float> ch1_out, span<float> ch2_out );
 
   void decode_missing( span<float> ch1_out, span<float> ch2_out );
+
+  /* decode any kind of AudioFrame */
+  void decode( const AudioFrame& frame, span<float> ch1_out, span<float> ch2_out );
+
+  void copy_state_from( const OpusDecoderProcess& other );
 };
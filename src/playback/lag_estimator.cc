@@ -0,0 +1,136 @@
+#include "lag_estimator.hh"
+
+#include <algorithm>
+
+using namespace std;
+
+static constexpr uint32_t MIN_TARGET_LAG = 2 * opus_frame::NUM_SAMPLES;
+static constexpr uint32_t MAX_TARGET_LAG = 9600;
+
+LagEstimator::LagEstimator( const float quality )
+  : quality_( quality )
+{}
+
+void LagEstimator::observe( const PartialFrameStore<AudioFrame>& frames,
+                            const uint64_t frontier_sample_index,
+                            const uint64_t now )
+{
+  /* frames the frontier has passed since last time */
+  const uint64_t first = max( next_frame_to_observe_, uint64_t( arrival_times_.range_begin() ) );
+  const uint64_t last
+    = min( frontier_sample_index / opus_frame::NUM_SAMPLES, uint64_t( arrival_times_.range_end() ) );
+  for ( uint64_t frame_index = first; frame_index < last; frame_index++ ) {
+    if ( frames.has_value( frame_index ) ) {
+      arrival_times_.at( frame_index ) = now;
+    } else {
+      frames_not_yet_arrived_.push_back( frame_index );
+    }
+  }
+  next_frame_to_observe_ = max( next_frame_to_observe_, last );
+
+  /* holes that have been filled in since (or that the Cursor has given up on) */
+  frames_not_yet_arrived_.erase( remove_if( frames_not_yet_arrived_.begin(),
+                                            frames_not_yet_arrived_.end(),
+                                            [&]( const uint64_t frame_index ) {
+                                              if ( frame_index < arrival_times_.range_begin() ) {
+                                                return true;
+                                              }
+                                              if ( frames.has_value( frame_index ) ) {
+                                                arrival_times_.at( frame_index ) = now;
+                                                return true;
+                                              }
+                                              return false;
+                                            } ),
+                                 frames_not_yet_arrived_.end() );
+}
+
+void LagEstimator::add_to_histogram( const size_t bucket )
+{
+  /* exponential decay, by growing the weight of new observations instead of shrinking the old ones */
+  weight_ /= 1 - DECAY;
+  slack_histogram_.at( bucket ) += weight_;
+  total_ += weight_;
+
+  if ( weight_ > 1e20 ) {
+    for ( auto& x : slack_histogram_ ) {
+      x /= weight_;
+    }
+    total_ /= weight_;
+    weight_ = 1.0;
+  }
+}
+
+void LagEstimator::played( const uint64_t frame_index, const bool hit, const uint64_t now )
+{
+  if ( not hit ) {
+    add_to_histogram( 0 );
+  } else if ( frame_index >= arrival_times_.range_begin() and frame_index < arrival_times_.range_end()
+              and arrival_times_.at( frame_index ).has_value() ) {
+    const uint64_t slack = now - min( now, arrival_times_.at( frame_index ).value() );
+    add_to_histogram( 1 + min( slack / BUCKET_SAMPLES, uint64_t( NUM_BUCKETS - 2 ) ) );
+  }
+
+  arrival_times_.pop_before( frame_index + 1 );
+  frames_since_decision_++;
+}
+
+optional<uint32_t> LagEstimator::quantile() const
+{
+  const float threshold = ( 1 - quality_ ) * total_;
+  float cumulative = 0;
+  for ( size_t bucket = 0; bucket < NUM_BUCKETS; bucket++ ) {
+    cumulative += slack_histogram_[bucket];
+    if ( cumulative > threshold ) {
+      if ( bucket == 0 ) {
+        return {};
+      }
+      return ( bucket - 1 ) * BUCKET_SAMPLES;
+    }
+  }
+
+  return {};
+}
+
+optional<uint32_t> LagEstimator::decide( const uint32_t target_lag_samples, const bool steady )
+{
+  if ( frames_since_decision_ < DECISION_INTERVAL or total_ == 0 ) {
+    return {};
+  }
+  frames_since_decision_ = 0;
+
+  slack_quantile_ = quantile();
+
+  uint32_t new_target;
+  if ( not slack_quantile_.has_value() ) {
+    /* too many frames missed their deadline: back off quickly */
+    new_target = target_lag_samples + max( uint32_t( opus_frame::NUM_SAMPLES ), target_lag_samples / 4 );
+  } else {
+    /* keep one frame of slack; tighten slowly, and only once the Cursor has settled at its current target */
+    const int64_t wanted = int64_t( target_lag_samples ) - slack_quantile_.value() + opus_frame::NUM_SAMPLES;
+    if ( wanted > target_lag_samples ) {
+      new_target = wanted;
+    } else if ( steady and wanted < target_lag_samples ) {
+      new_target = max( wanted, int64_t( target_lag_samples ) - opus_frame::NUM_SAMPLES );
+    } else {
+      return {};
+    }
+  }
+
+  new_target = clamp( new_target, MIN_TARGET_LAG, MAX_TARGET_LAG );
+  if ( new_target == target_lag_samples ) {
+    return {};
+  }
+
+  /* what was observed at the old target says little about the new one */
+  slack_histogram_.fill( 0 );
+  total_ = 0;
+  weight_ = 1.0;
+
+  return new_target;
+}
+
+void LagEstimator::json_summary( Json::Value& root ) const
+{
+  root["quality_target"] = quality_;
+  root["slack_quantile"] = slack_quantile_.has_value() ? int( slack_quantile_.value() ) : -1;
+}
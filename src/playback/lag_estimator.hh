@@ -0,0 +1,51 @@
+#pragma once
+
+#include "formats.hh"
+#include "receiver.hh"
+
+#include <array>
+#include <json/json.h>
+#include <vector>
+
+/* Watches when each frame arrives and how long it then waited before the Cursor played it, and picks the
+   smallest target lag at which (nearly) every frame would still have arrived in time. */
+class LagEstimator
+{
+  static constexpr size_t BUCKET_SAMPLES = 30;
+  static constexpr size_t NUM_BUCKETS = 320; /* bucket 0: frames that missed their deadline */
+  static constexpr float DECAY = 1.0 / 2000; /* per frame played */
+  static constexpr unsigned int DECISION_INTERVAL = 400;
+
+  float quality_; /* fraction of frames that should arrive before they are played */
+
+  EndlessBuffer<std::optional<uint64_t>> arrival_times_ { 4096 }; /* indexed by frame */
+  uint64_t next_frame_to_observe_ {};
+  std::vector<uint64_t> frames_not_yet_arrived_ {};
+
+  /* decaying histogram of slack (time between arrival and playback), in samples */
+  std::array<float, NUM_BUCKETS> slack_histogram_ {};
+  float weight_ { 1.0 };
+  float total_ {};
+  unsigned int frames_since_decision_ {};
+
+  std::optional<uint32_t> slack_quantile_ {}; /* most recent decision; empty if frames were missed */
+
+  void add_to_histogram( const size_t bucket );
+  std::optional<uint32_t> quantile() const;
+
+public:
+  explicit LagEstimator( const float quality );
+
+  /* note the frames that have arrived by now (the output sample clock) */
+  void observe( const PartialFrameStore<AudioFrame>& frames,
+                const uint64_t frontier_sample_index,
+                const uint64_t now );
+
+  /* the Cursor played (or concealed) a frame now */
+  void played( const uint64_t frame_index, const bool hit, const uint64_t now );
+
+  /* every so often, and while the Cursor is steady, a new target lag */
+  std::optional<uint32_t> decide( const uint32_t target_lag_samples, const bool steady );
+
+  void json_summary( Json::Value& root ) const;
+};
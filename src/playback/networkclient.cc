@@ -1,4 +1,5 @@
 #include "networkclient.hh"
+#include "mix_kernels.hh"
 #include "timestamp.hh"
 
 using namespace std;
@@ -6,15 +7,25 @@ using namespace std::chrono;
 
 using Option = RubberBand::RubberBandStretcher::Option;
 
+static constexpr auto stretcher_options = Option::OptionProcessRealTime | Option::OptionThreadingNever
+                                          | Option::OptionPitchHighConsistency | Option::OptionWindowShort;
+
+static constexpr uint64_t FEED_TIMEOUT_NS = 1'000'000'000; /* a performer who has stopped sending */
+static constexpr uint32_t FEED_RESTART_FRAMES = 400;        /* one second */
+static constexpr float FEED_GAIN = 2.0;                     /* as the server's board would mix them */
+
 NetworkClient::NetworkSession::NetworkSession( const uint8_t node_id,
                                                const KeyPair& session_key,
                                                const Address& destination )
   : connection( node_id, 0, CryptoSession( session_key.uplink, session_key.downlink ), destination )
   , cursor( 960, 120, 1920 )
-{}
+{
+  cursor.set_adaptive_target_lag( 0.99 );
+}
 
 void NetworkClient::NetworkSession::transmit_frame( OpusEncoderProcess& source, UDPSocket& socket )
 {
+  source.set_expected_loss( connection.sender_stats().smoothed_loss );
   connection.push_frame( source );
   connection.send_packet( socket );
 }
@@ -56,6 +67,156 @@ void NetworkClient::NetworkSession::summary( std::ostream& out ) const
   connection.summary( out );
 }
 
+NetworkClient::ForwardedSession::Feed::Feed()
+  : stretcher( 48000, 2, stretcher_options )
+{
+  stretcher.setMaxProcessSize( opus_frame::NUM_SAMPLES );
+  stretcher.calculateStretch();
+  cursor.set_adaptive_target_lag( 0.99 );
+}
+
+void NetworkClient::ForwardedSession::Feed::add( const AudioFrame& frame )
+{
+  if ( frame.frame_index < frames.range_begin() ) {
+    return; /* too late to play */
+  }
+
+  if ( frame.frame_index >= frames.range_end() ) {
+    frames.pop( frame.frame_index - frames.range_end() + 1 );
+  }
+
+  auto& dest = frames.at( frame.frame_index );
+  if ( not dest.has_value() ) {
+    dest = frame;
+  }
+
+  unreceived_beyond_this_frame_index = max( unreceived_beyond_this_frame_index, frame.frame_index + 1 );
+  last_arrival = Timer::timestamp_ns();
+}
+
+void NetworkClient::ForwardedSession::Feed::decode( const size_t decode_cursor )
+{
+  const size_t frontier_sample_index = unreceived_beyond_this_frame_index * opus_frame::NUM_SAMPLES;
+
+  cursor.setup( decode_cursor, frontier_sample_index );
+
+  Cursor::AudioSlice audio;
+
+  while ( cursor.initialized() and decode_cursor > cursor.num_samples_output() ) {
+    cursor.sample( frames, frontier_sample_index, decoder, stretcher, audio );
+
+    if ( audio.good ) {
+      auto target = output.region( audio.sample_index, audio.length );
+      target.ch1.copy( audio.ch1_span() );
+      target.ch2.copy( audio.ch2_span() );
+    }
+  }
+
+  frames.pop( cursor.ok_to_pop( frames ) );
+}
+
+NetworkClient::ForwardedSession::ForwardedSession( const uint8_t node_id,
+                                                   const KeyPair& session_key,
+                                                   const Address& destination )
+  : connection( node_id, 0, CryptoSession( session_key.uplink, session_key.downlink ), destination )
+{}
+
+void NetworkClient::ForwardedSession::transmit_frame( OpusEncoderProcess& source, UDPSocket& socket )
+{
+  source.set_expected_loss( connection.sender_stats().smoothed_loss );
+  connection.push_frame( source );
+  connection.send_packet( socket );
+}
+
+void NetworkClient::ForwardedSession::network_receive( const Ciphertext& ciphertext )
+{
+  if ( not connection.receive_packet( ciphertext ) ) {
+    return;
+  }
+
+  /* sort the new frames out by performer (frames beyond a hole stay in the receiver until it fills) */
+  const auto& frames = connection.frames();
+  sorted_.pop_before( frames.range_begin() );
+  for ( uint32_t frame_index = frames.range_begin();
+        frame_index < connection.unreceived_beyond_this_frame_index();
+        frame_index++ ) {
+    if ( not frames.has_value( frame_index ) or sorted_.at( frame_index ) ) {
+      continue;
+    }
+    sorted_.at( frame_index ) = true;
+
+    /* a performer who has started a new session numbers its frames from zero again */
+    const ForwardedAudioFrame& forwarded = frames.at( frame_index ).value();
+    auto feed = feeds.find( forwarded.source );
+    if ( feed != feeds.end() and forwarded.frame.frame_index < FEED_RESTART_FRAMES
+         and forwarded.frame.frame_index + FEED_RESTART_FRAMES < feed->second.frames.range_begin() ) {
+      feeds.erase( feed );
+      feed = feeds.end();
+    }
+    if ( feed == feeds.end() ) {
+      feed = feeds.try_emplace( forwarded.source ).first;
+    }
+    feed->second.add( forwarded.frame );
+  }
+
+  connection.pop_frames( connection.next_frame_needed() - frames.range_begin() );
+  sorted_.pop_before( frames.range_begin() );
+}
+
+void NetworkClient::ForwardedSession::decode( const size_t decode_cursor, ChannelPair& output )
+{
+  if ( decode_cursor < opus_frame::NUM_SAMPLES ) {
+    return;
+  }
+
+  /* mix the block before the decode cursor (still untouched, so silent) */
+  const size_t block_start = decode_cursor - opus_frame::NUM_SAMPLES;
+  auto target = output.clipped_region( block_start, opus_frame::NUM_SAMPLES );
+
+  const uint64_t now = Timer::timestamp_ns();
+  for ( auto it = feeds.begin(); it != feeds.end(); ) {
+    Feed& feed = it->second;
+    if ( feed.last_arrival + FEED_TIMEOUT_NS < now ) {
+      it = feeds.erase( it );
+      continue;
+    }
+
+    feed.output.pop_before( block_start ); /* a new feed's buffer starts at zero */
+    feed.decode( decode_cursor );
+
+    const auto source = feed.output.region( block_start + target.offset, target.size() );
+    mix_accumulate( source.ch1, FEED_GAIN, FEED_GAIN, target.ch1, target.ch2 );
+    mix_accumulate( source.ch2, FEED_GAIN, FEED_GAIN, target.ch1, target.ch2 );
+
+    ++it;
+  }
+}
+
+void NetworkClient::ForwardedSession::summary( ostream& out ) const
+{
+  for ( const auto& [source, feed] : feeds ) {
+    out << "#" << int( source ) << ": ";
+    feed.cursor.summary( out );
+  }
+  connection.summary( out );
+}
+
+void NetworkClient::ForwardedSession::json_summary( Json::Value& root ) const
+{
+  for ( const auto& [source, feed] : feeds ) {
+    feed.cursor.json_summary( root[to_string( source )] );
+  }
+}
+
+void NetworkClient::ForwardedSession::set_cursor_lag( const uint16_t target_samples,
+                                                      const uint16_t min_samples,
+                                                      const uint16_t max_samples )
+{
+  for ( auto& [source, feed] : feeds ) {
+    feed.cursor.set_target_lag( target_samples, min_samples, max_samples );
+  }
+}
+
 void NetworkClient::process_keyreply( const Ciphertext& ciphertext )
 {
   /* decrypt */
@@ -69,7 +230,15 @@ void NetworkClient::process_keyreply( const Ciphertext& ciphertext )
       p.clear_error();
       return;
     }
-    session_.emplace( keys.id, keys.key_pair, server_ );
+    /* a server that doesn't name a wire format (or only answered our empty request) gets the Original */
+    const WireFormat format = keys.wire_format.value_or( WireFormat::Original );
+    if ( forwarded_ ) {
+      forwarded_session_.emplace( keys.id, keys.key_pair, server_ );
+      forwarded_session_->connection.set_wire_format( format );
+    } else {
+      session_.emplace( keys.id, keys.key_pair, server_ );
+      session_->connection.set_wire_format( format );
+    }
     stats_.new_sessions++;
   } else {
     stats_.bad_packets++;
@@ -80,14 +249,13 @@ NetworkClient::NetworkClient( const Address& server,
                               const LongLivedKey& key,
                               shared_ptr<OpusEncoderProcess> source,
                               shared_ptr<AudioDeviceTask> dest,
-                              EventLoop& loop )
+                              EventLoop& loop,
+                              const bool forwarded )
   : server_( server )
   , name_( key.name() )
   , long_lived_crypto_( key.key_pair().uplink, key.key_pair().downlink, true )
-  , stretcher_( 48000,
-                2,
-                Option::OptionProcessRealTime | Option::OptionThreadingNever | Option::OptionPitchHighConsistency
-                  | Option::OptionWindowShort )
+  , forwarded_( forwarded )
+  , stretcher_( 48000, 2, stretcher_options )
   , source_( source )
   , dest_( dest )
   , next_key_request_( steady_clock::now() )
@@ -98,13 +266,19 @@ NetworkClient::NetworkClient( const Address& server,
 
   loop.add_rule(
     "network transmit",
-    [&] { session_->transmit_frame( *source_, socket_ ); },
-    [&] { return source_->has_frame() and session_.has_value(); } );
+    [&] {
+      if ( session_.has_value() ) {
+        session_->transmit_frame( *source_, socket_ );
+      } else {
+        forwarded_session_->transmit_frame( *source_, socket_ );
+      }
+    },
+    [&] { return source_->has_frame() and has_session(); } );
 
   loop.add_rule(
     "discard audio",
     [&] { source_->pop_frame(); },
-    [&] { return source_->has_frame() and not session_.has_value(); } );
+    [&] { return source_->has_frame() and not has_session(); } );
 
   loop.add_rule( "network receive", socket_, Direction::In, [&] {
     Address src { nullptr, 0 };
@@ -114,13 +288,15 @@ NetworkClient::NetworkClient( const Address& server,
       const uint8_t node_id = ciphertext.as_string_view().back();
       switch ( node_id ) {
         case uint8_t( KeyMessage::keyreq_server_id ):
-          if ( not session_.has_value() ) {
+          if ( not has_session() ) {
             process_keyreply( ciphertext );
           }
           break;
         case 0:
           if ( session_.has_value() ) {
             session_->network_receive( ciphertext );
+          } else if ( forwarded_session_.has_value() ) {
+            forwarded_session_->network_receive( ciphertext );
           }
           break;
         default:
@@ -135,35 +311,54 @@ NetworkClient::NetworkClient( const Address& server,
   loop.add_rule(
     "decode",
     [&] {
-      session_->decode( decode_cursor_, decoder_, stretcher_, dest_->playback() );
+      if ( session_.has_value() ) {
+        session_->decode( decode_cursor_, decoder_, stretcher_, dest_->playback() );
+      } else {
+        forwarded_session_->decode( decode_cursor_, dest_->playback() );
+      }
+      dest_->commit_playback( decode_cursor_ );
       decode_cursor_ += opus_frame::NUM_SAMPLES;
 
-      if ( session_->connection.sender_stats().last_good_ack_ts + 4'000'000'000 < Timer::timestamp_ns() ) {
+      const auto& sender_stats = session_.has_value() ? session_->connection.sender_stats()
+                                                      : forwarded_session_->connection.sender_stats();
+      if ( sender_stats.last_good_ack_ts + 4'000'000'000 < Timer::timestamp_ns() ) {
         stats_.timeouts++;
         session_.reset();
+        forwarded_session_.reset();
       }
     },
-    [&] { return session_.has_value() and ( dest_->cursor() + opus_frame::NUM_SAMPLES + 60 >= decode_cursor_ ); } );
+    [&] { return has_session() and ( dest_->cursor() + opus_frame::NUM_SAMPLES + 60 >= decode_cursor_ ); } );
 
   loop.add_rule(
     "play silence",
-    [&] { decode_cursor_ += opus_frame::NUM_SAMPLES; },
     [&] {
-      return ( !session_.has_value() ) and ( dest_->cursor() + opus_frame::NUM_SAMPLES + 60 >= decode_cursor_ );
+      decode_cursor_ += opus_frame::NUM_SAMPLES;
+      dest_->commit_playback( decode_cursor_ );
+    },
+    [&] {
+      return ( !has_session() ) and ( dest_->cursor() + opus_frame::NUM_SAMPLES + 60 >= decode_cursor_ );
     } );
 
   loop.add_rule(
     "key request",
     [&] {
       next_key_request_ = steady_clock::now() + milliseconds( 250 );
-      Plaintext empty;
-      empty.resize( 0 );
+
+      /* name the newest wire format we parse, except in every other request, which a server that predates
+         wire formats (and only answers empty requests) will still answer */
+      Plaintext request;
+      request.resize( 0 );
+      if ( stats_.key_requests % 2 == 0 ) {
+        request.resize( 1 );
+        request.mutable_data_ptr()[0] = char( WireFormat::Compact );
+      }
+
       Ciphertext keyreq;
-      long_lived_crypto_.encrypt( { &KeyMessage::keyreq_id, 1 }, empty, keyreq );
+      long_lived_crypto_.encrypt( { &KeyMessage::keyreq_id, 1 }, request, keyreq );
       socket_.sendto( server_, keyreq );
       stats_.key_requests++;
     },
-    [&] { return ( !session_.has_value() ) and ( next_key_request_ < steady_clock::now() ); } );
+    [&] { return ( !has_session() ) and ( next_key_request_ < steady_clock::now() ); } );
 }
 
 void NetworkClient::summary( ostream& out ) const
@@ -176,12 +371,17 @@ void NetworkClient::summary( ostream& out ) const
   if ( session_.has_value() ) {
     session_->summary( out );
   }
+  if ( forwarded_session_.has_value() ) {
+    forwarded_session_->summary( out );
+  }
 }
 
 void NetworkClient::json_summary( Json::Value& root ) const
 {
   if ( session_.has_value() ) {
     session_->json_summary( root[name_]["client"]["feed"] );
+  } else if ( forwarded_session_.has_value() ) {
+    forwarded_session_->json_summary( root[name_]["client"]["feeds"] );
   } else {
     Cursor::default_json_summary( root[name_]["client"]["feed"] );
   }
@@ -194,4 +394,7 @@ void NetworkClient::set_cursor_lag( const uint16_t target_samples,
   if ( session_.has_value() ) {
     session_->cursor.set_target_lag( target_samples, min_samples, max_samples );
   }
+  if ( forwarded_session_.has_value() ) {
+    forwarded_session_->set_cursor_lag( target_samples, min_samples, max_samples );
+  }
 }
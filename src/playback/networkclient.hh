@@ -1,6 +1,7 @@
 #pragma once
 
 #include <chrono>
+#include <map>
 
 #include "connection.hh"
 #include "cursor.hh"
@@ -29,6 +30,39 @@ public:
     void json_summary( Json::Value& root ) const { cursor.json_summary( root ); }
   };
 
+  /* With a forwarding server: the other performers' frames, still encoded, each played by its own Cursor and
+     mixed here */
+  struct ForwardedSession
+  {
+    struct Feed
+    {
+      PartialFrameStore<AudioFrame> frames { 8192 }; /* by the performer's own frame index */
+      uint32_t unreceived_beyond_this_frame_index {};
+      Cursor cursor { 960, 120, 1920 };
+      OpusDecoderProcess decoder { true };
+      RubberBand::RubberBandStretcher stretcher;
+      ChannelPair output { 8192 };
+      uint64_t last_arrival {};
+
+      Feed();
+      void add( const AudioFrame& frame );
+      void decode( const size_t decode_cursor );
+    };
+
+    ForwardedAudioNetworkConnection connection;
+    EndlessBuffer<bool> sorted_ { 8192 }; /* which received frames (by frame index) have gone to their Feed */
+    std::map<uint8_t, Feed> feeds {};      /* by performer's node id */
+
+    ForwardedSession( const uint8_t node_id, const KeyPair& session_key, const Address& destination );
+
+    void transmit_frame( OpusEncoderProcess& source, UDPSocket& socket );
+    void network_receive( const Ciphertext& ciphertext );
+    void decode( const size_t decode_cursor, ChannelPair& output );
+    void summary( std::ostream& out ) const;
+    void json_summary( Json::Value& root ) const;
+    void set_cursor_lag( const uint16_t target_samples, const uint16_t min_samples, const uint16_t max_samples );
+  };
+
 private:
   UDPSocket socket_ {};
   Address server_;
@@ -37,6 +71,8 @@ private:
   CryptoSession long_lived_crypto_;
 
   std::optional<NetworkSession> session_ {};
+  std::optional<ForwardedSession> forwarded_session_ {}; /* instead, if the server forwards */
+  bool forwarded_;
   OpusDecoderProcess decoder_ { false };
   RubberBand::RubberBandStretcher stretcher_;
 
@@ -58,14 +94,18 @@ public:
                  const LongLivedKey& key,
                  std::shared_ptr<OpusEncoderProcess> source,
                  std::shared_ptr<AudioDeviceTask> dest,
-                 EventLoop& loop );
+                 EventLoop& loop,
+                 const bool forwarded = false );
 
   void summary( std::ostream& out ) const override;
   void json_summary( Json::Value& root ) const;
 
   void set_cursor_lag( const uint16_t target_samples, const uint16_t min_samples, const uint16_t max_samples );
 
-  bool has_session() const { return session_.has_value(); }
+  bool has_session() const { return session_.has_value() or forwarded_session_.has_value(); }
+
+  /* the Cursor for the server's mix (not with a forwarding server) */
+  bool has_cursor() const { return session_.has_value(); }
   const Cursor& cursor() const { return session_->cursor; }
 
   void queue_update( const NetString& update )
@@ -0,0 +1,56 @@
+#include "pcm_frame_cache.hh"
+
+using namespace std;
+
+void PCMFrameCache::decode( const PartialFrameStore<AudioFrame>& frames, const uint64_t next_frame_needed )
+{
+  /* has the receiver given up on some frames? */
+  if ( next_frame_to_decode_ < frames.range_begin() ) {
+    next_frame_to_decode_ = frames.range_begin();
+    decoded_.pop_before( next_frame_to_decode_ );
+  }
+
+  while ( next_frame_to_decode_ < next_frame_needed ) {
+    /* make room if the Cursors have fallen far behind; they will decode for themselves */
+    if ( next_frame_to_decode_ >= decoded_.range_end() ) {
+      const uint64_t new_begin = next_frame_to_decode_ - decoded_.range_end() + decoded_.range_begin() + 1;
+      stats_.frames_evicted += new_begin - decoded_.range_begin();
+      decoded_.pop_before( new_begin );
+    }
+
+    DecodedFrame& output = decoded_.at( next_frame_to_decode_ );
+    decoder_.decode( frames.at( next_frame_to_decode_ ).value(),
+                     { output.ch1.data(), output.ch1.size() },
+                     { output.ch2.data(), output.ch2.size() } );
+
+    stats_.frames_decoded++;
+    next_frame_to_decode_++;
+  }
+}
+
+void CachedFrameDecoder::decode( const PCMFrameCache& cache,
+                                 const PartialFrameStore<AudioFrame>& frames,
+                                 const uint64_t frame_index,
+                                 span<float> ch1_out,
+                                 span<float> ch2_out )
+{
+  if ( cache.has_frame( frame_index ) ) {
+    ch1_out.copy( { cache.at( frame_index ).ch1.data(), opus_frame::NUM_SAMPLES } );
+    ch2_out.copy( { cache.at( frame_index ).ch2.data(), opus_frame::NUM_SAMPLES } );
+    concealer_current_ = false;
+    return;
+  }
+
+  /* If the Cursor just played the cache's last frame, the cache's decoder is in exactly the state that
+     this frame should be decoded or concealed from. (Otherwise the Cursor has jumped, and any state will do.) */
+  if ( not concealer_current_ and frame_index == cache.next_frame_to_decode() ) {
+    concealer_.copy_state_from( cache.decoder() );
+  }
+  concealer_current_ = true;
+
+  if ( frames.has_value( frame_index ) ) {
+    concealer_.decode( frames.at( frame_index ).value(), ch1_out, ch2_out );
+  } else {
+    concealer_.decode_missing( ch1_out, ch2_out );
+  }
+}
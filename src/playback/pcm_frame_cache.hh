@@ -0,0 +1,61 @@
+#pragma once
+
+#include "decoder_process.hh"
+#include "receiver.hh"
+#include "typed_ring_buffer.hh"
+
+/* The Opus frames from one NetworkReceiver, each decoded once (in order, as soon as it is contiguous) so that
+   several Cursors can play the same PCM at different lags */
+class PCMFrameCache
+{
+public:
+  struct DecodedFrame
+  {
+    std::array<float, opus_frame::NUM_SAMPLES> ch1, ch2;
+  };
+
+private:
+  EndlessBuffer<DecodedFrame> decoded_ { 1024 }; /* indexed by frame index */
+  OpusDecoderProcess decoder_ { true };
+  uint64_t next_frame_to_decode_ {};
+
+  struct Statistics
+  {
+    unsigned int frames_decoded, frames_evicted;
+  } stats_ {};
+
+public:
+  /* decode every frame that has become contiguous (everything before the receiver's next_frame_needed) */
+  void decode( const PartialFrameStore<AudioFrame>& frames, const uint64_t next_frame_needed );
+
+  bool has_frame( const uint64_t frame_index ) const
+  {
+    return frame_index >= decoded_.range_begin() and frame_index < next_frame_to_decode_;
+  }
+
+  const DecodedFrame& at( const uint64_t frame_index ) const { return decoded_.at( frame_index ); }
+
+  /* the decoder's state follows the frame just before this one */
+  uint64_t next_frame_to_decode() const { return next_frame_to_decode_; }
+  const OpusDecoderProcess& decoder() const { return decoder_; }
+
+  void pop_before( const uint64_t frame_index ) { decoded_.pop_before( frame_index ); }
+
+  const Statistics& stats() const { return stats_; }
+};
+
+/* One Cursor's decoder: it plays frames from a PCMFrameCache when it can, and otherwise decodes (or conceals)
+   them with its own OpusDecoderProcess, which picks up the cache's decoder state when the Cursor falls off the
+   end of the cache */
+class CachedFrameDecoder
+{
+  OpusDecoderProcess concealer_ { true };
+  bool concealer_current_ {}; /* has the concealer decoded the frame this Cursor played last? */
+
+public:
+  void decode( const PCMFrameCache& cache,
+               const PartialFrameStore<AudioFrame>& frames,
+               const uint64_t frame_index,
+               span<float> ch1_out,
+               span<float> ch2_out );
+};
@@ -1,9 +1,43 @@
 #include "audioboard.hh"
 #include "ewma.hh"
+#include "mix_kernels.hh"
+
+#include <cmath>
 
 using namespace std;
 using namespace std::chrono;
 
+void BlockPeaks::note( const uint64_t sample_index, const span_view<float> samples )
+{
+  /* each block that the samples touch */
+  uint64_t offset = 0;
+  while ( offset < samples.size() ) {
+    const uint64_t block = ( sample_index + offset ) / opus_frame::NUM_SAMPLES;
+    const uint64_t block_end = ( block + 1 ) * opus_frame::NUM_SAMPLES;
+    const size_t count = min( uint64_t( samples.size() ) - offset, block_end - ( sample_index + offset ) );
+    const float peak = peak_amplitude( samples.substr( offset, count ) );
+    peaks_.safe_set( block, max( peaks_.safe_get( block ), peak ) );
+    offset += count;
+  }
+}
+
+void BlockPeaks::note_block( const uint64_t sample_index, const float peak )
+{
+  const uint64_t block = sample_index / opus_frame::NUM_SAMPLES;
+  peaks_.safe_set( block, max( peaks_.safe_get( block ), peak ) );
+}
+
+bool BlockPeaks::silent( const uint64_t sample_index, const size_t count ) const
+{
+  const uint64_t last_block = ( sample_index + max( count, size_t( 1 ) ) - 1 ) / opus_frame::NUM_SAMPLES;
+  for ( uint64_t block = sample_index / opus_frame::NUM_SAMPLES; block <= last_block; block++ ) {
+    if ( peaks_.safe_get( block ) >= SILENT ) {
+      return false;
+    }
+  }
+  return true;
+}
+
 AudioBoard::AudioBoard( const string_view name, const uint8_t num_channels )
   : name_( name )
 {
@@ -13,7 +47,73 @@ AudioBoard::AudioBoard( const string_view name, const uint8_t num_channels )
     channels_.emplace_back( "Unknown " + to_string( i ), AudioChannel { 8192 } );
     gains_.push_back( { 2.0, 2.0 } );
     power_.push_back( 0.0 );
+    peaks_.emplace_back();
+    bus_of_.emplace_back();
+  }
+}
+
+optional<uint8_t> AudioBoard::find_bus( const string_view bus_name ) const
+{
+  for ( uint8_t bus_i = 0; bus_i < num_buses(); bus_i++ ) {
+    if ( buses_.at( bus_i ).name == bus_name ) {
+      return bus_i;
+    }
+  }
+  return nullopt;
+}
+
+void AudioBoard::set_bus( const string_view channel_name, const string_view bus_name )
+{
+  optional<uint8_t> bus_num;
+  if ( not bus_name.empty() ) {
+    bus_num = find_bus( bus_name );
+    if ( not bus_num.has_value() ) {
+      bus_num = num_buses();
+      auto& bus = buses_.emplace_back( Bus { string( bus_name ) } );
+      bus.mix.pop_before( mix_.range_begin() );
+      bus.peaks.pop_before( mix_.range_begin() );
+    }
+  }
+
+  for ( uint8_t channel_i = 0; channel_i < num_channels(); channel_i++ ) {
+    if ( channels_.at( channel_i ).first == channel_name ) {
+      bus_of_.at( channel_i ) = bus_num;
+    }
+  }
+}
+
+void AudioBoard::set_bus_gain( const string_view bus_name, const float gain1, const float gain2 )
+{
+  const auto bus_num = find_bus( bus_name );
+  if ( bus_num.has_value() ) {
+    buses_.at( bus_num.value() ).gain = { gain1, gain2 };
+  }
+}
+
+pair<float, float> AudioBoard::effective_gain( const uint8_t ch_num ) const
+{
+  const auto& bus_num = bus_of_.at( ch_num );
+  if ( not bus_num.has_value() ) {
+    return gain( ch_num );
   }
+
+  const auto& bus = bus_gain( bus_num.value() );
+  return { gain( ch_num ).first * bus.first, gain( ch_num ).second * bus.second };
+}
+
+pair<float, float> AudioBoard::effective_gain( const uint8_t ch_num,
+                                               const vector<BusOverride>& bus_overrides ) const
+{
+  const auto& bus_num = bus_of_.at( ch_num );
+  if ( bus_num.has_value() ) {
+    for ( const auto& [override_bus, override_gain] : bus_overrides ) {
+      if ( override_bus == bus_num.value() ) {
+        return { gain( ch_num ).first * override_gain.first, gain( ch_num ).second * override_gain.second };
+      }
+    }
+  }
+
+  return effective_gain( ch_num );
 }
 
 void AudioBoard::set_gain( const string_view channel_name, const float gain1, const float gain2 )
@@ -30,13 +130,173 @@ void AudioBoard::pop_samples_until( const uint64_t sample )
   for ( uint8_t channel_i = 0; channel_i < num_channels(); channel_i++ ) {
     AudioChannel& channel = channels_.at( channel_i ).second;
 
-    for ( uint64_t index = channel.range_begin(); index < sample; index++ ) {
-      const float mixed_sample_val = channel.at( index ) * ( gain( channel_i ).first + gain( channel_i ).second );
-      ewma_update( power_.at( channel_i ), mixed_sample_val * mixed_sample_val, 0.0002 );
+    if ( sample > channel.range_begin() ) {
+      /* same as a per-sample EWMA of the squared sample, assuming a steady level over the block */
+      const uint64_t count = sample - channel.range_begin();
+      const auto popped = channel.clipped_region( channel.range_begin(), count );
+      const float total_gain = gain( channel_i ).first + gain( channel_i ).second;
+      const bool silent = peaks_.at( channel_i ).silent( channel.range_begin(), count );
+      const float mean_square = silent ? 0 : sum_of_squares( popped.region ) / popped.region.size();
+      ewma_update( power_.at( channel_i ), total_gain * total_gain * mean_square, 1 - pow( 1 - 0.0002, count ) );
+
+      silence_stats_.metered++;
+      silence_stats_.meter_skipped += silent;
     }
 
     channel.pop_before( sample );
+    peaks_.at( channel_i ).pop_before( sample );
   }
+
+  for ( auto& bus : buses_ ) {
+    bus.mix.pop_before( sample );
+    bus.peaks.pop_before( sample );
+  }
+  audible_.pop_before( sample / opus_frame::NUM_SAMPLES );
+  mix_.pop_before( sample );
+}
+
+void AudioBoard::mix_until( const uint64_t sample )
+{
+  if ( mix_cursor_ < mix_.range_begin() ) {
+    /* skip blocks that have already been popped */
+    const uint64_t begin = mix_.range_begin();
+    mix_cursor_ = begin + ( opus_frame::NUM_SAMPLES - begin % opus_frame::NUM_SAMPLES ) % opus_frame::NUM_SAMPLES;
+  }
+
+  silence_stats_ = {};
+
+  while ( mix_cursor_ + opus_frame::NUM_SAMPLES <= sample ) {
+    auto target = mix_.region( mix_cursor_, opus_frame::NUM_SAMPLES );
+    uint16_t audible = 0;
+
+    /* the channels on no bus go straight into the mix */
+    for ( uint8_t channel_i = 0; channel_i < num_channels(); channel_i++ ) {
+      if ( not bus_of_.at( channel_i ).has_value() ) {
+        if ( peaks_.at( channel_i ).silent( mix_cursor_ ) ) {
+          silence_stats_.mix_skipped++;
+          continue;
+        }
+
+        const span_view<float> source = channel( channel_i ).region( mix_cursor_, opus_frame::NUM_SAMPLES );
+        mix_accumulate( source, gain( channel_i ).first, gain( channel_i ).second, target.ch1, target.ch2 );
+        silence_stats_.mixed++;
+        audible += ( gain( channel_i ) != pair<float, float> { 0, 0 } );
+      }
+    }
+
+    /* the rest are summed into their buses, and each bus goes in at the bus gain */
+    for ( uint8_t bus_i = 0; bus_i < num_buses(); bus_i++ ) {
+      Bus& bus = buses_.at( bus_i );
+      auto bus_target = bus.mix.region( mix_cursor_, opus_frame::NUM_SAMPLES );
+      bool bus_silent = true;
+      for ( uint8_t channel_i = 0; channel_i < num_channels(); channel_i++ ) {
+        if ( bus_of_.at( channel_i ) == bus_i ) {
+          if ( peaks_.at( channel_i ).silent( mix_cursor_ ) ) {
+            silence_stats_.mix_skipped++;
+            continue;
+          }
+
+          const span_view<float> source = channel( channel_i ).region( mix_cursor_, opus_frame::NUM_SAMPLES );
+          const auto& [gain_1, gain_2] = gain( channel_i );
+          mix_accumulate( source, gain_1, gain_2, bus_target.ch1, bus_target.ch2 );
+          silence_stats_.mixed++;
+          bus_silent = false;
+          audible += ( effective_gain( channel_i ) != pair<float, float> { 0, 0 } );
+        }
+      }
+
+      if ( not bus_silent ) {
+        bus.peaks.note_block( mix_cursor_, BlockPeaks::SILENT );
+        mix_accumulate( bus_target.ch1, bus.gain.first, 0, target.ch1, target.ch2 );
+        mix_accumulate( bus_target.ch2, 0, bus.gain.second, target.ch1, target.ch2 );
+      }
+    }
+
+    audible_.safe_set( mix_cursor_ / opus_frame::NUM_SAMPLES, audible );
+    mix_cursor_ += opus_frame::NUM_SAMPLES;
+  }
+}
+
+void AudioBoard::mix_minus( const uint64_t sample,
+                            const vector<GainOverride>& overrides,
+                            span<float> ch1_target,
+                            span<float> ch2_target ) const
+{
+  mix_minus( sample, overrides, {}, ch1_target, ch2_target );
+}
+
+void AudioBoard::mix_minus( const uint64_t sample,
+                            const vector<GainOverride>& overrides,
+                            const vector<BusOverride>& bus_overrides,
+                            span<float> ch1_target,
+                            span<float> ch2_target ) const
+{
+  if ( sample + opus_frame::NUM_SAMPLES > mix_cursor_ ) {
+    throw runtime_error( "AudioBoard::mix_minus: block at " + to_string( sample ) + " not yet mixed" );
+  }
+
+  const auto mix = mix_.region( sample, opus_frame::NUM_SAMPLES );
+  ch1_target.copy( mix.ch1 );
+  ch2_target.copy( mix.ch2 );
+
+  /* correct for each overridden channel by the difference from its gain into the mix with the buses overridden */
+  for ( const auto& [ch_num, override_gain] : overrides ) {
+    if ( peaks_.at( ch_num ).silent( sample ) ) {
+      continue;
+    }
+
+    const auto board_gain = effective_gain( ch_num, bus_overrides );
+    const float delta_1 = override_gain.first - board_gain.first;
+    const float delta_2 = override_gain.second - board_gain.second;
+    if ( delta_1 == 0 and delta_2 == 0 ) {
+      continue;
+    }
+
+    const span_view<float> source = channel( ch_num ).region( sample, opus_frame::NUM_SAMPLES );
+    mix_accumulate( source, delta_1, delta_2, ch1_target, ch2_target );
+  }
+
+  /* and each overridden bus, all its channels at once */
+  for ( const auto& [bus_num, override_gain] : bus_overrides ) {
+    const auto& bus = buses_.at( bus_num );
+    const float delta_1 = override_gain.first - bus.gain.first;
+    const float delta_2 = override_gain.second - bus.gain.second;
+    if ( ( delta_1 == 0 and delta_2 == 0 ) or bus.peaks.silent( sample ) ) {
+      continue;
+    }
+
+    const auto bus_mix = bus.mix.region( sample, opus_frame::NUM_SAMPLES );
+    mix_accumulate( bus_mix.ch1, delta_1, 0, ch1_target, ch2_target );
+    mix_accumulate( bus_mix.ch2, 0, delta_2, ch1_target, ch2_target );
+  }
+}
+
+bool AudioBoard::silent( const uint64_t sample, const vector<GainOverride>& overrides ) const
+{
+  /* start from the board mix, and adjust for the overridden channels that have sound */
+  int audible = audible_.safe_get( sample / opus_frame::NUM_SAMPLES );
+  for ( const auto& [ch_num, override_gain] : overrides ) {
+    if ( not peaks_.at( ch_num ).silent( sample ) ) {
+      audible -= ( effective_gain( ch_num ) != pair<float, float> { 0, 0 } );
+      audible += ( override_gain != pair<float, float> { 0, 0 } );
+    }
+  }
+
+  return audible <= 0;
+}
+
+bool AudioBoard::silent( const uint64_t sample,
+                         const vector<GainOverride>& overrides,
+                         const vector<BusOverride>& bus_overrides ) const
+{
+  /* the audible count is for the board's bus gains, so an overridden bus with sound is taken to be heard */
+  for ( const auto& override : bus_overrides ) {
+    if ( not buses_.at( override.bus_num ).peaks.silent( sample ) ) {
+      return false;
+    }
+  }
+
+  return silent( sample, overrides );
 }
 
 void AudioBoard::json_summary( Json::Value& root, const bool include_second_channels ) const
@@ -50,36 +310,33 @@ void AudioBoard::json_summary( Json::Value& root, const bool include_second_chan
     const float gain_mean = ( gains_.at( i ).first + gains_.at( i ).second ) / 2.0;
     root["channels"][channels_.at( i ).first]["gain"] = gain_mean;
     root["channels"][channels_.at( i ).first]["pan"] = 2 * ( ( gains_.at( i ).second / ( 2 * gain_mean ) ) - 0.5 );
+    if ( bus_of_.at( i ).has_value() ) {
+      root["channels"][channels_.at( i ).first]["bus"] = bus_name( bus_of_.at( i ).value() );
+    }
+  }
+
+  for ( const auto& bus : buses_ ) {
+    root["buses"][bus.name]["gain"] = ( bus.gain.first + bus.gain.second ) / 2.0;
   }
+
+  root["blocks"]["mixed"] = silence_stats_.mixed;
+  root["blocks"]["mix_skipped"] = silence_stats_.mix_skipped;
+  root["blocks"]["metered"] = silence_stats_.metered;
+  root["blocks"]["meter_skipped"] = silence_stats_.meter_skipped;
 }
 
 void AudioWriter::mix_and_write( const AudioBoard& board, const uint64_t cursor_sample )
 {
-  while ( mix_cursor_ + big_opus_frame::NUM_SAMPLES <= cursor_sample ) {
-    span<float> ch1_target = mixed_audio_.ch1().region( mix_cursor_, big_opus_frame::NUM_SAMPLES );
-    span<float> ch2_target = mixed_audio_.ch2().region( mix_cursor_, big_opus_frame::NUM_SAMPLES );
-
-    for ( uint8_t channel_i = 0; channel_i < board.num_channels(); channel_i++ ) {
-      const span_view<float> other_channel
-        = board.channel( channel_i ).region( mix_cursor_, big_opus_frame::NUM_SAMPLES );
-
-      const auto [gain_into_1, gain_into_2] = board.gain( channel_i );
-      for ( uint16_t sample_i = 0; sample_i < big_opus_frame::NUM_SAMPLES; sample_i++ ) {
-        const float value = other_channel[sample_i];
-        const float orig_1 = ch1_target[sample_i];
-        const float orig_2 = ch2_target[sample_i];
-
-        ch1_target[sample_i] = orig_1 + gain_into_1 * value;
-        ch2_target[sample_i] = orig_2 + gain_into_2 * value;
-      }
-    }
+  const uint64_t mixed_until = min( cursor_sample, board.mixed_until() );
+  while ( mix_cursor_ + big_opus_frame::NUM_SAMPLES <= mixed_until ) {
+    /* the writer hears every channel, so it can use the board mix as-is */
+    const auto mix = board.mix().region( mix_cursor_, big_opus_frame::NUM_SAMPLES );
 
     big_opus_frame encoded_frame;
-    encoder_.encode_stereo( ch1_target, ch2_target, encoded_frame );
+    encoder_.encode_stereo( mix.ch1, mix.ch2, encoded_frame );
     socket_.sendto_ignore_errors( destination_, encoded_frame );
     socket_.sendto_ignore_errors( destination2_, encoded_frame );
     mix_cursor_ += big_opus_frame::NUM_SAMPLES;
-    mixed_audio_.pop_before( mix_cursor_ );
   }
 }
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <optional>
 #include <vector>
 
 #include "audio_buffer.hh"
@@ -9,20 +10,83 @@
 
 #include <json/json.h>
 
+/* The peak |sample| of each block (opus_frame::NUM_SAMPLES long, from sample 0) of an AudioChannel, noted by
+   whatever writes the channel, so that the mixers and meters can skip the blocks that are silent */
+class BlockPeaks
+{
+  SafeEndlessBuffer<float> peaks_ { 1024 }; /* by block number */
+
+public:
+  static constexpr float SILENT = 1e-4; /* about -80 dBFS; quieter blocks are treated as digital silence */
+
+  /* some samples written at sample_index */
+  void note( const uint64_t sample_index, const span_view<float> samples );
+
+  /* a peak for the whole block starting at sample_index */
+  void note_block( const uint64_t sample_index, const float peak );
+
+  bool silent( const uint64_t sample_index, const size_t count = opus_frame::NUM_SAMPLES ) const;
+
+  void pop_before( const uint64_t sample_index ) { peaks_.pop_before( sample_index / opus_frame::NUM_SAMPLES ); }
+};
+
 class AudioBoard
 {
   std::string name_;
   std::vector<std::pair<std::string, AudioChannel>> channels_ {};
   std::vector<std::pair<float, float>> gains_ {};
   std::vector<float> power_ {};
+  std::vector<BlockPeaks> peaks_ {};
+
+  /* A sub-mix of some channels (e.g. "band"), summed once per tick at the channels' own gains. The board mix
+     takes each bus at the bus gain, and the channels on no bus directly. */
+  struct Bus
+  {
+    std::string name;
+    std::pair<float, float> gain { 1.0, 1.0 };
+    ChannelPair mix { 8192 };
+    BlockPeaks peaks {}; /* silent when all the bus's channels are */
+  };
+
+  std::vector<Bus> buses_ {};
+  std::vector<std::optional<uint8_t>> bus_of_ {}; /* each channel's bus, if any */
+
+  /* weighted sum of every channel, built once per tick and shared by all listeners */
+  ChannelPair mix_ { 8192 };
+  uint64_t mix_cursor_ {};
+
+  /* how many channels are in the mix (not silent, and not at zero gain), by block number */
+  SafeEndlessBuffer<uint16_t> audible_ { 2048 };
+
+  /* channel blocks on the last tick, and how many of them were silent and skipped */
+  struct SilenceStats
+  {
+    unsigned int mixed, mix_skipped, metered, meter_skipped;
+  } silence_stats_ {};
 
 public:
+  struct GainOverride
+  {
+    uint8_t ch_num;
+    std::pair<float, float> gain;
+  };
+
+  struct BusOverride
+  {
+    uint8_t bus_num;
+    std::pair<float, float> gain;
+  };
+
   AudioBoard( const std::string_view name, const uint8_t num_channels );
 
   const std::string& name() const { return name_; }
 
   void set_gain( const std::string_view channel_name, const float gain1, const float gain2 );
 
+  /* put a channel on a bus (made if necessary), or take it off any bus if bus_name is empty */
+  void set_bus( const std::string_view channel_name, const std::string_view bus_name );
+  void set_bus_gain( const std::string_view bus_name, const float gain1, const float gain2 );
+
   void set_channel_name( const uint8_t ch_num, const std::string_view name )
   {
     channels_.at( ch_num ).first = name;
@@ -31,20 +95,62 @@ public:
   const AudioChannel& channel( const uint8_t ch_num ) const { return channels_.at( ch_num ).second; }
   AudioChannel& channel( const uint8_t ch_num ) { return channels_.at( ch_num ).second; }
 
+  /* for whatever writes the channel */
+  BlockPeaks& peaks( const uint8_t ch_num ) { return peaks_.at( ch_num ); }
+
   void pop_samples_until( const uint64_t sample );
 
+  /* mix every whole block before `sample` (at the board gains) */
+  void mix_until( const uint64_t sample );
+  uint64_t mixed_until() const { return mix_cursor_; }
+  const ChannelPair& mix() const { return mix_; }
+
+  /* The const calls below only read the board, so any number of threads may make them at once, as long as none
+     is writing, mixing or popping it. */
+
+  /* one block of the board mix, with some channels at a different gain (e.g. muting the listener) */
+  void mix_minus( const uint64_t sample,
+                  const std::vector<GainOverride>& overrides,
+                  span<float> ch1_target,
+                  span<float> ch2_target ) const;
+
+  /* the same, with some whole buses at a different gain too (e.g. a monitor without the orchestra) */
+  void mix_minus( const uint64_t sample,
+                  const std::vector<GainOverride>& overrides,
+                  const std::vector<BusOverride>& bus_overrides,
+                  span<float> ch1_target,
+                  span<float> ch2_target ) const;
+
+  /* whether the output would be silent at this block, already mixed (every channel that it hears is) */
+  bool silent( const uint64_t sample, const std::vector<GainOverride>& overrides ) const;
+  bool silent( const uint64_t sample,
+               const std::vector<GainOverride>& overrides,
+               const std::vector<BusOverride>& bus_overrides ) const;
+
+  const SilenceStats& silence_stats() const { return silence_stats_; }
+
   uint8_t num_channels() const { return channels_.size(); }
   const std::string& channel_name( const uint8_t num ) const { return channels_.at( num ).first; }
 
   const std::pair<float, float>& gain( const uint8_t ch_num ) const { return gains_.at( ch_num ); }
 
+  /* the channel's gain into the board mix (its own gain, times its bus's) */
+  std::pair<float, float> effective_gain( const uint8_t ch_num ) const;
+
+  /* the same, in a mix that hears some buses at a different gain */
+  std::pair<float, float> effective_gain( const uint8_t ch_num,
+                                          const std::vector<BusOverride>& bus_overrides ) const;
+
+  uint8_t num_buses() const { return buses_.size(); }
+  std::optional<uint8_t> find_bus( const std::string_view bus_name ) const;
+  const std::string& bus_name( const uint8_t bus_num ) const { return buses_.at( bus_num ).name; }
+  const std::pair<float, float>& bus_gain( const uint8_t bus_num ) const { return buses_.at( bus_num ).gain; }
+
   void json_summary( Json::Value& root, const bool include_second_channels ) const;
 };
 
 class AudioWriter
 {
-  ChannelPair mixed_audio_ { 8192 };
-
   uint64_t mix_cursor_ {};
 
   OpusEncoder encoder_ { 96000, 48000, 2, OPUS_APPLICATION_AUDIO };
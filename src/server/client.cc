@@ -1,5 +1,7 @@
 #include "client.hh"
 
+#include <algorithm>
+
 using namespace std;
 using namespace chrono;
 
@@ -35,14 +37,17 @@ Client::Client( const uint8_t node_id,
                 const uint8_t ch1_num,
                 const uint8_t ch2_num,
                 CryptoSession&& crypto,
-                const bool send_mono )
+                const bool takes_program_audio )
   : connection_( 0, node_id, move( crypto ) )
   , internal_feed_( "internal", 960, 120, 1920, true )
   , quality_feed_( "quality", 4800, 4800 - 240, 4800 + 240, false )
-  , encoder_( send_mono ? OpusEncoderProcess { 96000, 96000, 48000 } : OpusEncoderProcess { 96000, 48000 } )
   , ch1_num_( ch1_num )
   , ch2_num_( ch2_num )
-{}
+  , takes_program_audio_( takes_program_audio )
+  , gain_overrides_( { { ch1_num, { 0, 0 } }, { ch2_num, { 0, 0 } } } )
+{
+  internal_feed_.cursor().set_adaptive_target_lag( 0.99 );
+}
 
 bool Client::receive_packet( const Address& source, const Ciphertext& ciphertext, const uint64_t clock_sample )
 {
@@ -66,90 +71,113 @@ bool Client::receive_packet( const Address& source, const Ciphertext& ciphertext
 }
 
 void AudioFeed::decode_into( const PartialFrameStore<AudioFrame>& frames,
+                             const PCMFrameCache& cache,
                              const uint64_t cursor_sample,
                              const uint64_t frontier_sample_index,
                              AudioChannel& ch1,
-                             AudioChannel& ch2 )
+                             AudioChannel& ch2,
+                             BlockPeaks& ch1_peaks,
+                             BlockPeaks& ch2_peaks )
 {
   cursor_.setup( cursor_sample, frontier_sample_index );
 
   Cursor::AudioSlice audio;
 
   while ( cursor_.initialized() and cursor_sample > cursor_.num_samples_output() ) {
-    cursor_.sample( frames, frontier_sample_index, decoder_, stretcher_, audio );
+    cursor_.sample( frames, frontier_sample_index, cache, decoder_, stretcher_, audio );
 
     if ( audio.good ) {
       ch1.region( audio.sample_index, audio.length ).copy( audio.ch1_span() );
       ch2.region( audio.sample_index, audio.length ).copy( audio.ch2_span() );
+      ch1_peaks.note( audio.sample_index, audio.ch1_span() );
+      ch2_peaks.note( audio.sample_index, audio.ch2_span() );
     }
   }
 }
 
 void Client::decode_audio( const uint64_t cursor_sample, AudioBoard& internal_board, AudioBoard& quality_board )
 {
+  pcm_cache_.decode( connection_.frames(), connection_.next_frame_needed() );
+
   internal_feed_.decode_into( connection_.frames(),
+                              pcm_cache_,
                               cursor_sample,
                               connection_.unreceived_beyond_this_frame_index() * opus_frame::NUM_SAMPLES,
                               internal_board.channel( ch1_num_ ),
-                              internal_board.channel( ch2_num_ ) );
+                              internal_board.channel( ch2_num_ ),
+                              internal_board.peaks( ch1_num_ ),
+                              internal_board.peaks( ch2_num_ ) );
 
   quality_feed_.decode_into( connection_.frames(),
+                             pcm_cache_,
                              cursor_sample,
                              connection_.unreceived_beyond_this_frame_index() * opus_frame::NUM_SAMPLES,
                              quality_board.channel( ch1_num_ ),
-                             quality_board.channel( ch2_num_ ) );
+                             quality_board.channel( ch2_num_ ),
+                             quality_board.peaks( ch1_num_ ),
+                             quality_board.peaks( ch2_num_ ) );
 
   connection_.pop_frames(
     min( min( internal_feed_.ok_to_pop( connection_.frames() ), quality_feed_.ok_to_pop( connection_.frames() ) ),
          connection_.next_frame_needed() - connection_.frames().range_begin() ) );
+  pcm_cache_.pop_before( connection_.frames().range_begin() );
+}
+
+EncoderGroup::Key Client::mix_key( const AudioBoard& board, const vector<BusGain>& bus_gains ) const
+{
+  EncoderGroup::Key key { takes_program_audio_, {}, {} };
+  for ( const auto& [bus_name, gain] : bus_gains ) {
+    const auto bus_num = board.find_bus( bus_name );
+    if ( bus_num.has_value() and gain != board.bus_gain( bus_num.value() ) ) {
+      key.bus_overrides.push_back( { bus_num.value(), gain } );
+    }
+  }
+  sort( key.bus_overrides.begin(), key.bus_overrides.end(), []( const auto& a, const auto& b ) {
+    return a.bus_num < b.bus_num;
+  } );
+
+  /* the listener's own channels stay out of the mix, whatever gain their bus has in it */
+  for ( const auto& override : gain_overrides_ ) {
+    if ( override.gain != board.effective_gain( override.ch_num, key.bus_overrides ) ) {
+      key.overrides.push_back( override );
+    }
+  }
+  return key;
 }
 
-void Client::mix_and_encode( const AudioBoard& board, const uint64_t cursor_sample )
+void Client::send_frames( const EncoderGroup& group )
 {
   if ( not outbound_frame_offset_.has_value() ) {
     return;
   }
 
-  while ( server_mix_cursor() + opus_frame::NUM_SAMPLES <= cursor_sample ) {
-    span<float> ch1_target = mixed_audio_.ch1().region( client_mix_cursor(), opus_frame::NUM_SAMPLES );
-    span<float> ch2_target = mixed_audio_.ch2().region( client_mix_cursor(), opus_frame::NUM_SAMPLES );
-
-    for ( uint8_t channel_i = 0; channel_i < board.num_channels(); channel_i++ ) {
-      if ( channel_i == ch1_num_ or channel_i == ch2_num_ ) {
-        continue;
-      }
-
-      const span_view<float> other_channel
-        = board.channel( channel_i ).region( server_mix_cursor(), opus_frame::NUM_SAMPLES );
-
-      const auto [gain_into_1, gain_into_2] = board.gain( channel_i );
-      for ( uint8_t sample_i = 0; sample_i < opus_frame::NUM_SAMPLES; sample_i++ ) {
-        const float value = other_channel[sample_i];
-        const float orig_1 = ch1_target[sample_i];
-        const float orig_2 = ch2_target[sample_i];
-
-        ch1_target[sample_i] = orig_1 + gain_into_1 * value;
-        ch2_target[sample_i] = orig_2 + gain_into_2 * value;
-      }
-    }
+  /* on joining a group, skip ahead to its frames (the frame indices carry on without a gap) */
+  if ( server_mix_cursor() < group.encoded_begin() ) {
+    outbound_frame_offset_.value() += ( group.encoded_begin() - server_mix_cursor() ) / opus_frame::NUM_SAMPLES;
+  }
 
+  while ( server_mix_cursor() < group.encoded_end() ) {
+    SharedFrameSource source { group.encoded(),
+                               ( server_mix_cursor() - group.encoded_begin() ) / opus_frame::NUM_SAMPLES };
+    connection_.push_frame( source );
     mix_cursor_ += opus_frame::NUM_SAMPLES;
   }
+}
 
-  /* encode audio */
-  while ( encoder_.min_encode_cursor() + opus_frame::NUM_SAMPLES <= client_mix_cursor() ) {
-    encoder_.encode_one_frame( mixed_audio_.ch1(), mixed_audio_.ch2() );
-    connection_.push_frame( encoder_ );
+optional<CryptoSession::EncryptRequest> Client::prepare_packet()
+{
+  if ( not connection_.has_destination() ) {
+    return {};
   }
 
-  /* pop used mixed audio */
-  mixed_audio_.pop_before( encoder_.min_encode_cursor() );
+  return connection_.serialize_packet( outbound_packet_.emplace() );
 }
 
-void Client::send_packet( UDPSocket& socket )
+void Client::send_packet( CiphertextBatch& batch )
 {
-  if ( connection_.has_destination() ) {
-    connection_.send_packet( socket );
+  if ( outbound_packet_.has_value() ) {
+    batch.add( connection_.destination() ) = outbound_packet_.value();
+    outbound_packet_.reset();
   }
 }
 
@@ -191,7 +219,8 @@ void Client::default_json_summary( Json::Value& root )
   root["client"]["self_gain"] = 0;
 }
 
-void KnownClient::summary( ostream& out ) const
+template<class SessionType>
+void BasicKnownClient<SessionType>::summary( ostream& out ) const
 {
   out << name_ << ":";
   out << " requests=" << stats_.key_requests;
@@ -202,21 +231,34 @@ void KnownClient::summary( ostream& out ) const
   }
 }
 
-bool KnownClient::try_keyrequest( const Address& src, const Ciphertext& ciphertext, UDPSocket& socket )
+template<class SessionType>
+bool BasicKnownClient<SessionType>::try_keyrequest( const Address& src,
+                                                    const Ciphertext& ciphertext,
+                                                    UDPSocket& socket )
 {
   Plaintext plaintext;
   if ( long_lived_crypto_.decrypt( ciphertext, { &KeyMessage::keyreq_id, 1 }, plaintext )
-       and ( plaintext.length() == 0 ) ) {
+       and ( plaintext.length() <= 1 ) ) {
     stats_.key_requests++;
     if ( steady_clock::now() < next_reply_allowed_ ) {
       return true;
     }
 
-    /* reply with keys to next session */
+    /* reply with keys to next session (and, if the client named the newest wire format it parses, ours); an empty
+       request is what clients from before the negotiation send, so they get the reply and packets they expect */
+    KeyMessage reply { id_, next_keys_, {} };
+    next_wire_format_ = WireFormat::Original;
+    if ( plaintext.length() == 1 ) {
+      if ( uint8_t( plaintext.as_string_view().front() ) >= uint8_t( WireFormat::Compact ) ) {
+        next_wire_format_ = WireFormat::Compact;
+      }
+      reply.wire_format = next_wire_format_;
+    }
+
     Plaintext outgoing_keys;
     {
       Serializer s { outgoing_keys.mutable_buffer() };
-      s.object( KeyMessage { id_, next_keys_ } );
+      s.object( reply );
       outgoing_keys.resize( s.bytes_written() );
     }
     Ciphertext outgoing_ciphertext;
@@ -230,11 +272,12 @@ bool KnownClient::try_keyrequest( const Address& src, const Ciphertext& cipherte
   return false;
 }
 
-KnownClient::KnownClient( const uint8_t node_id,
-                          const uint8_t ch1_num,
-                          const uint8_t ch2_num,
-                          const LongLivedKey& key,
-                          const bool takes_program_audio )
+template<class SessionType>
+BasicKnownClient<SessionType>::BasicKnownClient( const uint8_t node_id,
+                                                 const uint8_t ch1_num,
+                                                 const uint8_t ch2_num,
+                                                 const LongLivedKey& key,
+                                                 const bool takes_program_audio )
   : id_( node_id )
   , name_( key.name() )
   , long_lived_crypto_( key.key_pair().downlink, key.key_pair().uplink, true )
@@ -245,23 +288,40 @@ KnownClient::KnownClient( const uint8_t node_id,
   , takes_program_audio_( takes_program_audio )
 {}
 
-void KnownClient::receive_packet( const Address& src, const Ciphertext& ciphertext, const uint64_t clock_sample )
+template<>
+void KnownClient::start_session()
+{
+  current_session_.emplace( id_, ch1_num_, ch2_num_, move( next_session_.value() ), takes_program_audio_ );
+}
+
+template<>
+void KnownForwardingClient::start_session()
+{
+  current_session_.emplace( id_, move( next_session_.value() ) );
+}
+
+template<class SessionType>
+template<class... Args>
+void BasicKnownClient<SessionType>::receive_packet( const Address& src,
+                                                    const Ciphertext& ciphertext,
+                                                    const Args&... args )
 {
-  if ( current_session_.has_value() and current_session_->receive_packet( src, ciphertext, clock_sample ) ) {
+  if ( current_session_.has_value() and current_session_->receive_packet( src, ciphertext, args... ) ) {
     return;
   }
 
   Plaintext throwaway_plaintext;
   if ( next_session_.value().decrypt( ciphertext, { &id_, 1 }, throwaway_plaintext ) ) {
     /* new session established */
-    current_session_.emplace( id_, ch1_num_, ch2_num_, move( next_session_.value() ), takes_program_audio_ );
+    start_session();
+    current_session_->set_wire_format( next_wire_format_ );
 
     next_keys_ = KeyPair {};
     next_session_.emplace( next_keys_.downlink, next_keys_.uplink );
     stats_.new_sessions++;
 
     /* actually use packet */
-    current_session_->receive_packet( src, ciphertext, clock_sample );
+    current_session_->receive_packet( src, ciphertext, args... );
   }
 }
 
@@ -281,3 +341,70 @@ void Client::set_cursor_lag( const string_view feed,
     target->cursor().set_target_lag( target_samples, min_samples, max_samples );
   }
 }
+
+ForwardingClient::ForwardingClient( const uint8_t node_id, CryptoSession&& crypto )
+  : connection_( 0, node_id, move( crypto ) )
+{
+  arrivals_.reserve( AudioFrame::frames_per_packet );
+}
+
+bool ForwardingClient::receive_packet( const Address& source, const Ciphertext& ciphertext )
+{
+  arrivals_.clear();
+
+  if ( not connection_.receive_packet( ciphertext, source ) ) {
+    return false;
+  }
+
+  /* frames not yet handed out (everything before next_frame_needed has been, and was popped) */
+  const auto& frames = connection_.frames();
+  forwarded_.pop_before( frames.range_begin() ); /* in case the receiver discarded some */
+  for ( uint32_t frame_index = frames.range_begin();
+        frame_index < connection_.unreceived_beyond_this_frame_index();
+        frame_index++ ) {
+    if ( frames.has_value( frame_index ) and not forwarded_.at( frame_index ) ) {
+      arrivals_.push_back( frames.at( frame_index ).value() );
+      forwarded_.at( frame_index ) = true;
+    }
+  }
+
+  connection_.pop_frames( connection_.next_frame_needed() - frames.range_begin() );
+  forwarded_.pop_before( frames.range_begin() );
+
+  return true;
+}
+
+void ForwardingClient::send_packets( CiphertextBatch& batch )
+{
+  if ( not connection_.has_destination() ) {
+    return;
+  }
+
+  const size_t new_frames = outbound_frames_.size();
+  connection_.push_frames( outbound_frames_ );
+
+  const size_t num_packets
+    = clamp( ( new_frames + ForwardedAudioFrame::frames_per_packet - 1 ) / ForwardedAudioFrame::frames_per_packet,
+             size_t( 1 ),
+             size_t( MAX_PACKETS_PER_TICK ) );
+  for ( size_t i = 0; i < num_packets; i++ ) {
+    connection_.send_packet( batch );
+  }
+}
+
+void ForwardingClient::summary( ostream& out ) const
+{
+  if ( connection_.has_destination() ) {
+    out << " (" << connection_.destination().to_string() << ")";
+  }
+  if ( outbound_frames_.dropped() ) {
+    out << " dropped=" << outbound_frames_.dropped() << "!";
+  }
+  out << "\n";
+  connection_.summary( out );
+}
+
+template class BasicKnownClient<Client>;
+template class BasicKnownClient<ForwardingClient>;
+template void KnownClient::receive_packet( const Address&, const Ciphertext&, const uint64_t& );
+template void KnownForwardingClient::receive_packet( const Address&, const Ciphertext& );
@@ -8,6 +8,7 @@
 #include "connection.hh"
 #include "control_messages.hh"
 #include "cursor.hh"
+#include "encoder_group.hh"
 #include "keys.hh"
 
 #include <rubberband/RubberBandStretcher.h>
@@ -16,7 +17,7 @@ class AudioFeed
 {
   std::string name_;
   Cursor cursor_;
-  OpusDecoderProcess decoder_ { true };
+  CachedFrameDecoder decoder_ {};
   RubberBand::RubberBandStretcher stretcher_;
 
 public:
@@ -28,13 +29,18 @@ public:
 
   void summary( std::ostream& out ) const { cursor_.summary( out ); }
 
+  /* also notes the peak of each block written, for skipping silence */
   void decode_into( const PartialFrameStore<AudioFrame>& frames,
+                    const PCMFrameCache& cache,
                     uint64_t cursor_sample,
                     const uint64_t frontier_sample_index,
                     AudioChannel& ch1,
-                    AudioChannel& ch2 );
+                    AudioChannel& ch2,
+                    BlockPeaks& ch1_peaks,
+                    BlockPeaks& ch2_peaks );
 
   void decode_into( const PartialFrameStore<AudioFrame>& frames,
+                    const PCMFrameCache& cache,
                     uint64_t cursor_sample,
                     const uint64_t frontier_sample_index,
                     AudioChannel& ch1,
@@ -53,33 +59,53 @@ public:
 class Client
 {
   AudioNetworkConnection connection_;
+  PCMFrameCache pcm_cache_ {}; /* shared by both feeds */
   AudioFeed internal_feed_, quality_feed_;
 
-  ChannelPair mixed_audio_ { 8192 };
-
   uint64_t mix_cursor_ {};
   std::optional<uint32_t> outbound_frame_offset_ {};
 
   uint64_t server_mix_cursor() const;
   uint64_t client_mix_cursor() const;
 
-  OpusEncoderProcess encoder_;
-
   uint8_t ch1_num_, ch2_num_;
+  bool takes_program_audio_;
+
+  /* listener's own channels are left out of their mix */
+  std::vector<AudioBoard::GainOverride> gain_overrides_;
 
   client_report last_client_report_ {};
 
+  /* made by prepare_packet() and the caller's encryption, possibly on worker threads, and sent by send_packet() */
+  std::optional<Ciphertext> outbound_packet_ {};
+
 public:
   Client( const uint8_t node_id,
           const uint8_t ch1,
           const uint8_t ch2,
           CryptoSession&& crypto,
-          const bool send_stereo );
+          const bool takes_program_audio );
 
   bool receive_packet( const Address& source, const Ciphertext& ciphertext, const uint64_t clock_sample );
   void decode_audio( const uint64_t cursor_sample, AudioBoard& internal_board, AudioBoard& quality_board );
-  void mix_and_encode( const AudioBoard& board, const uint64_t cursor_sample );
-  void send_packet( UDPSocket& socket );
+
+  /* a bus that this listener hears at a gain of their own (kept by name, since buses come and go on the board) */
+  struct BusGain
+  {
+    std::string bus_name;
+    std::pair<float, float> gain;
+  };
+
+  /* what this client should hear (once it has a destination) */
+  bool needs_mix() const { return outbound_frame_offset_.has_value(); }
+  EncoderGroup::Key mix_key( const AudioBoard& board, const std::vector<BusGain>& bus_gains ) const;
+
+  /* send the group's frames that this client hasn't had */
+  void send_frames( const EncoderGroup& group );
+
+  /* serialize the next packet, which the caller must encrypt (perhaps with other clients') before send_packet() */
+  std::optional<CryptoSession::EncryptRequest> prepare_packet();
+  void send_packet( CiphertextBatch& batch );
 
   void summary( std::ostream& out ) const;
   void json_summary( Json::Value& root ) const;
@@ -89,6 +115,7 @@ public:
   uint8_t peer_id() const { return connection().peer_id(); }
 
   const AudioNetworkConnection& connection() const { return connection_; }
+  void set_wire_format( const WireFormat format ) { connection_.set_wire_format( format ); }
 
   void set_cursor_lag( const std::string_view feed,
                        const uint16_t target_samples,
@@ -96,7 +123,44 @@ public:
                        const uint16_t max_samples );
 };
 
-class KnownClient
+/* A client of the forwarding server: its frames go out, still encoded, to everyone else, and theirs come in */
+class ForwardingClient
+{
+  ForwardingNetworkConnection connection_;
+  ForwardingQueue outbound_frames_ {};
+
+  /* which of this client's own frames (by frame index) have been handed out; holes can fill in late */
+  EndlessBuffer<bool> forwarded_ { 8192 };
+  std::vector<AudioFrame> arrivals_ {};
+
+public:
+  static constexpr unsigned int MAX_PACKETS_PER_TICK = 4;
+
+  ForwardingClient( const uint8_t node_id, CryptoSession&& crypto );
+
+  bool receive_packet( const Address& source, const Ciphertext& ciphertext );
+
+  /* this client's frames that arrived in the last packet (each appears once) */
+  const std::vector<AudioFrame>& arrivals() const { return arrivals_; }
+
+  /* another client's frame, to be sent on */
+  void forward( const uint8_t source, const AudioFrame& frame ) { outbound_frames_.push( source, frame ); }
+
+  /* enough packets for everything forwarded since the last tick (but always one, for the acknowledgments) */
+  void send_packets( CiphertextBatch& batch );
+
+  void summary( std::ostream& out ) const;
+
+  uint8_t node_id() const { return connection().node_id(); }
+  uint8_t peer_id() const { return connection().peer_id(); }
+
+  const ForwardingNetworkConnection& connection() const { return connection_; }
+  void set_wire_format( const WireFormat format ) { connection_.set_wire_format( format ); }
+};
+
+/* a client's long-lived key, and its current session (a Client or ForwardingClient) */
+template<class SessionType>
+class BasicKnownClient
 {
   char id_;
 
@@ -104,10 +168,11 @@ class KnownClient
   CryptoSession long_lived_crypto_;
   std::chrono::steady_clock::time_point next_reply_allowed_;
 
-  std::optional<Client> current_session_ {};
+  std::optional<SessionType> current_session_ {};
 
   KeyPair next_keys_ {};
   std::optional<CryptoSession> next_session_;
+  WireFormat next_wire_format_ { WireFormat::Original }; /* as told to the client in the last key reply */
 
   struct Statistics
   {
@@ -118,18 +183,23 @@ class KnownClient
 
   bool takes_program_audio_ {};
 
+  void start_session();
+
 public:
-  KnownClient( const uint8_t node_id,
-               const uint8_t ch1_num,
-               const uint8_t ch2_num,
-               const LongLivedKey& key,
-               const bool takes_program_audio );
+  BasicKnownClient( const uint8_t node_id,
+                    const uint8_t ch1_num,
+                    const uint8_t ch2_num,
+                    const LongLivedKey& key,
+                    const bool takes_program_audio );
   bool try_keyrequest( const Address& src, const Ciphertext& ciphertext, UDPSocket& socket );
-  void receive_packet( const Address& src, const Ciphertext& ciphertext, const uint64_t clock_sample );
+
+  /* any further arguments go to the session's receive_packet() */
+  template<class... Args>
+  void receive_packet( const Address& src, const Ciphertext& ciphertext, const Args&... args );
 
   operator bool() const { return current_session_.has_value(); }
-  Client& client() { return current_session_.value(); }
-  const Client& client() const { return current_session_.value(); }
+  SessionType& client() { return current_session_.value(); }
+  const SessionType& client() const { return current_session_.value(); }
   const std::string& name() const { return name_; }
   uint8_t id() const { return id_; }
 
@@ -139,3 +209,6 @@ public:
 
   bool takes_program_audio() const { return takes_program_audio_; }
 };
+
+using KnownClient = BasicKnownClient<Client>;
+using KnownForwardingClient = BasicKnownClient<ForwardingClient>;
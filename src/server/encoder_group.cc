@@ -0,0 +1,74 @@
+#include "encoder_group.hh"
+
+#include <algorithm>
+
+using namespace std;
+
+bool EncoderGroup::Key::operator==( const Key& other ) const
+{
+  return program_audio == other.program_audio
+         and equal( overrides.begin(),
+                    overrides.end(),
+                    other.overrides.begin(),
+                    other.overrides.end(),
+                    []( const auto& a, const auto& b ) { return a.ch_num == b.ch_num and a.gain == b.gain; } )
+         and equal( bus_overrides.begin(),
+                    bus_overrides.end(),
+                    other.bus_overrides.begin(),
+                    other.bus_overrides.end(),
+                    []( const auto& a, const auto& b ) { return a.bus_num == b.bus_num and a.gain == b.gain; } );
+}
+
+EncoderGroup::EncoderGroup( const Key& key, const uint64_t first_sample )
+  : key_( key )
+  , encoder_( key.program_audio ? OpusEncoderProcess { 96000, 96000, 48000 } : OpusEncoderProcess { 96000, 48000 } )
+  , first_sample_( first_sample )
+  , mix_cursor_( first_sample )
+  , encoded_begin_( first_sample )
+{}
+
+void EncoderGroup::clear_members()
+{
+  members_.clear();
+  expected_loss_ = 0;
+}
+
+void EncoderGroup::add_member( const string& name, const float expected_loss )
+{
+  members_.push_back( name );
+  expected_loss_ = max( expected_loss_, expected_loss );
+}
+
+void EncoderGroup::mix_and_encode( const AudioBoard& board, const uint64_t cursor_sample )
+{
+  encoded_.clear();
+  encoded_begin_ = mix_cursor_;
+  silent_frames_ = 0;
+  encoder_.set_expected_loss( expected_loss_ );
+
+  while ( mix_cursor_ + opus_frame::NUM_SAMPLES <= cursor_sample ) {
+    /* a silent block is neither mixed nor encoded */
+    if ( board.silent( mix_cursor_, key_.overrides, key_.bus_overrides ) ) {
+      encoder_.encode_silent_frame();
+      silent_frames_++;
+    } else {
+      auto target = mixed_audio_.region( mix_cursor_ - first_sample_, opus_frame::NUM_SAMPLES );
+      board.mix_minus( mix_cursor_, key_.overrides, key_.bus_overrides, target.ch1, target.ch2 );
+      encoder_.encode_one_frame( mixed_audio_ );
+    }
+
+    encoded_.push_back( encoder_.front( 0 ) );
+    encoder_.pop_frame();
+    mix_cursor_ += opus_frame::NUM_SAMPLES;
+  }
+
+  /* pop used mixed audio */
+  mixed_audio_.pop_before( encoder_.min_encode_cursor() );
+}
+
+AudioFrame SharedFrameSource::front( const uint32_t frame_index ) const
+{
+  AudioFrame ret = frames_.at( next_ );
+  ret.frame_index = frame_index;
+  return ret;
+}
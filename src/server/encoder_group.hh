@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "audioboard.hh"
+#include "encoder_task.hh"
+
+/* The listeners whose mixes come out the same (the same board, with the same channels and buses at the same
+   gains). The group mixes and encodes each block once, and every member's NetworkSender sends the same frames. */
+class EncoderGroup
+{
+public:
+  struct Key
+  {
+    bool program_audio; /* chooses the board, and the encoder (two mono channels for program audio) */
+    std::vector<AudioBoard::GainOverride> overrides; /* only those that differ from the board gain */
+    std::vector<AudioBoard::BusOverride> bus_overrides; /* likewise, in order of bus number */
+
+    bool operator==( const Key& other ) const;
+  };
+
+private:
+  Key key_;
+
+  OpusEncoderProcess encoder_;
+  float expected_loss_ {};
+
+  ChannelPair mixed_audio_ { 8192 }; /* indexed from first_sample_ */
+  uint64_t first_sample_, mix_cursor_;
+
+  /* the frames encoded on this tick, the first of them starting at encoded_begin_ (server samples) */
+  std::vector<AudioFrame> encoded_ {};
+  uint64_t encoded_begin_;
+  unsigned int silent_frames_ {}; /* of those */
+
+  std::vector<std::string> members_ {};
+
+public:
+  /* start encoding with the block at first_sample */
+  EncoderGroup( const Key& key, const uint64_t first_sample );
+
+  const Key& key() const { return key_; }
+
+  /* members are re-counted on every tick; the encoder is tuned for the worst loss among them */
+  void clear_members();
+  void add_member( const std::string& name, const float expected_loss );
+  const std::vector<std::string>& members() const { return members_; }
+
+  void mix_and_encode( const AudioBoard& board, const uint64_t cursor_sample );
+
+  const std::vector<AudioFrame>& encoded() const { return encoded_; }
+  uint64_t encoded_begin() const { return encoded_begin_; }
+  uint64_t encoded_end() const { return encoded_begin_ + encoded_.size() * opus_frame::NUM_SAMPLES; }
+  unsigned int silent_frames() const { return silent_frames_; }
+};
+
+/* one listener's share of its group's new frames, as a frame source for the listener's NetworkSender */
+class SharedFrameSource
+{
+  const std::vector<AudioFrame>& frames_;
+  size_t next_;
+
+public:
+  SharedFrameSource( const std::vector<AudioFrame>& frames, const size_t first )
+    : frames_( frames )
+    , next_( first )
+  {}
+
+  bool has_frame() const { return next_ < frames_.size(); }
+  AudioFrame front( const uint32_t frame_index ) const;
+  void pop_frame() { next_++; }
+};
@@ -0,0 +1,120 @@
+#include "forwarding_server.hh"
+
+#include <iostream>
+
+using namespace std;
+
+void NetworkForwardingServer::receive_keyrequest( const Address& src, const Ciphertext& ciphertext )
+{
+  for ( auto& client : clients_ ) {
+    if ( client.try_keyrequest( src, ciphertext, socket_ ) ) {
+      return;
+    }
+  }
+
+  stats_.bad_packets++;
+}
+
+void NetworkForwardingServer::receive_packet( const Address& src, const Ciphertext& ciphertext )
+{
+  if ( ciphertext.length() <= 24 ) {
+    stats_.bad_packets++;
+    return;
+  }
+
+  const uint8_t node_id = ciphertext.as_string_view().back();
+  if ( node_id == uint8_t( KeyMessage::keyreq_id ) ) {
+    receive_keyrequest( src, ciphertext );
+    return;
+  }
+
+  if ( node_id == 0 or node_id > clients_.size() ) {
+    stats_.bad_packets++;
+    return;
+  }
+
+  auto& performer = clients_.at( node_id - 1 );
+  performer.receive_packet( src, ciphertext );
+  if ( not performer ) {
+    return;
+  }
+
+  /* hand the performer's new frames to everyone else */
+  for ( const auto& frame : performer.client().arrivals() ) {
+    for ( auto& listener : clients_ ) {
+      if ( listener and listener.id() != performer.id() ) {
+        listener.client().forward( performer.id(), frame );
+        stats_.frames_forwarded++;
+      }
+    }
+  }
+}
+
+void NetworkForwardingServer::add_key( const LongLivedKey& key )
+{
+  const uint8_t next_id = clients_.size() + 1;
+  clients_.emplace_back( next_id, 0, 0, key, false );
+  cerr << "Added key #" << int( next_id ) << " for: " << key.name() << "\n";
+}
+
+NetworkForwardingServer::NetworkForwardingServer( EventLoop& loop )
+  : socket_()
+  , next_tick_( Timer::timestamp_ns() + TICK_NS )
+{
+  socket_.set_blocking( false );
+  socket_.bind( { "0", 9101 } );
+
+  loop.add_rule( "network receive", socket_, Direction::In, [&] {
+    /* drain every datagram that is waiting */
+    size_t count;
+    do {
+      count = inbound_.receive();
+      for ( size_t i = 0; i < count; i++ ) {
+        receive_packet( inbound_.address( i ), inbound_.ciphertext( i ) );
+      }
+    } while ( count == CiphertextBatch::capacity );
+  } );
+
+  loop.add_timed_rule(
+    "forward+send",
+    [&] {
+      const uint64_t ts_now = Timer::timestamp_ns();
+
+      for ( auto& client : clients_ ) {
+        if ( client ) {
+          if ( client.client().connection().sender_stats().last_good_ack_ts + CLIENT_TIMEOUT_NS < ts_now ) {
+            client.clear_current_session();
+          }
+        }
+      }
+
+      /* send on everything that arrived since the last tick, in client order */
+      for ( auto& client : clients_ ) {
+        if ( client ) {
+          client.client().send_packets( outbound_ );
+        }
+      }
+      outbound_.send();
+
+      next_tick_ += TICK_NS;
+    },
+    [&] { return next_tick_; } );
+}
+
+void NetworkForwardingServer::summary( ostream& out ) const
+{
+  out << "bad packets: " << stats_.bad_packets << " frames forwarded: " << stats_.frames_forwarded << "\n";
+  for ( const auto& client : clients_ ) {
+    if ( client ) {
+      out << "#" << int( client.client().peer_id() ) << ": ";
+      client.summary( out );
+    }
+  }
+}
+
+void NetworkForwardingServer::json_summary( Json::Value& root ) const
+{
+  for ( const auto& client : clients_ ) {
+    root["client"][client.name()]["connected"] = bool( client );
+  }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <ostream>
+
+#include <json/json.h>
+
+#include "client.hh"
+#include "summarize.hh"
+
+/* The alternative to NetworkMultiServer that decodes and mixes nothing: each client's frames go out, still
+   encoded, to every other client, which plays each performer with its own Cursor and mixes them itself. The
+   server's work is the crypto, so it can take many more performers. */
+class NetworkForwardingServer : public Summarizable
+{
+  static constexpr uint64_t CLIENT_TIMEOUT_NS = 4'000'000'000;
+  static constexpr uint64_t TICK_NS = 2'500'000; /* one opus_frame */
+
+  UDPSocket socket_;
+  CiphertextBatch inbound_ { socket_ }, outbound_ { socket_ };
+
+  uint64_t next_tick_;
+
+  std::vector<KnownForwardingClient> clients_ {};
+
+  struct Stats
+  {
+    unsigned int bad_packets, frames_forwarded;
+  } stats_ {};
+
+  void receive_keyrequest( const Address& src, const Ciphertext& ciphertext );
+  void receive_packet( const Address& src, const Ciphertext& ciphertext );
+
+public:
+  NetworkForwardingServer( EventLoop& loop );
+  void add_key( const LongLivedKey& key );
+
+  void summary( std::ostream& out ) const override;
+  void json_summary( Json::Value& root ) const;
+};
@@ -1,5 +1,6 @@
 #include "multiserver.hh"
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 
@@ -11,6 +12,11 @@ uint64_t NetworkMultiServer::server_clock() const
   return ( Timer::timestamp_ns() - global_ns_timestamp_at_creation_ ) * 48 / 1000000;
 }
 
+uint64_t NetworkMultiServer::server_clock_deadline( const uint64_t sample ) const
+{
+  return global_ns_timestamp_at_creation_ + ( sample * 1000000 + 47 ) / 48;
+}
+
 void NetworkMultiServer::receive_keyrequest( const Address& src, const Ciphertext& ciphertext )
 {
   /* decrypt */
@@ -23,12 +29,30 @@ void NetworkMultiServer::receive_keyrequest( const Address& src, const Ciphertex
   stats_.bad_packets++;
 }
 
+void NetworkMultiServer::receive_packet( const Address& src, const Ciphertext& ciphertext )
+{
+  if ( ciphertext.length() > 24 ) {
+    const uint8_t node_id = ciphertext.as_string_view().back();
+    if ( node_id == uint8_t( KeyMessage::keyreq_id ) ) {
+      receive_keyrequest( src, ciphertext );
+    } else if ( node_id > 0 and node_id <= clients_.size() ) {
+      clients_.at( node_id - 1 ).receive_packet( src, ciphertext, server_clock() );
+    } else {
+      stats_.bad_packets++;
+    }
+  } else {
+    stats_.bad_packets++;
+  }
+}
+
 void NetworkMultiServer::add_key( const LongLivedKey& key, const bool takes_program_audio )
 {
   const uint8_t next_id = clients_.size() + 1;
   const uint8_t ch1 = 2 * clients_.size();
   const uint8_t ch2 = ch1 + 1;
   clients_.emplace_back( next_id, ch1, ch2, key, takes_program_audio );
+  client_groups_.emplace_back();
+  client_bus_gains_.emplace_back();
   cerr << "Added key #" << int( next_id ) << " for: " << key.name() << " on channels " << int( ch1 ) << ":"
        << int( ch2 ) << "\n";
   if ( takes_program_audio ) {
@@ -47,44 +71,43 @@ void NetworkMultiServer::initialize_clock()
   next_cursor_sample_ = server_clock() + opus_frame::NUM_SAMPLES;
 }
 
-NetworkMultiServer::NetworkMultiServer( const uint8_t num_clients, EventLoop& loop )
+NetworkMultiServer::NetworkMultiServer( const uint8_t num_clients, EventLoop& loop, const size_t num_workers )
   : socket_()
   , global_ns_timestamp_at_creation_( Timer::timestamp_ns() )
   , next_cursor_sample_( server_clock() + opus_frame::NUM_SAMPLES )
   , num_clients_( num_clients )
   , internal_board_( "internal", 2 * num_clients )
   , program_board_( "program", 2 * num_clients )
+  , workers_( num_workers )
 {
   socket_.set_blocking( false );
   socket_.bind( { "0", 9101 } );
 
   loop.add_rule( "network receive", socket_, Direction::In, [&] {
-    Address src { nullptr, 0 };
-    Ciphertext ciphertext;
-    ciphertext.resize( socket_.recv( src, ciphertext.mutable_buffer() ) );
-    if ( ciphertext.length() > 24 ) {
-      const uint8_t node_id = ciphertext.as_string_view().back();
-      if ( node_id == uint8_t( KeyMessage::keyreq_id ) ) {
-        receive_keyrequest( src, ciphertext );
-      } else if ( node_id > 0 and node_id <= clients_.size() ) {
-        clients_.at( node_id - 1 ).receive_packet( src, ciphertext, server_clock() );
-      } else {
-        stats_.bad_packets++;
+    /* drain every datagram that is waiting */
+    size_t count;
+    do {
+      count = inbound_.receive();
+      for ( size_t i = 0; i < count; i++ ) {
+        receive_packet( inbound_.address( i ), inbound_.ciphertext( i ) );
       }
-    } else {
-      stats_.bad_packets++;
-    }
+    } while ( count == CiphertextBatch::capacity );
   } );
 
-  loop.add_rule(
+  loop.add_timed_rule(
     "mix+encode+send",
     [&] {
       const uint64_t ts_now = Timer::timestamp_ns();
 
-      /* decode all audio */
+      /* decode all audio (each client writes only its own channels of the boards) */
+      workers_.run( clients_.size(), [&]( const size_t i ) {
+        if ( clients_[i] ) {
+          clients_[i].client().decode_audio( next_cursor_sample_, internal_board_, program_board_ );
+        }
+      } );
+
       for ( auto& client : clients_ ) {
         if ( client ) {
-          client.client().decode_audio( next_cursor_sample_, internal_board_, program_board_ );
           if ( client.client().connection().sender_stats().last_good_ack_ts + CLIENT_TIMEOUT_NS < ts_now ) {
             client.clear_current_session();
           }
@@ -92,25 +115,54 @@ NetworkMultiServer::NetworkMultiServer( const uint8_t num_clients, EventLoop& lo
       }
 
       /* mix all audio */
-      for ( auto& client : clients_ ) {
-        if ( client ) {
-          if ( client.takes_program_audio() ) {
-            client.client().mix_and_encode( program_board_, next_cursor_sample_ );
-          } else {
-            client.client().mix_and_encode( internal_board_, next_cursor_sample_ );
+      internal_board_.mix_until( next_cursor_sample_ );
+      program_board_.mix_until( next_cursor_sample_ );
+
+      /* mix-minus and encode once for each group of listeners with the same mix (the groups share the boards, but
+         only read them: reading a const buffer never writes to it, and nothing pops until the next tick) */
+      update_encoder_groups();
+      workers_.run( encoder_groups_.size(), [&]( const size_t i ) {
+        auto& group = encoder_groups_[i];
+        group.mix_and_encode( group.key().program_audio ? program_board_ : internal_board_, next_cursor_sample_ );
+      } );
+
+      /* hand each client its group's frames, and make its packet; the packets are encrypted together, several
+         clients to a job (as long as that still leaves every worker a job) */
+      const size_t threads = workers_.num_threads();
+      const size_t clients_per_job
+        = clamp( ( clients_.size() + threads - 1 ) / threads, size_t( 1 ), CryptoSession::BATCH_SIZE );
+      workers_.run( ( clients_.size() + clients_per_job - 1 ) / clients_per_job, [&]( const size_t job ) {
+        array<CryptoSession::EncryptRequest, CryptoSession::BATCH_SIZE> packets;
+        size_t num_packets = 0;
+
+        const size_t end = min( clients_.size(), ( job + 1 ) * clients_per_job );
+        for ( size_t i = job * clients_per_job; i < end; i++ ) {
+          auto& client = clients_[i];
+          if ( client ) {
+            if ( client_groups_[i].has_value() ) {
+              client.client().send_frames( encoder_groups_.at( client_groups_[i].value() ) );
+            }
+
+            const auto packet = client.client().prepare_packet();
+            if ( packet.has_value() ) {
+              packets[num_packets++] = packet.value();
+            }
           }
         }
-      }
+
+        CryptoSession::encrypt_batch( { packets.data(), num_packets } );
+      } );
 
       internal_audio_.mix_and_write( internal_board_, next_cursor_sample_ );
       program_audio_.mix_and_write( program_board_, next_cursor_sample_ );
 
-      /* send audio to clients */
+      /* send audio to clients, in client order */
       for ( auto& client : clients_ ) {
         if ( client ) {
-          client.client().send_packet( socket_ );
+          client.client().send_packet( outbound_ );
         }
       }
+      outbound_.send();
 
       if ( next_cursor_sample_ > 960 ) {
         internal_board_.pop_samples_until( next_cursor_sample_ - 960 );
@@ -119,12 +171,68 @@ NetworkMultiServer::NetworkMultiServer( const uint8_t num_clients, EventLoop& lo
 
       next_cursor_sample_ += opus_frame::NUM_SAMPLES;
     },
-    [&] { return server_clock() >= next_cursor_sample_; } );
+    [&] { return server_clock_deadline( next_cursor_sample_ ); } );
+}
+
+void NetworkMultiServer::update_encoder_groups()
+{
+  vector<optional<EncoderGroup::Key>> keys;
+  for ( size_t i = 0; i < clients_.size(); i++ ) {
+    const auto& client = clients_[i];
+    keys.emplace_back();
+    if ( client and client.client().needs_mix() ) {
+      keys.back() = client.client().mix_key( board_for( client ), client_bus_gains_[i] );
+    }
+  }
+
+  /* drop the groups that nobody needs any more */
+  encoder_groups_.erase( remove_if( encoder_groups_.begin(),
+                                    encoder_groups_.end(),
+                                    [&]( const EncoderGroup& group ) {
+                                      return none_of( keys.begin(), keys.end(), [&]( const auto& key ) {
+                                        return key.has_value() and key.value() == group.key();
+                                      } );
+                                    } ),
+                         encoder_groups_.end() );
+
+  /* put each client in the group for its mix, starting one (at the block being mixed now) if necessary */
+  for ( auto& group : encoder_groups_ ) {
+    group.clear_members();
+  }
+
+  for ( size_t i = 0; i < clients_.size(); i++ ) {
+    client_groups_[i].reset();
+    if ( not keys[i].has_value() ) {
+      continue;
+    }
+
+    auto group = find_if( encoder_groups_.begin(), encoder_groups_.end(), [&]( const EncoderGroup& g ) {
+      return g.key() == keys[i].value();
+    } );
+    if ( group == encoder_groups_.end() ) {
+      const uint64_t first_sample = ( next_cursor_sample_ / opus_frame::NUM_SAMPLES - 1 ) * opus_frame::NUM_SAMPLES;
+      group = encoder_groups_.emplace( encoder_groups_.end(), keys[i].value(), first_sample );
+    }
+
+    group->add_member( clients_[i].name(), clients_[i].client().connection().sender_stats().smoothed_loss );
+    client_groups_[i] = group - encoder_groups_.begin();
+  }
 }
 
 void NetworkMultiServer::summary( ostream& out ) const
 {
-  out << "bad packets: " << stats_.bad_packets << "\n";
+  out << "bad packets: " << stats_.bad_packets << " encoder groups: " << encoder_groups_.size() << "\n";
+
+  /* silent blocks skipped on the last tick */
+  unsigned int frames = 0, silent_frames = 0;
+  for ( const auto& group : encoder_groups_ ) {
+    frames += group.encoded().size();
+    silent_frames += group.silent_frames();
+  }
+  const auto& silence = internal_board_.silence_stats();
+  out << "silent blocks skipped: mix " << silence.mix_skipped << "/" << silence.mixed + silence.mix_skipped
+      << " meter " << silence.meter_skipped << "/" << silence.metered;
+  out << " encode " << silent_frames << "/" << frames << "\n";
   for ( const auto& client : clients_ ) {
     if ( client ) {
       out << "#" << int( client.client().peer_id() ) << ": ";
@@ -138,12 +246,27 @@ void NetworkMultiServer::json_summary( Json::Value& root, const bool include_sec
   internal_board_.json_summary( root["board"][internal_board_.name()], include_second_channels );
   program_board_.json_summary( root["board"][program_board_.name()], include_second_channels );
 
-  for ( const auto& client : clients_ ) {
+  for ( size_t i = 0; i < clients_.size(); i++ ) {
+    const auto& client = clients_[i];
     if ( client ) {
       client.client().json_summary( root["client"][client.name()] );
     } else {
       Client::default_json_summary( root["client"][client.name()] );
     }
+    root["client"][client.name()]["encoder_group"]
+      = client_groups_[i].has_value() ? Json::Int( client_groups_[i].value() ) : Json::Int( -1 );
+  }
+
+  root["encoder_groups"] = Json::arrayValue;
+  for ( const auto& group : encoder_groups_ ) {
+    Json::Value& entry = root["encoder_groups"].append( Json::objectValue );
+    entry["board"] = group.key().program_audio ? program_board_.name() : internal_board_.name();
+    entry["frames"] = Json::UInt( group.encoded().size() );
+    entry["silent_frames"] = group.silent_frames();
+    entry["members"] = Json::arrayValue;
+    for ( const auto& name : group.members() ) {
+      entry["members"].append( name );
+    }
   }
 }
 
@@ -160,19 +283,62 @@ void NetworkMultiServer::set_cursor_lag( const string_view name,
   }
 }
 
+AudioBoard* NetworkMultiServer::find_board( const string_view board_name )
+{
+  if ( internal_board_.name() == board_name ) {
+    return &internal_board_;
+  } else if ( program_board_.name() == board_name ) {
+    return &program_board_;
+  }
+  return nullptr;
+}
+
 void NetworkMultiServer::set_gain( const string_view board_name,
                                    const string_view channel_name,
                                    const float gain1,
                                    const float gain2 )
 {
-  AudioBoard* target = nullptr;
-  if ( internal_board_.name() == board_name ) {
-    target = &internal_board_;
-  } else if ( program_board_.name() == board_name ) {
-    target = &program_board_;
+  AudioBoard* target = find_board( board_name );
+  if ( target ) {
+    target->set_gain( channel_name, gain1, gain2 );
   }
+}
 
+void NetworkMultiServer::set_bus( const string_view board_name,
+                                  const string_view channel_name,
+                                  const string_view bus_name )
+{
+  AudioBoard* target = find_board( board_name );
   if ( target ) {
-    target->set_gain( channel_name, gain1, gain2 );
+    target->set_bus( channel_name, bus_name );
+  }
+}
+
+void NetworkMultiServer::set_bus_gain( const string_view board_name,
+                                       const string_view bus_name,
+                                       const float gain1,
+                                       const float gain2 )
+{
+  AudioBoard* target = find_board( board_name );
+  if ( target ) {
+    target->set_bus_gain( bus_name, gain1, gain2 );
+  }
+}
+
+void NetworkMultiServer::set_client_bus_gain( const string_view client_name,
+                                              const string_view bus_name,
+                                              const optional<pair<float, float>> gain )
+{
+  for ( size_t i = 0; i < clients_.size(); i++ ) {
+    if ( clients_[i].name() == client_name ) {
+      auto& bus_gains = client_bus_gains_[i];
+      bus_gains.erase( remove_if( bus_gains.begin(),
+                                  bus_gains.end(),
+                                  [&]( const auto& bus_gain ) { return bus_gain.bus_name == bus_name; } ),
+                       bus_gains.end() );
+      if ( gain.has_value() ) {
+        bus_gains.push_back( { string( bus_name ), gain.value() } );
+      }
+    }
   }
 }
@@ -6,6 +6,7 @@
 
 #include "client.hh"
 #include "summarize.hh"
+#include "worker_pool.hh"
 
 class NetworkMultiServer : public Summarizable
 {
@@ -15,14 +16,33 @@ class NetworkMultiServer : public Summarizable
   uint64_t global_ns_timestamp_at_creation_;
   uint64_t next_cursor_sample_;
   uint64_t server_clock() const;
+  uint64_t server_clock_deadline( const uint64_t sample ) const; /* when server_clock() reaches sample */
+
+  CiphertextBatch inbound_ { socket_ }, outbound_ { socket_ };
 
   void receive_keyrequest( const Address& src, const Ciphertext& ciphertext );
+  void receive_packet( const Address& src, const Ciphertext& ciphertext );
 
   uint8_t num_clients_;
 
   AudioBoard internal_board_, program_board_;
   std::vector<KnownClient> clients_ {};
 
+  /* listeners with the same mix share one encoder */
+  std::vector<EncoderGroup> encoder_groups_ {};
+  std::vector<std::optional<size_t>> client_groups_ {}; /* index into encoder_groups_, for each client */
+  std::vector<std::vector<Client::BusGain>> client_bus_gains_ {}; /* for each client, kept across sessions */
+  void update_encoder_groups();
+
+  AudioBoard* find_board( const std::string_view board_name );
+
+  const AudioBoard& board_for( const KnownClient& client ) const
+  {
+    return client.takes_program_audio() ? program_board_ : internal_board_;
+  }
+
+  WorkerPool workers_; /* per-client decoding and encoding */
+
   struct Stats
   {
     unsigned int bad_packets;
@@ -32,7 +52,7 @@ class NetworkMultiServer : public Summarizable
   AudioWriter program_audio_ { "stagecast-program-audio", "stagecast-program-audio-filmout" };
 
 public:
-  NetworkMultiServer( const uint8_t num_clients, EventLoop& loop );
+  NetworkMultiServer( const uint8_t num_clients, EventLoop& loop, const size_t num_workers = 1 );
   void add_key( const LongLivedKey& key, const bool takes_program_audio = false );
 
   void set_cursor_lag( const std::string_view name,
@@ -45,6 +65,19 @@ public:
                  const float gain1,
                  const float gain2 );
 
+  void set_bus( const std::string_view board_name,
+                const std::string_view channel_name,
+                const std::string_view bus_name );
+  void set_bus_gain( const std::string_view board_name,
+                     const std::string_view bus_name,
+                     const float gain1,
+                     const float gain2 );
+
+  /* one listener's own gain for a bus on their board (or, with no gain, back to the board's bus gain) */
+  void set_client_bus_gain( const std::string_view client_name,
+                            const std::string_view bus_name,
+                            const std::optional<std::pair<float, float>> gain );
+
   void initialize_clock();
 
   void summary( std::ostream& out ) const override;
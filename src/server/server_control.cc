@@ -44,6 +44,37 @@ ServerController::ServerController( shared_ptr<NetworkMultiServer> server, Event
         }
         server_->set_gain( my_gain.board_name, my_gain.channel_name, my_gain.gain1, my_gain.gain2 );
       } break;
+
+      case set_bus::id: {
+        set_bus my_bus;
+        parser.object( my_bus );
+        if ( parser.error() ) {
+          return;
+        }
+        server_->set_bus( my_bus.board_name, my_bus.channel_name, my_bus.bus_name );
+      } break;
+
+      case set_bus_gain::id: {
+        set_bus_gain my_bus_gain;
+        parser.object( my_bus_gain );
+        if ( parser.error() ) {
+          return;
+        }
+        server_->set_bus_gain( my_bus_gain.board_name, my_bus_gain.bus_name, my_bus_gain.gain1, my_bus_gain.gain2 );
+      } break;
+
+      case set_client_bus_gain::id: {
+        set_client_bus_gain my_client_bus_gain;
+        parser.object( my_client_bus_gain );
+        if ( parser.error() ) {
+          return;
+        }
+        optional<pair<float, float>> gain;
+        if ( not my_client_bus_gain.follow_board ) {
+          gain = { my_client_bus_gain.gain1, my_client_bus_gain.gain2 };
+        }
+        server_->set_client_bus_gain( my_client_bus_gain.client_name, my_client_bus_gain.bus_name, gain );
+      } break;
     }
   } );
 }
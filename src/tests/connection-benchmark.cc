@@ -0,0 +1,131 @@
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+#include "connection.hh"
+#include "timer.hh"
+#include "video_source.hh"
+
+using namespace std;
+
+/* Packets per second on one core through a pair of NetworkConnections: the sender assembling, serializing and
+   encrypting each packet, and the receiver decrypting and parsing it into its frame store. One new frame goes in
+   each packet (audio: two 30-byte Opus frames; video: a 500-byte chunk), and every packet is acknowledged. With
+   loss, a tenth of packets never arrive, so packets also carry retransmissions. */
+
+static constexpr unsigned int NUM_PACKETS = 200000;
+
+static default_random_engine rng { 1 };
+
+struct AudioSource
+{
+  AudioFrame frame {};
+
+  AudioSource()
+  {
+    frame.separate_channels = true;
+    frame.frame1.resize( 30 );
+    frame.frame2.resize( 30 );
+    for ( uint8_t i = 0; i < 30; i++ ) {
+      frame.frame1.mutable_data_ptr()[i] = char( rng() );
+      frame.frame2.mutable_data_ptr()[i] = char( rng() );
+    }
+  }
+
+  AudioFrame front( const uint32_t frame_index )
+  {
+    frame.frame_index = frame_index;
+    return frame;
+  }
+
+  void pop_frame() {}
+};
+
+struct VideoChunkSource
+{
+  VideoChunk chunk {};
+
+  VideoChunkSource()
+  {
+    chunk.data.resize( 500 );
+    for ( uint16_t i = 0; i < 500; i++ ) {
+      chunk.data.mutable_data_ptr()[i] = char( rng() );
+    }
+  }
+
+  VideoChunk front( const uint32_t frame_index )
+  {
+    chunk.frame_index = frame_index;
+    chunk.nal_index = frame_index / 8;
+    chunk.end_of_nal = frame_index % 8 == 7;
+    return chunk;
+  }
+
+  void pop_frame() {}
+};
+
+struct Result
+{
+  double send_ns, receive_ns;
+};
+
+template<class Connection, class Source>
+static Result run( const double loss )
+{
+  const KeyPair keys;
+  Connection sender { 1, 0, CryptoSession { keys.downlink, keys.uplink }, Address { "127.0.0.1", 9 } };
+  Connection receiver { 0, 1, CryptoSession { keys.uplink, keys.downlink }, Address { "127.0.0.1", 9 } };
+  Source source;
+
+  bernoulli_distribution lose { loss };
+  Ciphertext packet, ack;
+  uint64_t send_ns = 0, receive_ns = 0;
+  unsigned int packets_received = 0;
+
+  for ( unsigned int i = 0; i < NUM_PACKETS; i++ ) {
+    sender.push_frame( source );
+
+    uint64_t start = Timer::timestamp_ns();
+    sender.make_packet( packet );
+    send_ns += Timer::timestamp_ns() - start;
+
+    if ( lose( rng ) ) {
+      continue;
+    }
+
+    start = Timer::timestamp_ns();
+    if ( not receiver.receive_packet( packet ) ) {
+      throw runtime_error( "packet rejected" );
+    }
+    receive_ns += Timer::timestamp_ns() - start;
+    packets_received++;
+
+    receiver.pop_frames( receiver.next_frame_needed() - receiver.frames().range_begin() );
+    receiver.make_packet( ack );
+    sender.receive_packet( ack );
+  }
+
+  return { double( send_ns ) / NUM_PACKETS, double( receive_ns ) / packets_received };
+}
+
+template<class Connection, class Source>
+static void row( const string_view name, const double loss )
+{
+  const Result r = run<Connection, Source>( loss );
+  cout << setw( 18 ) << name << setw( 12 ) << r.send_ns << setw( 12 ) << 1e9 / r.send_ns << setw( 14 )
+       << r.receive_ns << setw( 12 ) << 1e9 / r.receive_ns << "\n";
+}
+
+int main()
+{
+  cout << fixed << setprecision( 0 );
+  cout << "                    send (ns)   packets/s   receive (ns)   packets/s\n";
+
+  row<AudioNetworkConnection, AudioSource>( "audio", 0 );
+  row<AudioNetworkConnection, AudioSource>( "audio, 10% loss", 0.1 );
+  row<NetworkConnection<VideoChunk, VideoSource>, VideoChunkSource>( "video", 0 );
+  row<NetworkConnection<VideoChunk, VideoSource>, VideoChunkSource>( "video, 10% loss", 0.1 );
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,119 @@
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "crypto.hh"
+#include "timer.hh"
+
+using namespace std;
+
+/* CPU per packet to encrypt and to decrypt, one packet at a time and CryptoSession::BATCH_SIZE at a time, as a
+   server does for each tick's packets to its clients (each client with its own session). Audio packets are one or
+   two frames of Opus; video packets are a 500-byte chunk, or as much as fits in a datagram. */
+
+static constexpr unsigned int NUM_ROUNDS = 50000;
+static constexpr size_t NUM_SESSIONS = CryptoSession::BATCH_SIZE;
+
+struct Result
+{
+  double encrypt_ns, encrypt_batch_ns, decrypt_ns, decrypt_batch_ns;
+};
+
+static Result run( const uint16_t length )
+{
+  default_random_engine rng { 1 };
+
+  vector<CryptoSession> senders, receivers;
+  vector<char> node_ids;
+  for ( size_t i = 0; i < NUM_SESSIONS; i++ ) {
+    const KeyPair keys;
+    senders.emplace_back( keys.downlink, keys.uplink );
+    receivers.emplace_back( keys.uplink, keys.downlink );
+    node_ids.push_back( 1 + i );
+  }
+
+  vector<Plaintext> payloads( NUM_SESSIONS ), plaintexts( NUM_SESSIONS );
+  for ( auto& payload : payloads ) {
+    payload.resize( length );
+    for ( uint16_t i = 0; i < length; i++ ) {
+      payload.mutable_data_ptr()[i] = char( rng() );
+    }
+  }
+
+  vector<Ciphertext> ciphertexts( NUM_SESSIONS );
+  vector<CryptoSession::EncryptRequest> encryptions;
+  vector<CryptoSession::DecryptRequest> decryptions;
+  for ( size_t i = 0; i < NUM_SESSIONS; i++ ) {
+    encryptions.push_back( { &senders[i], { &node_ids[i], 1 }, length, &ciphertexts[i] } );
+    decryptions.push_back( { &receivers[i], &ciphertexts[i], { &node_ids[i], 1 }, &plaintexts[i] } );
+  }
+
+  /* fill in each plaintext (as a packet is serialized into its datagram), then encrypt */
+  const auto fill = [&] {
+    for ( size_t i = 0; i < NUM_SESSIONS; i++ ) {
+      ciphertexts[i].mutable_buffer().copy( payloads[i] );
+    }
+  };
+
+  const auto check = [&] {
+    for ( size_t i = 0; i < NUM_SESSIONS; i++ ) {
+      if ( not decryptions[i].success or string_view( plaintexts[i] ) != string_view( payloads[i] ) ) {
+        throw runtime_error( "packet did not survive the round trip" );
+      }
+    }
+  };
+
+  uint64_t encrypt_ns = 0, encrypt_batch_ns = 0, decrypt_ns = 0, decrypt_batch_ns = 0;
+
+  for ( unsigned int round = 0; round < NUM_ROUNDS; round++ ) {
+    fill();
+    uint64_t start = Timer::timestamp_ns();
+    for ( const auto& request : encryptions ) {
+      request.session->encrypt_in_place( request.associated_data, request.plaintext_length, *request.ciphertext );
+    }
+    encrypt_ns += Timer::timestamp_ns() - start;
+
+    start = Timer::timestamp_ns();
+    for ( auto& request : decryptions ) {
+      request.success
+        = request.session->decrypt( *request.ciphertext, request.expected_associated_data, *request.plaintext );
+    }
+    decrypt_ns += Timer::timestamp_ns() - start;
+    check();
+
+    fill();
+    start = Timer::timestamp_ns();
+    CryptoSession::encrypt_batch( { encryptions.data(), encryptions.size() } );
+    encrypt_batch_ns += Timer::timestamp_ns() - start;
+
+    start = Timer::timestamp_ns();
+    CryptoSession::decrypt_batch( { decryptions.data(), decryptions.size() } );
+    decrypt_batch_ns += Timer::timestamp_ns() - start;
+    check();
+  }
+
+  const double packets = double( NUM_ROUNDS ) * NUM_SESSIONS;
+  return { encrypt_ns / packets, encrypt_batch_ns / packets, decrypt_ns / packets, decrypt_batch_ns / packets };
+}
+
+static void row( const string_view name, const uint16_t length )
+{
+  const Result r = run( length );
+  cout << setw( 18 ) << name << setw( 7 ) << length << setw( 11 ) << r.encrypt_ns << " -> " << setw( 4 )
+       << r.encrypt_batch_ns << setw( 11 ) << r.decrypt_ns << " -> " << setw( 4 ) << r.decrypt_batch_ns << "\n";
+}
+
+int main()
+{
+  cout << fixed << setprecision( 0 );
+  cout << "                   bytes   encrypt (ns, single -> batch)   decrypt (ns, single -> batch)\n";
+
+  row( "audio, one frame", 45 );
+  row( "audio, two frames", 80 );
+  row( "video chunk", 520 );
+  row( "video, full", Plaintext::capacity() );
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,104 @@
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+#include "cursor.hh"
+#include "encoder_task.hh"
+#include "timer.hh"
+
+#include <rubberband/RubberBandStretcher.h>
+
+using namespace std;
+using Option = RubberBand::RubberBandStretcher::Option;
+
+/* CPU per frame of one feed (decode, then either the stretcher bypass or the stretcher itself). In "steady", the
+   frontier advances in real time and the Cursor stays at its target lag; in "compressing", the frontier runs
+   ahead and the Cursor is always time-compressing to catch up. */
+
+static constexpr unsigned int NUM_FRAMES = 6000;
+
+static void encode_tone( PartialFrameStore<AudioFrame>& frames )
+{
+  OpusEncoderProcess encoder { 96000, 48000 };
+  ChannelPair input { 8192 };
+
+  for ( unsigned int frame = 0; frame < NUM_FRAMES; frame++ ) {
+    const uint64_t sample = frame * opus_frame::NUM_SAMPLES;
+    for ( size_t i = sample; i < sample + opus_frame::NUM_SAMPLES; i++ ) {
+      input.ch1().at( i ) = 0.25 * sin( 2 * M_PI * 440 * i / 48000.0 );
+      input.ch2().at( i ) = 0.25 * sin( 2 * M_PI * 660 * i / 48000.0 );
+    }
+
+    encoder.encode_one_frame( input );
+    frames.at( frame ) = encoder.front( encoder.frame_index() );
+    encoder.pop_frame();
+    input.pop_before( encoder.min_encode_cursor() );
+  }
+}
+
+struct Result
+{
+  double ns_per_frame;
+  double fraction_stretched;
+};
+
+static Result run( const PartialFrameStore<AudioFrame>& frames, const double frontier_speed )
+{
+  Cursor cursor { 960, 120, 1920 };
+  OpusDecoderProcess decoder { true };
+  RubberBand::RubberBandStretcher stretcher {
+    48000,
+    2,
+    Option::OptionProcessRealTime | Option::OptionThreadingNever | Option::OptionPitchHighConsistency
+      | Option::OptionWindowShort };
+  stretcher.setMaxProcessSize( opus_frame::NUM_SAMPLES );
+  stretcher.calculateStretch();
+
+  Cursor::AudioSlice audio;
+  double frontier = cursor.target_lag_samples() + opus_frame::NUM_SAMPLES;
+  cursor.setup( 0, frontier );
+
+  uint64_t total_ns = 0;
+  unsigned int count = 0;
+  while ( frontier + frontier_speed * opus_frame::NUM_SAMPLES < NUM_FRAMES * opus_frame::NUM_SAMPLES ) {
+    frontier += frontier_speed * opus_frame::NUM_SAMPLES;
+
+    const uint64_t start = Timer::timestamp_ns();
+    cursor.sample( frames, frontier, decoder, stretcher, audio );
+    total_ns += Timer::timestamp_ns() - start;
+    count++;
+
+    if ( not cursor.initialized() ) {
+      throw runtime_error( "cursor underflowed" );
+    }
+  }
+
+  const auto& stats = cursor.stats();
+  return { double( total_ns ) / count,
+           double( stats.frames_stretched ) / ( stats.frames_stretched + stats.frames_bypassed ) };
+}
+
+void program_body()
+{
+  PartialFrameStore<AudioFrame> frames { 8192 };
+  encode_tone( frames );
+
+  cout << "mode         us/frame  stretched\n";
+  for ( const auto& [name, speed] : { pair { "steady", 1.0 }, pair { "compressing", 1.1 } } ) {
+    const auto [ns_per_frame, fraction_stretched] = run( frames, speed );
+    cout << left << setw( 11 ) << name << right << fixed << setprecision( 2 ) << setw( 10 ) << ns_per_frame / 1000.0
+         << setw( 10 ) << setprecision( 0 ) << 100 * fraction_stretched << "%\n";
+  }
+}
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,173 @@
+#include <array>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sys/socket.h>
+
+#include "eventloop.hh"
+#include "exception.hh"
+#include "timer.hh"
+
+using namespace std;
+
+/* Many idle connections, a few of which are busy at a time (like WebSocket viewers). Each "server" end echoes
+   what it reads, through a separate write rule, and each "client" end counts what comes back. */
+
+static constexpr unsigned int NUM_ROUNDS = 400;
+
+struct Connection
+{
+  FileDescriptor client, server;
+  string outbound {};
+  size_t received {};
+
+  static Connection make()
+  {
+    int fds[2];
+    CheckSystemCall( "socketpair", socketpair( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds ) );
+    return { FileDescriptor { fds[0] }, FileDescriptor { fds[1] } };
+  }
+};
+
+struct Result
+{
+  double ns_per_round;
+  double iterations_per_round;
+};
+
+static Result run( const EventLoop::Backend backend, const size_t num_connections, const size_t active_per_round )
+{
+  EventLoop loop { backend };
+  vector<Connection> connections;
+  connections.reserve( num_connections );
+
+  const size_t read_category = loop.add_category( "server read" );
+  const size_t write_category = loop.add_category( "server write" );
+  const size_t client_category = loop.add_category( "client read" );
+
+  string buffer( 4096, 0 );
+  for ( size_t i = 0; i < num_connections; i++ ) {
+    auto& conn = connections.emplace_back( Connection::make() );
+    loop.add_rule( read_category, conn.server, Direction::In, [&] {
+      conn.outbound.append( buffer.data(), conn.server.read( string_span::from_view( buffer ) ) );
+    } );
+    loop.add_rule(
+      write_category,
+      conn.server,
+      Direction::Out,
+      [&] { conn.outbound.erase( 0, conn.server.write( conn.outbound ) ); },
+      [&] { return not conn.outbound.empty(); } );
+    loop.add_rule( client_category, conn.client, Direction::In, [&] {
+      conn.received += conn.client.read( string_span::from_view( buffer ) );
+    } );
+  }
+
+  default_random_engine rng { 0 };
+  uniform_int_distribution<size_t> pick { 0, num_connections - 1 };
+  size_t sent = 0, received = 0;
+  uint64_t iterations = 0;
+
+  const uint64_t start = Timer::timestamp_ns();
+  for ( unsigned int round = 0; round < NUM_ROUNDS; round++ ) {
+    for ( size_t i = 0; i < active_per_round; i++ ) {
+      connections.at( pick( rng ) ).client.write( "ping" );
+      sent += 4;
+    }
+
+    while ( received < sent ) {
+      if ( loop.wait_next_event( 1000 ) != EventLoop::Result::Success ) {
+        throw runtime_error( "event loop stalled" );
+      }
+      iterations++;
+
+      received = 0;
+      for ( const auto& conn : connections ) {
+        received += conn.received;
+      }
+    }
+  }
+  const uint64_t end = Timer::timestamp_ns();
+
+  if ( received != sent ) {
+    throw runtime_error( "sent " + to_string( sent ) + " bytes but received " + to_string( received ) );
+  }
+
+  return { double( end - start ) / NUM_ROUNDS, double( iterations ) / NUM_ROUNDS };
+}
+
+/* Two connections become readable at once, and whichever rule runs first drains both. The other rule may then
+   be served on readiness that is no longer true, and finds nothing to read; that isn't a busy wait. */
+static void check_drained_by_another_rule( const EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  array<Connection, 2> connections { Connection::make(), Connection::make() };
+  string buffer( 4096, 0 );
+  size_t received = 0;
+
+  const size_t category = loop.add_category( "drain both" );
+  for ( auto& conn : connections ) {
+    loop.add_rule( category, conn.server, Direction::In, [&] {
+      for ( auto& other : connections ) {
+        received += other.server.read( string_span::from_view( buffer ) );
+      }
+    } );
+  }
+
+  for ( auto& conn : connections ) {
+    conn.client.write( "ping" );
+  }
+
+  while ( received < 8 ) {
+    if ( loop.wait_next_event( 1000 ) != EventLoop::Result::Success ) {
+      throw runtime_error( "event loop stalled" );
+    }
+  }
+}
+
+void program_body( const vector<EventLoop::Backend>& backends )
+{
+  for ( const auto backend : backends ) {
+    check_drained_by_another_rule( backend );
+  }
+
+  cout << "backend  connections  us/round  iterations/round\n";
+  for ( const size_t num_connections : { 16, 64, 256 } ) {
+    for ( const auto backend : backends ) {
+      const auto [ns_per_round, iterations_per_round] = run( backend, num_connections, 8 );
+      cout << setw( 7 ) << ( backend == EventLoop::Backend::Poll ? "poll" : "epoll" ) << setw( 13 )
+           << num_connections << fixed << setprecision( 1 ) << setw( 10 ) << ns_per_round / 1000.0 << setw( 18 )
+           << iterations_per_round << "\n";
+    }
+  }
+}
+
+int main( int argc, char* argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    if ( argc > 2 ) {
+      cerr << "Usage: " << argv[0] << " [poll|epoll]\n";
+      return EXIT_FAILURE;
+    }
+
+    vector<EventLoop::Backend> backends { EventLoop::Backend::Poll, EventLoop::Backend::Epoll };
+    if ( argc == 2 ) {
+      const string_view name = argv[1];
+      if ( name != "poll" and name != "epoll" ) {
+        cerr << "Usage: " << argv[0] << " [poll|epoll]\n";
+        return EXIT_FAILURE;
+      }
+      backends = { name == "poll" ? EventLoop::Backend::Poll : EventLoop::Backend::Epoll };
+    }
+
+    program_body( backends );
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
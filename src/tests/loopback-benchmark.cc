@@ -0,0 +1,154 @@
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+#include "alsa_devices.hh"
+#include "mix_kernels.hh"
+#include "timer.hh"
+
+using namespace std;
+
+/* The ALSA loopback path (microphone -> capture buffer, and microphone + playback buffer -> headphones), once per
+   wakeup of `period` frames. Compares the old frame-at-a-time loop with the block kernel. */
+
+static constexpr size_t TOTAL_FRAMES = 1 << 20;
+
+static float sample_to_float( const int32_t sample )
+{
+  if ( sample & 0xff ) {
+    throw runtime_error( "invalid sample: " + to_string( sample ) );
+  }
+  constexpr float maxval = uint64_t( 1 ) << 31;
+  const float ret = sample / maxval;
+  if ( ret > 1.0 or ret < -1.0 ) {
+    throw runtime_error( "invalid sample: " + to_string( sample ) );
+  }
+  return ret;
+}
+
+static int32_t float_to_sample( const float sample_f )
+{
+  constexpr float maxval = uint64_t( 1 ) << 31;
+  return lrint( clamp( sample_f, -1.0f, 1.0f ) * maxval );
+}
+
+/* what AudioInterface::copy_all_available_samples_to used to do */
+static void naive_loopback( const span_view<int32_t> captured,
+                            span<int32_t> playback,
+                            size_t cursor,
+                            ChannelSet& capture_output,
+                            const ChannelPair& playback_input,
+                            const AudioInterface::Configuration& config,
+                            AudioStatistics::SampleStats& stats )
+{
+  for ( size_t i = 0; i < captured.size() / 2; i++ ) {
+    const float ch1_sample = sample_to_float( captured[2 * i] );
+    const float ch2_sample = sample_to_float( captured[2 * i + 1] );
+
+    capture_output.ch1().safe_set( cursor, ch1_sample );
+    capture_output.ch2().safe_set( cursor, ch2_sample );
+
+    stats.samples_counted++;
+    stats.ssa_ch1 += stats.max_ch1_amplitude * stats.max_ch1_amplitude;
+    stats.ssa_ch2 += stats.max_ch2_amplitude * stats.max_ch2_amplitude;
+    stats.max_ch1_amplitude = max( stats.max_ch1_amplitude, abs( ch1_sample ) );
+    stats.max_ch2_amplitude = max( stats.max_ch2_amplitude, abs( ch2_sample ) );
+
+    const auto playback_sample = playback_input.safe_get( cursor );
+
+    const auto& gain = config.loopback_gain;
+    playback[2 * i]
+      = float_to_sample( ch1_sample * gain[0][0] + ch2_sample * gain[1][0] + playback_sample.first );
+    playback[2 * i + 1]
+      = float_to_sample( ch1_sample * gain[0][1] + ch2_sample * gain[1][1] + playback_sample.second );
+
+    cursor++;
+  }
+}
+
+struct Device
+{
+  vector<int32_t> microphone = vector<int32_t>( 2 * TOTAL_FRAMES );
+  vector<int32_t> headphone = vector<int32_t>( 2 * TOTAL_FRAMES );
+};
+
+static void fill( Device& device )
+{
+  default_random_engine rng { 0 };
+  uniform_real_distribution<float> dist { -0.1, 0.1 };
+  for ( auto& x : device.microphone ) {
+    x = int32_t( dist( rng ) * ( uint64_t( 1 ) << 31 ) ) & ~0xff;
+  }
+}
+
+/* returns ns per frame */
+template<class Kernel>
+static double run( Device& device, const size_t period, Kernel&& kernel )
+{
+  AudioInterface::Configuration config;
+  config.loopback_gain[0] = { 0.5, 0.25 };
+  config.loopback_gain[1] = { 0.25, 0.5 };
+  AudioStatistics::SampleStats stats {};
+  ChannelSet capture { 2, 8192 };
+  ChannelPair playback { 8192 };
+  default_random_engine rng { 1 };
+  uniform_real_distribution<float> dist { -0.1, 0.1 };
+
+  uint64_t total_ns = 0;
+  for ( size_t cursor = 0; cursor + period <= TOTAL_FRAMES; cursor += period ) {
+    /* the rest of the program keeps both buffers near the cursor */
+    capture.pop_before( cursor > 4096 ? cursor - 4096 : 0 );
+    playback.pop_before( cursor > 4096 ? cursor - 4096 : 0 );
+    for ( size_t i = cursor; i < cursor + period; i++ ) {
+      playback.safe_set( i, { dist( rng ), dist( rng ) } );
+    }
+
+    const uint64_t start = Timer::timestamp_ns();
+    kernel( span_view<int32_t> { device.microphone.data() + 2 * cursor, 2 * period },
+            span<int32_t> { device.headphone.data() + 2 * cursor, 2 * period },
+            cursor,
+            capture,
+            playback,
+            config,
+            stats );
+    total_ns += Timer::timestamp_ns() - start;
+  }
+
+  return double( total_ns ) / ( TOTAL_FRAMES / period * period );
+}
+
+void program_body()
+{
+  Device naive, block;
+  fill( naive );
+  fill( block );
+
+  cout << "kernels: " << mix_kernels_name() << "\n";
+  cout << "period  per-frame (ns/frame)  block (ns/frame)\n";
+  for ( const size_t period : { 12, 48, 192 } ) {
+    const double naive_ns = run( naive, period, naive_loopback );
+    const double block_ns = run( block, period, AudioInterface::loopback );
+
+    for ( size_t i = 0; i < naive.headphone.size(); i++ ) {
+      if ( abs( int64_t( naive.headphone[i] ) - block.headphone[i] ) > 256 ) {
+        throw runtime_error( "block loopback differs from per-frame loopback at " + to_string( i ) );
+      }
+    }
+
+    cout << setw( 6 ) << period << fixed << setprecision( 2 ) << setw( 22 ) << naive_ns << setw( 18 ) << block_ns
+         << "\n";
+  }
+}
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,279 @@
+#include <array>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+#include "audioboard.hh"
+#include "mix_kernels.hh"
+#include "timer.hh"
+
+using namespace std;
+
+static constexpr unsigned int NUM_TICKS = 4000;
+
+/* the per-client N-1 mix the server used to do, for comparison */
+static void naive_mix( const AudioBoard& board,
+                       const uint64_t sample,
+                       const uint8_t ch1_num,
+                       const uint8_t ch2_num,
+                       span<float> ch1_target,
+                       span<float> ch2_target )
+{
+  for ( uint8_t channel_i = 0; channel_i < board.num_channels(); channel_i++ ) {
+    if ( channel_i == ch1_num or channel_i == ch2_num ) {
+      continue;
+    }
+
+    const span_view<float> other_channel = board.channel( channel_i ).region( sample, opus_frame::NUM_SAMPLES );
+    const auto [gain_into_1, gain_into_2] = board.gain( channel_i );
+    for ( uint8_t sample_i = 0; sample_i < opus_frame::NUM_SAMPLES; sample_i++ ) {
+      ch1_target[sample_i] += gain_into_1 * other_channel[sample_i];
+      ch2_target[sample_i] += gain_into_2 * other_channel[sample_i];
+    }
+  }
+}
+
+/* noise on every channel but the first `num_silent` */
+static void fill_block( AudioBoard& board,
+                        const uint64_t sample,
+                        default_random_engine& rng,
+                        const uint8_t num_silent = 0 )
+{
+  uniform_real_distribution<float> dist { -0.5, 0.5 };
+  for ( uint8_t channel_i = num_silent; channel_i < board.num_channels(); channel_i++ ) {
+    span<float> block = board.channel( channel_i ).region( sample, opus_frame::NUM_SAMPLES );
+    for ( float& x : block ) {
+      x = dist( rng );
+    }
+    board.peaks( channel_i ).note( sample, block );
+  }
+}
+
+/* returns ns per tick for {naive, mix-minus}, and checks that the two agree */
+static pair<double, double> run( const uint8_t num_clients )
+{
+  default_random_engine rng { 0 };
+  AudioBoard board { "bench", uint8_t( 2 * num_clients ) };
+  vector<vector<AudioBoard::GainOverride>> overrides;
+  for ( uint8_t i = 0; i < num_clients; i++ ) {
+    overrides.push_back( { { uint8_t( 2 * i ), { 0, 0 } }, { uint8_t( 2 * i + 1 ), { 0, 0 } } } );
+  }
+
+  ChannelPair naive_out { 8192 }, mix_minus_out { 8192 };
+  uint64_t naive_ns = 0, mix_minus_ns = 0;
+  float max_error = 0;
+
+  for ( unsigned int tick = 0; tick < NUM_TICKS; tick++ ) {
+    const uint64_t sample = tick * opus_frame::NUM_SAMPLES;
+    const uint64_t output_sample = sample * num_clients; /* each client's block goes after the previous one's */
+    fill_block( board, sample, rng );
+
+    const uint64_t start = Timer::timestamp_ns();
+    for ( uint8_t i = 0; i < num_clients; i++ ) {
+      const uint64_t block = output_sample + i * opus_frame::NUM_SAMPLES;
+      naive_mix( board,
+                 sample,
+                 2 * i,
+                 2 * i + 1,
+                 naive_out.ch1().region( block, opus_frame::NUM_SAMPLES ),
+                 naive_out.ch2().region( block, opus_frame::NUM_SAMPLES ) );
+    }
+
+    const uint64_t middle = Timer::timestamp_ns();
+    board.mix_until( sample + opus_frame::NUM_SAMPLES );
+    for ( uint8_t i = 0; i < num_clients; i++ ) {
+      const uint64_t block = output_sample + i * opus_frame::NUM_SAMPLES;
+      board.mix_minus( sample,
+                       overrides.at( i ),
+                       mix_minus_out.ch1().region( block, opus_frame::NUM_SAMPLES ),
+                       mix_minus_out.ch2().region( block, opus_frame::NUM_SAMPLES ) );
+    }
+    board.pop_samples_until( sample );
+    const uint64_t end = Timer::timestamp_ns();
+
+    naive_ns += middle - start;
+    mix_minus_ns += end - middle;
+
+    const uint64_t output_end = output_sample + num_clients * opus_frame::NUM_SAMPLES;
+    for ( uint64_t i = output_sample; i < output_end; i++ ) {
+      max_error = max( max_error, abs( naive_out.ch1().at( i ) - mix_minus_out.ch1().at( i ) ) );
+      max_error = max( max_error, abs( naive_out.ch2().at( i ) - mix_minus_out.ch2().at( i ) ) );
+    }
+    naive_out.pop_before( output_end );
+    mix_minus_out.pop_before( output_end );
+  }
+
+  if ( max_error > 1e-4 ) {
+    throw runtime_error( "mix-minus differs from naive mix by " + to_string( max_error ) );
+  }
+
+  return { double( naive_ns ) / NUM_TICKS, double( mix_minus_ns ) / NUM_TICKS };
+}
+
+/* Section monitors (a performer's own section at twice the gain, without the performer), with the sections as buses
+   or as overrides of each of their channels. Returns ns per tick for {flat, buses}, including the board mix, and
+   checks that the two agree. */
+static pair<double, double> run_buses( const uint8_t num_channels )
+{
+  static constexpr array<string_view, 3> bus_names { "band", "cast", "orchestra" };
+
+  default_random_engine rng { 0 };
+  AudioBoard flat { "flat", num_channels }, bussed { "bussed", num_channels };
+  for ( uint8_t channel_i = 0; channel_i < num_channels; channel_i++ ) {
+    const string name = "ch" + to_string( channel_i );
+    flat.set_channel_name( channel_i, name );
+    bussed.set_channel_name( channel_i, name );
+    bussed.set_bus( name, bus_names.at( channel_i % bus_names.size() ) );
+  }
+
+  /* the performer on channel i is in section i */
+  vector<vector<AudioBoard::GainOverride>> flat_overrides( bus_names.size() ), self_overrides( bus_names.size() );
+  vector<vector<AudioBoard::BusOverride>> bus_overrides( bus_names.size() );
+  for ( uint8_t bus_i = 0; bus_i < bus_names.size(); bus_i++ ) {
+    for ( uint8_t channel_i = bus_i; channel_i < num_channels; channel_i += bus_names.size() ) {
+      const auto& gain = flat.gain( channel_i );
+      const pair<float, float> off { 0, 0 }, louder { 2 * gain.first, 2 * gain.second };
+      flat_overrides.at( bus_i ).push_back( { channel_i, channel_i == bus_i ? off : louder } );
+    }
+    self_overrides.at( bus_i ).push_back( { bus_i, { 0, 0 } } );
+    bus_overrides.at( bus_i ).push_back( { bus_i, { 2, 2 } } );
+  }
+
+  ChannelPair flat_out { 8192 }, bussed_out { 8192 };
+  uint64_t flat_ns = 0, bussed_ns = 0;
+  float max_error = 0;
+
+  for ( unsigned int tick = 0; tick < NUM_TICKS; tick++ ) {
+    const uint64_t sample = tick * opus_frame::NUM_SAMPLES;
+    const uint64_t output_sample = sample * bus_names.size();
+    fill_block( flat, sample, rng );
+    for ( uint8_t channel_i = 0; channel_i < num_channels; channel_i++ ) {
+      span<float> block = bussed.channel( channel_i ).region( sample, opus_frame::NUM_SAMPLES );
+      block.copy( flat.channel( channel_i ).region( sample, opus_frame::NUM_SAMPLES ) );
+      bussed.peaks( channel_i ).note( sample, block );
+    }
+
+    const uint64_t start = Timer::timestamp_ns();
+    flat.mix_until( sample + opus_frame::NUM_SAMPLES );
+    for ( uint8_t i = 0; i < bus_names.size(); i++ ) {
+      const uint64_t block = output_sample + i * opus_frame::NUM_SAMPLES;
+      flat.mix_minus( sample,
+                      flat_overrides.at( i ),
+                      flat_out.ch1().region( block, opus_frame::NUM_SAMPLES ),
+                      flat_out.ch2().region( block, opus_frame::NUM_SAMPLES ) );
+    }
+
+    const uint64_t middle = Timer::timestamp_ns();
+    bussed.mix_until( sample + opus_frame::NUM_SAMPLES );
+    for ( uint8_t i = 0; i < bus_names.size(); i++ ) {
+      const uint64_t block = output_sample + i * opus_frame::NUM_SAMPLES;
+      bussed.mix_minus( sample,
+                        self_overrides.at( i ),
+                        bus_overrides.at( i ),
+                        bussed_out.ch1().region( block, opus_frame::NUM_SAMPLES ),
+                        bussed_out.ch2().region( block, opus_frame::NUM_SAMPLES ) );
+    }
+    const uint64_t end = Timer::timestamp_ns();
+
+    /* (metering isn't mixing) */
+    flat.pop_samples_until( sample );
+    bussed.pop_samples_until( sample );
+
+    flat_ns += middle - start;
+    bussed_ns += end - middle;
+
+    const uint64_t output_end = output_sample + bus_names.size() * opus_frame::NUM_SAMPLES;
+    for ( uint64_t i = output_sample; i < output_end; i++ ) {
+      max_error = max( max_error, abs( flat_out.ch1().at( i ) - bussed_out.ch1().at( i ) ) );
+      max_error = max( max_error, abs( flat_out.ch2().at( i ) - bussed_out.ch2().at( i ) ) );
+    }
+    flat_out.pop_before( output_end );
+    bussed_out.pop_before( output_end );
+  }
+
+  if ( max_error > 1e-4 ) {
+    throw runtime_error( "bus mix differs from flat mix by " + to_string( max_error ) );
+  }
+
+  return { double( flat_ns ) / NUM_TICKS, double( bussed_ns ) / NUM_TICKS };
+}
+
+/* The server's tick (board mix, mix-minus for each client, metering) with some of the performers silent.
+   Returns ns per tick and the fraction of channel blocks that the board skipped. */
+static pair<double, double> run_silent( const uint8_t num_clients, const uint8_t num_silent_clients )
+{
+  default_random_engine rng { 0 };
+  AudioBoard board { "bench", uint8_t( 2 * num_clients ) };
+  vector<vector<AudioBoard::GainOverride>> overrides;
+  for ( uint8_t i = 0; i < num_clients; i++ ) {
+    overrides.push_back( { { uint8_t( 2 * i ), { 0, 0 } }, { uint8_t( 2 * i + 1 ), { 0, 0 } } } );
+  }
+
+  ChannelPair out { 8192 };
+  uint64_t total_ns = 0;
+  unsigned int skipped = 0, total = 0;
+
+  for ( unsigned int tick = 0; tick < NUM_TICKS; tick++ ) {
+    const uint64_t sample = tick * opus_frame::NUM_SAMPLES;
+    fill_block( board, sample, rng, 2 * num_silent_clients );
+
+    const uint64_t start = Timer::timestamp_ns();
+    board.mix_until( sample + opus_frame::NUM_SAMPLES );
+    for ( uint8_t i = 0; i < num_clients; i++ ) {
+      if ( not board.silent( sample, overrides.at( i ) ) ) {
+        const uint64_t block = sample * num_clients + i * opus_frame::NUM_SAMPLES;
+        board.mix_minus( sample,
+                         overrides.at( i ),
+                         out.ch1().region( block, opus_frame::NUM_SAMPLES ),
+                         out.ch2().region( block, opus_frame::NUM_SAMPLES ) );
+      }
+    }
+    board.pop_samples_until( sample );
+    total_ns += Timer::timestamp_ns() - start;
+
+    skipped += board.silence_stats().mix_skipped;
+    total += board.silence_stats().mixed + board.silence_stats().mix_skipped;
+    out.pop_before( ( sample + opus_frame::NUM_SAMPLES ) * num_clients );
+  }
+
+  return { double( total_ns ) / NUM_TICKS, double( skipped ) / total };
+}
+
+void program_body()
+{
+  cout << "kernels: " << mix_kernels_name() << "\n";
+  cout << "clients  naive (us/tick)  mix-minus (us/tick)\n";
+  for ( const uint8_t num_clients : { 2, 4, 8, 12, 16, 24, 32, 48, 64 } ) {
+    const auto [naive, mix_minus] = run( num_clients );
+    cout << setw( 7 ) << int( num_clients ) << fixed << setprecision( 2 ) << setw( 17 ) << naive / 1000.0
+         << setw( 21 ) << mix_minus / 1000.0 << "\n";
+  }
+
+  cout << "\nsection monitors (three buses)\n";
+  cout << "channels  flat (us/tick)  buses (us/tick)\n";
+  for ( const uint8_t num_channels : { 12, 24, 36, 48, 64, 96, 128 } ) {
+    const auto [flat, buses] = run_buses( num_channels );
+    cout << setw( 8 ) << int( num_channels ) << fixed << setprecision( 2 ) << setw( 16 ) << flat / 1000.0
+         << setw( 17 ) << buses / 1000.0 << "\n";
+  }
+
+  cout << "\n32 clients, some silent\n";
+  cout << "silent  tick (us)  blocks skipped\n";
+  for ( const uint8_t num_silent : { 0, 8, 16, 24, 30 } ) {
+    const auto [tick_ns, skipped] = run_silent( 32, num_silent );
+    cout << setw( 6 ) << int( num_silent ) << fixed << setprecision( 2 ) << setw( 11 ) << tick_ns / 1000.0
+         << setw( 15 ) << setprecision( 0 ) << 100 * skipped << "%\n";
+  }
+}
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
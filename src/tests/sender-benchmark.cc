@@ -0,0 +1,145 @@
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+#include "receiver.hh"
+#include "sender.hh"
+#include "timer.hh"
+
+using namespace std;
+
+/* CPU per packet of one NetworkSender<AudioFrame>: assembling a packet, taking in an ack, and printing the
+   summary; and for its NetworkReceiver, the CPU and wire size (in the Compact encoding) of each ack. One frame is
+   pushed and one packet sent per tick; each direction loses 10% of packets and delays the rest by half the round
+   trip. In "acks lost", nothing ever comes back, so every frame stays outstanding. */
+
+static constexpr unsigned int NUM_TICKS = 40000;
+static constexpr double LOSS = 0.1;
+
+struct FrameSource
+{
+  AudioFrame frame {};
+
+  AudioFrame front( const uint32_t frame_index )
+  {
+    frame.frame_index = frame_index;
+    return frame;
+  }
+
+  void pop_frame() {}
+};
+
+/* what the receiver will get (the sender section only points at the sender's frames) */
+static Packet<AudioFrame>::SenderSection copy_of( const PacketRef<AudioFrame>::SenderSection& section )
+{
+  Packet<AudioFrame>::SenderSection ret;
+  ret.sequence_number = section.sequence_number;
+  for ( const AudioFrame* frame : section.frames ) {
+    ret.frames.push_back( *frame );
+  }
+  return ret;
+}
+
+template<class T>
+struct InTransit
+{
+  unsigned int arrival_tick;
+  T contents;
+};
+
+struct Result
+{
+  double send_ns, ack_ns, summary_ns, make_ack_ns, ack_bytes;
+  unsigned int retransmissions;
+};
+
+static Result run( const unsigned int rtt_ticks, const bool acks_lost )
+{
+  NetworkSender<AudioFrame> sender;
+  NetworkReceiver<AudioFrame> receiver;
+  FrameSource source;
+
+  default_random_engine rng { 1 };
+  bernoulli_distribution lose { LOSS };
+
+  deque<InTransit<Packet<AudioFrame>::SenderSection>> downlink;
+  deque<InTransit<PacketReceiverSection>> uplink;
+
+  uint64_t send_ns = 0, ack_ns = 0, summary_ns = 0, make_ack_ns = 0, ack_bytes = 0;
+  unsigned int acks = 0, acks_made = 0, frames_sent = 0;
+  ostringstream summary;
+
+  for ( unsigned int tick = 0; tick < NUM_TICKS; tick++ ) {
+    sender.push_frame( source );
+
+    PacketRef<AudioFrame>::SenderSection packet;
+    uint64_t start = Timer::timestamp_ns();
+    sender.set_sender_section( packet );
+    send_ns += Timer::timestamp_ns() - start;
+    frames_sent += packet.frames.length;
+
+    if ( not lose( rng ) ) {
+      downlink.push_back( { tick + rtt_ticks / 2, copy_of( packet ) } );
+    }
+
+    while ( not downlink.empty() and downlink.front().arrival_tick <= tick ) {
+      receiver.receive_sender_section( downlink.front().contents );
+      downlink.pop_front();
+
+      PacketReceiverSection ack;
+      start = Timer::timestamp_ns();
+      receiver.set_receiver_section( ack );
+      make_ack_ns += Timer::timestamp_ns() - start;
+      ack_bytes += ack.compact_length();
+      acks_made++;
+      if ( receiver.next_frame_needed() > receiver.frames().range_begin() + 1024 ) {
+        receiver.pop_frames( receiver.next_frame_needed() - receiver.frames().range_begin() - 1024 );
+      }
+
+      if ( not acks_lost and not lose( rng ) ) {
+        uplink.push_back( { tick + rtt_ticks - rtt_ticks / 2, ack } );
+      }
+    }
+
+    while ( not uplink.empty() and uplink.front().arrival_tick <= tick ) {
+      start = Timer::timestamp_ns();
+      sender.receive_receiver_section( uplink.front().contents );
+      ack_ns += Timer::timestamp_ns() - start;
+      acks++;
+      uplink.pop_front();
+    }
+
+    summary.str( {} );
+    start = Timer::timestamp_ns();
+    sender.summary( summary );
+    summary_ns += Timer::timestamp_ns() - start;
+  }
+
+  return { double( send_ns ) / NUM_TICKS,
+           acks ? double( ack_ns ) / acks : 0,
+           double( summary_ns ) / NUM_TICKS,
+           double( make_ack_ns ) / acks_made,
+           double( ack_bytes ) / acks_made,
+           frames_sent - NUM_TICKS };
+}
+
+int main()
+{
+  cout << fixed << setprecision( 0 );
+  cout << "round trip     send (ns)   ack (ns)   summary (ns)   make ack (ns)   ack bytes   retransmissions\n";
+
+  for ( const unsigned int rtt_ticks : { 2, 40, 200, 800 } ) {
+    const Result r = run( rtt_ticks, false );
+    cout << setw( 7 ) << rtt_ticks * 2.5 << " ms " << setw( 12 ) << r.send_ns << setw( 11 ) << r.ack_ns
+         << setw( 15 ) << r.summary_ns << setw( 16 ) << r.make_ack_ns << setw( 12 ) << r.ack_bytes << setw( 18 )
+         << r.retransmissions << "\n";
+  }
+
+  const Result r = run( 2, true );
+  cout << "acks lost " << setw( 12 ) << r.send_ns << setw( 11 ) << "-" << setw( 15 ) << r.summary_ns << setw( 16 )
+       << r.make_ack_ns << setw( 12 ) << r.ack_bytes << setw( 18 ) << r.retransmissions << "\n";
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,95 @@
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <thread>
+
+#include "audio_buffer.hh"
+#include "encoder_task.hh"
+#include "timer.hh"
+#include "worker_pool.hh"
+
+using namespace std;
+
+/* The per-client encode phase of the audio server's tick (one Opus encode per client per 2.5 ms), spread over a
+   WorkerPool of increasing size. The encoded bytes must not depend on the number of threads. */
+
+static constexpr unsigned int NUM_TICKS = 2000;
+static constexpr size_t NUM_CLIENTS = 32;
+
+struct EncodedClient
+{
+  OpusEncoderProcess encoder { 96000, 48000 };
+  ChannelPair input { 8192 };
+  uint64_t checksum {};
+};
+
+/* returns ns per tick, and a checksum of everything that was encoded */
+static pair<double, uint64_t> run( const size_t num_threads )
+{
+  WorkerPool workers { num_threads };
+  vector<EncodedClient> clients( NUM_CLIENTS );
+  default_random_engine rng { 0 };
+  uniform_real_distribution<float> dist { -0.5, 0.5 };
+
+  uint64_t total_ns = 0;
+  for ( unsigned int tick = 0; tick < NUM_TICKS; tick++ ) {
+    const uint64_t sample = tick * opus_frame::NUM_SAMPLES;
+    for ( auto& client : clients ) {
+      for ( size_t i = 0; i < opus_frame::NUM_SAMPLES; i++ ) {
+        client.input.ch1().at( sample + i ) = dist( rng );
+        client.input.ch2().at( sample + i ) = dist( rng );
+      }
+    }
+
+    const uint64_t start = Timer::timestamp_ns();
+    workers.run( clients.size(), [&]( const size_t i ) {
+      auto& client = clients[i];
+      client.encoder.encode_one_frame( client.input );
+      const AudioFrame frame = client.encoder.front( client.encoder.frame_index() );
+      for ( const char byte : frame.frame1.as_string_view() ) {
+        client.checksum = client.checksum * 31 + uint8_t( byte );
+      }
+      client.encoder.pop_frame();
+      client.input.pop_before( client.encoder.min_encode_cursor() );
+    } );
+    total_ns += Timer::timestamp_ns() - start;
+  }
+
+  uint64_t checksum = 0;
+  for ( const auto& client : clients ) {
+    checksum = checksum * 1000003 + client.checksum;
+  }
+
+  return { double( total_ns ) / NUM_TICKS, checksum };
+}
+
+void program_body()
+{
+  const size_t max_threads = max( 1U, thread::hardware_concurrency() );
+  cout << "clients: " << NUM_CLIENTS << "\n";
+  cout << "threads  encode phase (us/tick)\n";
+
+  optional<uint64_t> reference_checksum;
+  for ( size_t num_threads = 1; num_threads <= max_threads; num_threads *= 2 ) {
+    const auto [ns_per_tick, checksum] = run( num_threads );
+    cout << setw( 7 ) << num_threads << fixed << setprecision( 1 ) << setw( 25 ) << ns_per_tick / 1000.0 << "\n";
+
+    if ( not reference_checksum.has_value() ) {
+      reference_checksum = checksum;
+    } else if ( checksum != reference_checksum.value() ) {
+      throw runtime_error( "output with " + to_string( num_threads ) + " threads differs from one thread" );
+    }
+  }
+}
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,128 @@
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+
+#include "exception.hh"
+#include "socket.hh"
+
+using namespace std;
+
+/* A swarm of loopback clients each sends the server one datagram per tick, and the server answers each
+   client once per tick -- the NetworkMultiServer traffic pattern, without the audio. Compares one system call per
+   datagram (recv/sendto) with recvmmsg/sendmmsg. */
+
+static constexpr unsigned int NUM_TICKS = 1000;
+static constexpr size_t PAYLOAD_SIZE = 200;
+
+static uint64_t thread_cpu_ns()
+{
+  timespec ts;
+  CheckSystemCall( "clock_gettime", clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts ) );
+  return ts.tv_sec * 1'000'000'000 + ts.tv_nsec;
+}
+
+struct Result
+{
+  double syscalls_per_tick;
+  double server_cpu_ns_per_client_tick;
+};
+
+static Result run( const size_t num_clients, const bool batched )
+{
+  UDPSocket server;
+  server.set_blocking( false );
+  server.bind( { "127.0.0.1", 0 } );
+  const Address server_address = server.local_address();
+
+  vector<UDPSocket> clients( num_clients );
+  for ( auto& client : clients ) {
+    client.set_blocking( false );
+    client.bind( { "127.0.0.1", 0 } );
+  }
+
+  const string payload( PAYLOAD_SIZE, 'x' );
+  string buffer( 2048, 0 );
+
+  vector<Address> sources( UDPSocket::max_batch ), destinations( num_clients );
+  vector<string> inbound( UDPSocket::max_batch, string( 2048, 0 ) );
+  vector<string_span> inbound_spans;
+  for ( auto& x : inbound ) {
+    inbound_spans.push_back( string_span::from_view( x ) );
+  }
+  vector<size_t> lengths( UDPSocket::max_batch );
+  vector<string_view> outbound( num_clients, payload );
+
+  uint64_t syscalls = 0, server_cpu_ns = 0;
+
+  for ( unsigned int tick = 0; tick < NUM_TICKS; tick++ ) {
+    for ( auto& client : clients ) {
+      client.sendto( server_address, payload );
+    }
+
+    const uint64_t start = thread_cpu_ns();
+
+    /* receive everything */
+    size_t received = 0;
+    while ( received < num_clients ) {
+      syscalls++;
+      if ( batched ) {
+        const size_t count = server.recv_batch( { sources.data(), sources.size() },
+                                                { inbound_spans.data(), inbound_spans.size() },
+                                                { lengths.data(), lengths.size() } );
+        for ( size_t i = 0; i < count; i++ ) {
+          destinations.at( received + i ) = sources.at( i );
+        }
+        received += count;
+      } else {
+        server.recv( destinations.at( received ), string_span::from_view( buffer ) );
+        received++;
+      }
+    }
+
+    /* answer everyone */
+    if ( batched ) {
+      syscalls += ( num_clients + UDPSocket::max_batch - 1 ) / UDPSocket::max_batch;
+      server.sendto_batch( { destinations.data(), destinations.size() }, { outbound.data(), outbound.size() } );
+    } else {
+      for ( const auto& destination : destinations ) {
+        syscalls++;
+        server.sendto( destination, payload );
+      }
+    }
+
+    server_cpu_ns += thread_cpu_ns() - start;
+
+    for ( auto& client : clients ) {
+      Address source;
+      if ( client.recv( source, string_span::from_view( buffer ) ) != PAYLOAD_SIZE ) {
+        throw runtime_error( "client received wrong length" );
+      }
+    }
+  }
+
+  return { double( syscalls ) / NUM_TICKS, double( server_cpu_ns ) / NUM_TICKS / num_clients };
+}
+
+void program_body()
+{
+  cout << "clients  syscalls/tick (single, batched)  server CPU ns/client/tick (single, batched)\n";
+  for ( const size_t num_clients : { 4, 16, 64, 128 } ) {
+    const auto single = run( num_clients, false );
+    const auto batched = run( num_clients, true );
+    cout << setw( 7 ) << num_clients << fixed << setprecision( 1 ) << setw( 16 ) << single.syscalls_per_tick
+         << setw( 10 ) << batched.syscalls_per_tick << setw( 34 ) << single.server_cpu_ns_per_client_tick
+         << setw( 10 ) << batched.server_cpu_ns_per_client_tick << "\n";
+  }
+}
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,22 @@
+#include "eventfd.hh"
+#include "exception.hh"
+
+#include <sys/eventfd.h>
+
+using namespace std;
+
+EventFD::EventFD()
+  : FileDescriptor( CheckSystemCall( "eventfd", eventfd( 0, EFD_NONBLOCK ) ) )
+{}
+
+void EventFD::signal()
+{
+  /* not FileDescriptor::write, whose bookkeeping belongs to the thread that reads */
+  CheckSystemCall( "eventfd_write", eventfd_write( fd_num(), 1 ) );
+}
+
+void EventFD::acknowledge()
+{
+  uint64_t count;
+  read( { reinterpret_cast<char*>( &count ), sizeof( count ) } );
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "file_descriptor.hh"
+
+//! \brief A wrapper around an [eventfd](\ref man2::eventfd), used by one thread to wake another's EventLoop.
+class EventFD : public FileDescriptor
+{
+public:
+  //! Construct a non-blocking eventfd that isn't readable yet
+  EventFD();
+
+  //! Make the eventfd readable (safe to call from any thread)
+  void signal();
+
+  //! Read and discard the counter, making the eventfd unreadable again
+  void acknowledge();
+};
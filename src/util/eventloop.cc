@@ -3,17 +3,29 @@
 #include "socket.hh"
 #include "timer.hh"
 
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 
 using namespace std;
 
-EventLoop::EventLoop()
-  : _rule_categories()
+EventLoop::EventLoop( const Backend backend )
+  : _backend( backend )
+  , _rule_categories()
 {
   _rule_categories.reserve( 64 );
   // prevent _rule_categories from being reallocated in middle of wait_next_event
   // (if a rule adds a new category)
+
+  if ( _backend == Backend::Epoll ) {
+    _epoll_fd.emplace( CheckSystemCall( "epoll_create1", epoll_create1( EPOLL_CLOEXEC ) ) );
+
+    /* the timerfd stays registered; it is only readable while armed and due */
+    epoll_event event {};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    CheckSystemCall( "epoll_ctl", epoll_ctl( _epoll_fd->fd_num(), EPOLL_CTL_ADD, _timer_fd.fd_num(), &event ) );
+  }
 }
 
 unsigned int EventLoop::FDRule::service_count() const
@@ -27,7 +39,7 @@ size_t EventLoop::add_category( const string& name )
     throw runtime_error( "maximum categories reached" );
   }
 
-  _rule_categories.push_back( { name, {} } );
+  _rule_categories.push_back( { name, {}, {} } );
   return _rule_categories.size() - 1;
 }
 
@@ -52,6 +64,11 @@ EventLoop::FDRule::FDRule( BasicRule&& base,
   , recover( s_recover )
 {}
 
+EventLoop::TimedRule::TimedRule( BasicRule&& base, const DeadlineT& s_deadline )
+  : BasicRule( base )
+  , deadline( s_deadline )
+{}
+
 EventLoop::RuleHandle EventLoop::add_rule( const size_t category_id,
                                            const FileDescriptor& fd,
                                            const Direction direction,
@@ -83,6 +100,20 @@ EventLoop::RuleHandle EventLoop::add_rule( const size_t category_id,
   return _non_fd_rules.back();
 }
 
+EventLoop::RuleHandle EventLoop::add_timed_rule( const size_t category_id,
+                                                 const CallbackT& callback,
+                                                 const DeadlineT& deadline )
+{
+  if ( category_id >= _rule_categories.size() ) {
+    throw out_of_range( "bad category_id" );
+  }
+
+  _timed_rules.emplace_back(
+    make_shared<TimedRule>( BasicRule { category_id, [] { return true; }, callback }, deadline ) );
+
+  return _timed_rules.back();
+}
+
 void EventLoop::RuleHandle::cancel()
 {
   const shared_ptr<BasicRule> rule_shared_ptr = rule_weak_ptr_.lock();
@@ -127,32 +158,129 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
     }
   }
 
-  // now the file-descriptor-related rules. poll any "interested" file descriptors
+  // next, the timed rules: run any that are due, and find the earliest deadline still to come
+  uint64_t next_deadline = numeric_limits<uint64_t>::max();
+  {
+    for ( auto it = _timed_rules.begin(); it != _timed_rules.end(); ) {
+      auto& this_rule = **it;
+      bool rule_fired = false;
+
+      if ( this_rule.cancel_requested ) {
+        it = _timed_rules.erase( it );
+        continue;
+      }
+
+      uint64_t deadline = this_rule.deadline();
+      for ( uint64_t now = Timer::timestamp_ns(); deadline <= now; now = Timer::timestamp_ns() ) {
+        rule_fired = true;
+        auto& category = _rule_categories.at( this_rule.category_id );
+        category.lateness.log( now - deadline );
+        {
+          RecordScopeTimer<Timer::Category::Nonblock> record_timer { category.timer };
+          this_rule.callback();
+        }
+        deadline = this_rule.deadline();
+      }
+
+      if ( rule_fired ) {
+        return Result::Success; /* only serve one rule on each iteration */
+      }
+
+      next_deadline = min( next_deadline, deadline );
+      ++it;
+    }
+  }
+
+  // arm the timerfd for the next timed rule
+  const bool timer_armed = next_deadline != numeric_limits<uint64_t>::max();
+  if ( timer_armed and _timer_fd_deadline != next_deadline ) {
+    _timer_fd.set_deadline( next_deadline );
+    _timer_fd_deadline = next_deadline;
+  }
+
+  // now the file-descriptor-related rules
+  return _backend == Backend::Poll ? wait_poll( timeout_ms, timer_armed ) : wait_epoll( timeout_ms, timer_armed );
+}
+
+/* returns true (after calling the cancel callback if appropriate) if the rule should be removed */
+bool EventLoop::fd_rule_finished( FDRule& rule )
+{
+  if ( rule.cancel_requested ) {
+    //      rule.cancel();
+    //      if rule is cancelled externally, no need to call the cancellation callback
+    //      this makes it easier to cancel rules and delete captured objects right away
+    return true;
+  }
+
+  if ( rule.direction == Direction::In && rule.fd.eof() ) {
+    // no more reading on this rule, it's reached eof
+    rule.cancel();
+    return true;
+  }
+
+  if ( rule.fd.closed() ) {
+    rule.cancel();
+    return true;
+  }
+
+  return false;
+}
+
+/* returns true if the rule recovered from an error on its fd, otherwise cancels it and returns false */
+bool EventLoop::fd_rule_recovered( FDRule& rule, const bool invalid )
+{
+  /* recoverable error? */
+  if ( not invalid ) {
+    if ( rule.recover() ) {
+      return true;
+    }
+  }
+
+  /* see if fd is a socket */
+  int socket_error = 0;
+  socklen_t optlen = sizeof( socket_error );
+  const int ret = getsockopt( rule.fd.fd_num(), SOL_SOCKET, SO_ERROR, &socket_error, &optlen );
+  if ( ret == -1 and errno == ENOTSOCK ) {
+    cerr << "error on polled file descriptor for rule \"" << _rule_categories.at( rule.category_id ).name << "\"\n";
+  } else if ( ret == -1 ) {
+    throw unix_error( "getsockopt" );
+  } else if ( optlen != sizeof( socket_error ) ) {
+    throw runtime_error( "unexpected length from getsockopt: " + to_string( optlen ) );
+  } else if ( socket_error ) {
+    cerr << "error on polled socket for rule \"" << _rule_categories.at( rule.category_id ).name
+         << "\": " << strerror( socket_error ) << "\n";
+  }
+
+  rule.cancel();
+  return false;
+}
+
+void EventLoop::run_fd_rule( FDRule& rule, const bool fresh_readiness )
+{
+  RecordScopeTimer<Timer::Category::Nonblock> record_timer { _rule_categories.at( rule.category_id ).timer };
+  // we only want to call callback if revents includes the event we asked for
+  const auto count_before = rule.service_count();
+  rule.callback();
+
+  // (readiness reported before another callback ran may be stale: that callback could have drained the fd)
+  if ( fresh_readiness and count_before == rule.service_count() and ( not rule.fd.closed() ) and rule.interest() ) {
+    throw runtime_error( "EventLoop: busy wait detected: rule \"" + _rule_categories.at( rule.category_id ).name
+                         + "\" did not read/write fd and is still interested" );
+  }
+}
+
+EventLoop::Result EventLoop::wait_poll( const int timeout_ms, const bool timer_armed )
+{
+  // poll any "interested" file descriptors
   vector<pollfd> pollfds {};
-  pollfds.reserve( _fd_rules.size() );
+  pollfds.reserve( _fd_rules.size() + 1 );
   bool something_to_poll = false;
 
   // set up the pollfd for each rule
   for ( auto it = _fd_rules.begin(); it != _fd_rules.end(); ) { // NOTE: it gets erased or incremented in loop body
     auto& this_rule = **it;
 
-    if ( this_rule.cancel_requested ) {
-      //      this_rule.cancel();
-      //      if rule is cancelled externally, no need to call the cancellation callback
-      //      this makes it easier to cancel rules and delete captured objects right away
-      it = _fd_rules.erase( it );
-      continue;
-    }
-
-    if ( this_rule.direction == Direction::In && this_rule.fd.eof() ) {
-      // no more reading on this rule, it's reached eof
-      this_rule.cancel();
-      it = _fd_rules.erase( it );
-      continue;
-    }
-
-    if ( this_rule.fd.closed() ) {
-      this_rule.cancel();
+    if ( fd_rule_finished( this_rule ) ) {
       it = _fd_rules.erase( it );
       continue;
     }
@@ -166,6 +294,13 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
     ++it;
   }
 
+  // wake up for the next timed rule (after all the fd rules, so their indices still match)
+  const size_t timer_index = pollfds.size();
+  if ( timer_armed ) {
+    pollfds.push_back( { _timer_fd.fd_num(), POLLIN, 0 } );
+    something_to_poll = true;
+  }
+
   // quit if there is nothing left to poll
   if ( not something_to_poll ) {
     return Result::Exit;
@@ -179,6 +314,11 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
     }
   }
 
+  if ( timer_index < pollfds.size() and ( pollfds.at( timer_index ).revents & POLLIN ) ) {
+    _timer_fd.acknowledge(); /* the due rule will run on the next call */
+    _timer_fd_deadline.reset();
+  }
+
   // go through the poll results
   for ( auto [it, idx] = make_pair( _fd_rules.begin(), size_t( 0 ) ); it != _fd_rules.end(); ++idx ) {
     const auto& this_pollfd = pollfds.at( idx );
@@ -186,31 +326,11 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
 
     const auto poll_error = static_cast<bool>( this_pollfd.revents & ( POLLERR | POLLNVAL ) );
     if ( poll_error ) {
-      /* recoverable error? */
-      if ( not static_cast<bool>( this_pollfd.revents & POLLNVAL ) ) {
-        if ( this_rule.recover() ) {
-          ++it;
-          continue;
-        }
-      }
-
-      /* see if fd is a socket */
-      int socket_error = 0;
-      socklen_t optlen = sizeof( socket_error );
-      const int ret = getsockopt( this_rule.fd.fd_num(), SOL_SOCKET, SO_ERROR, &socket_error, &optlen );
-      if ( ret == -1 and errno == ENOTSOCK ) {
-        cerr << "error on polled file descriptor for rule \"" << _rule_categories.at( this_rule.category_id ).name
-             << "\"\n";
-      } else if ( ret == -1 ) {
-        throw unix_error( "getsockopt" );
-      } else if ( optlen != sizeof( socket_error ) ) {
-        throw runtime_error( "unexpected length from getsockopt: " + to_string( optlen ) );
-      } else if ( socket_error ) {
-        cerr << "error on polled socket for rule \"" << _rule_categories.at( this_rule.category_id ).name
-             << "\": " << strerror( socket_error ) << "\n";
+      if ( fd_rule_recovered( this_rule, this_pollfd.revents & POLLNVAL ) ) {
+        ++it;
+        continue;
       }
 
-      this_rule.cancel();
       it = _fd_rules.erase( it );
       continue;
     }
@@ -227,19 +347,7 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
     }
 
     if ( poll_ready ) {
-      RecordScopeTimer<Timer::Category::Nonblock> record_timer {
-        _rule_categories.at( this_rule.category_id ).timer
-      };
-      // we only want to call callback if revents includes the event we asked for
-      const auto count_before = this_rule.service_count();
-      this_rule.callback();
-
-      if ( count_before == this_rule.service_count() and ( not this_rule.fd.closed() ) and this_rule.interest() ) {
-        throw runtime_error( "EventLoop: busy wait detected: rule \""
-                             + _rule_categories.at( this_rule.category_id ).name
-                             + "\" did not read/write fd and is still interested" );
-      }
-
+      run_fd_rule( this_rule );
       return Result::Success; /* only serve one rule on each iteration */
     }
 
@@ -249,6 +357,170 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
   return Result::Success;
 }
 
+static uint32_t epoll_events( const Direction direction )
+{
+  return direction == Direction::In ? EPOLLIN : EPOLLOUT;
+}
+
+void EventLoop::epoll_register( FDRule& rule )
+{
+  rule.registration = &_epoll_registrations[rule.fd.fd_num()]; /* references survive rehashing */
+  rule.registration->rules.push_back( &rule );
+}
+
+void EventLoop::epoll_unregister( FDRule& rule )
+{
+  auto& registration = *rule.registration;
+  registration.rules.erase( find( registration.rules.begin(), registration.rules.end(), &rule ) );
+  rule.registration = nullptr;
+
+  if ( rule.fd.closed() ) {
+    registration.added = false; /* closing the fd took it out of the epoll set */
+  }
+
+  if ( registration.rules.empty() ) {
+    if ( registration.added ) {
+      CheckSystemCall( "epoll_ctl", epoll_ctl( _epoll_fd->fd_num(), EPOLL_CTL_DEL, rule.fd.fd_num(), nullptr ) );
+    }
+    _epoll_registrations.erase( rule.fd.fd_num() );
+  }
+}
+
+void EventLoop::epoll_update( const int fd_num, EpollRegistration& registration )
+{
+  epoll_event event {};
+  event.events = registration.wanted;
+  event.data.ptr = &registration;
+
+  /* if the fd number was closed and reused behind our back, ADD and MOD can each fail; try the other */
+  const int first_op = registration.added ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  if ( epoll_ctl( _epoll_fd->fd_num(), first_op, fd_num, &event ) < 0 ) {
+    if ( errno == EPERM ) {
+      registration.unpollable = true; /* poll(2) would say a regular file is always ready */
+      return;
+    } else if ( errno == ENOENT ) {
+      CheckSystemCall( "epoll_ctl", epoll_ctl( _epoll_fd->fd_num(), EPOLL_CTL_ADD, fd_num, &event ) );
+    } else if ( errno == EEXIST ) {
+      CheckSystemCall( "epoll_ctl", epoll_ctl( _epoll_fd->fd_num(), EPOLL_CTL_MOD, fd_num, &event ) );
+    } else {
+      throw unix_error( "epoll_ctl" );
+    }
+  }
+
+  registration.added = true;
+  registration.events = registration.wanted;
+}
+
+EventLoop::Result EventLoop::wait_epoll( const int timeout_ms, const bool timer_armed )
+{
+  bool something_to_poll = timer_armed;
+
+  // find each rule's interest, and the events wanted on each fd
+  for ( auto it = _fd_rules.begin(); it != _fd_rules.end(); ) { // NOTE: it gets erased or incremented in loop body
+    auto& this_rule = **it;
+
+    if ( fd_rule_finished( this_rule ) ) {
+      if ( this_rule.registration ) {
+        epoll_unregister( this_rule );
+      }
+      it = _fd_rules.erase( it );
+      continue;
+    }
+
+    if ( not this_rule.registration ) {
+      epoll_register( this_rule );
+    }
+
+    this_rule.polled = this_rule.interest();
+    if ( this_rule.polled ) {
+      this_rule.registration->wanted |= epoll_events( this_rule.direction );
+      something_to_poll = true;
+    }
+    ++it;
+  }
+
+  // quit if there is nothing left to poll
+  if ( not something_to_poll ) {
+    return Result::Exit;
+  }
+
+  // tell the kernel only about fds whose interest has changed (errors and hangups are always reported)
+  vector<EpollRegistration*> always_ready;
+  for ( auto& [fd_num, registration] : _epoll_registrations ) {
+    if ( registration.unpollable ) {
+      if ( registration.wanted ) {
+        always_ready.push_back( &registration );
+      }
+    } else if ( not registration.added or registration.wanted != registration.events ) {
+      epoll_update( fd_num, registration );
+    }
+  }
+
+  _epoll_events.resize( _epoll_registrations.size() + 1 );
+  int num_events;
+  {
+    RecordScopeTimer<Timer::Category::WaitingForEvent> record_timer { _waiting };
+    num_events = CheckSystemCall( "epoll_wait",
+                                  epoll_wait( _epoll_fd->fd_num(),
+                                              _epoll_events.data(),
+                                              _epoll_events.size(),
+                                              always_ready.empty() ? timeout_ms : 0 ) );
+  }
+
+  for ( auto registration : always_ready ) {
+    _epoll_events.at( num_events++ ) = { registration->wanted, { registration } };
+  }
+
+  for ( auto& [fd_num, registration] : _epoll_registrations ) {
+    registration.wanted = 0;
+  }
+
+  if ( num_events == 0 ) {
+    return Result::Timeout;
+  }
+
+  // serve every ready rule. Rules can't be removed (only cancelled) until the next call, so the registrations
+  // are all still valid, but an earlier callback may have changed a later rule's interest, closed its fd, or
+  // consumed what made it ready.
+  bool callback_ran = false;
+  for ( const auto& event : span_view<epoll_event> { _epoll_events.data(), size_t( num_events ) } ) {
+    if ( event.data.ptr == nullptr ) {
+      _timer_fd.acknowledge(); /* the due rule will run on the next call */
+      _timer_fd_deadline.reset();
+      continue;
+    }
+
+    for ( FDRule* rule_ptr : static_cast<EpollRegistration*>( event.data.ptr )->rules ) {
+      auto& this_rule = *rule_ptr;
+      if ( this_rule.cancel_requested or this_rule.fd.closed() ) {
+        continue;
+      }
+
+      if ( event.events & EPOLLERR ) {
+        if ( not fd_rule_recovered( this_rule, false ) ) {
+          this_rule.cancel_requested = true; /* already cancelled; remove it on the next call */
+        }
+        continue;
+      }
+
+      const bool ready = this_rule.polled and ( event.events & epoll_events( this_rule.direction ) );
+      if ( ( event.events & EPOLLHUP ) and this_rule.polled and not ready ) {
+        // the _only_ condition was a hangup: this FD is defunct (see the comment in wait_poll)
+        this_rule.cancel();
+        this_rule.cancel_requested = true;
+        continue;
+      }
+
+      if ( ready and this_rule.interest() ) {
+        run_fd_rule( this_rule, not callback_ran );
+        callback_ran = true;
+      }
+    }
+  }
+
+  return Result::Success;
+}
+
 void EventLoop::summary( ostream& out ) const
 {
   out << "EventLoop timing summary\n------------------------\n\n";
@@ -281,6 +553,24 @@ void EventLoop::summary( ostream& out ) const
   }
 
   print_timer( "waiting for event", _waiting );
+
+  for ( const auto& rule : _rule_categories ) {
+    if ( rule.lateness.count() == 0 ) {
+      continue;
+    }
+
+    out << "   " << rule.name << " lateness:";
+    for ( size_t bin = 0; bin < Timer::Histogram::num_bins; bin++ ) {
+      if ( rule.lateness.bins.at( bin ) == 0 ) {
+        continue;
+      }
+
+      out << ( bin + 1 < Timer::Histogram::num_bins ? "  <" : "  >=" );
+      Timer::pp_ns( out, Timer::Histogram::bin_limit_ns( bin + 1 < Timer::Histogram::num_bins ? bin : bin - 1 ) );
+      out << ": " << rule.lateness.bins.at( bin );
+    }
+    out << "\n";
+  }
 }
 
 void EventLoop::reset_summary()
@@ -288,5 +578,6 @@ void EventLoop::reset_summary()
   _waiting.reset();
   for ( auto& rule : _rule_categories ) {
     rule.timer.reset();
+    rule.lateness.reset();
   }
 }
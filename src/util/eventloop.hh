@@ -3,13 +3,18 @@
 #include <functional>
 #include <list>
 #include <memory>
+#include <optional>
 #include <ostream>
 #include <poll.h>
 #include <string_view>
+#include <sys/epoll.h>
+#include <unordered_map>
+#include <vector>
 
 #include "file_descriptor.hh"
 #include "summarize.hh"
 #include "timer.hh"
+#include "timerfd.hh"
 
 //! Waits for events on file descriptors and executes corresponding callbacks.
 class EventLoop : public Summarizable
@@ -22,14 +27,23 @@ public:
     Out = POLLOUT //!< Callback will be triggered when Rule::fd is writable.
   };
 
+  //! The system call used to wait for file descriptors.
+  enum class Backend
+  {
+    Poll, //!< Rebuild a [poll(2)](\ref man2::poll) set on every call and serve one ready rule.
+    Epoll //!< Keep fds registered with [epoll(7)](\ref man7::epoll) and serve every ready rule.
+  };
+
 private:
   using CallbackT = std::function<void( void )>;
   using InterestT = std::function<bool( void )>;
+  using DeadlineT = std::function<uint64_t( void )>;
 
   struct RuleCategory
   {
     std::string name;
     Timer::Record timer;
+    Timer::Histogram lateness; //!< How late timed rules in this category ran, relative to their deadlines
   };
 
   struct BasicRule
@@ -42,6 +56,8 @@ private:
     BasicRule( const size_t s_category_id, const InterestT& s_interest, const CallbackT& s_callback );
   };
 
+  struct EpollRegistration;
+
   struct FDRule : public BasicRule
   {
     FileDescriptor fd;   //!< FileDescriptor to monitor for activity.
@@ -49,24 +65,56 @@ private:
     CallbackT cancel;    //!< A callback that is called when the rule is cancelled (e.g. on hangup)
     InterestT recover;   //!< A callback that is called when the fd is ERR. Returns true to keep rule.
 
+    EpollRegistration* registration = nullptr; //!< (epoll only) Shared by all the rules on this fd number
+    bool polled = false;                       //!< (epoll only) Whether the rule was interested at last wait
+
     FDRule( BasicRule&& base,
             FileDescriptor&& s_fd,
             const Direction s_direction,
             const CallbackT& s_cancel,
             const InterestT& s_recover );
 
+    FDRule( const FDRule& other ) = delete;
+    FDRule& operator=( const FDRule& other ) = delete;
+
     //! Returns the number of times fd has been read or written, depending on the value of Rule::direction.
     //! \details This function is used internally by EventLoop; you will not need to call it
     unsigned int service_count() const;
   };
 
+  struct TimedRule : public BasicRule
+  {
+    DeadlineT deadline; //!< Returns the absolute Timer::timestamp_ns() when the callback should next run.
+
+    TimedRule( BasicRule&& base, const DeadlineT& s_deadline );
+  };
+
+  //! All the rules on one fd number, and what the kernel has been told about them
+  struct EpollRegistration
+  {
+    std::vector<FDRule*> rules {};
+    uint32_t events = 0;     //!< Events currently registered with the kernel
+    uint32_t wanted = 0;     //!< Events the rules are interested in on this iteration
+    bool added = false;      //!< Whether the fd is in the epoll set
+    bool unpollable = false; //!< epoll refused the fd (e.g. a regular file); treat it as always ready
+  };
+
+  Backend _backend;
   std::vector<RuleCategory> _rule_categories;
   std::list<std::shared_ptr<FDRule>> _fd_rules {};
   std::list<std::shared_ptr<BasicRule>> _non_fd_rules {};
+  std::list<std::shared_ptr<TimedRule>> _timed_rules {};
   Timer::Record _waiting {};
 
+  TimerFD _timer_fd {};                          //!< Wakes up poll at the earliest deadline of the timed rules.
+  std::optional<uint64_t> _timer_fd_deadline {}; //!< The deadline _timer_fd is currently armed for.
+
+  std::optional<FileDescriptor> _epoll_fd {};                         //!< (epoll only) The epoll instance
+  std::unordered_map<int, EpollRegistration> _epoll_registrations {}; //!< (epoll only) Keyed by fd number
+  std::vector<epoll_event> _epoll_events {};                          //!< (epoll only) Filled by epoll_wait
+
 public:
-  EventLoop();
+  explicit EventLoop( const Backend backend = Backend::Poll );
 
   //! Returned by each call to EventLoop::wait_next_event.
   enum class Result
@@ -77,6 +125,19 @@ public:
              //!< EventLoop::wait_next_event.
   };
 
+private:
+  bool fd_rule_finished( FDRule& rule );
+  bool fd_rule_recovered( FDRule& rule, const bool invalid );
+  void run_fd_rule( FDRule& rule, const bool fresh_readiness = true );
+
+  void epoll_register( FDRule& rule );
+  void epoll_unregister( FDRule& rule );
+  void epoll_update( const int fd_num, EpollRegistration& registration );
+
+  Result wait_poll( const int timeout_ms, const bool timer_armed );
+  Result wait_epoll( const int timeout_ms, const bool timer_armed );
+
+public:
   size_t add_category( const std::string& name );
 
   class RuleHandle
@@ -106,7 +167,18 @@ public:
     const CallbackT& callback,
     const InterestT& interest = [] { return true; } );
 
-  //! Calls [poll(2)](\ref man2::poll) and then executes callback for each ready fd.
+  //! \brief Add a rule that runs at an absolute time.
+  //! \details The callback runs (repeatedly, if necessary) until `deadline` returns a time in the
+  //! future. Between deadlines, the EventLoop sleeps on a [timerfd](\ref man2::timerfd_create).
+  RuleHandle add_timed_rule( const size_t category_id, const CallbackT& callback, const DeadlineT& deadline );
+
+  RuleHandle add_timed_rule( const std::string& name, const CallbackT& callback, const DeadlineT& deadline )
+  {
+    return add_timed_rule( add_category( name ), callback, deadline );
+  }
+
+  //! Calls [poll(2)](\ref man2::poll) or [epoll_wait(2)](\ref man2::epoll_wait) and then executes callbacks
+  //! for ready fds.
   Result wait_next_event( const int timeout_ms );
 
   void summary( std::ostream& out ) const override;
@@ -55,6 +55,27 @@ public:
     input_.remove_prefix( sizeof( T ) );
   }
 
+  /* seven bits a byte, low bits first; the high bit of each byte but the last is set */
+  template<typename T>
+  void varint( T& out )
+  {
+    out = static_cast<T>( 0 );
+    for ( unsigned int shift = 0; shift < 8 * sizeof( T ); shift += 7 ) {
+      uint8_t byte {};
+      integer( byte );
+      if ( error() ) {
+        return;
+      }
+
+      out |= static_cast<T>( byte & 0x7f ) << shift;
+      if ( not( byte & 0x80 ) ) {
+        return;
+      }
+    }
+
+    set_error();
+  }
+
   template<typename T>
   void floating( T& out )
   {
@@ -77,6 +98,18 @@ public:
     input_.remove_prefix( out.size() );
   }
 
+  /* the next len bytes, left where they are (valid as long as the input is) */
+  std::string_view view( const size_t len )
+  {
+    check_size( len );
+    if ( error() ) {
+      return {};
+    }
+    const std::string_view ret = input_.substr( 0, len );
+    input_.remove_prefix( len );
+    return ret;
+  }
+
   template<typename T>
   void object( T& out )
   {
@@ -118,6 +151,29 @@ public:
     }
   }
 
+  template<typename T>
+  void varint( T val )
+  {
+    do {
+      uint8_t byte = val & 0x7f;
+      val >>= 7;
+      if ( val ) {
+        byte |= 0x80;
+      }
+      integer( byte );
+    } while ( val );
+  }
+
+  template<typename T>
+  static constexpr uint8_t varint_length( T val )
+  {
+    uint8_t ret = 1;
+    while ( val >>= 7 ) {
+      ret++;
+    }
+    return ret;
+  }
+
   template<typename T>
   void floating( const T& val )
   {
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <optional>
+
+/* One bit for each position in a sliding window of num_bits positions (position i lives at bit i % num_bits). The
+   caller keeps the window; positions that leave it must be reset before they are reused. Range operations work a
+   64-bit word at a time. */
+template<size_t num_bits>
+class RingBitmap
+{
+  static_assert( num_bits > 0 and num_bits % 64 == 0 );
+
+  std::array<uint64_t, num_bits / 64> words_ {};
+
+  uint64_t& word( const uint64_t pos ) { return words_[( pos / 64 ) % words_.size()]; }
+  uint64_t word( const uint64_t pos ) const { return words_[( pos / 64 ) % words_.size()]; }
+  static uint64_t bit( const uint64_t pos ) { return uint64_t( 1 ) << ( pos % 64 ); }
+
+  /* call f( pos, word, mask ) for each word overlapping [begin, end), in order, until f returns true */
+  template<class Bitmap, class F>
+  static void for_each_word( Bitmap& bitmap, uint64_t begin, const uint64_t end, F&& f )
+  {
+    while ( begin < end ) {
+      const uint64_t offset = begin % 64;
+      const uint64_t count = std::min( 64 - offset, end - begin );
+      const uint64_t mask = ( count == 64 ? ~uint64_t( 0 ) : ( uint64_t( 1 ) << count ) - 1 ) << offset;
+      if ( f( begin - offset, bitmap.word( begin ), mask ) ) {
+        return;
+      }
+      begin += count;
+    }
+  }
+
+public:
+  bool test( const uint64_t pos ) const { return word( pos ) & bit( pos ); }
+  void set( const uint64_t pos ) { word( pos ) |= bit( pos ); }
+  void reset( const uint64_t pos ) { word( pos ) &= ~bit( pos ); }
+
+  /* the range must be at most num_bits long */
+  void reset( const uint64_t begin, const uint64_t end )
+  {
+    for_each_word( *this, begin, end, []( uint64_t, uint64_t& w, const uint64_t mask ) {
+      w &= ~mask;
+      return false;
+    } );
+  }
+
+  unsigned int count( const uint64_t begin, const uint64_t end ) const
+  {
+    unsigned int ret = 0;
+    for_each_word( *this, begin, end, [&]( uint64_t, const uint64_t w, const uint64_t mask ) {
+      ret += __builtin_popcountll( w & mask );
+      return false;
+    } );
+    return ret;
+  }
+
+  /* the first set position in [begin, end) */
+  std::optional<uint64_t> find_first( const uint64_t begin, const uint64_t end ) const
+  {
+    std::optional<uint64_t> ret;
+    for_each_word( *this, begin, end, [&]( const uint64_t word_begin, const uint64_t w, const uint64_t mask ) {
+      if ( w & mask ) {
+        ret = word_begin + __builtin_ctzll( w & mask );
+        return true;
+      }
+      return false;
+    } );
+    return ret;
+  }
+};
@@ -2,6 +2,8 @@
 
 #include "exception.hh"
 
+#include <algorithm>
+#include <array>
 #include <cstddef>
 #include <netinet/tcp.h>
 #include <stdexcept>
@@ -130,6 +132,73 @@ void UDPSocket::sendto( const Address& destination, const string_view payload )
   register_write();
 }
 
+//! \note If a payload is too small to hold its datagram, this method throws a std::runtime_error
+size_t UDPSocket::recv_batch( span<Address> sources, span<string_span> payloads, span<size_t> lengths )
+{
+  const size_t count = min( { sources.size(), payloads.size(), lengths.size(), max_batch } );
+
+  array<mmsghdr, max_batch> messages {};
+  array<iovec, max_batch> buffers {};
+  array<Address::Raw, max_batch> datagram_source_addresses {};
+
+  for ( size_t i = 0; i < count; i++ ) {
+    buffers[i] = { payloads[i].mutable_data(), payloads[i].size() };
+    messages[i].msg_hdr.msg_name = datagram_source_addresses[i];
+    messages[i].msg_hdr.msg_namelen = sizeof( datagram_source_addresses[i].storage );
+    messages[i].msg_hdr.msg_iov = &buffers[i];
+    messages[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  const int recv_count = ::recvmmsg( fd_num(), messages.data(), count, MSG_DONTWAIT, nullptr );
+  if ( recv_count < 0 ) {
+    if ( errno == EAGAIN or errno == EWOULDBLOCK ) {
+      return 0;
+    }
+    throw unix_error( "recvmmsg" );
+  }
+
+  register_read();
+
+  for ( int i = 0; i < recv_count; i++ ) {
+    sources[i] = { datagram_source_addresses[i], messages[i].msg_hdr.msg_namelen };
+    if ( messages[i].msg_hdr.msg_flags & MSG_TRUNC ) {
+      throw runtime_error( "recvmmsg (oversized datagram)" );
+    }
+    lengths[i] = messages[i].msg_len;
+  }
+
+  return recv_count;
+}
+
+void UDPSocket::sendto_batch( span_view<Address> destinations, span_view<string_view> payloads )
+{
+  if ( destinations.size() != payloads.size() ) {
+    throw runtime_error( "UDPSocket::sendto_batch: " + to_string( destinations.size() ) + " destinations but "
+                         + to_string( payloads.size() ) + " payloads" );
+  }
+
+  array<mmsghdr, max_batch> messages {};
+  array<iovec, max_batch> buffers {};
+
+  while ( payloads.size() > 0 ) {
+    const size_t count = min( payloads.size(), max_batch );
+    for ( size_t i = 0; i < count; i++ ) {
+      buffers[i] = { const_cast<char*>( payloads[i].data() ), payloads[i].size() };
+      messages[i].msg_hdr.msg_name = const_cast<sockaddr*>( static_cast<const sockaddr*>( destinations[i] ) );
+      messages[i].msg_hdr.msg_namelen = destinations[i].size();
+      messages[i].msg_hdr.msg_iov = &buffers[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    /* sendmmsg stops at the first datagram it can't send; if that wasn't the first, retry from there */
+    const size_t sent = CheckSystemCall( "sendmmsg", ::sendmmsg( fd_num(), messages.data(), count, 0 ) );
+    register_write();
+
+    destinations.remove_prefix( sent );
+    payloads.remove_prefix( sent );
+  }
+}
+
 void UDPSocket::send( const string_view payload )
 {
   CheckSystemCall( "send", ::send( fd_num(), payload.data(), payload.length(), 0 ) );
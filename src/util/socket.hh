@@ -78,6 +78,19 @@ public:
 
   //! Send datagram to the socket's connected address (must call connect() first)
   void send( const std::string_view payload );
+
+  //! The most datagrams recv_batch() will receive, or sendto_batch() will pass to the kernel, in one system call
+  static constexpr size_t max_batch = 64;
+
+  //! \brief Receive the datagrams that are waiting, with one [recvmmsg(2)](\ref man2::recvmmsg)
+  //! \details Does not block. Datagram i goes in `payloads[i]`, with its length in `lengths[i]` and its
+  //! sender in `sources[i]`.
+  //! \returns the number of datagrams received (0 if none were waiting)
+  size_t recv_batch( span<Address> sources, span<string_span> payloads, span<size_t> lengths );
+
+  //! Send each payload to the corresponding Address, with as few [sendmmsg(2)](\ref man2::sendmmsg) calls as
+  //! possible
+  void sendto_batch( span_view<Address> destinations, span_view<std::string_view> payloads );
 };
 
 class UnixDatagramSocket : public Socket
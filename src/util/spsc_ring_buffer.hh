@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <stdexcept>
+
+#include "typed_ring_buffer.hh"
+
+//! \brief A TypedRingBuffer that one thread can push to while another pops from it, without locks.
+//! \details Only the producer may call writable_region() and push(), and only the consumer readable_region() and
+//! pop(). Each side publishes its count with a release store, so elements written before push() are visible to
+//! the consumer once it sees them in readable_region().
+template<typename T>
+class SPSCRingBuffer : public TypedRingStorage<T>
+{
+  /* on separate cache lines, so the two threads don't contend */
+  alignas( 64 ) std::atomic<size_t> num_pushed_ { 0 };
+  alignas( 64 ) std::atomic<size_t> num_popped_ { 0 };
+
+public:
+  using TypedRingStorage<T>::TypedRingStorage;
+  using TypedRingStorage<T>::capacity;
+
+  span<T> writable_region()
+  {
+    const size_t pushed = num_pushed_.load( std::memory_order_relaxed );
+    const size_t popped = num_popped_.load( std::memory_order_acquire );
+    const size_t space = capacity() - ( pushed - popped );
+    return TypedRingStorage<T>::mutable_storage( pushed % capacity() ).substr( 0, space );
+  }
+
+  void push( const size_t num_elems )
+  {
+    if ( num_elems > writable_region().size() ) {
+      throw std::runtime_error( "SPSCRingBuffer::push exceeded size of writable region" );
+    }
+
+    num_pushed_.store( num_pushed_.load( std::memory_order_relaxed ) + num_elems, std::memory_order_release );
+  }
+
+  span_view<T> readable_region() const
+  {
+    const size_t popped = num_popped_.load( std::memory_order_relaxed );
+    const size_t pushed = num_pushed_.load( std::memory_order_acquire );
+    return TypedRingStorage<T>::storage( popped % capacity() ).substr( 0, pushed - popped );
+  }
+
+  void pop( const size_t num_elems )
+  {
+    if ( num_elems > readable_region().size() ) {
+      throw std::runtime_error( "SPSCRingBuffer::pop exceeded size of readable region" );
+    }
+
+    num_popped_.store( num_popped_.load( std::memory_order_relaxed ) + num_elems, std::memory_order_release );
+  }
+};
@@ -59,6 +59,55 @@ public:
     }
   };
 
+  //! Counts of durations in power-of-two bins: under 1 μs, under 2 μs, ..., and 16 ms or more
+  struct Histogram
+  {
+    static constexpr size_t num_bins = 16;
+    std::array<uint64_t, num_bins> bins {};
+    uint64_t max_ns {};
+
+    static uint64_t bin_limit_ns( const size_t bin ) { return uint64_t( 1000 ) << bin; }
+
+    void log( const uint64_t time_ns )
+    {
+      size_t bin = 0;
+      while ( bin + 1 < num_bins and time_ns >= bin_limit_ns( bin ) ) {
+        bin++;
+      }
+      bins[bin]++;
+      max_ns = std::max( max_ns, time_ns );
+    }
+
+    //! An upper bound on the given quantile (0 to 1): the limit of its bin, or past the maximum for the last bin
+    uint64_t quantile_ns( const double q ) const
+    {
+      const double target = q * count();
+      uint64_t cumulative = 0;
+      for ( size_t bin = 0; bin + 1 < num_bins; bin++ ) {
+        cumulative += bins[bin];
+        if ( cumulative >= target ) {
+          return bin_limit_ns( bin );
+        }
+      }
+      return max_ns + 1;
+    }
+
+    uint64_t count() const
+    {
+      uint64_t ret = 0;
+      for ( const auto x : bins ) {
+        ret += x;
+      }
+      return ret;
+    }
+
+    void reset()
+    {
+      bins = {};
+      max_ns = 0;
+    }
+  };
+
   enum class Category
   {
     DNS,
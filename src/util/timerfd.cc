@@ -0,0 +1,36 @@
+#include "timerfd.hh"
+#include "exception.hh"
+
+#include <sys/timerfd.h>
+
+using namespace std;
+
+TimerFD::TimerFD()
+  : FileDescriptor( CheckSystemCall( "timerfd_create", timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK ) ) )
+{}
+
+void TimerFD::set_deadline( const uint64_t deadline_ns )
+{
+  itimerspec spec {};
+  spec.it_value.tv_sec = deadline_ns / 1'000'000'000;
+  spec.it_value.tv_nsec = deadline_ns % 1'000'000'000;
+
+  /* a zero it_value would disarm the timer instead */
+  if ( spec.it_value.tv_sec == 0 and spec.it_value.tv_nsec == 0 ) {
+    spec.it_value.tv_nsec = 1;
+  }
+
+  CheckSystemCall( "timerfd_settime", timerfd_settime( fd_num(), TFD_TIMER_ABSTIME, &spec, nullptr ) );
+}
+
+void TimerFD::disarm()
+{
+  const itimerspec spec {};
+  CheckSystemCall( "timerfd_settime", timerfd_settime( fd_num(), 0, &spec, nullptr ) );
+}
+
+void TimerFD::acknowledge()
+{
+  uint64_t expirations;
+  read( { reinterpret_cast<char*>( &expirations ), sizeof( expirations ) } );
+}
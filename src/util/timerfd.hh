@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+
+#include "file_descriptor.hh"
+
+//! \brief A wrapper around a [timerfd](\ref man2::timerfd_create).
+//! \details The timer runs on CLOCK_MONOTONIC, the same clock as Timer::timestamp_ns(), so deadlines
+//! can be given directly as Timer timestamps.
+class TimerFD : public FileDescriptor
+{
+public:
+  //! Construct a disarmed, non-blocking timer
+  TimerFD();
+
+  //! Arm the timer to become readable at an absolute Timer::timestamp_ns() value
+  void set_deadline( const uint64_t deadline_ns );
+
+  //! Stop the timer
+  void disarm();
+
+  //! Read and discard the expiration count, making the timer unreadable again
+  void acknowledge();
+};
@@ -103,9 +103,12 @@ class EndlessBuffer : TypedRingStorage<T>
 public:
   using TypedRingStorage<T>::TypedRingStorage;
 
+  /* Popped elements come back at the end of the window, so they are zeroed here: access through a const buffer
+     never writes, and may run on several threads at once. */
   void pop( const size_t num_elems )
   {
-    span<T> region_to_erase { readable_region().substr( 0, num_elems ) };
+    const size_t count = std::min( num_elems, TypedRingStorage<T>::capacity() );
+    span<T> region_to_erase { readable_region().substr( 0, count ) };
     std::fill( region_to_erase.begin(), region_to_erase.end(), T {} );
     num_popped_ += num_elems;
   }
@@ -122,6 +125,7 @@ public:
   size_t range_begin() const { return num_popped_; }
   size_t range_end() const { return range_begin() + TypedRingStorage<T>::capacity(); }
 
+  /* contiguous even across the end of the storage, which is mapped twice */
   span<T> region( const size_t pos, const size_t count )
   {
     check_bounds( pos, count );
@@ -144,24 +148,76 @@ public:
 template<typename T>
 class SafeEndlessBuffer : public EndlessBuffer<T>
 {
+  using parent = EndlessBuffer<T>;
+
 public:
   using EndlessBuffer<T>::EndlessBuffer;
 
+  /* the part of a requested range that lies inside the window, starting `offset` elements into the request */
+  template<class Span>
+  struct Clipped
+  {
+    size_t offset;
+    Span region;
+  };
+
+  bool contains( const size_t pos ) const { return pos >= parent::range_begin() and pos < parent::range_end(); }
+
+  /* [pos, pos + count) clipped to the window (empty, at the window's edge, if they don't overlap) */
+  struct Extent
+  {
+    size_t offset, begin, length;
+  };
+
+  Extent clip( const size_t pos, const size_t count ) const
+  {
+    const size_t begin = std::clamp( pos, parent::range_begin(), parent::range_end() );
+    const size_t end = std::clamp( pos + count, begin, parent::range_end() );
+    return { end > begin ? begin - pos : 0, begin, end - begin };
+  }
+
+  Clipped<span<T>> clipped_region( const size_t pos, const size_t count )
+  {
+    const Extent extent = clip( pos, count );
+    return { extent.offset, parent::region( extent.begin, extent.length ) };
+  }
+
+  Clipped<span_view<T>> clipped_region( const size_t pos, const size_t count ) const
+  {
+    const Extent extent = clip( pos, count );
+    return { extent.offset, parent::region( extent.begin, extent.length ) };
+  }
+
   T safe_get( const size_t pos ) const
   {
-    if ( pos < EndlessBuffer<T>::range_begin() or pos >= EndlessBuffer<T>::range_end() ) {
+    if ( not contains( pos ) ) {
       return {};
     }
 
-    return EndlessBuffer<T>::region( pos, 1 ).at( 0 );
+    return parent::operator[]( pos );
   }
 
   void safe_set( const size_t pos, const T& val )
   {
-    if ( pos < EndlessBuffer<T>::range_begin() or pos >= EndlessBuffer<T>::range_end() ) {
+    if ( not contains( pos ) ) {
       return;
     }
 
-    EndlessBuffer<T>::region( pos, 1 ).at( 0 ) = val;
+    parent::operator[]( pos ) = val;
+  }
+
+  /* block versions: the part of [pos, pos + count) outside the window is skipped (writes) or zero (reads) */
+  void safe_write( const size_t pos, const span_view<T> values )
+  {
+    auto target = clipped_region( pos, values.size() );
+    target.region.copy( values.substr( target.offset, target.region.size() ) );
+  }
+
+  void safe_read( const size_t pos, span<T> out ) const
+  {
+    const auto source = clipped_region( pos, out.size() );
+    std::fill( out.begin(), out.begin() + source.offset, T {} );
+    out.substr( source.offset, source.region.size() ).copy( source.region );
+    std::fill( out.begin() + source.offset + source.region.size(), out.end(), T {} );
   }
 };
@@ -0,0 +1,99 @@
+#include "worker_pool.hh"
+
+#include <stdexcept>
+#include <utility>
+
+using namespace std;
+
+WorkerPool::WorkerPool( const size_t num_threads )
+{
+  if ( num_threads == 0 ) {
+    throw runtime_error( "WorkerPool needs at least one thread" );
+  }
+
+  threads_.reserve( num_threads - 1 );
+  for ( size_t i = 1; i < num_threads; i++ ) {
+    threads_.emplace_back( [&] { worker_loop(); } );
+  }
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    unique_lock lock { mutex_ };
+    shutting_down_ = true;
+  }
+  work_ready_.notify_all();
+
+  for ( auto& thread : threads_ ) {
+    thread.join();
+  }
+}
+
+/* take indices until there are none left; called and returns with the lock held */
+void WorkerPool::run_indices( unique_lock<mutex>& lock )
+{
+  while ( next_index_ < count_ ) {
+    const JobT& job = *job_;
+    const size_t index = next_index_++;
+    lock.unlock();
+
+    exception_ptr error;
+    try {
+      job( index );
+    } catch ( ... ) {
+      error = current_exception();
+    }
+
+    lock.lock();
+    if ( error and not error_ ) {
+      error_ = error;
+    }
+    if ( --unfinished_ == 0 ) {
+      work_done_.notify_all();
+    }
+  }
+}
+
+void WorkerPool::worker_loop()
+{
+  unique_lock lock { mutex_ };
+  uint64_t last_generation = generation_;
+
+  while ( true ) {
+    work_ready_.wait( lock, [&] { return shutting_down_ or generation_ != last_generation; } );
+    if ( shutting_down_ ) {
+      return;
+    }
+
+    last_generation = generation_;
+    run_indices( lock );
+  }
+}
+
+void WorkerPool::run( const size_t count, const JobT& job )
+{
+  if ( threads_.empty() ) {
+    for ( size_t i = 0; i < count; i++ ) {
+      job( i );
+    }
+    return;
+  }
+
+  unique_lock lock { mutex_ };
+  job_ = &job;
+  count_ = count;
+  next_index_ = 0;
+  unfinished_ = count;
+  error_ = nullptr;
+  generation_++;
+  work_ready_.notify_all();
+
+  run_indices( lock );
+  work_done_.wait( lock, [&] { return unfinished_ == 0; } );
+  job_ = nullptr;
+
+  if ( error_ ) {
+    rethrow_exception( exchange( error_, nullptr ) );
+  }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//! \brief A fixed set of threads that share out the iterations of a loop.
+//! \details WorkerPool::run calls `job( i )` for every i in [0, count), on the pool's threads and the calling
+//! thread, and returns once all of them have finished, so consecutive calls are separated by a barrier. Which
+//! thread runs which index is not fixed, so each job should touch only its own state.
+class WorkerPool
+{
+  using JobT = std::function<void( const size_t )>;
+
+  std::vector<std::thread> threads_ {};
+
+  std::mutex mutex_ {};
+  std::condition_variable work_ready_ {}, work_done_ {};
+
+  const JobT* job_ {};          //!< The job being run (guarded by mutex_)
+  size_t count_ {};             //!< The number of indices in the job being run
+  size_t next_index_ {};        //!< The next index to hand out
+  size_t unfinished_ {};        //!< The number of indices that have not finished running
+  uint64_t generation_ {};      //!< Incremented for each job, so idle threads can tell a new one has arrived
+  bool shutting_down_ {};       //!< Tells the threads to exit
+  std::exception_ptr error_ {}; //!< The first exception thrown by the job
+
+  void worker_loop();
+  void run_indices( std::unique_lock<std::mutex>& lock );
+
+public:
+  //! Start `num_threads - 1` threads (the caller of WorkerPool::run is the last one)
+  explicit WorkerPool( const size_t num_threads );
+  ~WorkerPool();
+
+  //! Run `job` on each index in [0, count) and wait for all to finish; rethrows the first exception from `job`
+  void run( const size_t count, const JobT& job );
+
+  size_t num_threads() const { return threads_.size() + 1; }
+
+  WorkerPool( const WorkerPool& other ) = delete;
+  WorkerPool& operator=( const WorkerPool& other ) = delete;
+};
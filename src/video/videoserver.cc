@@ -13,6 +13,11 @@ uint64_t VideoServer::server_clock() const
   return ( Timer::timestamp_ns() - global_ns_timestamp_at_creation_ ) * 24 / 1'000'000'000;
 }
 
+uint64_t VideoServer::server_clock_deadline( const uint64_t frame ) const
+{
+  return global_ns_timestamp_at_creation_ + ( frame * 1'000'000'000 + 23 ) / 24;
+}
+
 void VideoServer::receive_keyrequest( const Address& src, const Ciphertext& ciphertext )
 {
   /* decrypt */
@@ -24,6 +29,22 @@ void VideoServer::receive_keyrequest( const Address& src, const Ciphertext& ciph
   stats_.bad_packets++;
 }
 
+void VideoServer::receive_packet( const Address& src, const Ciphertext& ciphertext )
+{
+  if ( ciphertext.length() > 24 ) {
+    const uint8_t node_id = ciphertext.as_string_view().back();
+    if ( node_id == uint8_t( KeyMessage::keyreq_id ) ) {
+      receive_keyrequest( src, ciphertext );
+    } else if ( node_id > 0 and node_id <= clients_.size() ) {
+      clients_.at( node_id - 1 ).receive_packet( src, ciphertext, server_clock() );
+    } else {
+      stats_.bad_packets++;
+    }
+  } else {
+    stats_.bad_packets++;
+  }
+}
+
 void VideoServer::add_key( const LongLivedKey& key )
 {
   const uint8_t next_id = clients_.size() + 1;
@@ -51,42 +72,36 @@ VideoServer::VideoServer( const uint8_t num_clients, EventLoop& loop )
   socket_.bind( { "0", 9201 } );
 
   loop.add_rule( "network receive", socket_, Direction::In, [&] {
-    Address src { nullptr, 0 };
-    Ciphertext ciphertext;
-    ciphertext.resize( socket_.recv( src, ciphertext.mutable_buffer() ) );
-    if ( ciphertext.length() > 24 ) {
-      const uint8_t node_id = ciphertext.as_string_view().back();
-      if ( node_id == uint8_t( KeyMessage::keyreq_id ) ) {
-        receive_keyrequest( src, ciphertext );
-      } else if ( node_id > 0 and node_id <= clients_.size() ) {
-        clients_.at( node_id - 1 ).receive_packet( src, ciphertext, server_clock() );
-      } else {
-        stats_.bad_packets++;
+    /* drain every datagram that is waiting */
+    size_t count;
+    do {
+      count = inbound_.receive();
+      for ( size_t i = 0; i < count; i++ ) {
+        receive_packet( inbound_.address( i ), inbound_.ciphertext( i ) );
       }
-    } else {
-      stats_.bad_packets++;
-    }
+    } while ( count == CiphertextBatch::capacity );
   } );
 
-  loop.add_rule(
+  loop.add_timed_rule(
     "send acks",
     [&] {
       const uint64_t ts_now = Timer::timestamp_ns();
 
       for ( auto& client : clients_ ) {
         if ( client ) {
-          client.client().send_packet( socket_ );
+          client.client().send_packet( outbound_ );
 
           if ( client.client().connection().sender_stats().last_good_ack_ts + CLIENT_TIMEOUT_NS < ts_now ) {
             client.clear_current_session();
           }
         }
       }
+      outbound_.send();
       next_ack_ts_ = Timer::timestamp_ns() + 5'000'000;
     },
-    [&] { return Timer::timestamp_ns() > next_ack_ts_; } );
+    [&] { return next_ack_ts_; } );
 
-  loop.add_rule(
+  loop.add_timed_rule(
     "encode [camera]",
     [&] {
       RasterYUV420& output = clients_.at( camera_feed_live_no_ )
@@ -103,9 +118,9 @@ VideoServer::VideoServer( const uint8_t num_clients, EventLoop& loop )
         camera_feed_.reset_nal();
       }
     },
-    [&] { return server_clock() >= camera_feed_.frames_encoded() and not camera_feed_.has_nal(); } );
+    [&] { return server_clock_deadline( camera_feed_.frames_encoded() ); } );
 
-  loop.add_rule(
+  loop.add_timed_rule(
     "encode [preview & program]",
     [&] {
       load_cameras( preview_.scene_ );
@@ -120,7 +135,7 @@ VideoServer::VideoServer( const uint8_t num_clients, EventLoop& loop )
       }
       output_frames_encoded_++;
     },
-    [&] { return server_clock() >= output_frames_encoded_; } );
+    [&] { return server_clock_deadline( output_frames_encoded_ ); } );
 
   preview_.scene_.insert( Layer { Layer::layer_type::Camera, "Sam", "", 0, 0, 640, 20 } );
   preview_.scene_.insert( Layer { Layer::layer_type::Camera, "Audrey", "", 640, 0, 640, 20 } );
@@ -53,8 +53,12 @@ class VideoServer : public Summarizable
   UDPSocket socket_;
   uint64_t global_ns_timestamp_at_creation_;
   uint64_t server_clock() const;
+  uint64_t server_clock_deadline( const uint64_t frame ) const; /* when server_clock() reaches frame */
+
+  CiphertextBatch inbound_ { socket_ }, outbound_ { socket_ };
 
   void receive_keyrequest( const Address& src, const Ciphertext& ciphertext );
+  void receive_packet( const Address& src, const Ciphertext& ciphertext );
 
   uint8_t num_clients_;
   uint64_t next_ack_ts_;
@@ -44,7 +44,7 @@ bool VSClient::receive_packet( const Address& source, const Ciphertext& cipherte
   return ret;
 }
 
-void VSClient::send_packet( UDPSocket& socket )
+void VSClient::send_packet( CiphertextBatch& batch )
 {
   if ( connection_.has_destination() ) {
 
@@ -59,7 +59,7 @@ void VSClient::send_packet( UDPSocket& socket )
       next_zoom_update_ = now + 25'000'000;
     }
 
-    connection_.send_packet( socket );
+    connection_.send_packet( batch );
   }
 }
 
@@ -32,7 +32,7 @@ public:
   unsigned int NALs_decoded_ {};
 
   bool receive_packet( const Address& source, const Ciphertext& ciphertext );
-  void send_packet( UDPSocket& sock );
+  void send_packet( CiphertextBatch& batch );
 
   void summary( std::ostream& out ) const;
 